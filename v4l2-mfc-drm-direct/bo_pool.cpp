@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bo_pool.h"
+#include "drm_backend.h"
+
+#include <iostream>
+#include <string>
+#include <algorithm>
+
+
+BOPool::BOPool() : backend(nullptr), bytes_allocated(0), num_allocated(0),
+	num_reused(0)
+{
+	// Nothing here.
+}
+
+BOPool::~BOPool()
+{
+	deinit();
+}
+
+void BOPool::init(DRMBackend *b)
+{
+	deinit();
+
+	backend = b;
+}
+
+void BOPool::deinit()
+{
+	static const std::string msg_prefix("BOPool::deinit(): ");
+
+	if (!backend)
+		return;
+
+	for (auto &i : entries) {
+		if (i.used)
+			std::cerr << msg_prefix << "buffer is still in use.\n";
+
+		backend->destroy_bo(i.bo);
+	}
+
+	entries.clear();
+	bytes_allocated = 0;
+	backend = nullptr;
+}
+
+drm_bo* BOPool::alloc(unsigned size)
+{
+	const unsigned sz = (size + size_granularity - 1) / size_granularity * size_granularity;
+
+	drm_bo *bo = backend->create_bo(sz);
+	if (!bo)
+		return nullptr;
+
+	entries.push_back(entry{bo, false});
+
+	bytes_allocated += bo->size;
+	num_allocated++;
+
+	return bo;
+}
+
+bool BOPool::reserve(unsigned count, unsigned size)
+{
+	if (!backend)
+		return false;
+
+	unsigned usable = std::count_if(entries.begin(), entries.end(),
+		[size](const entry &e) { return !e.used && e.bo->size >= size; });
+
+	if (usable >= count)
+		return true;
+
+	// Release free buffers that are too small, so that the pool
+	// grows by replacing them instead of adding more buffers.
+	unsigned missing = count - usable;
+
+	for (auto i = entries.begin(); i != entries.end() && missing != 0; ) {
+		if (i->used || i->bo->size >= size) {
+			++i;
+			continue;
+		}
+
+		bytes_allocated -= i->bo->size;
+		backend->destroy_bo(i->bo);
+		i = entries.erase(i);
+
+		--missing;
+	}
+
+	while (usable < count) {
+		if (!alloc(size))
+			return false;
+
+		++usable;
+	}
+
+	return true;
+}
+
+drm_bo* BOPool::get(unsigned size)
+{
+	if (!backend)
+		return nullptr;
+
+	entry *best = nullptr;
+
+	// Use the smallest free buffer that is large enough.
+	for (auto &i : entries) {
+		if (i.used || i.bo->size < size)
+			continue;
+
+		if (!best || i.bo->size < best->bo->size)
+			best = &i;
+	}
+
+	if (best) {
+		best->used = true;
+		num_reused++;
+
+		return best->bo;
+	}
+
+	drm_bo *bo = alloc(size);
+	if (!bo)
+		return nullptr;
+
+	entries.back().used = true;
+
+	return bo;
+}
+
+void BOPool::put(drm_bo *bo)
+{
+	if (!bo)
+		return;
+
+	auto i = std::find_if(entries.begin(), entries.end(),
+		[bo](const entry &e) { return e.bo == bo; });
+
+	if (i != entries.end())
+		i->used = false;
+}
+
+void BOPool::add_stats(StatsReport &r) const
+{
+	r.add("pool_bytes", bytes_allocated);
+	r.add("pool_buffers_allocated", num_allocated);
+	r.add("pool_buffers_reused", num_reused);
+}
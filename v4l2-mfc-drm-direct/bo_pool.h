@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__BO_POOL_)
+#define __BO_POOL_
+
+#include "stats.h"
+
+#include <vector>
+#include <cstdint>
+
+// Forward-declarations
+class DRMBackend;
+struct drm_bo;
+
+// Pool of buffer objects, which outlives the pages that use them. Freed
+// buffers are kept and handed out again, e.g. after a resolution change
+// or a restart of the stream. A new buffer is only allocated if no free
+// one is large enough, which keeps the number of (contiguous) allocations
+// low and avoids fragmenting the CMA area.
+//
+// The buffers are not carved out of one large allocation: each page has
+// to be exported as a dmabuf of its own for the decoder, and a dmabuf
+// always covers a whole buffer object.
+class BOPool {
+private:
+	enum constants {
+		// Sizes are rounded up to this, so that buffers can be reused
+		// when the frame size changes only slightly.
+		size_granularity = 256 * 1024,
+	};
+
+	// @bo: the buffer object
+	// @used: buffer was handed out by get()
+	struct entry {
+		drm_bo *bo;
+		bool used;
+	};
+
+	DRMBackend *backend;
+	std::vector<entry> entries;
+
+	uint64_t bytes_allocated;
+	uint64_t num_allocated;
+	uint64_t num_reused;
+
+	drm_bo* alloc(unsigned size);
+
+public:
+	BOPool();
+	~BOPool();
+
+	BOPool(const BOPool &p) = delete;
+
+	// Initialize/deinitialize the pool. deinit() destroys all buffers,
+	// which must not be in use anymore.
+	//
+	// @b: backend that allocates the buffers
+	void init(DRMBackend *b);
+	void deinit();
+
+	// Make sure that the pool holds at least a number of buffers of a
+	// given size. The buffers are allocated up front, and free buffers
+	// that are too small are replaced.
+	// reserve() returns false if an error occurs.
+	//
+	// @count: number of buffers
+	// @size: minimum size of each buffer in bytes
+	bool reserve(unsigned count, unsigned size);
+
+	// Get a free buffer with at least 'size' bytes, which is allocated
+	// if needed. Returns nullptr if an error occurs.
+	drm_bo* get(unsigned size);
+
+	// Give a buffer back to the pool.
+	void put(drm_bo *bo);
+
+	// Add the pool statistics to a report.
+	void add_stats(StatsReport &r) const;
+};
+
+#endif // __BO_POOL_
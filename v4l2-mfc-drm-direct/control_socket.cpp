@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "control_socket.h"
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+
+ControlSocket::ControlSocket() : fd(-1), flags(0)
+{
+	for (auto &i : clients)
+		i.fd = -1;
+}
+
+ControlSocket::~ControlSocket()
+{
+	close();
+}
+
+bool ControlSocket::open(const std::string &name)
+{
+	static const std::string msg_prefix("ControlSocket::open(): ");
+
+	if (flags & opened)
+		return false;
+
+	using namespace std;
+
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (name.empty() || name.size() >= sizeof(addr.sun_path)) {
+		cerr << msg_prefix << "invalid socket path.\n";
+		return false;
+	}
+
+	strcpy(addr.sun_path, name.c_str());
+
+	// A socket file that was left behind by an earlier run.
+	struct stat st;
+
+	if (stat(name.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(name.c_str());
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		cerr << msg_prefix << "failed to create socket (errno=" << errno << ").\n";
+		return false;
+	}
+
+	if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ||
+		listen(fd, max_clients)) {
+		cerr << msg_prefix << "failed to listen on " << name << " (errno="
+			 << errno << ").\n";
+		::close(fd);
+
+		return false;
+	}
+
+	if (!loop.open() || !loop.add(fd, EPOLLIN, listen_id)) {
+		loop.close();
+		::close(fd);
+		unlink(name.c_str());
+
+		return false;
+	}
+
+	path = name;
+	flags |= opened;
+
+	return true;
+}
+
+void ControlSocket::close()
+{
+	if (!(flags & opened))
+		return;
+
+	for (unsigned i = 0; i < max_clients; ++i)
+		drop_client(i);
+
+	loop.close();
+	::close(fd);
+	unlink(path.c_str());
+
+	fd = -1;
+	path.clear();
+
+	flags &= ~opened;
+}
+
+int ControlSocket::get_fd() const
+{
+	return loop.get_fd();
+}
+
+bool ControlSocket::receive(std::deque<command> &cmds)
+{
+	if (!(flags & opened))
+		return false;
+
+	if (!loop.wait(events, 0))
+		return false;
+
+	for (auto &i : events) {
+		if (i.id == listen_id) {
+			accept_client();
+			continue;
+		}
+
+		if (!read_client(i.id, cmds))
+			drop_client(i.id);
+	}
+
+	return true;
+}
+
+void ControlSocket::reply(unsigned client, const std::string &msg)
+{
+	static const std::string msg_prefix("ControlSocket::reply(): ");
+
+	if (client >= max_clients || clients[client].fd < 0)
+		return;
+
+	const std::string line = msg + '\n';
+
+	// The replies are short, so a full socket buffer means
+	// that the client doesn't read them.
+	if (send(clients[client].fd, line.data(), line.size(), MSG_NOSIGNAL) !=
+		ssize_t(line.size())) {
+		std::cerr << msg_prefix << "failed to send reply, dropping client.\n";
+		drop_client(client);
+	}
+}
+
+void ControlSocket::accept_client()
+{
+	static const std::string msg_prefix("ControlSocket::accept_client(): ");
+
+	const int cfd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (cfd < 0)
+		return;
+
+	for (unsigned i = 0; i < max_clients; ++i) {
+		if (clients[i].fd >= 0)
+			continue;
+
+		if (!loop.add(cfd, EPOLLIN, i))
+			break;
+
+		clients[i].fd = cfd;
+		clients[i].input.clear();
+
+		return;
+	}
+
+	std::cerr << msg_prefix << "too many clients.\n";
+	::close(cfd);
+}
+
+void ControlSocket::drop_client(unsigned id)
+{
+	client &c = clients[id];
+
+	if (c.fd < 0)
+		return;
+
+	loop.remove(c.fd);
+	::close(c.fd);
+
+	c.fd = -1;
+	c.input.clear();
+}
+
+bool ControlSocket::read_client(unsigned id, std::deque<command> &cmds)
+{
+	using namespace std;
+
+	if (id >= max_clients || clients[id].fd < 0)
+		return false;
+
+	client &c = clients[id];
+	char buf[512];
+
+	const ssize_t ret = read(c.fd, buf, sizeof(buf));
+
+	if (ret < 0)
+		return (errno == EAGAIN || errno == EINTR);
+
+	// The client has closed the connection.
+	if (ret == 0)
+		return false;
+
+	c.input.append(buf, ret);
+
+	size_t end;
+
+	while ((end = c.input.find('\n')) != string::npos) {
+		string line = c.input.substr(0, end);
+		c.input.erase(0, end + 1);
+
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+
+		const size_t name_begin = line.find_first_not_of(" \t");
+		if (name_begin == string::npos)
+			continue;
+
+		const size_t name_end = line.find_first_of(" \t", name_begin);
+		const size_t arg_begin = line.find_first_not_of(" \t", name_end);
+
+		command cmd;
+
+		cmd.client = id;
+		cmd.name = line.substr(name_begin, name_end - name_begin);
+
+		if (arg_begin != string::npos)
+			cmd.arg = line.substr(arg_begin);
+
+		cmds.push_back(cmd);
+	}
+
+	return (c.input.size() <= max_line_length);
+}
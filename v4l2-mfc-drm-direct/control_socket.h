@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__CONTROL_SOCKET_)
+#define __CONTROL_SOCKET_
+
+#include "event_loop.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+
+// Unix stream socket that accepts commands, e.g. for the daemon mode.
+// A command is a line of text: a word, optionally followed by an
+// argument. Each command is answered with a line, which starts with
+// "ok" or "error". The socket never blocks, and is meant to be
+// watched by an event loop (see get_fd()).
+class ControlSocket {
+public:
+	// @client: ID of the client that sent the command (see reply())
+	// @name: first word of the line
+	// @arg: rest of the line, without the leading blanks
+	struct command {
+		unsigned client;
+		std::string name;
+		std::string arg;
+	};
+
+private:
+	enum flags {
+		opened			= (1 << 0),
+	};
+
+	enum constants {
+		max_clients = 8,
+
+		// Longer lines are rejected, and the client is dropped.
+		max_line_length = 4096,
+
+		// Event ID of the listening socket, the clients use their index.
+		listen_id = max_clients,
+	};
+
+	// @fd: connection to the client (-1 if the slot is unused)
+	// @input: received data that does not form a complete line yet
+	struct client {
+		int fd;
+		std::string input;
+	};
+
+	int fd;
+	std::string path;
+
+	EventLoop loop;
+	std::vector<EventLoop::event> events;
+
+	client clients[max_clients];
+
+	unsigned flags;
+
+	void accept_client();
+	void drop_client(unsigned id);
+
+	// Read from a client, and split the data into commands.
+	// Returns false if the client has disconnected or misbehaved.
+	bool read_client(unsigned id, std::deque<command> &cmds);
+
+public:
+	ControlSocket();
+	~ControlSocket();
+
+	ControlSocket(const ControlSocket &cs) = delete;
+
+	// Open/close the socket. A stale socket file is replaced.
+	// open() returns false if an error occurs.
+	//
+	// @name: path of the socket file
+	bool open(const std::string &name);
+	void close();
+
+	// A fd, which becomes readable when clients connect or send data.
+	int get_fd() const;
+
+	// Accept new clients, and read the commands that were sent.
+	// This never blocks.
+	// receive() returns false if an error occurs.
+	//
+	// @cmds: receives the commands (in the order of arrival)
+	bool receive(std::deque<command> &cmds);
+
+	// Send a reply to a client. The newline is appended.
+	//
+	// @client: ID of the client (see command)
+	// @msg: text of the reply
+	void reply(unsigned client, const std::string &msg);
+};
+
+#endif // __CONTROL_SOCKET_
@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "detile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <system_error>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DETILE_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DETILE_SSE2
+#endif
+
+namespace {
+
+// Copy one line (64 bytes) of a tile.
+// The source is always 16 byte aligned, since tiles are.
+inline void
+copy_tile_line(const uint8_t *src, uint8_t *dst)
+{
+#if defined(DETILE_NEON)
+	const uint8x16_t a = vld1q_u8(src + 0);
+	const uint8x16_t b = vld1q_u8(src + 16);
+	const uint8x16_t c = vld1q_u8(src + 32);
+	const uint8x16_t d = vld1q_u8(src + 48);
+
+	vst1q_u8(dst + 0, a);
+	vst1q_u8(dst + 16, b);
+	vst1q_u8(dst + 32, c);
+	vst1q_u8(dst + 48, d);
+#elif defined(DETILE_SSE2)
+	const __m128i *s = reinterpret_cast<const __m128i*>(src);
+	__m128i *t = reinterpret_cast<__m128i*>(dst);
+
+	const __m128i a = _mm_load_si128(s + 0);
+	const __m128i b = _mm_load_si128(s + 1);
+	const __m128i c = _mm_load_si128(s + 2);
+	const __m128i d = _mm_load_si128(s + 3);
+
+	_mm_storeu_si128(t + 0, a);
+	_mm_storeu_si128(t + 1, b);
+	_mm_storeu_si128(t + 2, c);
+	_mm_storeu_si128(t + 3, d);
+#else
+	std::memcpy(dst, src, tile_width);
+#endif
+}
+
+// Copy a complete tile into the linear destination, while
+// prefetching the tile that is processed next.
+inline void
+copy_tile(const uint8_t *src, const uint8_t *next, uint8_t *dst, unsigned dst_stride)
+{
+	for (unsigned i = 0; i < tile_height; ++i) {
+		__builtin_prefetch(next + i * tile_width);
+
+		copy_tile_line(src + i * tile_width, dst + i * dst_stride);
+	}
+}
+
+// Copy a part of a tile.
+//
+// @{x,y}: offset inside the tile
+// @{w,h}: size of the part
+inline void
+copy_tile_part(const uint8_t *src, uint8_t *dst, unsigned dst_stride,
+			   unsigned x, unsigned y, unsigned w, unsigned h)
+{
+	src += y * tile_width + x;
+
+	for (unsigned i = 0; i < h; ++i)
+		std::memcpy(dst + i * dst_stride, src + i * tile_width, w);
+}
+
+}; // anonymous namespace
+
+
+void detile_nv12mt_ref(const uint8_t *src, unsigned plane_w, unsigned plane_h,
+					   uint8_t *dst, unsigned dst_stride,
+					   unsigned x, unsigned y, unsigned w, unsigned h)
+{
+	const unsigned x_tiles = (plane_w + tile_width - 1) / tile_width;
+	const unsigned y_tiles = (plane_h + tile_height - 1) / tile_height;
+
+	for (unsigned row = y; row < y + h; ++row) {
+		const unsigned ty = row / tile_height;
+		const unsigned line = (row % tile_height) * tile_width;
+
+		uint8_t *out = dst + (row - y) * dst_stride;
+		unsigned col = x;
+
+		while (col < x + w) {
+			const unsigned tx = col / tile_width;
+			const unsigned in_tile = col % tile_width;
+			const unsigned len = std::min(tile_width - in_tile, x + w - col);
+
+			std::memcpy(out, src + tile_offset(tx, ty, x_tiles, y_tiles) +
+						line + in_tile, len);
+
+			out += len;
+			col += len;
+		}
+	}
+}
+
+void detile_nv12mt(const uint8_t *src, unsigned plane_w, unsigned plane_h,
+				   uint8_t *dst, unsigned dst_stride,
+				   unsigned x, unsigned y, unsigned w, unsigned h)
+{
+	if (w == 0 || h == 0)
+		return;
+
+	const unsigned x_tiles = (plane_w + tile_width - 1) / tile_width;
+	const unsigned y_tiles = (plane_h + tile_height - 1) / tile_height;
+
+	const unsigned tx_first = x / tile_width;
+	const unsigned tx_last = (x + w - 1) / tile_width;
+	const unsigned ty_first = y / tile_height;
+	const unsigned ty_last = (y + h - 1) / tile_height;
+
+	// Walk the rectangle tile by tile. This reads the source sequentially
+	// in 2 KiB blocks, instead of jumping between tiles on every line.
+	for (unsigned ty = ty_first; ty <= ty_last; ++ty) {
+		const unsigned row0 = std::max(y, ty * tile_height);
+		const unsigned row1 = std::min(y + h, (ty + 1) * tile_height);
+
+		uint8_t *out_row = dst + (row0 - y) * dst_stride;
+
+		for (unsigned tx = tx_first; tx <= tx_last; ++tx) {
+			const unsigned col0 = std::max(x, tx * tile_width);
+			const unsigned col1 = std::min(x + w, (tx + 1) * tile_width);
+
+			const uint8_t *tile = src + tile_offset(tx, ty, x_tiles, y_tiles);
+			uint8_t *out = out_row + (col0 - x);
+
+			if (col1 - col0 == tile_width && row1 - row0 == tile_height) {
+				const unsigned next = (tx < tx_last) ?
+					tile_offset(tx + 1, ty, x_tiles, y_tiles) :
+					tile_offset(tx_first, std::min(ty + 1, y_tiles - 1), x_tiles, y_tiles);
+
+				copy_tile(tile, src + next, out, dst_stride);
+			} else {
+				copy_tile_part(tile, out, dst_stride, col0 % tile_width,
+							   row0 % tile_height, col1 - col0, row1 - row0);
+			}
+		}
+	}
+}
+
+DetilePool::DetilePool() : current(), num_bands(0), pending(0), generation(0), flags(0)
+{
+	// Nothing here.
+}
+
+DetilePool::~DetilePool()
+{
+	stop();
+}
+
+bool DetilePool::start(unsigned num_threads)
+{
+	if (flags & started)
+		return false;
+
+	if (num_threads == 0)
+		return false;
+
+	// More threads than cores only add hand-offs.
+	const unsigned cores = std::thread::hardware_concurrency();
+
+	if (cores != 0)
+		num_threads = std::min(num_threads, cores);
+
+	flags = started;
+
+	// The calling thread takes the first band.
+	try {
+		workers.reserve(num_threads - 1);
+
+		for (unsigned i = 1; i < num_threads; ++i)
+			workers.emplace_back(&DetilePool::run, this, i);
+	}
+	catch (std::system_error &e) {
+		stop();
+		return false;
+	}
+
+	return true;
+}
+
+void DetilePool::stop()
+{
+	if (!(flags & started))
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		flags |= quit;
+	}
+
+	work_cv.notify_all();
+
+	for (auto &i : workers)
+		i.join();
+
+	workers.clear();
+	flags = 0;
+}
+
+void DetilePool::detile(const uint8_t *src, unsigned plane_w, unsigned plane_h,
+						uint8_t *dst, unsigned dst_stride,
+						unsigned x, unsigned y, unsigned w, unsigned h)
+{
+	if (w == 0 || h == 0)
+		return;
+
+	const unsigned tile_rows = (y + h + tile_height - 1) / tile_height - y / tile_height;
+	const unsigned bands = std::min<unsigned>(workers.size() + 1,
+											  tile_rows / min_band_rows);
+
+	if (bands <= 1) {
+		detile_nv12mt(src, plane_w, plane_h, dst, dst_stride, x, y, w, h);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		current = job{src, plane_w, plane_h, dst, dst_stride, x, y, w, h};
+		num_bands = bands;
+		pending = bands - 1;
+		generation++;
+	}
+
+	work_cv.notify_all();
+
+	convert_band(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done_cv.wait(lock, [this] { return pending == 0; });
+}
+
+void DetilePool::run(unsigned index)
+{
+	uint64_t seen = 0;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			work_cv.wait(lock, [this, seen] {
+				return (flags & quit) || generation != seen;
+			});
+
+			if (flags & quit)
+				return;
+
+			seen = generation;
+
+			// Not every worker gets a band of a small rectangle.
+			if (index >= num_bands)
+				continue;
+		}
+
+		convert_band(index);
+
+		bool last;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			last = (--pending == 0);
+		}
+
+		if (last)
+			done_cv.notify_one();
+	}
+}
+
+void DetilePool::convert_band(unsigned index) const
+{
+	const job &j = current;
+
+	// Split the rectangle into bands of whole tile rows.
+	const unsigned ty_first = j.y / tile_height;
+	const unsigned tile_rows = (j.y + j.h + tile_height - 1) / tile_height - ty_first;
+
+	const unsigned band_first = ty_first + (tile_rows * index) / num_bands;
+	const unsigned band_end = ty_first + (tile_rows * (index + 1)) / num_bands;
+
+	const unsigned row0 = std::max(j.y, band_first * tile_height);
+	const unsigned row1 = std::min(j.y + j.h, band_end * tile_height);
+
+	detile_nv12mt(j.src, j.plane_w, j.plane_h, j.dst + (row0 - j.y) * j.dst_stride,
+				  j.dst_stride, j.x, row0, j.w, row1 - row0);
+}
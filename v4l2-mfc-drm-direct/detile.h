@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__DETILE_)
+#define __DETILE_
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Conversion of planes in the Samsung NV12MT layout into linear planes.
+//
+// NV12MT stores each plane in tiles of 64x32 bytes. The tiles are arranged
+// in groups of 2x2 tiles, which are ordered in a flipped Z pattern. This
+// is the layout described by DRM_FORMAT_MOD_SAMSUNG_64_32_TILE.
+
+enum detile_constants {
+	tile_width = 64,
+	tile_height = 32,
+	tile_size = tile_width * tile_height,
+};
+
+// Get the byte offset of the tile at tile position (x,y).
+//
+// @{x,y}: position of the tile (in tiles)
+// @x_tiles, y_tiles: number of tiles in horizontal and vertical direction
+inline unsigned
+tile_offset(unsigned x, unsigned y, unsigned x_tiles, unsigned y_tiles)
+{
+	unsigned index = (y & ~1u) * x_tiles + x;
+
+	if (y & 1)
+		index += (x & ~3u) + 2;
+	else if ((y_tiles & 1) == 0 || y != y_tiles - 1)
+		index += (x + 2) & ~3u;
+
+	return index * tile_size;
+}
+
+// Copy a rectangle out of a NV12MT plane into a linear buffer.
+// The copy is done tile by tile, using NEON or SSE2 where available.
+//
+// @src: start of the tiled plane
+// @plane_w, plane_h: width (in bytes) and height of the tiled plane
+// @dst: start of the linear destination
+// @dst_stride: pitch of the destination in bytes
+// @{x,y,w,h}: rectangle to copy (in bytes and lines)
+void detile_nv12mt(const uint8_t *src, unsigned plane_w, unsigned plane_h,
+				   uint8_t *dst, unsigned dst_stride,
+				   unsigned x, unsigned y, unsigned w, unsigned h);
+
+// Workers that run detile_nv12mt() on bands of tile rows concurrently.
+// The threads are started once and wait for the next rectangle, since
+// starting threads for every plane costs more than the split gains.
+class DetilePool {
+private:
+	enum flags {
+		started			= (1 << 0),
+		quit			= (1 << 1),
+	};
+
+	enum constants {
+		// Fewer tile rows per band aren't worth the hand-off.
+		min_band_rows = 4,
+	};
+
+	// Arguments of detile_nv12mt() for the current rectangle.
+	struct job {
+		const uint8_t *src;
+		unsigned plane_w, plane_h;
+		uint8_t *dst;
+		unsigned dst_stride;
+		unsigned x, y, w, h;
+	};
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable work_cv;
+	std::condition_variable done_cv;
+
+	// The current rectangle, the number of its bands, and how many of
+	// the bands are still running. The generation counts the rectangles.
+	job current;
+	unsigned num_bands;
+	unsigned pending;
+	uint64_t generation;
+
+	unsigned flags;
+
+	void run(unsigned index);
+	void convert_band(unsigned index) const;
+
+public:
+	DetilePool();
+	~DetilePool();
+
+	DetilePool(const DetilePool &p) = delete;
+
+	// Start/stop the worker threads.
+	// start() returns false if an error occurs.
+	//
+	// @num_threads: number of threads to use (including the calling one),
+	//               at most one per core
+	bool start(unsigned num_threads);
+	void stop();
+
+	// Same as detile_nv12mt(), with the work split among the threads.
+	// Small rectangles are converted by the calling thread alone.
+	void detile(const uint8_t *src, unsigned plane_w, unsigned plane_h,
+				uint8_t *dst, unsigned dst_stride,
+				unsigned x, unsigned y, unsigned w, unsigned h);
+};
+
+// Plain line-by-line reference implementation.
+void detile_nv12mt_ref(const uint8_t *src, unsigned plane_w, unsigned plane_h,
+					   uint8_t *dst, unsigned dst_stride,
+					   unsigned x, unsigned y, unsigned w, unsigned h);
+
+#endif // __DETILE_
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmark of the NV12MT detiler against the reference implementation.
+//
+// Usage: detile_bench [<width> <height> [<iterations> [<threads>]]]
+
+#include "main.h"
+#include "detile.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+
+enum variant {
+	variant_reference = 0,
+	variant_optimized,
+	variant_threaded,
+	variant_count,
+};
+
+struct frame {
+	unsigned w, h;
+	unsigned luma_size;
+	std::vector<uint8_t> data;
+};
+
+unsigned
+align(unsigned v, unsigned a)
+{
+	return (v + a - 1) / a * a;
+}
+
+void
+detile_plane(enum variant v, const uint8_t *src, unsigned plane_w, unsigned plane_h,
+			 uint8_t *dst, unsigned w, unsigned h, DetilePool &pool)
+{
+	switch (v) {
+	case variant_reference:
+		detile_nv12mt_ref(src, plane_w, plane_h, dst, w, 0, 0, w, h);
+		break;
+
+	case variant_optimized:
+		detile_nv12mt(src, plane_w, plane_h, dst, w, 0, 0, w, h);
+		break;
+
+	case variant_threaded:
+	default:
+		pool.detile(src, plane_w, plane_h, dst, w, 0, 0, w, h);
+		break;
+	}
+}
+
+// Convert a whole frame (luma and chroma plane) into linear NV12.
+void
+convert(enum variant v, const frame &f, uint8_t *dst, unsigned crop_w,
+		unsigned crop_h, DetilePool &pool)
+{
+	detile_plane(v, f.data.data(), f.w, f.h, dst, crop_w, crop_h, pool);
+	detile_plane(v, f.data.data() + f.luma_size, f.w, f.h / 2,
+				 dst + crop_w * crop_h, crop_w, crop_h / 2, pool);
+}
+
+}; // anonymous namespace
+
+
+int main(int argc, char* argv[])
+{
+	using namespace std;
+
+	const unsigned crop_w = (argc > 2) ? stoul(argv[1]) : 1920;
+	const unsigned crop_h = (argc > 2) ? stoul(argv[2]) : 1080;
+	const unsigned iterations = (argc > 3) ? stoul(argv[3]) : 200;
+	const unsigned threads = (argc > 4) ? stoul(argv[4]) :
+		max(1u, std::thread::hardware_concurrency());
+
+	// Use the same alignment as the MFC for its NV12MT buffers.
+	frame f;
+	f.w = align(crop_w, 128);
+	f.h = align(crop_h, 32);
+	f.luma_size = align(f.w * f.h, 8192);
+	f.data.resize(f.luma_size + align(f.w * align(f.h / 2, 32), 8192));
+
+	srand(0);
+	for (auto &i : f.data)
+		i = rand();
+
+	// The workers are started once, like in a player.
+	DetilePool pool;
+
+	if (!pool.start(threads)) {
+		cerr << "failed to start " << threads << " threads.\n";
+		return 1;
+	}
+
+	const unsigned out_size = crop_w * crop_h * 3 / 2;
+	vector<uint8_t> ref(out_size), out(out_size);
+
+	const string names[variant_count] = {
+		"reference",
+		"optimized",
+		"optimized (" + to_string(threads) + " threads)",
+	};
+
+	cout << "detiling " << crop_w << " x " << crop_h << " (buffer "
+		 << f.w << " x " << f.h << "), " << iterations << " iterations\n";
+
+	convert(variant_reference, f, ref.data(), crop_w, crop_h, pool);
+
+	for (unsigned i = variant_optimized; i < variant_count; ++i) {
+		zerostruct(out.data(), out_size);
+		convert(variant(i), f, out.data(), crop_w, crop_h, pool);
+
+		if (out != ref) {
+			cerr << names[i] << ": output differs from reference.\n";
+			return 1;
+		}
+	}
+
+	double ref_fps = 0.0;
+
+	for (unsigned i = variant_reference; i < variant_count; ++i) {
+		const uint64_t start = monotonic_us();
+
+		for (unsigned j = 0; j < iterations; ++j)
+			convert(variant(i), f, out.data(), crop_w, crop_h, pool);
+
+		const uint64_t elapsed = max<uint64_t>(monotonic_us() - start, 1);
+		const double fps = double(iterations) * 1000000.0 / double(elapsed);
+
+		if (i == variant_reference)
+			ref_fps = fps;
+
+		cout << names[i] << ": " << elapsed / iterations << " us/frame, "
+			 << fps << " fps (speedup = " << fps / ref_fps << ")\n";
+	}
+
+	return 0;
+}
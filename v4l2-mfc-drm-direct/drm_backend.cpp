@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "drm_backend.h"
+#include "main.h"
+
+#include <iostream>
+
+#include <sys/mman.h>
+
+#include <xf86drm.h>
+
+extern "C" {
+#include <libdrm/exynos_drmif.h>
+};
+
+
+namespace {
+
+// Exynos buffer object, which wraps the one from libdrm_exynos.
+struct exynos_backend_bo : public drm_bo {
+	struct exynos_bo *bo;
+};
+
+enum dumb_constants {
+	// Dumb buffers are created as 2D buffers with one byte per pixel.
+	// The size of a buffer is rounded up to a multiple of this width.
+	dumb_width = 4096,
+};
+
+}; // anonymous namespace
+
+
+DRMBackend::DRMBackend() : fd(-1)
+{
+	// Nothing here.
+}
+
+DRMBackend* DRMBackend::get_backend(enum backend_type t)
+{
+	switch (t) {
+	case backend_exynos:
+		return new ExynosBackend;
+
+	case backend_dumb:
+		return new DumbBackend;
+
+	default:
+		return nullptr;
+	}
+}
+
+
+ExynosBackend::ExynosBackend() : device(nullptr)
+{
+	// Nothing here.
+}
+
+ExynosBackend::~ExynosBackend()
+{
+	close();
+}
+
+bool ExynosBackend::supports(int drm_fd, const std::string &driver) const
+{
+	return (driver == "exynos");
+}
+
+bool ExynosBackend::open(int drm_fd)
+{
+	static const std::string msg_prefix("ExynosBackend::open(): ");
+
+	if (device)
+		return false;
+
+	device = exynos_device_create(drm_fd);
+	if (!device) {
+		std::cerr << msg_prefix << "failed to create device from fd.\n";
+		return false;
+	}
+
+	fd = drm_fd;
+
+	return true;
+}
+
+void ExynosBackend::close()
+{
+	if (!device)
+		return;
+
+	exynos_device_destroy(device);
+
+	device = nullptr;
+	fd = -1;
+}
+
+drm_bo* ExynosBackend::create_bo(unsigned size)
+{
+	if (!device)
+		return nullptr;
+
+	const unsigned bo_flags = 0;
+
+	struct exynos_bo *bo = exynos_bo_create(device, size, bo_flags);
+	if (!bo)
+		return nullptr;
+
+	exynos_backend_bo *b = new exynos_backend_bo;
+
+	b->handle = bo->handle;
+	b->size = bo->size;
+	b->vaddr = nullptr;
+	b->bo = bo;
+
+	return b;
+}
+
+void ExynosBackend::destroy_bo(drm_bo *bo)
+{
+	if (!bo)
+		return;
+
+	exynos_backend_bo *b = static_cast<exynos_backend_bo*>(bo);
+
+	// This also removes the mapping.
+	exynos_bo_destroy(b->bo);
+
+	delete b;
+}
+
+void* ExynosBackend::map_bo(drm_bo *bo)
+{
+	if (!bo)
+		return nullptr;
+
+	if (!bo->vaddr)
+		bo->vaddr = exynos_bo_map(static_cast<exynos_backend_bo*>(bo)->bo);
+
+	return bo->vaddr;
+}
+
+
+DumbBackend::DumbBackend()
+{
+	// Nothing here.
+}
+
+DumbBackend::~DumbBackend()
+{
+	close();
+}
+
+bool DumbBackend::supports(int drm_fd, const std::string &driver) const
+{
+	uint64_t cap = 0;
+
+	// Every KMS driver provides dumb buffers, render-only devices don't.
+	if (drmGetCap(drm_fd, DRM_CAP_DUMB_BUFFER, &cap) < 0)
+		return false;
+
+	return (cap != 0);
+}
+
+bool DumbBackend::open(int drm_fd)
+{
+	static const std::string msg_prefix("DumbBackend::open(): ");
+
+	if (fd >= 0)
+		return false;
+
+	uint64_t cap = 0;
+
+	if (drmGetCap(drm_fd, DRM_CAP_DUMB_BUFFER, &cap) < 0 || cap == 0) {
+		std::cerr << msg_prefix << "device has no support for dumb buffers.\n";
+		return false;
+	}
+
+	fd = drm_fd;
+
+	return true;
+}
+
+void DumbBackend::close()
+{
+	fd = -1;
+}
+
+drm_bo* DumbBackend::create_bo(unsigned size)
+{
+	if (fd < 0 || size == 0)
+		return nullptr;
+
+	struct drm_mode_create_dumb create;
+
+	zerostruct(&create);
+	create.width = dumb_width;
+	create.height = (size + dumb_width - 1) / dumb_width;
+	create.bpp = 8;
+
+	if (drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create))
+		return nullptr;
+
+	drm_bo *b = new drm_bo;
+
+	b->handle = create.handle;
+	b->size = create.size;
+	b->vaddr = nullptr;
+
+	return b;
+}
+
+void DumbBackend::destroy_bo(drm_bo *bo)
+{
+	if (!bo)
+		return;
+
+	if (bo->vaddr)
+		munmap(bo->vaddr, bo->size);
+
+	struct drm_mode_destroy_dumb destroy;
+
+	zerostruct(&destroy);
+	destroy.handle = bo->handle;
+
+	drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+
+	delete bo;
+}
+
+void* DumbBackend::map_bo(drm_bo *bo)
+{
+	if (!bo)
+		return nullptr;
+
+	if (bo->vaddr)
+		return bo->vaddr;
+
+	struct drm_mode_map_dumb map;
+
+	zerostruct(&map);
+	map.handle = bo->handle;
+
+	if (drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map))
+		return nullptr;
+
+	void *ptr = mmap(nullptr, bo->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+					 fd, map.offset);
+	if (ptr == MAP_FAILED)
+		return nullptr;
+
+	bo->vaddr = ptr;
+
+	return ptr;
+}
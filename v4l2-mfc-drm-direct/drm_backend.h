@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__DRM_BACKEND_)
+#define __DRM_BACKEND_
+
+#include <cstdint>
+#include <string>
+
+// Buffer object that was allocated by a backend.
+//
+// @handle: GEM handle of the buffer
+// @size: size of the buffer in bytes
+// @vaddr: CPU mapping of the buffer (nullptr if it is not mapped)
+struct drm_bo {
+	uint32_t handle;
+	unsigned size;
+	void *vaddr;
+};
+
+
+// Allocation of buffer objects. This is the only driver-specific part
+// of the presentation path, everything else uses generic atomic KMS.
+class DRMBackend {
+protected:
+	int fd;
+
+public:
+	enum backend_type {
+		// Exynos GEM buffers (libdrm_exynos).
+		backend_exynos = 0,
+
+		// Generic dumb buffers, e.g. for vkms.
+		backend_dumb,
+	};
+
+	DRMBackend();
+	virtual ~DRMBackend() {}
+
+	DRMBackend(const DRMBackend &b) = delete;
+
+	// Check if the backend can be used with a DRM device.
+	//
+	// @drm_fd: fd of the DRM device
+	// @driver: name of the DRM driver
+	virtual bool supports(int drm_fd, const std::string &driver) const = 0;
+
+	// Open/close the backend on a DRM device.
+	// open() returns false if an error occurs.
+	//
+	// @drm_fd: fd of the DRM device
+	virtual bool open(int drm_fd) = 0;
+	virtual void close() = 0;
+
+	// Create/destroy a buffer object.
+	// create_bo() returns nullptr if an error occurs.
+	//
+	// @size: size of the buffer in bytes
+	virtual drm_bo* create_bo(unsigned size) = 0;
+	virtual void destroy_bo(drm_bo *bo) = 0;
+
+	// Map a buffer object for CPU access. The mapping stays valid
+	// until the buffer object is destroyed.
+	// Returns nullptr if an error occurs.
+	virtual void* map_bo(drm_bo *bo) = 0;
+
+	// Construct a backend from a backend type.
+	static DRMBackend* get_backend(enum backend_type t);
+};
+
+
+class ExynosBackend : public DRMBackend {
+private:
+	struct exynos_device *device;
+
+public:
+	ExynosBackend();
+	~ExynosBackend();
+
+	bool supports(int drm_fd, const std::string &driver) const;
+
+	bool open(int drm_fd);
+	void close();
+
+	drm_bo* create_bo(unsigned size);
+	void destroy_bo(drm_bo *bo);
+	void* map_bo(drm_bo *bo);
+};
+
+
+class DumbBackend : public DRMBackend {
+public:
+	DumbBackend();
+	~DumbBackend();
+
+	bool supports(int drm_fd, const std::string &driver) const;
+
+	bool open(int drm_fd);
+	void close();
+
+	drm_bo* create_bo(unsigned size);
+	void destroy_bo(drm_bo *bo);
+	void* map_bo(drm_bo *bo);
+};
+
+#endif // __DRM_BACKEND_
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "event_loop.h"
+#include "main.h"
+
+#include <iostream>
+#include <string>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+
+EventLoop::EventLoop() : epfd(-1), timer_fd(-1), flags(0)
+{
+	// Nothing here.
+}
+
+EventLoop::~EventLoop()
+{
+	close();
+}
+
+bool EventLoop::open()
+{
+	static const std::string msg_prefix("EventLoop::open(): ");
+
+	if (flags & opened)
+		return false;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		std::cerr << msg_prefix << "failed to create epoll instance (errno="
+				  << errno << ").\n";
+		return false;
+	}
+
+	flags |= opened;
+
+	return true;
+}
+
+void EventLoop::close()
+{
+	if (!(flags & opened))
+		return;
+
+	if (flags & timer_added)
+		::close(timer_fd);
+
+	::close(epfd);
+
+	flags &= ~(opened | timer_added);
+}
+
+bool EventLoop::add(int fd, uint32_t events, unsigned id)
+{
+	static const std::string msg_prefix("EventLoop::add(): ");
+
+	if (!(flags & opened))
+		return false;
+
+	struct epoll_event ev;
+
+	zerostruct(&ev);
+	ev.events = events;
+	ev.data.u32 = id;
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		std::cerr << msg_prefix << "failed to add fd (errno=" << errno << ").\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events, unsigned id)
+{
+	if (!(flags & opened))
+		return false;
+
+	struct epoll_event ev;
+
+	zerostruct(&ev);
+	ev.events = events;
+	ev.data.u32 = id;
+
+	return (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == 0);
+}
+
+void EventLoop::remove(int fd)
+{
+	if (!(flags & opened))
+		return;
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+bool EventLoop::add_timer(unsigned id)
+{
+	static const std::string msg_prefix("EventLoop::add_timer(): ");
+
+	if (!(flags & opened) || (flags & timer_added))
+		return false;
+
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		std::cerr << msg_prefix << "failed to create timer (errno=" << errno << ").\n";
+		return false;
+	}
+
+	if (!add(timer_fd, EPOLLIN, id)) {
+		::close(timer_fd);
+		return false;
+	}
+
+	flags |= timer_added;
+
+	return true;
+}
+
+bool EventLoop::arm_timer(uint64_t t)
+{
+	if (!(flags & timer_added))
+		return false;
+
+	struct itimerspec its;
+
+	zerostruct(&its);
+
+	// A zero value would disarm the timer.
+	its.it_value.tv_sec = t / 1000000;
+	its.it_value.tv_nsec = (t % 1000000) * 1000 + (t == 0 ? 1 : 0);
+
+	return (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, nullptr) == 0);
+}
+
+void EventLoop::disarm_timer()
+{
+	if (!(flags & timer_added))
+		return;
+
+	struct itimerspec its;
+
+	zerostruct(&its);
+	timerfd_settime(timer_fd, 0, &its, nullptr);
+}
+
+void EventLoop::ack_timer()
+{
+	if (!(flags & timer_added))
+		return;
+
+	uint64_t expirations;
+
+	// The timer is nonblocking, so this fails if it has not expired.
+	if (::read(timer_fd, &expirations, sizeof(expirations)) < 0)
+		return;
+}
+
+int EventLoop::get_fd() const
+{
+	return epfd;
+}
+
+bool EventLoop::wait(std::vector<event> &events, int timeout)
+{
+	static const std::string msg_prefix("EventLoop::wait(): ");
+
+	events.clear();
+
+	if (!(flags & opened))
+		return false;
+
+	struct epoll_event ev[max_events];
+
+	const int ret = epoll_wait(epfd, ev, max_events, timeout);
+	if (ret < 0) {
+		if (errno == EINTR)
+			return true;
+
+		std::cerr << msg_prefix << "epoll_wait failed (errno=" << errno << ").\n";
+		return false;
+	}
+
+	for (int i = 0; i < ret; ++i)
+		events.push_back({ev[i].data.u32, ev[i].events});
+
+	return true;
+}
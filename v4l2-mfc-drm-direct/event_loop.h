@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__EVENT_LOOP_)
+#define __EVENT_LOOP_
+
+#include <cstdint>
+#include <vector>
+
+#include <sys/epoll.h>
+
+// Thin wrapper around epoll, which lets a single thread wait for the
+// decoder, the display and timers at the same time. Each fd is registered
+// with an ID, which is returned together with its events.
+class EventLoop {
+public:
+	// @id: ID that the fd was registered with
+	// @events: EPOLL* event mask
+	struct event {
+		unsigned id;
+		uint32_t events;
+	};
+
+private:
+	enum flags {
+		opened			= (1 << 0),
+		timer_added		= (1 << 1),
+	};
+
+	enum constants {
+		max_events = 8,
+	};
+
+	int epfd;
+	int timer_fd;
+
+	unsigned flags;
+
+public:
+	EventLoop();
+	~EventLoop();
+
+	EventLoop(const EventLoop &el) = delete;
+
+	// Open/close the event loop.
+	// open() returns false if an error occurs.
+	bool open();
+	void close();
+
+	// Add/modify/remove a fd.
+	// add() and modify() return false if an error occurs.
+	//
+	// @fd: file descriptor to watch
+	// @events: EPOLL* event mask
+	// @id: ID that is returned with the events
+	bool add(int fd, uint32_t events, unsigned id);
+	bool modify(int fd, uint32_t events, unsigned id);
+	void remove(int fd);
+
+	// Add a timer on the monotonic clock.
+	// add_timer() returns false if an error occurs.
+	//
+	// @id: ID that is returned when the timer expires
+	bool add_timer(unsigned id);
+
+	// Arm the timer for the absolute time 't' (monotonic, in
+	// microseconds), or disarm it. Expirations need to be
+	// acknowledged with ack_timer().
+	bool arm_timer(uint64_t t);
+	void disarm_timer();
+	void ack_timer();
+
+	// The epoll fd, which becomes readable when events are pending.
+	// This allows to nest the loop into another one.
+	int get_fd() const;
+
+	// Wait for events.
+	// wait() returns false if an error occurs.
+	//
+	// @events: vector that receives the events (cleared first)
+	// @timeout: timeout in milliseconds (-1 for none)
+	bool wait(std::vector<event> &events, int timeout);
+};
+
+#endif // __EVENT_LOOP_
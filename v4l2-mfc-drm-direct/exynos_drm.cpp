@@ -16,19 +16,25 @@
 
 #include "exynos_drm.h"
 #include "main.h"
-#include "cairo_text.h"
+#include "glyph_text.h"
+#include "subtitles.h"
 
 #include <string>
+#include <array>
 #include <map>
 #include <memory>
 #include <cassert>
+#include <cerrno>
 #include <iostream>
 #include <stdexcept>
-#include <cmath>
+#include <algorithm>
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <linux/sync_file.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -36,12 +42,12 @@
 #include <linux/videodev2.h>
 
 
-extern "C" {
-#include <libdrm/exynos_drmif.h>
-};
-
-
 class FlipHandler {
+public:
+	// Handler of the flip events, which gets the user data of the commit.
+	typedef void (*handler)(int fd, unsigned frame, unsigned sec, unsigned usec,
+							unsigned crtc_id, void *data);
+
 private:
 	struct pollfd fds;
 	drmEventContext evctx;
@@ -52,7 +58,14 @@ public:
 
 	FlipHandler(const FlipHandler& fh) = delete;
 
+	// Replace the handler, e.g. when the commits come from the mosaic
+	// instead of a page.
+	void set_handler(handler h);
+
 	void wait();
+
+	// Handle the pending events, without waiting for new ones.
+	void dispatch();
 };
 
 
@@ -62,6 +75,22 @@ struct CommonDRM {
 	typedef std::pair<uint32_t, unsigned> property_key;
 	typedef std::map<property_key, uint32_t> property_map;
 
+	// Additional output that mirrors the video.
+	//
+	// @{connector,crtc}_id: IDs of the connector and CRTC objects
+	// @crtc_index: index of the CRTC, to validate the planes
+	// @plane_id: ID of the video plane (zero until the pages are allocated)
+	// @mode_blob_id: blob with the native mode of the output
+	// @{w,h}: dimensions of the mode
+	struct clone_output {
+		uint32_t connector_id;
+		uint32_t crtc_id;
+		unsigned crtc_index;
+		uint32_t plane_id;
+		uint32_t mode_blob_id;
+		unsigned w, h;
+	};
+
 	unsigned crtc_index;
 
 	// IDs for connector, CRTC and plane objects.
@@ -70,8 +99,30 @@ struct CommonDRM {
 	uint32_t plane_id[2];
 	uint32_t mode_blob_id;
 
+	// ID of the OUT_FENCE_PTR property of the CRTC (zero if the
+	// driver does not support out-fences).
+	uint32_t out_fence_prop;
+
+	// ID of the FB_DAMAGE_CLIPS property of the primary plane (zero
+	// if the driver does not support damage clips).
+	uint32_t damage_prop;
+
+	// Writeback connector of the main CRTC (zero if writeback is not
+	// enabled), and the IDs of its writeback properties.
+	uint32_t writeback_id;
+	uint32_t writeback_fb_prop;
+	uint32_t writeback_fence_prop;
+
+	// Plane for the subtitles (zero if there is none).
+	uint32_t subtitle_plane_id;
+
+	// Video planes that the mosaic can use (empty without a mosaic).
+	std::vector<uint32_t> mosaic_plane_ids;
+
 	property_map pmap;
 
+	std::vector<clone_output> clones;
+
 	// Atomic requests for the initial and the restore modeset.
 	drmModeAtomicReq *modeset_request;
 	drmModeAtomicReq *restore_request;
@@ -97,10 +148,13 @@ enum e_prop {
 	plane_prop_zpos,
 };
 
+// @optional: the property might be missing, e.g. zpos is
+//            not exposed by all drivers
 struct drm_prop {
 	uint32_t object_type;
 	enum e_prop prop;
 	std::string prop_name;
+	bool optional;
 };
 
 const std::array<drm_prop, 14> prop_template{{
@@ -122,7 +176,7 @@ const std::array<drm_prop, 14> prop_template{{
 	{ DRM_MODE_OBJECT_PLANE, plane_prop_src_y, "SRC_Y" },
 	{ DRM_MODE_OBJECT_PLANE, plane_prop_src_w, "SRC_W" },
 	{ DRM_MODE_OBJECT_PLANE, plane_prop_src_h, "SRC_H" },
-	{ DRM_MODE_OBJECT_PLANE, plane_prop_zpos, "zpos" },
+	{ DRM_MODE_OBJECT_PLANE, plane_prop_zpos, "zpos", true },
 }};
 
 struct prop_assign {
@@ -135,11 +189,6 @@ enum e_plane_type {
 	plane_video
 };
 
-enum drm_constants {
-	overlay_width = 128,
-	overlay_height = 64
-};
-
 // Dynamic memory management of DRM resources.
 namespace drmMode {
 
@@ -153,9 +202,15 @@ namespace drmMode {
 	template <>
 	void free<drmModeEncoder>(drmModeEncoder *p) { drmModeFreeEncoder(p); }
 	template <>
-	void free<drmModeAtomicReq>(drmModeAtomicReq *p) { drmModeAtomicFree(p); }
+	void free<drmModeConnector>(drmModeConnector *p) { drmModeFreeConnector(p); }
+	template <>
+	void free<drmModeRes>(drmModeRes *p) { drmModeFreeResources(p); }
+	template <>
+	void free<drmModePlaneRes>(drmModePlaneRes *p) { drmModeFreePlaneResources(p); }
 	template <>
-	void free<exynos_device>(exynos_device *p) { exynos_device_destroy(p); }
+	void free<drmModePlane>(drmModePlane *p) { drmModeFreePlane(p); }
+	template <>
+	void free<drmModeAtomicReq>(drmModeAtomicReq *p) { drmModeAtomicFree(p); }
 
 	template <typename T>
 	using drm_mode_unique_ptr = std::unique_ptr<T, decltype(*free<T>)>;
@@ -166,18 +221,29 @@ namespace drmMode {
 };
 
 // The main pageflip handler which is used by drmHandleEvent.
-// Decreases the pending pageflip count and updates the current page.
+// Each CRTC of the flip sends its own event.
 void
-page_flip_handler(int fd, unsigned frame, unsigned sec, unsigned usec, void *data)
+page_flip_handler(int fd, unsigned frame, unsigned sec, unsigned usec,
+				  unsigned crtc_id, void *data)
 {
 	ExynosPage *page = static_cast<ExynosPage*>(data);
 
-	page->handle_flip();
+	page->handle_flip(frame, uint64_t(sec) * 1000000 + usec, crtc_id);
+}
+
+// Same for the commits of the mosaic, which only use the main CRTC.
+void
+mosaic_flip_handler(int fd, unsigned frame, unsigned sec, unsigned usec,
+					unsigned crtc_id, void *data)
+{
+	ExynosMosaic *mosaic = static_cast<ExynosMosaic*>(data);
+
+	mosaic->handle_flip(frame, uint64_t(sec) * 1000000 + usec);
 }
 
-// Find the name of a compatible DRM device.
+// Find the name of a DRM device that is supported by a backend.
 void
-get_device_name(std::string &name)
+get_device_name(std::string &name, const DRMBackend &backend)
 {
 	using namespace std;
 
@@ -196,7 +262,7 @@ get_device_name(std::string &name)
 			break;
 
 		drmVersionPtr ver = drmGetVersion(fd);
-		found = (string(ver->name) == "exynos");
+		found = (ver && backend.supports(fd, ver->name));
 
 		drmFreeVersion(ver);
 		::close(fd);
@@ -277,19 +343,46 @@ get_ids_from_type(const CommonDRM &drm, uint32_t object_type)
 {
 	using namespace std;
 
+	vector<uint32_t> ids;
+
 	switch (object_type) {
 	case DRM_MODE_OBJECT_CONNECTOR:
-		return vector<uint32_t>{drm.connector_id};
+		ids.push_back(drm.connector_id);
+
+		for (auto &i : drm.clones)
+			ids.push_back(i.connector_id);
+
+		if (drm.writeback_id != 0)
+			ids.push_back(drm.writeback_id);
+
+		break;
 
 	case DRM_MODE_OBJECT_CRTC:
-		return vector<uint32_t>{drm.crtc_id};
+		ids.push_back(drm.crtc_id);
+
+		for (auto &i : drm.clones)
+			ids.push_back(i.crtc_id);
+
+		break;
 
 	case DRM_MODE_OBJECT_PLANE:
 	default:
-		return vector<uint32_t>{
-			drm.plane_id[plane_primary],
-			drm.plane_id[plane_video]};
+		ids.push_back(drm.plane_id[plane_primary]);
+		ids.push_back(drm.plane_id[plane_video]);
+
+		for (auto &i : drm.clones)
+			ids.push_back(i.plane_id);
+
+		if (drm.subtitle_plane_id != 0)
+			ids.push_back(drm.subtitle_plane_id);
+
+		for (auto &i : drm.mosaic_plane_ids)
+			ids.push_back(i);
+
+		break;
 	}
+
+	return ids;
 }
 
 bool
@@ -328,6 +421,9 @@ setup_properties(int fd, CommonDRM &drm, drmModeRes &res,
 			uint32_t prop_id;
 
 			if (!get_propid_by_name(fd, obj_id, object_type, prop_name, prop_id)) {
+				if (i.optional)
+					continue;
+
 				drm.pmap.clear();
 
 				return false;
@@ -340,26 +436,49 @@ setup_properties(int fd, CommonDRM &drm, drmModeRes &res,
 	return true;
 }
 
+// Add the current values of the properties of all objects of one type
+// to a request, so that committing the request restores them.
 bool
-create_restore_req(int fd, CommonDRM &drm)
+add_restore_props(int fd, CommonDRM &drm, drmModeAtomicReq *req,
+				  uint32_t object_type)
 {
-	auto req = drmMode::make_unique(drmModeAtomicAlloc());
-
 	for (auto &i : prop_template) {
-		const uint32_t object_type = i.object_type;
+		if (i.object_type != object_type)
+			continue;
 
 		for (auto &j : get_ids_from_type(drm, object_type)) {
-			const uint32_t prop_id = drm.pmap.at(std::make_pair(j, i.prop));
+			auto it = drm.pmap.find(std::make_pair(j, i.prop));
+
+			// Skip optional properties that the object doesn't have.
+			if (it == drm.pmap.end())
+				continue;
+
+			const uint32_t prop_id = it->second;
 			uint64_t prop_value;
 
 			if (!get_propval_by_id(fd, j, object_type, prop_id, prop_value))
 				return false;
 
-			if (drmModeAtomicAddProperty(req.get(), j, prop_id, prop_value) < 0)
+			if (drmModeAtomicAddProperty(req, j, prop_id, prop_value) < 0)
 				return false;
 		}
 	}
 
+	return true;
+}
+
+bool
+create_restore_req(int fd, CommonDRM &drm)
+{
+	auto req = drmMode::make_unique(drmModeAtomicAlloc());
+	if (!req)
+		return false;
+
+	if (!add_restore_props(fd, drm, req.get(), DRM_MODE_OBJECT_CONNECTOR) ||
+		!add_restore_props(fd, drm, req.get(), DRM_MODE_OBJECT_CRTC) ||
+		!add_restore_props(fd, drm, req.get(), DRM_MODE_OBJECT_PLANE))
+		return false;
+
 	drm.restore_request = req.release();
 	return true;
 }
@@ -367,117 +486,361 @@ create_restore_req(int fd, CommonDRM &drm)
 bool
 add_overlay_props(drmModeAtomicReq *req, CommonDRM &drm, unsigned w, unsigned h)
 {
-	const unsigned overlay_x = (w <= overlay_width * 2) ?
-		0 : (w - overlay_width * 2) / 2;
-	const unsigned overlay_y = (h <= overlay_height * 2) ?
-		0 : (h - overlay_height * 2) / 2;
-
+	// The overlay covers the whole screen, without any scaling.
 	const struct prop_assign assign[] = {
 		{ plane_prop_crtc_id, drm.crtc_id },
-		{ plane_prop_crtc_x, overlay_x },
-		{ plane_prop_crtc_y, overlay_y },
-		// We make use of the pixel-doubling feature here.
-		{ plane_prop_crtc_w, overlay_width * 2 },
-		{ plane_prop_crtc_h, overlay_height * 2 },
+		{ plane_prop_crtc_x, 0 },
+		{ plane_prop_crtc_y, 0 },
+		{ plane_prop_crtc_w, w },
+		{ plane_prop_crtc_h, h },
 		{ plane_prop_src_x, 0 },
 		{ plane_prop_src_y, 0 },
-		{ plane_prop_src_w, overlay_width << 16 },
-		{ plane_prop_src_h, overlay_height << 16 },
+		{ plane_prop_src_w, w << 16 },
+		{ plane_prop_src_h, h << 16 },
 		{ plane_prop_zpos, 2 },
 	};
 
 	const uint32_t obj_id = drm.plane_id[plane_primary];
 
 	for (auto &i : assign) {
-		const uint32_t prop_id = drm.pmap.at(std::make_pair(obj_id, i.prop));
+		auto it = drm.pmap.find(std::make_pair(obj_id, i.prop));
+
+		// Optional property, which the plane doesn't have.
+		if (it == drm.pmap.end())
+			continue;
 
-		if (drmModeAtomicAddProperty(req, obj_id, prop_id, i.value) < 0)
+		if (drmModeAtomicAddProperty(req, obj_id, it->second, i.value) < 0)
 			return false;
 	}
 
 	return true;
 }
 
-bool
-add_video_props(drmModeAtomicReq *req, CommonDRM &drm, unsigned w, unsigned h,
-				const videoinfo &vi)
+// Placement of the video plane.
+//
+// @src_{x,y,w,h}: visible part of the framebuffer (in pixels)
+// @crtc_{x,y,w,h}: area on the screen (in pixels)
+struct video_geometry {
+	unsigned src_x, src_y, src_w, src_h;
+	unsigned crtc_x, crtc_y, crtc_w, crtc_h;
+};
+
+// Compute the placement of the video plane for a scaling mode. The
+// display engine does the scaling, the decoded frame is never copied.
+//
+// @m: scaling mode
+// @{w,h}: width, height of the mode
+// @vi: reference to a struct containing video information
+video_geometry
+compute_geometry(enum ExynosDRM::scaling_mode m, unsigned w, unsigned h,
+				 const videoinfo &vi)
 {
-	const float mode_aspect = float(w) / float(h);
-	const float video_aspect = float(vi.crop_w) / float(vi.crop_h);
+	video_geometry g;
+
+	// Start with the whole visible area of the frame.
+	g.src_x = vi.crop_left;
+	g.src_y = vi.crop_top;
+	g.src_w = vi.crop_w;
+	g.src_h = vi.crop_h;
+
+	// Compare the aspect ratios without rounding errors.
+	const uint64_t video_ratio = uint64_t(vi.crop_w) * h;
+	const uint64_t mode_ratio = uint64_t(w) * vi.crop_h;
+
+	switch (m) {
+	case ExynosDRM::scaling_fill:
+		// Cover the whole screen, and cut off the parts of the frame
+		// that don't fit.
+		if (video_ratio > mode_ratio) {
+			g.src_w = uint64_t(vi.crop_h) * w / h;
+			g.src_x += (vi.crop_w - g.src_w) / 2;
+		} else if (video_ratio < mode_ratio) {
+			g.src_h = uint64_t(vi.crop_w) * h / w;
+			g.src_y += (vi.crop_h - g.src_h) / 2;
+		}
 
-	unsigned width, height;
+		g.crtc_w = w;
+		g.crtc_h = h;
+		break;
 
-	if (std::fabs(mode_aspect - video_aspect) < 0.0001f) {
-		width = w;
-		height = h;
-	} else if (mode_aspect > video_aspect) {
-		width = float(w) * video_aspect / mode_aspect;
-		height = h;
-	} else {
-		width = w;
-		height = float(h) * mode_aspect / video_aspect;
+	case ExynosDRM::scaling_none:
+		// Show the frame pixel by pixel, and cut off the parts
+		// that are larger than the screen.
+		if (vi.crop_w > w) {
+			g.src_x += (vi.crop_w - w) / 2;
+			g.src_w = w;
+		}
+
+		if (vi.crop_h > h) {
+			g.src_y += (vi.crop_h - h) / 2;
+			g.src_h = h;
+		}
+
+		g.crtc_w = g.src_w;
+		g.crtc_h = g.src_h;
+		break;
+
+	case ExynosDRM::scaling_integer: {
+		const unsigned factor = std::min(w / vi.crop_w, h / vi.crop_h);
+
+		// A frame that is larger than the screen has to be scaled down,
+		// in that case fall back to 'fit'.
+		if (factor != 0) {
+			g.crtc_w = vi.crop_w * factor;
+			g.crtc_h = vi.crop_h * factor;
+			break;
+		}
 	}
+		// fall through
 
+	case ExynosDRM::scaling_fit:
+	default:
+		// Scale the frame to the screen, and keep the aspect ratio.
+		if (video_ratio > mode_ratio) {
+			g.crtc_w = w;
+			g.crtc_h = uint64_t(w) * vi.crop_h / vi.crop_w;
+		} else if (video_ratio < mode_ratio) {
+			g.crtc_w = uint64_t(h) * vi.crop_w / vi.crop_h;
+			g.crtc_h = h;
+		} else {
+			g.crtc_w = w;
+			g.crtc_h = h;
+		}
+
+		break;
+	}
+
+	g.crtc_x = (w - g.crtc_w) / 2;
+	g.crtc_y = (h - g.crtc_h) / 2;
+
+	return g;
+}
+
+// @{plane,crtc}_id: video plane and the CRTC that it is placed on
+// @zpos: position of the plane in the stack
+bool
+add_video_props(drmModeAtomicReq *req, CommonDRM &drm, uint32_t plane_id,
+				uint32_t crtc_id, const video_geometry &g, unsigned zpos = 0)
+{
+	// The source coordinates are in 16.16 fixed point.
 	const struct prop_assign assign[] = {
-		{ plane_prop_crtc_id, drm.crtc_id },
-		{ plane_prop_crtc_x, (w - width) / 2 },
-		{ plane_prop_crtc_y, (h - height) / 2 },
-		{ plane_prop_crtc_w, width },
-		{ plane_prop_crtc_h, height },
-		{ plane_prop_src_x, vi.crop_left },
-		{ plane_prop_src_y, vi.crop_top },
-		{ plane_prop_src_w, vi.crop_w << 16 },
-		{ plane_prop_src_h, vi.crop_h << 16 },
-		{ plane_prop_zpos, 0 },
+		{ plane_prop_crtc_id, crtc_id },
+		{ plane_prop_crtc_x, g.crtc_x },
+		{ plane_prop_crtc_y, g.crtc_y },
+		{ plane_prop_crtc_w, g.crtc_w },
+		{ plane_prop_crtc_h, g.crtc_h },
+		{ plane_prop_src_x, uint64_t(g.src_x) << 16 },
+		{ plane_prop_src_y, uint64_t(g.src_y) << 16 },
+		{ plane_prop_src_w, uint64_t(g.src_w) << 16 },
+		{ plane_prop_src_h, uint64_t(g.src_h) << 16 },
+		{ plane_prop_zpos, zpos },
 	};
 
-	const uint32_t obj_id = drm.plane_id[plane_video];
-
 	for (auto &i : assign) {
-		const uint32_t prop_id = drm.pmap.at(std::make_pair(obj_id, i.prop));
+		auto it = drm.pmap.find(std::make_pair(plane_id, i.prop));
+
+		// Optional property, which the plane doesn't have.
+		if (it == drm.pmap.end())
+			continue;
 
-		if (drmModeAtomicAddProperty(req, obj_id, prop_id, i.value) < 0)
+		if (drmModeAtomicAddProperty(req, plane_id, it->second, i.value) < 0)
 			return false;
 	}
 
 	return true;
 }
 
+// Route a connector to a CRTC, and enable the CRTC with a mode.
 bool
-create_modeset_req(int fd, CommonDRM &drm, unsigned w, unsigned h,
-				   const videoinfo &vi)
+add_output_props(drmModeAtomicReq *req, CommonDRM &drm, uint32_t connector_id,
+				 uint32_t crtc_id, uint32_t mode_blob_id)
 {
 	using namespace std;
 
-	auto req = drmMode::make_unique(drmModeAtomicAlloc());
-	if (!req)
+	uint32_t prop_id;
+
+	prop_id = drm.pmap[make_pair(connector_id, connector_prop_crtc_id)];
+	if (drmModeAtomicAddProperty(req, connector_id, prop_id, crtc_id) < 0)
 		return false;
 
-	uint32_t prop_id;
+	prop_id = drm.pmap[make_pair(crtc_id, crtc_prop_active)];
+	if (drmModeAtomicAddProperty(req, crtc_id, prop_id, 1) < 0)
+		return false;
 
-	prop_id = drm.pmap[make_pair(drm.connector_id, connector_prop_crtc_id)];
-	if (drmModeAtomicAddProperty(req.get(), drm.connector_id, prop_id, drm.crtc_id) < 0)
+	prop_id = drm.pmap[make_pair(crtc_id, crtc_prop_mode_id)];
+	if (drmModeAtomicAddProperty(req, crtc_id, prop_id, mode_blob_id) < 0)
 		return false;
 
-	prop_id = drm.pmap[make_pair(drm.crtc_id, crtc_prop_active)];
-	if (drmModeAtomicAddProperty(req.get(), drm.crtc_id, prop_id, 1) < 0)
+	return true;
+}
+
+// @m: scaling mode (the clone outputs have their own geometry)
+bool
+create_modeset_req(int fd, CommonDRM &drm, unsigned w, unsigned h,
+				   enum ExynosDRM::scaling_mode m, const videoinfo &vi)
+{
+	auto req = drmMode::make_unique(drmModeAtomicAlloc());
+	if (!req)
 		return false;
 
-	prop_id = drm.pmap[make_pair(drm.crtc_id, crtc_prop_mode_id)];
-	if (drmModeAtomicAddProperty(req.get(), drm.crtc_id, prop_id, drm.mode_blob_id) < 0)
+	if (!add_output_props(req.get(), drm, drm.connector_id, drm.crtc_id,
+						  drm.mode_blob_id))
 		return false;
 
 	if (!add_overlay_props(req.get(), drm, w, h))
 		return false;
 
-	if (!add_video_props(req.get(), drm, w, h, vi))
+	if (!add_video_props(req.get(), drm, drm.plane_id[plane_video], drm.crtc_id,
+						 compute_geometry(m, w, h, vi)))
 		return false;
 
+	// The writeback connector stays attached to the CRTC. It only
+	// captures the flips that come with a writeback framebuffer.
+	if (drm.writeback_id != 0) {
+		const uint32_t prop_id = drm.pmap[std::make_pair(drm.writeback_id, connector_prop_crtc_id)];
+
+		if (drmModeAtomicAddProperty(req.get(), drm.writeback_id, prop_id, drm.crtc_id) < 0)
+			return false;
+	}
+
+	for (auto &i : drm.clones) {
+		if (!add_output_props(req.get(), drm, i.connector_id, i.crtc_id,
+							  i.mode_blob_id))
+			return false;
+
+		if (!add_video_props(req.get(), drm, i.plane_id, i.crtc_id,
+							 compute_geometry(m, i.w, i.h, vi)))
+			return false;
+	}
+
+	// The subtitle plane stays off until the first cue is due.
+	if (drm.subtitle_plane_id != 0) {
+		const uint32_t obj_id = drm.subtitle_plane_id;
+
+		if (drmModeAtomicAddProperty(req.get(), obj_id,
+				drm.pmap[std::make_pair(obj_id, plane_prop_fb_id)], 0) < 0 ||
+			drmModeAtomicAddProperty(req.get(), obj_id,
+				drm.pmap[std::make_pair(obj_id, plane_prop_crtc_id)], 0) < 0)
+			return false;
+	}
+
 	drm.modeset_request = req.release();
 
 	return true;
 }
 
+// Find a plane for a CRTC that supports a pixel format, and that
+// is not used by the main output or a clone. Returns zero if there
+// is no such plane.
+uint32_t
+find_free_plane(int fd, const CommonDRM &drm, const drmModePlaneRes &pres,
+				unsigned crtc_index, uint32_t format)
+{
+	using namespace std;
+
+	vector<uint32_t> used_planes{drm.plane_id[plane_primary], drm.plane_id[plane_video]};
+
+	for (auto &i : drm.clones)
+		used_planes.push_back(i.plane_id);
+
+	used_planes.insert(used_planes.end(), drm.mosaic_plane_ids.cbegin(),
+					   drm.mosaic_plane_ids.cend());
+
+	for (unsigned i = 0; i < pres.count_planes; ++i) {
+		const uint32_t plane_id = pres.planes[i];
+
+		if (find(used_planes.cbegin(), used_planes.cend(), plane_id) != used_planes.cend())
+			continue;
+
+		auto plane = drmMode::make_unique(drmModeGetPlane(fd, plane_id));
+		if (!plane || !(plane->possible_crtcs & (1 << crtc_index)))
+			continue;
+
+		for (unsigned j = 0; j < plane->count_formats; ++j) {
+			if (plane->formats[j] == format)
+				return plane_id;
+		}
+	}
+
+	return 0;
+}
+
+// Check if a writeback connector can write a pixel format.
+bool
+writeback_supports_format(int fd, uint32_t connector_id, uint32_t format)
+{
+	uint32_t prop_id;
+	uint64_t blob_id;
+
+	if (!get_propid_by_name(fd, connector_id, DRM_MODE_OBJECT_CONNECTOR,
+							"WRITEBACK_PIXEL_FORMATS", prop_id))
+		return false;
+
+	if (!get_propval_by_id(fd, connector_id, DRM_MODE_OBJECT_CONNECTOR,
+						   prop_id, blob_id))
+		return false;
+
+	drmModePropertyBlobRes *blob = drmModeGetPropertyBlob(fd, blob_id);
+	if (!blob)
+		return false;
+
+	const uint32_t *formats = static_cast<const uint32_t*>(blob->data);
+	bool found = false;
+
+	for (unsigned i = 0; i < blob->length / sizeof(uint32_t) && !found; ++i)
+		found = (formats[i] == format);
+
+	drmModeFreePropertyBlob(blob);
+
+	return found;
+}
+
+// Check the state of a fence, and get the time when it has signalled
+// (monotonic, in microseconds). Returns 1 if the fence has signalled,
+// zero if it is still pending, and -1 if an error occurs.
+int
+fence_status(int fence, uint64_t &timestamp)
+{
+	struct sync_fence_info info;
+	struct sync_file_info file_info;
+
+	zerostruct(&info);
+	zerostruct(&file_info);
+
+	file_info.num_fences = 1;
+	file_info.sync_fence_info = uint64_t(uintptr_t(&info));
+
+	if (ioctl(fence, SYNC_IOC_FILE_INFO, &file_info) < 0)
+		return -1;
+
+	if (info.status < 0)
+		return -1;
+
+	if (info.status == 0)
+		return 0;
+
+	timestamp = info.timestamp_ns / 1000;
+
+	return 1;
+}
+
+// FNV-1a hash of the visible pixels of a XRGB8888 buffer. The X byte
+// is undefined, hence it is left out.
+uint32_t
+checksum_xrgb(const uint8_t *data, unsigned w, unsigned h, unsigned pitch)
+{
+	uint32_t hash = 2166136261u;
+
+	for (unsigned y = 0; y < h; ++y) {
+		const uint32_t *line = reinterpret_cast<const uint32_t*>(data + y * pitch);
+
+		for (unsigned x = 0; x < w; ++x)
+			hash = (hash ^ (line[x] & 0x00ffffff)) * 16777619u;
+	}
+
+	return hash;
+}
+
 bool validate_videoinfo(const videoinfo &vi)
 {
 	if (vi.w == 0 || vi.h == 0)
@@ -495,6 +858,79 @@ bool validate_videoinfo(const videoinfo &vi)
 	return true;
 }
 
+// Map the V4L2 pixel format of the decoder to the DRM pixel format.
+// Returns false if the format is unknown.
+//
+// @tiling: receives if the frames use tiling layout
+bool
+get_drm_format(uint32_t v4l2_fmt, uint32_t &drm_fmt, bool &tiling)
+{
+	switch (v4l2_fmt) {
+	case V4L2_PIX_FMT_NV12:
+		drm_fmt = DRM_FORMAT_NV12;
+		tiling = false;
+		return true;
+
+	case V4L2_PIX_FMT_NV21:
+		drm_fmt = DRM_FORMAT_NV21;
+		tiling = false;
+		return true;
+
+	case V4L2_PIX_FMT_NV12MT:
+		drm_fmt = DRM_FORMAT_NV12;
+		tiling = true;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Placement of a plane from its source and screen rectangle.
+video_geometry
+to_geometry(const M2MScaler::rect &src, const M2MScaler::rect &dst)
+{
+	return video_geometry{src.x, src.y, src.w, src.h, dst.x, dst.y, dst.w, dst.h};
+}
+
+bool
+add_plane_fb(drmModeAtomicReq *req, const CommonDRM &drm, uint32_t plane_id,
+			 uint32_t fb_id)
+{
+	const uint32_t prop_id = drm.pmap.at(std::make_pair(plane_id, plane_prop_fb_id));
+
+	return (drmModeAtomicAddProperty(req, plane_id, prop_id, fb_id) >= 0);
+}
+
+// Turn a plane off, by detaching it from its framebuffer and CRTC.
+bool
+disable_plane(drmModeAtomicReq *req, const CommonDRM &drm, uint32_t plane_id)
+{
+	const uint32_t prop_id = drm.pmap.at(std::make_pair(plane_id, plane_prop_crtc_id));
+
+	if (!add_plane_fb(req, drm, plane_id, 0))
+		return false;
+
+	return (drmModeAtomicAddProperty(req, plane_id, prop_id, 0) >= 0);
+}
+
+// Enable the main output with the overlay, which every commit of the
+// mosaic with a modeset starts with.
+//
+// @overlay_fb: framebuffer ID of the overlay
+bool
+add_mosaic_output(drmModeAtomicReq *req, CommonDRM &drm, unsigned w, unsigned h,
+				  uint32_t overlay_fb)
+{
+	if (!add_output_props(req, drm, drm.connector_id, drm.crtc_id, drm.mode_blob_id))
+		return false;
+
+	if (!add_overlay_props(req, drm, w, h))
+		return false;
+
+	return add_plane_fb(req, drm, drm.plane_id[plane_primary], overlay_fb);
+}
+
 }; // anonymous namespace
 
 
@@ -505,8 +941,14 @@ FlipHandler::FlipHandler(int fd)
 
 	fds.fd = fd;
 	fds.events = POLLIN;
-	evctx.version = DRM_EVENT_CONTEXT_VERSION;
-	evctx.page_flip_handler = page_flip_handler;
+	// Version 3 reports the CRTC of each flip event.
+	evctx.version = 3;
+	evctx.page_flip_handler2 = page_flip_handler;
+}
+
+void FlipHandler::set_handler(handler h)
+{
+	evctx.page_flip_handler2 = h;
 }
 
 void FlipHandler::wait()
@@ -525,6 +967,17 @@ void FlipHandler::wait()
 		drmHandleEvent(fds.fd, &evctx);
 }
 
+void FlipHandler::dispatch()
+{
+	fds.revents = 0;
+
+	if (poll(&fds, 1, 0) <= 0)
+		return;
+
+	if (fds.revents & POLLIN)
+		drmHandleEvent(fds.fd, &evctx);
+}
+
 ExynosBuffer::ExynosBuffer(ExynosDRM *r) : bo(nullptr), root(r)
 {
 	// Nothing here.
@@ -547,9 +1000,7 @@ bool ExynosBuffer::alloc(unsigned size)
 	if (bo)
 		return false;
 
-	const unsigned bo_flags = 0;
-
-	bo = exynos_bo_create(root->device, size, bo_flags);
+	bo = root->backend->create_bo(size);
 	if (!bo)
 		return false;
 
@@ -558,7 +1009,9 @@ bool ExynosBuffer::alloc(unsigned size)
 
 void ExynosBuffer::free()
 {
-	exynos_bo_destroy(bo);
+	if (bo)
+		root->backend->destroy_bo(bo);
+
 	bo = nullptr;
 }
 
@@ -567,7 +1020,7 @@ void* ExynosBuffer::mmap()
 	void *ptr = nullptr;
 
 	if (bo)
-		ptr = exynos_bo_map(bo);
+		ptr = root->backend->map_bo(bo);
 
 	return ptr;
 }
@@ -597,9 +1050,10 @@ unsigned ExynosBuffer::get_size() const
 }
 
 
-ExynosPage::ExynosPage(ExynosDRM *r) : root(r), flags(0)
+ExynosPage::ExynosPage(ExynosDRM *r) : bo(nullptr), root(r), decode_time(0),
+	issue_time(0), index(0), state(state_free), flags(0)
 {
-	// Nothing here
+	// Nothing here.
 }
 
 ExynosPage::~ExynosPage()
@@ -615,99 +1069,85 @@ ExynosPage::ExynosPage(ExynosPage &&p) noexcept
 
 	atomic_request = p.atomic_request;
 
-	buf_id[plane_primary] = p.buf_id[plane_primary];
-	buf_id[plane_video] = p.buf_id[plane_video];
+	buf_id = p.buf_id;
+	bo = p.bo;
 
-	bo[plane_primary] = p.bo[plane_primary];
-	bo[plane_video] = p.bo[plane_video];
+	decode_time = p.decode_time;
+	issue_time = p.issue_time;
+	index = p.index;
 
-	renderer = p.renderer;
+	state = p.state;
 
 	flags = p.flags;
 	p.flags = 0;
 }
 
-bool ExynosPage::alloc_overlay()
+bool ExynosPage::alloc(unsigned size)
 {
-	const unsigned sz = overlay_width * overlay_height * sizeof(uint32_t);
-	const unsigned bo_flags = 0;
-
-	using namespace std;
+	static const std::string msg_prefix("ExynosPage::alloc(): ");
 
-	auto b = drmMode::make_unique(exynos_bo_create(root->device, sz, bo_flags));
-	if (!b)
+	if (flags & allocated)
 		return false;
 
-	try {
-		renderer = new CairoText(overlay_width, overlay_height);
-		if (!renderer)
-			throw exception();
-
-		if (renderer->get_size() != sz)
-			throw exception();
-
-		if (!renderer->init(static_cast<uint8_t*>(exynos_bo_map(b.get()))))
-			throw exception();
-	}
-	catch (exception &e) {
-		delete renderer;
+	// We don't access the video BO through userspace, hence don't map it.
+	bo = root->pool.get(size);
+	if (!bo) {
+		std::cerr << msg_prefix << "failed to allocate buffer for video.\n";
 		return false;
 	}
 
-	renderer->clear();
-	bo[plane_primary] = b.release();
+	flags |= allocated;
 
 	return true;
 }
 
-bool ExynosPage::alloc_video(unsigned size)
+void ExynosPage::free()
 {
-	// We don't access the video BO through userspace, hence don't map it.
-	const unsigned bo_flags = 0;
+	if (!(flags & allocated))
+		return;
 
-	bo[plane_video] = exynos_bo_create(root->device, size, bo_flags);
-	if (!bo[plane_video])
-		return false;
+	if (flags & added)
+		return;
 
-	return true;
-}
+	root->pool.put(bo);
+	bo = nullptr;
 
-bool ExynosPage::add_overlay()
+	flags &= ~allocated;
+}
+
+bool ExynosPage::add(const fbinfo &fbi)
 {
-	uint32_t handles[4] = {bo[plane_primary]->handle, 0, 0, 0};
-	uint32_t pitches[4] = {overlay_width * sizeof(uint32_t), 0, 0, 0};
-	uint32_t offsets[4] = {0, 0, 0, 0};
-	uint32_t fb_flags = 0;
+	static const std::string msg_prefix("ExynosPage::add(): ");
 
-	if (drmModeAddFB2(root->fd, overlay_width, overlay_height, DRM_FORMAT_ARGB8888,
-					  handles, pitches, offsets, &buf_id[plane_primary], fb_flags))
+	if (flags & added)
 		return false;
 
-	return true;
-}
-
-bool ExynosPage::add_video(const fbinfo &fbi)
-{
-	unsigned pitch[2];
+	if (!(flags & allocated))
+		return false;
 
 	switch (fbi.pixel_format) {
 	case DRM_FORMAT_NV12:
-		pitch[0] = fbi.w * sizeof(uint8_t);
-		pitch[1] = fbi.w * sizeof(uint8_t);
-		break;
-
 	case DRM_FORMAT_NV21:
-		pitch[0] = fbi.w * sizeof(uint8_t);
-		pitch[1] = fbi.w * sizeof(uint8_t);
 		break;
 
 	default:
+		std::cerr << msg_prefix << "unsupported pixel format.\n";
 		return false;
 	}
 
-	uint32_t handles[4] = {bo[plane_video]->handle, bo[plane_video]->handle, 0, 0};
-	uint32_t pitches[4] = {pitch[0], pitch[1], 0, 0};
-	uint32_t offsets[4] = {0, pitch[0] * fbi.h, 0, 0};
+	// The chroma plane has half the height, and has to fit into the BO.
+	if (fbi.chroma_offset < fbi.pitch * fbi.h ||
+		fbi.chroma_offset + fbi.pitch * (fbi.h / 2) > bo->size) {
+		std::cerr << msg_prefix << "invalid plane layout.\n";
+		return false;
+	}
+
+	// Both planes are in the same BO. The decoder places the chroma
+	// plane after the (aligned) luma plane, not directly after the
+	// last line of luma.
+	uint32_t handles[4] = {bo->handle, bo->handle, 0, 0};
+	uint32_t pitches[4] = {fbi.pitch, fbi.pitch, 0, 0};
+	uint32_t offsets[4] = {0, fbi.chroma_offset, 0, 0};
 	uint64_t modifiers[4] = {0};
 	uint32_t fb_flags = 0;
 
@@ -717,70 +1157,8 @@ bool ExynosPage::add_video(const fbinfo &fbi)
 	}
 
 	if (drmModeAddFB2WithModifiers(root->fd, fbi.w, fbi.h, fbi.pixel_format, handles, pitches,
-								   offsets, modifiers, &buf_id[plane_video], fb_flags))
-		return false;
-
-	return true;
-}
-
-bool ExynosPage::alloc(unsigned size)
-{
-	static const std::string msg_prefix("ExynosPage::alloc(): ");
-
-	if (flags & allocated)
-		return false;
-
-	using namespace std;
-
-	if (!alloc_overlay()) {
-		cerr << msg_prefix << "failed to allocate buffer for overlay.\n";
-		return false;
-	}
-
-	if (!alloc_video(size)) {
-		cerr << msg_prefix << "failed to allocate buffer for video.\n";
-		return false;
-	}
-
-	flags |= allocated;
-
-	return true;
-}
-
-void ExynosPage::free()
-{
-	if (!(flags & allocated))
-		return;
-
-	if (flags & added)
-		return;
-
-	delete renderer;
-	exynos_bo_destroy(bo[plane_primary]);
-	exynos_bo_destroy(bo[plane_video]);
-
-	flags &= ~allocated;
-}
-
-bool ExynosPage::add(const fbinfo &fbi)
-{
-	static const std::string msg_prefix("ExynosPage::add(): ");
-
-	if (flags & added)
-		return false;
-
-	if (!(flags & allocated))
-		return false;
-
-	using namespace std;
-
-	if (!add_overlay()) {
-		cerr << msg_prefix << "failed to add overlay buffer as FB.\n";
-		return false;
-	}
-
-	if (!add_video(fbi)) {
-		cerr << msg_prefix << "failed to add video buffer as FB.\n";
+								   offsets, modifiers, &buf_id, fb_flags)) {
+		std::cerr << msg_prefix << "failed to add video buffer as FB.\n";
 		return false;
 	}
 
@@ -797,8 +1175,7 @@ void ExynosPage::remove()
 	if (flags & req_created)
 		return;
 
-	drmModeRmFB(buf_id[plane_primary], bo[plane_primary]->handle);
-	drmModeRmFB(buf_id[plane_video], bo[plane_video]->handle);
+	drmModeRmFB(root->fd, buf_id);
 
 	flags &= ~added;
 }
@@ -819,11 +1196,17 @@ bool ExynosPage::create_request()
 
 	const CommonDRM &drm = *root->drm;
 
-	for (auto &i : {plane_primary, plane_video}) {
-		const uint32_t obj_id = drm.plane_id[i];
+	// Only the video planes change with the page. An update of the
+	// overlay is added by the flip itself.
+	vector<uint32_t> planes{drm.plane_id[plane_video]};
+
+	for (auto &i : drm.clones)
+		planes.push_back(i.plane_id);
+
+	for (auto &obj_id : planes) {
 		const uint32_t prop_id = drm.pmap.at(make_pair(obj_id, plane_prop_fb_id));
 
-		if (drmModeAtomicAddProperty(req.get(), obj_id, prop_id, buf_id[i]) < 0)
+		if (drmModeAtomicAddProperty(req.get(), obj_id, prop_id, buf_id) < 0)
 			return false;
 	}
 
@@ -844,15 +1227,13 @@ void ExynosPage::destroy_request()
 	flags &= ~req_created;
 }
 
-bool ExynosPage::initial_modeset() const
+bool ExynosPage::initial_modeset(uint32_t overlay_fb, bool test_only) const
 {
 	if (!(flags & req_created))
 		return false;
 
 	using namespace std;
 
-	renderer->render("Hello world!"); // TODO
-
 	auto req = drmMode::make_unique(drmModeAtomicDuplicate(root->drm->modeset_request));
 	if (!req)
 		return false;
@@ -860,7 +1241,19 @@ bool ExynosPage::initial_modeset() const
 	if (drmModeAtomicMerge(req.get(), atomic_request))
 		return false;
 
-	if (drmModeAtomicCommit(root->fd, req.get(), DRM_MODE_ATOMIC_ALLOW_MODESET, nullptr))
+	const CommonDRM &drm = *root->drm;
+	const uint32_t obj_id = drm.plane_id[plane_primary];
+	const uint32_t prop_id = drm.pmap.at(make_pair(obj_id, plane_prop_fb_id));
+
+	if (drmModeAtomicAddProperty(req.get(), obj_id, prop_id, overlay_fb) < 0)
+		return false;
+
+	uint32_t commit_flags = DRM_MODE_ATOMIC_ALLOW_MODESET;
+
+	if (test_only)
+		commit_flags |= DRM_MODE_ATOMIC_TEST_ONLY;
+
+	if (drmModeAtomicCommit(root->fd, req.get(), commit_flags, nullptr))
 		return false;
 
 	return true;
@@ -868,13 +1261,13 @@ bool ExynosPage::initial_modeset() const
 
 int ExynosPage::get_prime_fd()
 {
-	if (!(flags & added))
+	if (!(flags & allocated))
 		return -1;
 
 	int prime_fd, ret;
 
 	// MFC writes the decoded data into this buffer, hence export it as r/w.
-	ret = drmPrimeHandleToFD(root->fd, bo[plane_video]->handle,
+	ret = drmPrimeHandleToFD(root->fd, bo->handle,
 							 DRM_RDWR | DRM_CLOEXEC, &prime_fd);
 	if (ret < 0)
 		return -1;
@@ -882,527 +1275,3458 @@ int ExynosPage::get_prime_fd()
 	return prime_fd;
 }
 
-void ExynosPage::handle_flip()
+void* ExynosPage::mmap()
 {
-	static const std::string msg_prefix("ExynosPage::handle_flip(): ");
-
-	std::cout << msg_prefix << "page = " << this << '\n';
-
-	if (root->cur_page)
-		root->cur_page->flags &= ~page_used;
+	if (!(flags & allocated))
+		return nullptr;
 
-	root->flags &= ~ExynosDRM::pageflip_pending;
-	root->cur_page = this;
+	return root->backend->map_bo(bo);
 }
 
-
-bool ExynosDRM::check_connector_type(enum connector_type ct, uint32_t drm_ct) const
+ExynosPage::page_state ExynosPage::get_state() const
 {
-	enum connector_type t;
-
-	switch (drm_ct) {
-	case DRM_MODE_CONNECTOR_HDMIA:
-	case DRM_MODE_CONNECTOR_HDMIB:
-		t = connector_hdmi;
-		break;
-
-	case DRM_MODE_CONNECTOR_VGA:
-		t = connector_vga;
-		break;
+	return state;
+}
 
-	default:
-		t = connector_other;
-		break;
-	}
+void ExynosPage::mark_queued()
+{
+	state = state_queued;
+}
 
-	return (t == ct);
+void ExynosPage::mark_decoded(uint64_t timestamp)
+{
+	decode_time = timestamp;
+	state = state_decoded;
 }
 
-ExynosDRM::ExynosDRM() : flags(0)
+void ExynosPage::set_index(unsigned i)
 {
-	// Nothing here.
+	index = i;
 }
 
-ExynosDRM::~ExynosDRM()
+unsigned ExynosPage::get_index() const
 {
-	free_pages();
-	free_buffers();
-	deinit();
-	close();
+	return index;
 }
 
-bool ExynosDRM::open(enum connector_type ct)
+void ExynosPage::handle_flip(unsigned frame, uint64_t timestamp, uint32_t crtc_id)
 {
-	static const std::string msg_prefix("ExynosDRM::open(): ");
+	static const std::string msg_prefix("ExynosPage::handle_flip(): ");
 
-	if (flags & opened)
-		return false;
+	ExynosDRM &drm = *root;
+	const uint64_t period = drm.refresh_period;
 
-	using namespace std;
+	// The out-fence signals slightly before the flip event is queued, so
+	// handle_fence() might have completed the flip already. The late
+	// event then belongs to an earlier commit, possibly of this page,
+	// and must not count towards the pending one.
+	if (state != state_pending || this != drm.pending_page ||
+		(issue_time != 0 && timestamp < issue_time))
+		return;
 
-	string device_name;
-	get_device_name(device_name);
+	if (drm.pending_crtcs > 0)
+		drm.pending_crtcs--;
 
-	if (device_name.empty()) {
-		cerr << msg_prefix << "no compatible DRM device found.\n";
-		return false;
+	// The flips of all CRTCs were issued with the same commit, so
+	// they should complete on the same vblank.
+	if (drm.first_flip_time == 0) {
+		drm.first_flip_time = timestamp;
+	} else {
+		drm.clone_skew.record(timestamp > drm.first_flip_time ?
+			timestamp - drm.first_flip_time : drm.first_flip_time - timestamp);
 	}
 
-	fd = ::open(device_name.c_str(), O_RDWR, 0);
-	if (fd < 0) {
-		cerr << msg_prefix << "failed to open DRM device.\n";
-		return false;
+	// The statistics only cover the main output.
+	if (crtc_id != drm.drm->crtc_id) {
+		if (drm.pending_crtcs == 0 && state == state_pending)
+			drm.complete_flip(this);
+
+		return;
 	}
 
-	try {
-		drm = nullptr;
+	std::cout << msg_prefix << "page = " << this << '\n';
 
-		// Request atomic DRM support. This also enables universal planes.
-		if (drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1) < 0)
-			throw runtime_error("failed to enable atomic support");
+	if (decode_time != 0 && timestamp >= decode_time)
+		drm.flip_latency.record(timestamp - decode_time);
 
-		drm = new CommonDRM;
-		if (!drm)
-			throw runtime_error("failed to allocate DRM");
+	if (issue_time != 0 && timestamp >= issue_time)
+		drm.scanout_latency.record(timestamp - issue_time);
 
-		auto resources = drmMode::make_unique(drmModeGetResources(fd));
-		if (!resources)
-			throw runtime_error("failed to get DRM resources");
+	// Vblanks since the previous flip, and the ones the flip has missed.
+	unsigned vblanks = 0, missed = 0;
 
-		auto plane_resources = drmMode::make_unique(drmModeGetPlaneResources(fd));
-		if (!plane_resources)
-			throw runtime_error("failed to get DRM plane resources");
+	if (drm.last_flip_time != 0) {
+		vblanks = frame - drm.last_frame;
 
-		auto connector = drmMode::make_unique<drmModeConnector>(nullptr);
-		for (unsigned i = 0; i < unsigned(resources->count_connectors); ++i) {
-			connector.reset(drmModeGetConnector(fd, resources->connectors[i]));
-			if (!connector)
-				continue;
+		// The previous frame was shown again at each vblank in between.
+		// With frame pacing, some of these repeats are intended.
+		if (vblanks > 1)
+			drm.vblanks_repeated += vblanks - 1;
 
-			if (check_connector_type(ct, connector->connector_type) &&
-					connector->connection == DRM_MODE_CONNECTED &&
-					connector->count_modes > 0) {
-				drm->connector_id = connector->connector_id;
-				break;
-			}
+		if (vblanks != 0 && timestamp > drm.last_flip_time)
+			drm.refresh_interval.record((timestamp - drm.last_flip_time) / vblanks);
 
-			connector.reset(nullptr);
+		// The flip should land on the first vblank after it was issued.
+		if (period != 0 && issue_time != 0) {
+			const uint64_t since = (issue_time > drm.last_flip_time) ?
+				issue_time - drm.last_flip_time : 0;
+			const uint64_t target = std::max<uint64_t>(1, (since + period - 1) / period);
+
+			if (vblanks > target)
+				missed = vblanks - target;
 		}
 
-		if (!connector)
-			throw runtime_error("no currently active connector found");
+		drm.vblanks_missed += missed;
+	}
 
-		auto encoder = drmMode::make_unique<drmModeEncoder>(nullptr);
-		for (unsigned i = 0; i < unsigned(connector->count_encoders); ++i) {
-			encoder.reset(drmModeGetEncoder(fd, connector->encoders[i]));
-			if (!encoder)
-				continue;
+	// The flip should complete on the first vblank after it was issued.
+	// Allow for some slack before we consider the frame as late.
+	if (period != 0 && issue_time != 0 &&
+		timestamp > issue_time + period + period / 4)
+		drm.frames_late++;
 
-			// Find a CRTC that is compatible with the encoder.
-			unsigned j;
-			for (j = 0; j < unsigned(resources->count_crtcs); ++j) {
-				if (encoder->possible_crtcs & (1 << j))
-					break;
-			}
+	if (drm.last_flip_time != 0 && timestamp > drm.last_flip_time) {
+		const uint64_t interval = timestamp - drm.last_flip_time;
 
-			// Stop when a suitable CRTC was found.
-			if (j != unsigned(resources->count_crtcs)) {
-				// Store index and ID of the CRTC.
-				// We need the index again later, when we validate the planes.
-				drm->crtc_index = j;
-				drm->crtc_id = resources->crtcs[j];
+		drm.flip_interval.record(interval);
 
-				break;
-			}
+		if (period != 0) {
+			const uint64_t nearest = ((interval + period / 2) / period) * period;
 
-			encoder.reset(nullptr);
+			drm.vblank_jitter.record(interval > nearest ?
+				interval - nearest : nearest - interval);
 		}
-
-		if (!encoder)
-			throw runtime_error("no compatible encoder found");
-
-		if (!setup_properties(fd, *drm, *resources, *plane_resources))
-			throw runtime_error("failed to setup properties");
 	}
-	catch (exception &e) {
-		delete drm;
-		::close(fd);
-
-		cerr << msg_prefix << e.what() << ".\n";
 
-		return false;
+	if (drm.flip_log.is_open()) {
+		drm.flip_log << drm.frames_presented << ',' << frame << ',' << timestamp << ','
+					 << issue_time << ',' << decode_time << ',' << vblanks << ','
+					 << missed << '\n';
 	}
 
-	cout << msg_prefix << "using DRM device \"" << device_name << "\" with:\n"
-		 << "\tconnector ID = " << drm->connector_id << '\n'
-		 << "\tcrtc ID = " << drm->crtc_id << '\n';
-
-	flags |= opened;
+	drm.last_flip_time = timestamp;
+	drm.last_frame = frame;
+	drm.frames_presented++;
 
-	return true;
+	// The out-fence might have released the pages already. Otherwise
+	// the page is on the screen, once all outputs have flipped to it.
+	if (drm.pending_crtcs == 0 && state == state_pending)
+		drm.complete_flip(this);
 }
 
-void ExynosDRM::close()
-{
-	if (!(flags & opened))
-		return;
-
-	if (flags & initialized)
-		return;
 
-	delete drm;
-	::close(fd);
 
-	flags &= ~opened;
+ExynosOverlay::ExynosOverlay(ExynosDRM *r) : root(r), bo(nullptr), front(0), width(0),
+	height(0), damage_blob(0), flags(0)
+{
+	for (auto &i : buffers) {
+		i.offset = 0;
+		i.buf_id = 0;
+		i.renderer = nullptr;
+	}
 }
 
-bool ExynosDRM::init(unsigned w, unsigned h)
+ExynosOverlay::~ExynosOverlay()
 {
-	static const std::string msg_prefix("ExynosDRM::init(): ");
+	remove();
+	free();
+}
 
-	if (flags & initialized)
-		return false;
+bool ExynosOverlay::alloc(unsigned w, unsigned h)
+{
+	static const std::string msg_prefix("ExynosOverlay::alloc(): ");
 
-	if (!(flags & opened))
+	if (flags & allocated)
 		return false;
 
 	using namespace std;
 
-	auto connector = drmMode::make_unique(drmModeGetConnector(fd, drm->connector_id));
-	if (!connector) {
-		cerr << msg_prefix << "failed to get connector.\n";
+	width = w;
+	height = h;
+
+	// The glyphs are only rasterized once, with the first allocation.
+	if (atlas.get_cell_width() == 0 && !atlas.init("Liberation Mono", 20.0)) {
+		cerr << msg_prefix << "failed to setup glyphs for overlay.\n";
 		return false;
 	}
 
-	drmModeModeInfo *mode;
-	if (w != 0 && h != 0) {
-		mode = nullptr;
+	const unsigned size = GlyphText(width, height, atlas).get_size();
 
-		for (unsigned i = 0; i < unsigned(connector->count_modes); ++i) {
-			if (connector->modes[i].hdisplay == w &&
-				connector->modes[i].vdisplay == h) {
-				mode = &connector->modes[i];
-				break;
-			}
-		}
+	bo = root->pool.get(size * buffer_count);
+	uint8_t *map = static_cast<uint8_t*>(root->backend->map_bo(bo));
 
-		if (!mode) {
-			cerr << msg_prefix << "requested resolution (" << w << 'x'
-				 << h << ") not available.\n";
-			return false;
-		}
+	flags |= allocated;
 
-	} else {
-		// Select first mode, which is the native one.
-		mode = &connector->modes[0];
-	}
+	if (!map) {
+		cerr << msg_prefix << "failed to allocate buffer for overlay.\n";
+		free();
 
-	if (mode->hdisplay == 0 || mode->vdisplay == 0) {
-		cerr << msg_prefix << "failed to select sane resolution.\n";
 		return false;
 	}
 
-	fh = new FlipHandler(fd);
-	if (!fh) {
-		cerr << msg_prefix << "failed to allocate fliphandler.\n";
-		return false;
-	}
+	for (unsigned i = 0; i < buffer_count; ++i) {
+		buffer &b = buffers[i];
 
-	if (drmModeCreatePropertyBlob(fd, mode, sizeof(drmModeModeInfo), &drm->mode_blob_id)) {
-		cerr << msg_prefix << "failed to blobify mode info.\n";
-		delete fh;
-	}
+		b.offset = i * size;
+		b.renderer = new GlyphText(width, height, atlas);
 
-	width = mode->hdisplay;
-	height = mode->vdisplay;
-	cout << msg_prefix << "resolution = " << width << " x " << height << '\n';
+		if (!b.renderer->init(map + b.offset)) {
+			cerr << msg_prefix << "failed to setup renderer for overlay.\n";
+			free();
 
-	flags |= initialized;
+			return false;
+		}
+
+		b.renderer->clear();
+	}
+
+	front = 0;
 
 	return true;
 }
 
-void ExynosDRM::deinit()
+void ExynosOverlay::free()
 {
-	if (!(flags & initialized))
+	if (!(flags & allocated))
 		return;
 
-	if (flags & buffers_alloced)
+	if (flags & added)
 		return;
 
-	drmModeDestroyPropertyBlob(fd, drm->mode_blob_id);
-	delete fh;
+	for (auto &i : buffers) {
+		delete i.renderer;
 
-	flags &= ~initialized;
-}
+		i.renderer = nullptr;
+	}
 
-bool ExynosDRM::alloc_buffers(unsigned num_buffers, unsigned size, std::vector<ExynosBuffer> &buffers)
-{
-	static const std::string msg_prefix("ExynosDRM::alloc_buffers(): ");
+	root->pool.put(bo);
+	bo = nullptr;
 
-	if (flags & buffers_alloced)
-		return false;
+	text.clear();
+	front_text.clear();
+	back_text.clear();
 
-	if (!(flags & initialized))
-		return false;
+	flags &= ~allocated;
+}
 
-	using namespace std;
+bool ExynosOverlay::add()
+{
+	static const std::string msg_prefix("ExynosOverlay::add(): ");
 
-	if (num_buffers == 0) {
-		cerr << msg_prefix << "no buffers requested.\n";
+	if (flags & added)
 		return false;
-	}
 
-	if (size == 0) {
-		cerr << msg_prefix << "zero-sized buffers requested.\n";
+	if (!(flags & allocated))
 		return false;
+
+	const uint32_t fb_flags = 0;
+
+	for (unsigned i = 0; i < buffer_count; ++i) {
+		uint32_t handles[4] = {bo->handle, 0, 0, 0};
+		uint32_t pitches[4] = {buffers[i].renderer->get_size() / height, 0, 0, 0};
+		uint32_t offsets[4] = {buffers[i].offset, 0, 0, 0};
+
+		if (drmModeAddFB2(root->fd, width, height, DRM_FORMAT_ARGB8888, handles,
+						  pitches, offsets, &buffers[i].buf_id, fb_flags)) {
+			std::cerr << msg_prefix << "failed to add overlay buffer as FB.\n";
+
+			while (i-- > 0)
+				drmModeRmFB(root->fd, buffers[i].buf_id);
+
+			return false;
+		}
 	}
 
-	using namespace std;
+	flags |= added;
+
+	return true;
+}
+
+void ExynosOverlay::remove()
+{
+	if (!(flags & added))
+		return;
+
+	if (damage_blob != 0)
+		drmModeDestroyPropertyBlob(root->fd, damage_blob);
 
-	device = exynos_device_create(fd);
-	if (!device) {
-		cerr << msg_prefix << "failed to create device from fd.\n";
+	for (auto &i : buffers)
+		drmModeRmFB(root->fd, i.buf_id);
+
+	damage_blob = 0;
+
+	flags &= ~(added | update_ready | update_pending);
+}
+
+bool ExynosOverlay::update()
+{
+	static const std::string msg_prefix("ExynosOverlay::update(): ");
+
+	if (!(flags & added))
 		return false;
-	}
 
-	buffers.clear();
+	// The back buffer is in use, the text is rendered once the
+	// pending update has reached the screen.
+	if (flags & (update_ready | update_pending))
+		return true;
 
-	try {
-		for (unsigned i = 0; i < num_buffers; ++i) {
-			buffers.emplace_back(this);
+	if (text == front_text)
+		return true;
 
-			if (!buffers.back().alloc(size))
-				throw exception();
+	buffer &back = buffers[front ^ 1];
+
+	// The back buffer still holds the text from two updates ago. The
+	// renderer only redraws the characters that differ from it.
+	back.renderer->render(text);
+	back_text = text;
+
+	// Compared to the front buffer, only the characters that differ
+	// between the two texts have changed.
+	const text_rect area = back.renderer->diff(front_text, text);
+
+	if (root->drm->damage_prop != 0 && area.w != 0 && area.h != 0) {
+		struct drm_mode_rect clip;
+
+		clip.x1 = area.x;
+		clip.y1 = area.y;
+		clip.x2 = area.x + area.w;
+		clip.y2 = area.y + area.h;
+
+		if (drmModeCreatePropertyBlob(root->fd, &clip, sizeof(clip), &damage_blob)) {
+			std::cerr << msg_prefix << "failed to create damage blob.\n";
+			damage_blob = 0;
 		}
 	}
-	catch (exception &e) {
-		buffers.clear();
-		exynos_device_destroy(device);
 
-		cerr << msg_prefix << "allocation of mmap-capable buffers failed.\n";
+	flags |= update_ready;
+
+	return true;
+}
+
+bool ExynosOverlay::add_update(drmModeAtomicReq *req)
+{
+	if (!(flags & update_ready))
+		return true;
+
+	using namespace std;
+
+	const CommonDRM &drm = *root->drm;
+	const uint32_t obj_id = drm.plane_id[plane_primary];
+	const uint32_t prop_id = drm.pmap.at(make_pair(obj_id, plane_prop_fb_id));
 
+	if (drmModeAtomicAddProperty(req, obj_id, prop_id, buffers[front ^ 1].buf_id) < 0)
 		return false;
-	}
 
-	flags |= buffers_alloced;
+	// Without damage clips, the whole plane is considered as damaged.
+	if (damage_blob != 0 &&
+		drmModeAtomicAddProperty(req, obj_id, drm.damage_prop, damage_blob) < 0)
+		return false;
 
 	return true;
 }
 
-void ExynosDRM::free_buffers()
+void ExynosOverlay::handle_commit()
 {
-	if (!(flags & buffers_alloced))
+	if (!(flags & update_ready))
 		return;
 
-	if (flags & pages_alloced)
+	// The committed state holds its own reference to the blob.
+	if (damage_blob != 0) {
+		drmModeDestroyPropertyBlob(root->fd, damage_blob);
+		damage_blob = 0;
+	}
+
+	flags &= ~update_ready;
+	flags |= update_pending;
+}
+
+void ExynosOverlay::handle_flip()
+{
+	if (!(flags & update_pending))
 		return;
 
-	exynos_device_destroy(device);
+	front ^= 1;
+	front_text = back_text;
 
-	flags &= ~buffers_alloced;
+	flags &= ~update_pending;
+
+	// The text might have changed again in the meantime.
+	update();
 }
 
-bool ExynosDRM::alloc_pages(unsigned num_pages, const videoinfo &vi)
+uint32_t ExynosOverlay::get_front_id() const
 {
-	static const std::string msg_prefix("ExynosDRM::alloc_pages(): ");
+	return buffers[front].buf_id;
+}
 
-	if (flags & pages_alloced)
-		return false;
 
-	if (!(flags & buffers_alloced))
-		return false;
+ExynosWriteback::ExynosWriteback(ExynosDRM *r) : root(r), bo(nullptr), buf_id(0),
+	map(nullptr), width(0), height(0), pitch(0), decimation(1), flip_count(0),
+	capture_flip(0), next_flip(0), issue_time(0), fence(-1), fence_storage(-1),
+	last_checksum(0), captures(0), repeats(0), flags(0)
+{
+	// Nothing here.
+}
 
-	using namespace std;
+ExynosWriteback::~ExynosWriteback()
+{
+	remove();
+	free();
+}
 
-	if (!validate_videoinfo(vi)) {
-		cerr << msg_prefix << "invalid video info.\n";
+bool ExynosWriteback::alloc(unsigned w, unsigned h, unsigned n)
+{
+	static const std::string msg_prefix("ExynosWriteback::alloc(): ");
+
+	if (flags & allocated)
 		return false;
-	}
 
-	uint32_t drm_fmt;
-	bool tiling;
+	width = w;
+	height = h;
+	pitch = w * 4;
+	decimation = n;
 
-	switch (vi.pixel_format) {
-	case V4L2_PIX_FMT_NV12:
-		drm_fmt = DRM_FORMAT_NV12;
-		tiling = false;
-		break;
+	bo = root->pool.get(pitch * height);
+	if (!bo) {
+		std::cerr << msg_prefix << "failed to allocate buffer for writeback.\n";
+		return false;
+	}
 
-	case V4L2_PIX_FMT_NV21:
-		drm_fmt = DRM_FORMAT_NV21;
-		tiling = false;
-		break;
+	// The captures are read back with the CPU.
+	map = static_cast<const uint8_t*>(root->backend->map_bo(bo));
+	if (!map) {
+		std::cerr << msg_prefix << "failed to map buffer for writeback.\n";
 
-	case V4L2_PIX_FMT_NV12MT:
-		drm_fmt = DRM_FORMAT_NV12;
-		tiling = true;
-		break;
+		root->pool.put(bo);
+		bo = nullptr;
 
-	default:
-		cerr << msg_prefix << "unknown V4L2 pixel format.\n";
 		return false;
 	}
 
-	auto plane_resources = drmMode::make_unique(drmModeGetPlaneResources(fd));
-	if (!plane_resources) {
-		cerr << msg_prefix << "failed to get DRM plane resources.\n";
-		return false;
-	}
+	flip_count = 0;
+	next_flip = 0;
+	results.clear();
 
-	drm->plane_id[plane_primary] = 0;
-	drm->plane_id[plane_video] = 0;
+	flags |= allocated;
 
-	for (unsigned i = 0; i < plane_resources->count_planes; ++i) {
-		const uint32_t plane_id = plane_resources->planes[i];
-		drmModePlane *plane;
+	return true;
+}
 
-		plane = drmModeGetPlane(fd, plane_id);
+void ExynosWriteback::free()
+{
+	if (!(flags & allocated))
+		return;
 
-		if (!plane)
-			continue;
+	if (flags & added)
+		return;
 
-		// Make sure that the plane can be used with the selected CRTC.
-		if (plane->possible_crtcs & (1 << drm->crtc_index)) {
-			// Check that the plane supports the chosen pixel format.
-			for (unsigned j = 0; j < plane->count_formats; ++j) {
-				const uint32_t f = plane->formats[j];
+	root->pool.put(bo);
+	bo = nullptr;
+	map = nullptr;
 
-				if (f == drm_fmt && !drm->plane_id[plane_video]) {
-					drm->plane_id[plane_video] = plane->plane_id;
-					break;
-				} else if (f == DRM_FORMAT_ARGB8888 &&
-						   !drm->plane_id[plane_primary]) {
-					drm->plane_id[plane_primary] = plane->plane_id;
-					break;
-				}
-			}
-		}
+	results.clear();
 
-		drmModeFreePlane(plane);
-	}
+	flags &= ~allocated;
+}
 
-	if (!drm->plane_id[plane_primary]) {
-		cerr << msg_prefix << "no primary plane with support for ARGB32 found.\n";
+bool ExynosWriteback::add()
+{
+	static const std::string msg_prefix("ExynosWriteback::add(): ");
+
+	if (flags & added)
 		return false;
-	}
 
-	if (!drm->plane_id[plane_video]) {
-		cerr << msg_prefix << "no video plane found.\n";
+	if (!(flags & allocated))
+		return false;
+
+	uint32_t handles[4] = {bo->handle, 0, 0, 0};
+	uint32_t pitches[4] = {pitch, 0, 0, 0};
+	uint32_t offsets[4] = {0, 0, 0, 0};
+
+	if (drmModeAddFB2(root->fd, width, height, DRM_FORMAT_XRGB8888, handles,
+					  pitches, offsets, &buf_id, 0)) {
+		std::cerr << msg_prefix << "failed to add writeback buffer as FB.\n";
 		return false;
 	}
 
-	try {
-		drm->modeset_request = nullptr;
+	flags |= added;
 
-		if (!create_restore_req(fd, *drm))
-			throw runtime_error("failed to create restore atomic request");
+	return true;
+}
 
-		if (!create_modeset_req(fd, *drm, width, height, vi))
-			throw runtime_error("failed to create modeset atomic request");
+void ExynosWriteback::remove()
+{
+	if (!(flags & added))
+		return;
 
-		const ExynosPage::fbinfo fbi = { // TODO
-			vi.w, vi.h,
-			drm_fmt,
-			tiling
-		};
+	if (fence >= 0)
+		::close(fence);
 
-		const unsigned fb_size = vi.buffer_size[0] + vi.buffer_size[1]; // TODO
+	drmModeRmFB(root->fd, buf_id);
 
-		for (unsigned i = 0; i < num_pages; ++i) {
-			pages.emplace_back(this);
+	fence = -1;
 
-			if (!pages.back().alloc(fb_size))
-				throw runtime_error("failed to allocate BO for page");
+	flags &= ~(added | capture_queued | capture_pending);
+}
 
-			if (!pages.back().add(fbi))
-				throw runtime_error("failed to add BO as framebuffer");
+bool ExynosWriteback::add_capture(drmModeAtomicReq *req)
+{
+	// A capture that was queued for a failed commit is dropped.
+	flags &= ~capture_queued;
 
-			if (!pages.back().create_request())
-				throw runtime_error("failed to create atomic request for page");
-		}
+	if (!(flags & added))
+		return true;
 
-		cur_page = get_page();
-		if (!cur_page->initial_modeset())
-			throw runtime_error("initial atomic modeset failed");
-	}
-	catch (exception &e) {
-		pages.clear();
-		drmModeAtomicFree(drm->modeset_request);
-		drmModeAtomicFree(drm->restore_request);
+	collect();
 
-		cerr << msg_prefix << e.what() << ".\n";
+	// The buffer is still in use, the flip is not captured.
+	if ((flags & capture_pending) || flip_count < next_flip)
+		return true;
+
+	const CommonDRM &drm = *root->drm;
 
+	fence_storage = -1;
+
+	if (drmModeAtomicAddProperty(req, drm.writeback_id, drm.writeback_fb_prop, buf_id) < 0)
 		return false;
-	}
 
-	flags |= pages_alloced;
+	if (drmModeAtomicAddProperty(req, drm.writeback_id, drm.writeback_fence_prop,
+								 uint64_t(uintptr_t(&fence_storage))) < 0)
+		return false;
+
+	issue_time = monotonic_us();
+
+	flags |= capture_queued;
 
 	return true;
 }
 
-void ExynosDRM::free_pages()
+void ExynosWriteback::handle_commit()
 {
-	static const std::string msg_prefix("ExynosDRM::free_pages(): ");
+	if (flags & capture_queued) {
+		capture_flip = flip_count;
+		next_flip = flip_count + decimation;
+		fence = fence_storage;
 
-	if (!(flags & pages_alloced))
+		flags &= ~capture_queued;
+		flags |= capture_pending;
+	}
+
+	flip_count++;
+}
+
+void ExynosWriteback::collect()
+{
+	static const std::string msg_prefix("ExynosWriteback::collect(): ");
+
+	if (!(flags & capture_pending))
 		return;
 
-	// Restore the display state.
-	if (drmModeAtomicCommit(fd, drm->restore_request,
-							DRM_MODE_ATOMIC_ALLOW_MODESET, nullptr)) {
-		std::cerr << msg_prefix << "failed to restore the display.\n";
+	uint64_t signal_time = 0;
+	const int status = (fence >= 0) ? fence_status(fence, signal_time) : -1;
+
+	if (status == 0)
+		return;
+
+	if (fence >= 0)
+		::close(fence);
+
+	fence = -1;
+	flags &= ~capture_pending;
+
+	if (status < 0) {
+		std::cerr << msg_prefix << "writeback of flip " << capture_flip << " failed.\n";
+		return;
 	}
 
-	pages.clear();
+	const uint64_t t = monotonic_us();
+	const uint32_t checksum = checksum_xrgb(map, width, height, pitch);
 
-	drmModeAtomicFree(drm->modeset_request);
-	drmModeAtomicFree(drm->restore_request);
+	checksum_time.record(monotonic_us() - t);
 
-	flags &= ~pages_alloced;
+	const uint64_t latency = (signal_time > issue_time) ? signal_time - issue_time : 0;
+
+	capture_latency.record(latency);
+
+	if (captures > 0 && checksum == last_checksum)
+		repeats++;
+
+	captures++;
+	last_checksum = checksum;
+
+	if (results.size() == max_results)
+		results.pop_front();
+
+	results.push_back(capture{capture_flip, latency, checksum});
 }
 
-ExynosPage* ExynosDRM::get_page()
+void ExynosWriteback::add_stats(StatsReport &r) const
 {
-	for (auto& it : pages) {
-		if (it.flags & ExynosPage::page_used)
-			continue;
+	r.add("writeback_captures", captures.load());
+	r.add("writeback_repeats", repeats.load());
+	r.add("writeback_latency", capture_latency);
+	r.add("writeback_checksum_time", checksum_time);
+}
 
-		it.flags |= ExynosPage::page_used;
-		return &it;
+ExynosSubtitles::ExynosSubtitles(ExynosDRM *r) : root(r), track(nullptr), fps_num(1),
+	fps_den(1), bo(nullptr), width(0), height(0), screen_w(0), screen_h(0),
+	worker(nullptr), upcoming(0), shown(-1), queued(-1), stop(false), late_cue(-1),
+	cues_shown(0), cues_late(0), flags(0)
+{
+	for (auto &i : slots) {
+		i.offset = 0;
+		i.buf_id = 0;
+		i.renderer = nullptr;
+		i.cue = -1;
+		i.text_w = i.text_h = 0;
+		i.state = slot_free;
 	}
-
-	return nullptr;
 }
 
-void ExynosDRM::wait_for_flip()
+ExynosSubtitles::~ExynosSubtitles()
 {
-	fh->wait();
+	stop_worker();
+	remove();
+	free();
 }
 
-bool ExynosDRM::issue_flip(ExynosPage *p)
+bool ExynosSubtitles::alloc(const SubtitleTrack *t, unsigned num, unsigned den,
+							unsigned w, unsigned h)
 {
-	static const std::string msg_prefix("ExynosDRM::issue_flip(): ");
+	static const std::string msg_prefix("ExynosSubtitles::alloc(): ");
 
-	if (!p)
+	if (flags & allocated)
 		return false;
 
-	// We don't queue multiple page flips.
-	if (flags & pageflip_pending)
-		wait_for_flip();
+	using namespace std;
 
-	// Issue a page flip at the next vblank interval.
-	if (drmModeAtomicCommit(fd, p->atomic_request, DRM_MODE_PAGE_FLIP_EVENT, p)) {
-		std::cerr << msg_prefix << "failed to issue atomic page flip.\n";
+	track = t;
+	fps_num = num;
+	fps_den = den;
+	screen_w = w;
+	screen_h = h;
+
+	// The font size follows the height of the screen.
+	if (atlas.get_cell_width() == 0 && !atlas.init("Liberation Mono", max(16.0, h / 27.0))) {
+		cerr << msg_prefix << "failed to setup glyphs for subtitles.\n";
 		return false;
 	}
 
-	flags |= pageflip_pending;
-
-	// On startup no frame is displayed. We therefore
-	// wait for the initial flip to finish.
-	if (!cur_page)
-		wait_for_flip();
+	// The last line ends one pixel above the bottom (see GlyphText).
+	width = w;
+	height = max_lines * atlas.get_cell_height() + 1;
+
+	// The cues are placed a bit above the bottom of the screen.
+	if (height + h / 20 > h) {
+		cerr << msg_prefix << "screen too small for subtitles.\n";
+		return false;
+	}
+
+	const unsigned size = GlyphText(width, height, atlas).get_size();
+
+	bo = root->pool.get(size * slot_count);
+	uint8_t *map = static_cast<uint8_t*>(root->backend->map_bo(bo));
+
+	flags |= allocated;
+
+	if (!map) {
+		cerr << msg_prefix << "failed to allocate buffers for subtitles.\n";
+		free();
+
+		return false;
+	}
+
+	for (unsigned i = 0; i < slot_count; ++i) {
+		slot &s = slots[i];
+
+		s.offset = i * size;
+		s.renderer = new GlyphText(width, height, atlas);
+
+		if (!s.renderer->init(map + s.offset)) {
+			cerr << msg_prefix << "failed to setup renderer for subtitles.\n";
+			free();
+
+			return false;
+		}
+
+		// This also clears the buffer.
+		s.renderer->set_color(255, 255, 255);
+	}
+
+	upcoming = 0;
+	shown = queued = late_cue = -1;
+
+	return true;
+}
+
+void ExynosSubtitles::free()
+{
+	if (!(flags & allocated))
+		return;
+
+	if (flags & added)
+		return;
+
+	for (auto &i : slots) {
+		delete i.renderer;
+
+		i.renderer = nullptr;
+		i.cue = -1;
+		i.state = slot_free;
+	}
+
+	root->pool.put(bo);
+	bo = nullptr;
+
+	flags &= ~allocated;
+}
+
+bool ExynosSubtitles::add()
+{
+	static const std::string msg_prefix("ExynosSubtitles::add(): ");
+
+	if (flags & added)
+		return false;
+
+	if (!(flags & allocated))
+		return false;
+
+	const uint32_t fb_flags = 0;
+
+	for (unsigned i = 0; i < slot_count; ++i) {
+		uint32_t handles[4] = {bo->handle, 0, 0, 0};
+		uint32_t pitches[4] = {width * 4, 0, 0, 0};
+		uint32_t offsets[4] = {slots[i].offset, 0, 0, 0};
+
+		if (drmModeAddFB2(root->fd, width, height, DRM_FORMAT_ARGB8888, handles,
+						  pitches, offsets, &slots[i].buf_id, fb_flags)) {
+			std::cerr << msg_prefix << "failed to add subtitle buffer as FB.\n";
+
+			while (i-- > 0)
+				drmModeRmFB(root->fd, slots[i].buf_id);
+
+			return false;
+		}
+	}
+
+	flags |= added;
+
+	return true;
+}
+
+void ExynosSubtitles::remove()
+{
+	if (!(flags & added))
+		return;
+
+	// The worker might still render into the buffers.
+	stop_worker();
+
+	for (auto &i : slots)
+		drmModeRmFB(root->fd, i.buf_id);
+
+	shown = queued = -1;
+
+	flags &= ~(added | update_queued | update_pending);
+}
+
+void ExynosSubtitles::start()
+{
+	if (!(flags & added) || (flags & started))
+		return;
+
+	stop = false;
+	worker = new std::thread(&ExynosSubtitles::worker_thread, this);
+
+	flags |= started;
+}
+
+void ExynosSubtitles::stop_worker()
+{
+	if (!(flags & started))
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stop = true;
+	}
+
+	cond.notify_all();
+
+	worker->join();
+	delete worker;
+	worker = nullptr;
+
+	flags &= ~started;
+}
+
+void ExynosSubtitles::worker_thread()
+{
+	using namespace std;
+
+	const vector<SubtitleTrack::cue> &cues = track->get_cues();
+	const unsigned max_columns = width / atlas.get_cell_width();
+
+	unique_lock<mutex> lock(mtx);
+
+	while (!stop) {
+		int c;
+		unsigned index;
+
+		if (!next_job(c, index)) {
+			cond.wait(lock);
+			continue;
+		}
+
+		slot &s = slots[index];
+
+		s.state = slot_rendering;
+		s.cue = c;
+
+		// The presentation thread ignores the slot while it is rendered.
+		lock.unlock();
+
+		const uint64_t t = monotonic_us();
+
+		// Cut off the lines and columns that don't fit.
+		string text;
+		unsigned lines = 0, columns = 0;
+		size_t pos = 0;
+
+		while (pos <= cues[c].text.size() && lines < max_lines) {
+			size_t end = cues[c].text.find('\n', pos);
+			if (end == string::npos)
+				end = cues[c].text.size();
+
+			const string line = cues[c].text.substr(pos, min<size_t>(end - pos, max_columns));
+
+			if (lines++ != 0)
+				text += '\n';
+
+			text += line;
+			columns = max<unsigned>(columns, line.size());
+			pos = end + 1;
+		}
+
+		s.renderer->render(text);
+		render_time.record(monotonic_us() - t);
+
+		lock.lock();
+
+		s.text_w = columns * atlas.get_cell_width();
+		s.text_h = lines * atlas.get_cell_height();
+		s.state = slot_ready;
+	}
+}
+
+bool ExynosSubtitles::next_job(int &cue, unsigned &s) const
+{
+	const unsigned num_cues = track->get_cues().size();
+
+	// One slot is left for the cue on the screen.
+	const unsigned window = slot_count - 1;
+
+	for (unsigned c = upcoming; c < num_cues && c < upcoming + window; ++c) {
+		bool cached = false;
+
+		for (auto &i : slots)
+			cached = cached || (i.state != slot_free && i.cue == int(c));
+
+		if (cached)
+			continue;
+
+		// Reuse a slot with a cue that has ended, or that is too far
+		// ahead, unless it is on the screen or about to be.
+		for (unsigned i = 0; i < slot_count; ++i) {
+			const slot &sl = slots[i];
+
+			if (int(i) == shown || int(i) == queued || sl.state == slot_rendering)
+				continue;
+
+			if (sl.state == slot_free || sl.cue < int(upcoming) ||
+				sl.cue >= int(upcoming + window)) {
+				cue = c;
+				s = i;
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	return false;
+}
+
+bool ExynosSubtitles::add_update(drmModeAtomicReq *req, unsigned index)
+{
+	if (!(flags & added))
+		return true;
+
+	using namespace std;
+
+	// Time of the page in the stream.
+	const uint64_t t = uint64_t(index) * 1000000 * fps_den / fps_num;
+	const int c = track->find(t);
+	const unsigned next = track->next(t);
+
+	int target = -1;
+	unsigned text_w = 0, text_h = 0;
+
+	{
+		lock_guard<mutex> lock(mtx);
+
+		if (next != upcoming) {
+			upcoming = next;
+			cond.notify_one();
+		}
+
+		for (unsigned i = 0; i < slot_count && c >= 0; ++i) {
+			if (slots[i].state == slot_ready && slots[i].cue == c) {
+				target = i;
+				text_w = slots[i].text_w;
+				text_h = slots[i].text_h;
+			}
+		}
+
+		// The cue is not rendered yet, so the plane is turned off
+		// instead of showing the previous cue.
+		if (c >= 0 && target < 0 && late_cue != c) {
+			late_cue = c;
+			cues_late++;
+		}
+
+		if (target == shown)
+			return true;
+
+		queued = target;
+	}
+
+	const CommonDRM &drm = *root->drm;
+	const uint32_t obj_id = drm.subtitle_plane_id;
+
+	// The plane shows the text at the bottom left of the buffer,
+	// centered above the bottom of the screen.
+	const struct prop_assign assign[] = {
+		{ plane_prop_fb_id, (target >= 0) ? slots[target].buf_id : 0 },
+		{ plane_prop_crtc_id, (target >= 0) ? drm.crtc_id : 0 },
+		{ plane_prop_crtc_x, (screen_w - text_w) / 2 },
+		{ plane_prop_crtc_y, screen_h - screen_h / 20 - text_h },
+		{ plane_prop_crtc_w, text_w },
+		{ plane_prop_crtc_h, text_h },
+		{ plane_prop_src_x, 0 },
+		{ plane_prop_src_y, uint64_t(height - 1 - text_h) << 16 },
+		{ plane_prop_src_w, uint64_t(text_w) << 16 },
+		{ plane_prop_src_h, uint64_t(text_h) << 16 },
+		{ plane_prop_zpos, 1 },
+	};
+
+	// Disabling the plane only needs the FB and the CRTC.
+	const unsigned count = (target >= 0) ? (sizeof(assign) / sizeof(assign[0])) : 2;
+
+	for (unsigned i = 0; i < count; ++i) {
+		auto it = drm.pmap.find(make_pair(obj_id, assign[i].prop));
+
+		// Optional property, which the plane doesn't have.
+		if (it == drm.pmap.end())
+			continue;
+
+		if (drmModeAtomicAddProperty(req, obj_id, it->second, assign[i].value) < 0)
+			return false;
+	}
+
+	flags |= update_queued;
+
+	return true;
+}
+
+void ExynosSubtitles::handle_commit()
+{
+	if (!(flags & update_queued))
+		return;
+
+	flags &= ~update_queued;
+	flags |= update_pending;
+}
+
+void ExynosSubtitles::handle_flip()
+{
+	if (!(flags & update_pending))
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+
+		shown = queued;
+		queued = -1;
+	}
+
+	// The slot that left the screen can be reused.
+	cond.notify_one();
+
+	if (shown >= 0)
+		cues_shown++;
+
+	flags &= ~update_pending;
+}
+
+void ExynosSubtitles::add_stats(StatsReport &r) const
+{
+	r.add("subtitles_shown", cues_shown.load());
+	r.add("subtitles_late", cues_late.load());
+	r.add("subtitle_render_time", render_time);
+}
+
+ExynosMosaic::ExynosMosaic(ExynosDRM *r) : root(r), canvas_plane_id(0), canvas_front(0),
+	pending_frames(0), pack_start(0), commits(0), frames_packed(0), pack_errors(0), flags(0)
+{
+	// Nothing here.
+}
+
+ExynosMosaic::~ExynosMosaic()
+{
+	free();
+}
+
+bool ExynosMosaic::alloc(const std::vector<tile_setup> &setup, const std::vector<uint32_t> &planes,
+						 uint32_t drm_fmt, bool tiling)
+{
+	static const std::string msg_prefix("ExynosMosaic::alloc(): ");
+
+	if (flags & allocated)
+		return false;
+
+	using namespace std;
+
+	if (setup.empty() || planes.empty())
+		return false;
+
+	const unsigned count = setup.size();
+	const unsigned w = root->width;
+	const unsigned h = root->height;
+
+	// Keep the grid as square as possible.
+	unsigned cols = 1;
+
+	while (cols * cols < count)
+		++cols;
+
+	const unsigned rows = (count + cols - 1) / cols;
+
+	flags |= allocated;
+
+	try {
+		if (!pack_loop.open() || !pack_loop.add_timer(pack_event_timeout))
+			throw runtime_error("failed to set up the scaler events");
+
+		tiles.reserve(count);
+
+		for (unsigned i = 0; i < count; ++i) {
+			const videoinfo &vi = setup[i].vi;
+
+			tiles.emplace_back();
+
+			tile &t = tiles.back();
+			t.vi = vi;
+
+			// The frames are scaled to the cell of the tile, like they
+			// are scaled to the screen with a single stream. The scaler
+			// of the SoC needs even coordinates with NV12.
+			const unsigned col = i % cols;
+			const unsigned row = i / cols;
+			const unsigned x = col * w / cols;
+			const unsigned y = row * h / rows;
+
+			const video_geometry g = compute_geometry(root->scaling,
+				(col + 1) * w / cols - x, (row + 1) * h / rows - y, vi);
+
+			t.src = M2MScaler::rect{g.src_x & ~1u, g.src_y & ~1u, g.src_w & ~1u, g.src_h & ~1u};
+			t.dst = M2MScaler::rect{(x + g.crtc_x) & ~1u, (y + g.crtc_y) & ~1u,
+									g.crtc_w & ~1u, g.crtc_h & ~1u};
+
+			const ExynosPage::fbinfo fbi = {
+				vi.w, vi.h,
+				vi.w,
+				vi.buffer_size[0],
+				drm_fmt,
+				tiling
+			};
+
+			const unsigned fb_size = vi.buffer_size[0] + vi.buffer_size[1];
+
+			t.pages.reserve(setup[i].num_pages);
+
+			for (unsigned j = 0; j < setup[i].num_pages; ++j) {
+				t.pages.emplace_back(root);
+
+				if (!t.pages.back().alloc(fb_size))
+					throw runtime_error("failed to allocate BO for page");
+
+				if (!t.pages.back().add(fbi))
+					throw runtime_error("failed to add BO as framebuffer");
+			}
+
+			for (auto &j : t.pages)
+				t.free_pages.push_back(&j);
+		}
+
+		// Give each tile a plane of its own, as long as there are enough.
+		// Otherwise the last plane shows the packed tiles. If the CRTC
+		// can't show that many planes, pack more tiles.
+		unsigned direct = min<size_t>(count, planes.size());
+
+		if (direct < count)
+			direct--;
+
+		while (true) {
+			if (direct < count && canvas.empty() && !alloc_canvas())
+				throw runtime_error("failed to allocate packed frame");
+
+			if (test_layout(direct, planes))
+				break;
+
+			if (direct == 0)
+				throw runtime_error("CRTC can't show the tiles");
+
+			direct--;
+		}
+
+		for (auto &t : tiles) {
+			if (t.plane_id != 0)
+				continue;
+
+			t.scaler = new M2MScaler;
+
+			if (!t.scaler->open())
+				throw runtime_error("no scaler for the packed tiles");
+
+			if (!t.scaler->setup(t.vi, t.src, t.pages.size(), w, h, t.dst, canvas_count))
+				throw runtime_error("scaler can't pack the tiles");
+
+			for (auto &i : t.pages) {
+				const int fd = i.get_prime_fd();
+
+				if (fd < 0)
+					throw runtime_error("failed to export page");
+
+				t.fds.push_back(fd);
+			}
+		}
+
+		cout << msg_prefix << count << " tiles (" << cols << 'x' << rows << "), "
+			 << direct << " on planes of their own, " << (count - direct)
+			 << " packed.\n";
+	}
+	catch (exception &e) {
+		free();
+
+		cerr << msg_prefix << e.what() << ".\n";
+
+		return false;
+	}
+
+	return true;
+}
+
+void ExynosMosaic::free()
+{
+	if (!(flags & allocated))
+		return;
+
+	// The scaler drops its references to the pages when it is closed.
+	for (auto &t : tiles) {
+		delete t.scaler;
+
+		for (auto &i : t.fds)
+			::close(i);
+	}
+
+	for (auto &i : canvas_fds)
+		::close(i);
+
+	pack_loop.close();
+
+	tiles.clear();
+	canvas.clear();
+	canvas_fds.clear();
+
+	for (auto &i : canvas_seq)
+		i.clear();
+
+	canvas_plane_id = 0;
+	flags = 0;
+}
+
+bool ExynosMosaic::alloc_canvas()
+{
+	const unsigned w = root->width;
+	const unsigned h = root->height;
+
+	// Linear NV12, with the chroma plane right after the luma plane.
+	const ExynosPage::fbinfo fbi = {
+		w, h,
+		w,
+		w * h,
+		DRM_FORMAT_NV12,
+		false
+	};
+
+	canvas.reserve(canvas_count);
+
+	for (unsigned i = 0; i < canvas_count; ++i) {
+		canvas.emplace_back(root);
+
+		ExynosPage &c = canvas.back();
+
+		if (!c.alloc(w * h * 3 / 2) || !c.add(fbi))
+			return false;
+
+		// The cells stay black until the first frame of their tile.
+		uint8_t *map = static_cast<uint8_t*>(c.mmap());
+		if (!map)
+			return false;
+
+		std::memset(map, 16, w * h);
+		std::memset(map + w * h, 128, w * h / 2);
+
+		const int fd = c.get_prime_fd();
+		if (fd < 0)
+			return false;
+
+		canvas_fds.push_back(fd);
+		canvas_seq[i].assign(tiles.size(), 0);
+	}
+
+	return true;
+}
+
+bool ExynosMosaic::test_layout(unsigned direct, const std::vector<uint32_t> &planes)
+{
+	CommonDRM &drm = *root->drm;
+	const unsigned w = root->width;
+	const unsigned h = root->height;
+
+	for (unsigned i = 0; i < tiles.size(); ++i)
+		tiles[i].plane_id = (i < direct) ? planes[i] : 0;
+
+	canvas_plane_id = (direct < tiles.size()) ? planes[direct] : 0;
+
+	auto req = drmMode::make_unique(drmModeAtomicAlloc());
+	if (!req)
+		return false;
+
+	if (!add_mosaic_output(req.get(), drm, w, h, root->overlay->get_front_id()))
+		return false;
+
+	// The tiles are stacked above the packed frame, which covers the
+	// whole screen.
+	for (auto &t : tiles) {
+		if (t.plane_id == 0)
+			continue;
+
+		if (!add_video_props(req.get(), drm, t.plane_id, drm.crtc_id, to_geometry(t.src, t.dst), 1) ||
+			!add_plane_fb(req.get(), drm, t.plane_id, t.pages[0].buf_id))
+			return false;
+	}
+
+	if (canvas_plane_id != 0) {
+		const video_geometry g = {0, 0, w, h, 0, 0, w, h};
+
+		if (!add_video_props(req.get(), drm, canvas_plane_id, drm.crtc_id, g) ||
+			!add_plane_fb(req.get(), drm, canvas_plane_id, canvas[0].buf_id))
+			return false;
+	}
+
+	return (drmModeAtomicCommit(root->fd, req.get(),
+		DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET, nullptr) == 0);
+}
+
+bool ExynosMosaic::modeset()
+{
+	CommonDRM &drm = *root->drm;
+	const unsigned w = root->width;
+	const unsigned h = root->height;
+
+	auto req = drmMode::make_unique(drmModeAtomicAlloc());
+	if (!req)
+		return false;
+
+	if (!add_mosaic_output(req.get(), drm, w, h, root->overlay->get_front_id()))
+		return false;
+
+	// The planes of the tiles are enabled with their first frame.
+	for (auto &i : drm.mosaic_plane_ids) {
+		if (i != canvas_plane_id && !disable_plane(req.get(), drm, i))
+			return false;
+	}
+
+	if (canvas_plane_id != 0) {
+		const video_geometry g = {0, 0, w, h, 0, 0, w, h};
+
+		if (!add_video_props(req.get(), drm, canvas_plane_id, drm.crtc_id, g) ||
+			!add_plane_fb(req.get(), drm, canvas_plane_id, canvas[0].buf_id))
+			return false;
+	}
+
+	canvas_front = 0;
+
+	return (drmModeAtomicCommit(root->fd, req.get(), DRM_MODE_ATOMIC_ALLOW_MODESET,
+								nullptr) == 0);
+}
+
+bool ExynosMosaic::commit()
+{
+	ExynosDRM &d = *root;
+
+	// The frames wait until the pending commit has reached the screen.
+	// Then all new frames go out at once, at most one commit per vblank.
+	if ((d.flags & ExynosDRM::pageflip_pending) || (flags & packing))
+		return true;
+
+	bool direct = false, packed = false;
+
+	for (auto &t : tiles) {
+		if (!t.next)
+			continue;
+
+		if (t.plane_id != 0)
+			direct = true;
+		else
+			packed = true;
+	}
+
+	if (!direct && !packed)
+		return true;
+
+	pending_frames = 0;
+
+	// The buffer of the packed frame is not on the screen. The commit
+	// follows once the scalers are done with it.
+	if (packed) {
+		start_pack(canvas_front ^ 1);
+
+		if (flags & packing)
+			return true;
+	}
+
+	return issue();
+}
+
+void ExynosMosaic::start_pack(unsigned back)
+{
+	static const std::string msg_prefix("ExynosMosaic::start_pack(): ");
+
+	pack_start = monotonic_us();
+
+	for (unsigned i = 0; i < tiles.size(); ++i) {
+		tile &t = tiles[i];
+
+		if (t.plane_id != 0)
+			continue;
+
+		// The frame that was packed last is only kept for the other
+		// buffer, its content is not on the screen.
+		if (t.next) {
+			if (t.shown)
+				release(t, t.shown);
+
+			t.shown = t.next;
+			t.shown->state = ExynosPage::state_on_screen;
+			t.next = nullptr;
+			t.seq++;
+
+			pending_frames++;
+		}
+
+		if (!t.shown || canvas_seq[back][i] == t.seq)
+			continue;
+
+		const unsigned index = t.shown - t.pages.data();
+
+		if (!t.scaler->start(index, t.fds[index], back, canvas_fds[back])) {
+			pack_errors++;
+			continue;
+		}
+
+		if (!pack_loop.add(t.scaler->get_fd(), EPOLLIN, pack_event_scaler + i)) {
+			std::cerr << msg_prefix << "failed to watch scaler of tile " << i << ".\n";
+
+			t.scaler->cancel();
+			pack_errors++;
+
+			continue;
+		}
+
+		flags |= packing;
+	}
+
+	// The tiles are packed in parallel, if there are several scalers.
+	if ((flags & packing) && !pack_loop.arm_timer(pack_start + pack_timeout * 1000))
+		std::cerr << msg_prefix << "failed to arm the timeout.\n";
+}
+
+bool ExynosMosaic::handle_pack()
+{
+	static const std::string msg_prefix("ExynosMosaic::handle_pack(): ");
+
+	if (!(flags & packing))
+		return true;
+
+	if (!pack_loop.wait(pack_events, 0))
+		return false;
+
+	const unsigned back = canvas_front ^ 1;
+	bool timed_out = false;
+
+	for (auto &e : pack_events) {
+		if (e.id == pack_event_timeout) {
+			pack_loop.ack_timer();
+			timed_out = true;
+
+			continue;
+		}
+
+		const unsigned i = e.id - pack_event_scaler;
+		tile &t = tiles[i];
+
+		pack_loop.remove(t.scaler->get_fd());
+
+		if (!t.scaler->finish(0)) {
+			pack_errors++;
+			continue;
+		}
+
+		canvas_seq[back][i] = t.seq;
+		flags |= canvas_ready;
+		frames_packed++;
+	}
+
+	bool busy = false;
+
+	for (unsigned i = 0; i < tiles.size(); ++i) {
+		tile &t = tiles[i];
+
+		if (!t.scaler || !t.scaler->is_busy())
+			continue;
+
+		// The tile keeps the frame that the buffer held before.
+		if (timed_out) {
+			std::cerr << msg_prefix << "packing tile " << i << " timed out.\n";
+
+			pack_loop.remove(t.scaler->get_fd());
+			t.scaler->cancel();
+			pack_errors++;
+
+			continue;
+		}
+
+		busy = true;
+	}
+
+	if (busy)
+		return true;
+
+	pack_loop.disarm_timer();
+	pack_loop.ack_timer();
+
+	pack_time.record(monotonic_us() - pack_start);
+	flags &= ~packing;
+
+	return issue();
+}
+
+bool ExynosMosaic::issue()
+{
+	static const std::string msg_prefix("ExynosMosaic::issue(): ");
+
+	ExynosDRM &d = *root;
+	CommonDRM &drm = *d.drm;
+
+	bool changed = (flags & canvas_ready);
+
+	for (auto &t : tiles) {
+		if (t.plane_id != 0 && t.next)
+			changed = true;
+	}
+
+	if (!changed)
+		return true;
+
+	auto req = drmMode::make_unique(drmModeAtomicAlloc());
+	if (!req)
+		return false;
+
+	if (flags & canvas_ready) {
+		if (!add_plane_fb(req.get(), drm, canvas_plane_id, canvas[canvas_front ^ 1].buf_id))
+			return false;
+	}
+
+	const uint64_t now = monotonic_us();
+
+	// The plane of a tile stays off until its first frame.
+	for (auto &t : tiles) {
+		if (t.plane_id == 0 || !t.next)
+			continue;
+
+		if ((!t.shown && !add_video_props(req.get(), drm, t.plane_id, drm.crtc_id,
+										  to_geometry(t.src, t.dst), 1)) ||
+			!add_plane_fb(req.get(), drm, t.plane_id, t.next->buf_id))
+			return false;
+
+		t.pending = t.next;
+		t.next = nullptr;
+
+		t.pending->issue_time = now;
+		t.pending->state = ExynosPage::state_pending;
+
+		pending_frames++;
+	}
+
+	if (!d.overlay->add_update(req.get()))
+		return false;
+
+	if (drmModeAtomicCommit(d.fd, req.get(),
+			DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK, this)) {
+		std::cerr << msg_prefix << "failed to issue atomic commit.\n";
+		return false;
+	}
+
+	if (flags & canvas_ready) {
+		flags &= ~canvas_ready;
+		flags |= canvas_pending;
+	}
+
+	d.overlay->handle_commit();
+	d.flags |= ExynosDRM::pageflip_pending;
+
+	commits++;
+
+	return true;
+}
+
+void ExynosMosaic::release(tile &t, ExynosPage *p)
+{
+	p->state = ExynosPage::state_free;
+	t.free_pages.push_back(p);
+}
+
+void ExynosMosaic::handle_flip(unsigned frame, uint64_t timestamp)
+{
+	ExynosDRM &d = *root;
+
+	// The previous frames of the updated tiles left the screen.
+	for (auto &t : tiles) {
+		if (!t.pending)
+			continue;
+
+		if (t.shown)
+			release(t, t.shown);
+
+		t.shown = t.pending;
+		t.shown->state = ExynosPage::state_on_screen;
+		t.pending = nullptr;
+	}
+
+	if (flags & canvas_pending) {
+		canvas_front ^= 1;
+		flags &= ~canvas_pending;
+	}
+
+	if (d.last_flip_time != 0 && timestamp > d.last_flip_time)
+		d.flip_interval.record(timestamp - d.last_flip_time);
+
+	d.last_flip_time = timestamp;
+	d.last_frame = frame;
+	d.frames_presented += pending_frames;
+	pending_frames = 0;
+
+	d.overlay->handle_flip();
+	d.flags &= ~ExynosDRM::pageflip_pending;
+}
+
+void ExynosMosaic::add_stats(StatsReport &r) const
+{
+	uint64_t direct = 0;
+
+	for (auto &t : tiles) {
+		if (t.plane_id != 0)
+			direct++;
+	}
+
+	r.add("mosaic_tiles_direct", direct);
+	r.add("mosaic_tiles_packed", tiles.size() - direct);
+	r.add("mosaic_commits", commits.load());
+	r.add("mosaic_frames_packed", frames_packed.load());
+	r.add("mosaic_pack_errors", pack_errors.load());
+	r.add("mosaic_pack_time", pack_time);
+}
+
+bool ExynosDRM::check_connector_type(enum connector_type ct, uint32_t drm_ct) const
+{
+	enum connector_type t;
+
+	switch (drm_ct) {
+	// Writeback connectors don't drive a display.
+	case DRM_MODE_CONNECTOR_WRITEBACK:
+		return false;
+
+	case DRM_MODE_CONNECTOR_HDMIA:
+	case DRM_MODE_CONNECTOR_HDMIB:
+		t = connector_hdmi;
+		break;
+
+	case DRM_MODE_CONNECTOR_VGA:
+		t = connector_vga;
+		break;
+
+	default:
+		t = connector_other;
+		break;
+	}
+
+	return (t == ct);
+}
+
+bool ExynosDRM::find_output(enum connector_type ct, uint32_t &connector_id,
+							unsigned &crtc_index, uint32_t &crtc_id) const
+{
+	using namespace std;
+
+	auto resources = drmMode::make_unique(drmModeGetResources(fd));
+	if (!resources)
+		return false;
+
+	// Connectors and CRTCs that already drive an output.
+	vector<uint32_t> used_connectors{drm->connector_id};
+	vector<uint32_t> used_crtcs{drm->crtc_id};
+
+	for (auto &i : drm->clones) {
+		used_connectors.push_back(i.connector_id);
+		used_crtcs.push_back(i.crtc_id);
+	}
+
+	auto is_used = [](const vector<uint32_t> &v, uint32_t id) {
+		return find(v.cbegin(), v.cend(), id) != v.cend();
+	};
+
+	for (unsigned i = 0; i < unsigned(resources->count_connectors); ++i) {
+		auto connector = drmMode::make_unique(drmModeGetConnector(fd, resources->connectors[i]));
+		if (!connector)
+			continue;
+
+		if (is_used(used_connectors, connector->connector_id))
+			continue;
+
+		if (!check_connector_type(ct, connector->connector_type) ||
+				connector->connection != DRM_MODE_CONNECTED ||
+				connector->count_modes <= 0)
+			continue;
+
+		for (unsigned j = 0; j < unsigned(connector->count_encoders); ++j) {
+			auto encoder = drmMode::make_unique(drmModeGetEncoder(fd, connector->encoders[j]));
+			if (!encoder)
+				continue;
+
+			// Find a free CRTC that is compatible with the encoder.
+			for (unsigned k = 0; k < unsigned(resources->count_crtcs); ++k) {
+				if (!(encoder->possible_crtcs & (1 << k)))
+					continue;
+
+				if (is_used(used_crtcs, resources->crtcs[k]))
+					continue;
+
+				// Store index and ID of the CRTC.
+				// We need the index again later, when we validate the planes.
+				connector_id = connector->connector_id;
+				crtc_index = k;
+				crtc_id = resources->crtcs[k];
+
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+ExynosDRM::ExynosDRM() : scaling(scaling_fit), backend(nullptr), free_mask(0), free_fd(-1),
+	overlay(nullptr), writeback(nullptr), writeback_decimation(0), subtitles(nullptr),
+	subtitle_track(nullptr), subtitle_fps_num(0), subtitle_fps_den(0), mosaic(nullptr), cur_page(nullptr), pending_page(nullptr), mailbox(nullptr), refresh_period(0), last_flip_time(0), last_frame(0), out_fence(-1),
+	fence_storage(-1), pending_crtcs(0), first_flip_time(0), frames_presented(0), frames_late(0), frames_replaced(0),
+	vblanks_missed(0), vblanks_repeated(0), flags(0)
+{
+	// Nothing here.
+}
+
+ExynosDRM::~ExynosDRM()
+{
+	free_mosaic();
+	free_pages();
+	free_buffers();
+	deinit();
+	close();
+}
+
+bool ExynosDRM::open(enum connector_type ct, enum DRMBackend::backend_type bt)
+{
+	static const std::string msg_prefix("ExynosDRM::open(): ");
+
+	if (flags & opened)
+		return false;
+
+	using namespace std;
+
+	backend = DRMBackend::get_backend(bt);
+	if (!backend) {
+		cerr << msg_prefix << "unknown backend.\n";
+		return false;
+	}
+
+	string device_name;
+	get_device_name(device_name, *backend);
+
+	if (device_name.empty()) {
+		cerr << msg_prefix << "no compatible DRM device found.\n";
+		delete backend;
+		return false;
+	}
+
+	fd = ::open(device_name.c_str(), O_RDWR, 0);
+	if (fd < 0) {
+		cerr << msg_prefix << "failed to open DRM device.\n";
+		delete backend;
+		return false;
+	}
+
+	if (ct == connector_none) {
+		drm = new CommonDRM;
+		drm->out_fence_prop = 0;
+		drm->writeback_id = 0;
+		drm->subtitle_plane_id = 0;
+
+		cout << msg_prefix << "using DRM device \"" << device_name
+			 << "\" without display.\n";
+
+		flags |= (opened | headless);
+
+		return true;
+	}
+
+	try {
+		drm = nullptr;
+
+		// Request atomic DRM support. This also enables universal planes.
+		if (drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1) < 0)
+			throw runtime_error("failed to enable atomic support");
+
+		drm = new CommonDRM;
+		if (!drm)
+			throw runtime_error("failed to allocate DRM");
+
+		auto resources = drmMode::make_unique(drmModeGetResources(fd));
+		if (!resources)
+			throw runtime_error("failed to get DRM resources");
+
+		auto plane_resources = drmMode::make_unique(drmModeGetPlaneResources(fd));
+		if (!plane_resources)
+			throw runtime_error("failed to get DRM plane resources");
+
+		drm->connector_id = 0;
+		drm->crtc_id = 0;
+		drm->writeback_id = 0;
+		drm->subtitle_plane_id = 0;
+
+		if (!find_output(ct, drm->connector_id, drm->crtc_index, drm->crtc_id))
+			throw runtime_error("no currently active connector with a compatible CRTC found");
+
+		if (!setup_properties(fd, *drm, *resources, *plane_resources))
+			throw runtime_error("failed to setup properties");
+
+		// Out-fences are optional, without them pages are only
+		// released by the flip event.
+		if (!get_propid_by_name(fd, drm->crtc_id, DRM_MODE_OBJECT_CRTC,
+								"OUT_FENCE_PTR", drm->out_fence_prop))
+			drm->out_fence_prop = 0;
+	}
+	catch (exception &e) {
+		delete drm;
+		delete backend;
+		::close(fd);
+
+		cerr << msg_prefix << e.what() << ".\n";
+
+		return false;
+	}
+
+	cout << msg_prefix << "using DRM device \"" << device_name << "\" with:\n"
+		 << "\tconnector ID = " << drm->connector_id << '\n'
+		 << "\tcrtc ID = " << drm->crtc_id << '\n'
+		 << "\tout-fences = " << (drm->out_fence_prop ? "yes" : "no") << '\n';
+
+	flags |= opened;
+
+	return true;
+}
+
+void ExynosDRM::close()
+{
+	if (!(flags & opened))
+		return;
+
+	if (flags & initialized)
+		return;
+
+	delete drm;
+	delete backend;
+	::close(fd);
+
+	backend = nullptr;
+
+	flags &= ~(opened | headless);
+}
+
+bool ExynosDRM::add_clone(enum connector_type ct)
+{
+	static const std::string msg_prefix("ExynosDRM::add_clone(): ");
+
+	if (!(flags & opened) || (flags & initialized))
+		return false;
+
+	if ((flags & headless) || ct == connector_none)
+		return false;
+
+	CommonDRM::clone_output c = {0, 0, 0, 0, 0, 0, 0};
+
+	if (!find_output(ct, c.connector_id, c.crtc_index, c.crtc_id)) {
+		std::cerr << msg_prefix << "no free output with a compatible CRTC found.\n";
+		return false;
+	}
+
+	drm->clones.push_back(c);
+
+	std::cout << msg_prefix << "clone output with:\n"
+			  << "\tconnector ID = " << c.connector_id << '\n'
+			  << "\tcrtc ID = " << c.crtc_id << '\n';
+
+	return true;
+}
+
+bool ExynosDRM::enable_writeback(unsigned decimation)
+{
+	static const std::string msg_prefix("ExynosDRM::enable_writeback(): ");
+
+	// The writeback connector has to be saved by enable_output().
+	if (!(flags & opened) || (flags & (headless | output_enabled | pages_alloced)))
+		return false;
+
+	using namespace std;
+
+	if (decimation == 0) {
+		cerr << msg_prefix << "invalid decimation.\n";
+		return false;
+	}
+
+	// Writeback connectors are only exposed on request.
+	if (drmSetClientCap(fd, DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1) < 0) {
+		cerr << msg_prefix << "writeback connectors not supported.\n";
+		return false;
+	}
+
+	auto resources = drmMode::make_unique(drmModeGetResources(fd));
+	if (!resources) {
+		cerr << msg_prefix << "failed to get DRM resources.\n";
+		return false;
+	}
+
+	drm->writeback_id = 0;
+
+	for (unsigned i = 0; i < unsigned(resources->count_connectors) && !drm->writeback_id; ++i) {
+		auto connector = drmMode::make_unique(drmModeGetConnector(fd, resources->connectors[i]));
+		if (!connector || connector->connector_type != DRM_MODE_CONNECTOR_WRITEBACK)
+			continue;
+
+		// The connector has to be usable with the main CRTC.
+		bool usable = false;
+
+		for (unsigned j = 0; j < unsigned(connector->count_encoders) && !usable; ++j) {
+			auto encoder = drmMode::make_unique(drmModeGetEncoder(fd, connector->encoders[j]));
+
+			usable = (encoder && (encoder->possible_crtcs & (1 << drm->crtc_index)));
+		}
+
+		const uint32_t id = connector->connector_id;
+		uint32_t crtc_prop;
+
+		if (!usable || !writeback_supports_format(fd, id, DRM_FORMAT_XRGB8888))
+			continue;
+
+		if (!get_propid_by_name(fd, id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", crtc_prop) ||
+			!get_propid_by_name(fd, id, DRM_MODE_OBJECT_CONNECTOR, "WRITEBACK_FB_ID",
+								drm->writeback_fb_prop) ||
+			!get_propid_by_name(fd, id, DRM_MODE_OBJECT_CONNECTOR, "WRITEBACK_OUT_FENCE_PTR",
+								drm->writeback_fence_prop))
+			continue;
+
+		drm->pmap[make_pair(id, connector_prop_crtc_id)] = crtc_prop;
+		drm->writeback_id = id;
+	}
+
+	if (!drm->writeback_id) {
+		cerr << msg_prefix << "no usable writeback connector found.\n";
+		return false;
+	}
+
+	writeback_decimation = decimation;
+
+	cout << msg_prefix << "writeback connector ID = " << drm->writeback_id
+		 << ", capturing every " << decimation << ". flip\n";
+
+	return true;
+}
+
+bool ExynosDRM::enable_subtitles(const SubtitleTrack *t, unsigned num, unsigned den)
+{
+	static const std::string msg_prefix("ExynosDRM::enable_subtitles(): ");
+
+	if (!(flags & opened) || (flags & (headless | pages_alloced)))
+		return false;
+
+	if (!t || num == 0 || den == 0) {
+		std::cerr << msg_prefix << "invalid subtitle track or frame rate.\n";
+		return false;
+	}
+
+	subtitle_track = t;
+	subtitle_fps_num = num;
+	subtitle_fps_den = den;
+
+	return true;
+}
+
+bool ExynosDRM::init(unsigned w, unsigned h)
+{
+	static const std::string msg_prefix("ExynosDRM::init(): ");
+
+	if (flags & initialized)
+		return false;
+
+	if (!(flags & opened))
+		return false;
+
+	using namespace std;
+
+	if (flags & headless) {
+		width = height = 0;
+		refresh_period = 0;
+		fh = nullptr;
+
+		flags |= initialized;
+
+		return true;
+	}
+
+	auto connector = drmMode::make_unique(drmModeGetConnector(fd, drm->connector_id));
+	if (!connector) {
+		cerr << msg_prefix << "failed to get connector.\n";
+		return false;
+	}
+
+	drmModeModeInfo *mode;
+	if (w != 0 && h != 0) {
+		mode = nullptr;
+
+		for (unsigned i = 0; i < unsigned(connector->count_modes); ++i) {
+			if (connector->modes[i].hdisplay == w &&
+				connector->modes[i].vdisplay == h) {
+				mode = &connector->modes[i];
+				break;
+			}
+		}
+
+		if (!mode) {
+			cerr << msg_prefix << "requested resolution (" << w << 'x'
+				 << h << ") not available.\n";
+			return false;
+		}
+
+	} else {
+		// Select first mode, which is the native one.
+		mode = &connector->modes[0];
+	}
+
+	if (mode->hdisplay == 0 || mode->vdisplay == 0) {
+		cerr << msg_prefix << "failed to select sane resolution.\n";
+		return false;
+	}
+
+	fh = new FlipHandler(fd);
+	if (!fh) {
+		cerr << msg_prefix << "failed to allocate fliphandler.\n";
+		return false;
+	}
+
+	if (drmModeCreatePropertyBlob(fd, mode, sizeof(drmModeModeInfo), &drm->mode_blob_id)) {
+		cerr << msg_prefix << "failed to blobify mode info.\n";
+		delete fh;
+	}
+
+	width = mode->hdisplay;
+	height = mode->vdisplay;
+	cout << msg_prefix << "resolution = " << width << " x " << height << '\n';
+
+	// The mode clock is given in kHz.
+	if (mode->clock != 0)
+		refresh_period = uint64_t(mode->htotal) * mode->vtotal * 1000 / mode->clock;
+	else if (mode->vrefresh != 0)
+		refresh_period = 1000000 / mode->vrefresh;
+	else
+		refresh_period = 0;
+
+	cout << msg_prefix << "refresh period = " << refresh_period << " us\n";
+
+	// The clone outputs use their native mode. An output that can't be
+	// set up is dropped, the video is still shown on the others.
+	for (auto it = drm->clones.begin(); it != drm->clones.end();) {
+		auto clone_connector = drmMode::make_unique(drmModeGetConnector(fd, it->connector_id));
+		const drmModeModeInfo *clone_mode = (clone_connector && clone_connector->count_modes > 0) ?
+			&clone_connector->modes[0] : nullptr;
+
+		if (!clone_mode || drmModeCreatePropertyBlob(fd, clone_mode,
+				sizeof(drmModeModeInfo), &it->mode_blob_id)) {
+			cerr << msg_prefix << "failed to setup mode of clone output, dropping it.\n";
+			it = drm->clones.erase(it);
+			continue;
+		}
+
+		it->w = clone_mode->hdisplay;
+		it->h = clone_mode->vdisplay;
+
+		cout << msg_prefix << "clone resolution = " << it->w << " x " << it->h << '\n';
+
+		++it;
+	}
+
+	flags |= initialized;
+
+	return true;
+}
+
+void ExynosDRM::deinit()
+{
+	if (!(flags & initialized))
+		return;
+
+	if (flags & buffers_alloced)
+		return;
+
+	if (!(flags & headless))
+		drmModeDestroyPropertyBlob(fd, drm->mode_blob_id);
+
+	drop_clones();
+
+	// The pages were never set up, so the output is restored here.
+	if (flags & output_enabled) {
+		if (drmModeAtomicCommit(fd, drm->restore_request,
+								DRM_MODE_ATOMIC_ALLOW_MODESET, nullptr))
+			std::cerr << "ExynosDRM::deinit(): failed to restore the display.\n";
+
+		drmModeAtomicFree(drm->restore_request);
+		drm->restore_request = nullptr;
+	}
+
+	delete fh;
+
+	flags &= ~(initialized | output_enabled);
+}
+
+bool ExynosDRM::enable_output()
+{
+	static const std::string msg_prefix("ExynosDRM::enable_output(): ");
+
+	if (!(flags & initialized))
+		return false;
+
+	if (flags & (headless | output_enabled | pages_alloced))
+		return false;
+
+	using namespace std;
+
+	auto req = drmMode::make_unique(drmModeAtomicAlloc());
+	auto restore = drmMode::make_unique(drmModeAtomicAlloc());
+
+	if (!req || !restore)
+		return false;
+
+	// The planes are saved by alloc_pages(), which is the first
+	// to touch them.
+	if (!add_restore_props(fd, *drm, restore.get(), DRM_MODE_OBJECT_CONNECTOR) ||
+		!add_restore_props(fd, *drm, restore.get(), DRM_MODE_OBJECT_CRTC)) {
+		cerr << msg_prefix << "failed to save the state of the outputs.\n";
+		return false;
+	}
+
+	if (!add_output_props(req.get(), *drm, drm->connector_id, drm->crtc_id,
+						  drm->mode_blob_id))
+		return false;
+
+	if (drmModeAtomicCommit(fd, req.get(), DRM_MODE_ATOMIC_ALLOW_MODESET, nullptr)) {
+		cerr << msg_prefix << "failed to enable the output (errno="
+			 << errno << ").\n";
+		return false;
+	}
+
+	drm->restore_request = restore.release();
+	flags |= output_enabled;
+
+	return true;
+}
+
+bool ExynosDRM::alloc_buffers(unsigned num_buffers, unsigned size, std::vector<ExynosBuffer> &buffers)
+{
+	static const std::string msg_prefix("ExynosDRM::alloc_buffers(): ");
+
+	if (flags & buffers_alloced)
+		return false;
+
+	if (!(flags & opened))
+		return false;
+
+	using namespace std;
+
+	if (num_buffers == 0) {
+		cerr << msg_prefix << "no buffers requested.\n";
+		return false;
+	}
+
+	if (size == 0) {
+		cerr << msg_prefix << "zero-sized buffers requested.\n";
+		return false;
+	}
+
+	using namespace std;
+
+	if (!backend->open(fd))
+		return false;
+
+	pool.init(backend);
+
+	buffers.clear();
+
+	try {
+		for (unsigned i = 0; i < num_buffers; ++i) {
+			buffers.emplace_back(this);
+
+			if (!buffers.back().alloc(size))
+				throw exception();
+		}
+	}
+	catch (exception &e) {
+		buffers.clear();
+		pool.deinit();
+		backend->close();
+
+		cerr << msg_prefix << "allocation of mmap-capable buffers failed.\n";
+
+		return false;
+	}
+
+	flags |= buffers_alloced;
+
+	return true;
+}
+
+void ExynosDRM::free_buffers()
+{
+	if (!(flags & buffers_alloced))
+		return;
+
+	if (flags & (pages_alloced | mosaic_alloced))
+		return;
+
+	pool.deinit();
+	backend->close();
+
+	flags &= ~buffers_alloced;
+}
+
+bool ExynosDRM::alloc_pages(unsigned num_pages, const videoinfo &vi)
+{
+	static const std::string msg_prefix("ExynosDRM::alloc_pages(): ");
+
+	if (flags & (pages_alloced | mosaic_alloced))
+		return false;
+
+	if (!(flags & initialized) || !(flags & buffers_alloced))
+		return false;
+
+	using namespace std;
+
+	if (!validate_videoinfo(vi)) {
+		cerr << msg_prefix << "invalid video info.\n";
+		return false;
+	}
+
+	uint32_t drm_fmt;
+	bool tiling;
+
+	if (!get_drm_format(vi.pixel_format, drm_fmt, tiling)) {
+		cerr << msg_prefix << "unknown V4L2 pixel format.\n";
+		return false;
+	}
+
+	if (num_pages == 0 || num_pages > max_pages) {
+		cerr << msg_prefix << "invalid number of pages.\n";
+		return false;
+	}
+
+	const unsigned fb_size = vi.buffer_size[0] + vi.buffer_size[1]; // TODO
+
+	// Get the buffers for all pages at once. Buffers of an earlier
+	// stream are reused, if they are large enough.
+	if (!pool.reserve(num_pages, fb_size)) {
+		cerr << msg_prefix << "failed to allocate buffers for pages.\n";
+		return false;
+	}
+
+	// Without a display, we only need the buffers themselves.
+	if (flags & headless) {
+		try {
+			for (unsigned i = 0; i < num_pages; ++i) {
+				pages.emplace_back(this);
+
+				if (!pages.back().alloc(fb_size))
+					throw runtime_error("failed to allocate BO for page");
+			}
+
+			if (!init_free_list())
+				throw runtime_error("failed to setup free list of pages");
+		}
+		catch (exception &e) {
+			pages.clear();
+
+			cerr << msg_prefix << e.what() << ".\n";
+
+			return false;
+		}
+
+		cur_page = nullptr;
+		page_vi = vi;
+		flags |= pages_alloced;
+
+		return true;
+	}
+
+	auto plane_resources = drmMode::make_unique(drmModeGetPlaneResources(fd));
+	if (!plane_resources) {
+		cerr << msg_prefix << "failed to get DRM plane resources.\n";
+		return false;
+	}
+
+	drm->plane_id[plane_primary] = 0;
+	drm->plane_id[plane_video] = 0;
+
+	for (unsigned i = 0; i < plane_resources->count_planes; ++i) {
+		const uint32_t plane_id = plane_resources->planes[i];
+		drmModePlane *plane;
+
+		plane = drmModeGetPlane(fd, plane_id);
+
+		if (!plane)
+			continue;
+
+		// Make sure that the plane can be used with the selected CRTC.
+		if (plane->possible_crtcs & (1 << drm->crtc_index)) {
+			// Check that the plane supports the chosen pixel format.
+			for (unsigned j = 0; j < plane->count_formats; ++j) {
+				const uint32_t f = plane->formats[j];
+
+				if (f == drm_fmt && !drm->plane_id[plane_video]) {
+					drm->plane_id[plane_video] = plane->plane_id;
+					break;
+				} else if (f == DRM_FORMAT_ARGB8888 &&
+						   !drm->plane_id[plane_primary]) {
+					drm->plane_id[plane_primary] = plane->plane_id;
+					break;
+				}
+			}
+		}
+
+		drmModeFreePlane(plane);
+	}
+
+	if (!drm->plane_id[plane_primary]) {
+		cerr << msg_prefix << "no primary plane with support for ARGB32 found.\n";
+		return false;
+	}
+
+	if (!drm->plane_id[plane_video]) {
+		cerr << msg_prefix << "no video plane found.\n";
+		return false;
+	}
+
+	setup_clones(drm_fmt);
+
+	// The subtitles need a plane of their own, the video is
+	// shown without them otherwise.
+	drm->subtitle_plane_id = 0;
+
+	if (subtitle_track) {
+		drm->subtitle_plane_id = find_free_plane(fd, *drm, *plane_resources,
+												 drm->crtc_index, DRM_FORMAT_ARGB8888);
+
+		if (!drm->subtitle_plane_id)
+			cerr << msg_prefix << "no plane for subtitles found, subtitles disabled.\n";
+	}
+
+	// Damage clips are optional, without them the whole overlay
+	// is considered as damaged on each update.
+	if (!get_propid_by_name(fd, drm->plane_id[plane_primary], DRM_MODE_OBJECT_PLANE,
+							"FB_DAMAGE_CLIPS", drm->damage_prop))
+		drm->damage_prop = 0;
+
+	try {
+		drm->modeset_request = nullptr;
+
+		if (!(flags & output_enabled))
+			drm->restore_request = nullptr;
+
+		overlay = new ExynosOverlay(this);
+
+		if (!overlay->alloc(width, height))
+			throw runtime_error("failed to allocate overlay");
+
+		if (!overlay->add())
+			throw runtime_error("failed to add overlay as framebuffer");
+
+		if (drm->writeback_id != 0) {
+			writeback = new ExynosWriteback(this);
+
+			if (!writeback->alloc(width, height, writeback_decimation))
+				throw runtime_error("failed to allocate writeback buffer");
+
+			if (!writeback->add())
+				throw runtime_error("failed to add writeback buffer as framebuffer");
+		}
+
+		if (drm->subtitle_plane_id != 0) {
+			subtitles = new ExynosSubtitles(this);
+
+			if (!subtitles->alloc(subtitle_track, subtitle_fps_num, subtitle_fps_den,
+								  width, height))
+				throw runtime_error("failed to allocate subtitle buffers");
+
+			if (!subtitles->add())
+				throw runtime_error("failed to add subtitle buffers as framebuffers");
+
+			// Render the first cues while the pages are set up.
+			subtitles->start();
+		}
+
+		// The outputs were already saved, when they were enabled.
+		if (flags & output_enabled) {
+			if (!add_restore_props(fd, *drm, drm->restore_request, DRM_MODE_OBJECT_PLANE))
+				throw runtime_error("failed to save the state of the planes");
+		} else if (!create_restore_req(fd, *drm)) {
+			throw runtime_error("failed to create restore atomic request");
+		}
+
+		const video_geometry g = compute_geometry(scaling, width, height, vi);
+
+		cout << msg_prefix << "video plane: " << g.src_w << 'x' << g.src_h
+			 << '+' << g.src_x << '+' << g.src_y << " -> " << g.crtc_w << 'x'
+			 << g.crtc_h << '+' << g.crtc_x << '+' << g.crtc_y << '\n';
+
+		if (!create_modeset_req(fd, *drm, width, height, scaling, vi))
+			throw runtime_error("failed to create modeset atomic request");
+
+		// The framebuffer covers the whole decoded frame, the crop
+		// rectangle is applied by the source rectangle of the plane.
+		const ExynosPage::fbinfo fbi = {
+			vi.w, vi.h,
+			vi.w,
+			vi.buffer_size[0],
+			drm_fmt,
+			tiling
+		};
+
+		for (unsigned i = 0; i < num_pages; ++i) {
+			pages.emplace_back(this);
+
+			if (!pages.back().alloc(fb_size))
+				throw runtime_error("failed to allocate BO for page");
+
+			if (!pages.back().add(fbi))
+				throw runtime_error("failed to add BO as framebuffer");
+
+			if (!pages.back().create_request())
+				throw runtime_error("failed to create atomic request for page");
+		}
+
+		if (!init_free_list())
+			throw runtime_error("failed to setup free list of pages");
+
+		cur_page = get_page();
+		cur_page->state = ExynosPage::state_on_screen;
+
+		// The hardware might not be able to drive all outputs at once,
+		// e.g. because of bandwidth limits. Continue with the main one.
+		if (!drm->clones.empty() &&
+			!cur_page->initial_modeset(overlay->get_front_id(), true)) {
+			cerr << msg_prefix << "outputs can't be used together, clone outputs dropped.\n";
+
+			drop_clones();
+			drmModeAtomicFree(drm->modeset_request);
+			drm->modeset_request = nullptr;
+
+			if (!create_modeset_req(fd, *drm, width, height, scaling, vi))
+				throw runtime_error("failed to create modeset atomic request");
+
+			for (auto &i : pages) {
+				i.destroy_request();
+
+				if (!i.create_request())
+					throw runtime_error("failed to create atomic request for page");
+			}
+		}
+
+		// The flip events of all CRTCs are needed before a page can be
+		// recycled, a single out-fence doesn't tell about the others.
+		if (!drm->clones.empty())
+			drm->out_fence_prop = 0;
+
+		if (!cur_page->initial_modeset(overlay->get_front_id()))
+			throw runtime_error("initial atomic modeset failed");
+
+		// The text is shown with the first flip.
+		overlay->text = "Hello world!"; // TODO
+		overlay->update();
+	}
+	catch (exception &e) {
+		deinit_free_list();
+		pages.clear();
+		delete overlay;
+		overlay = nullptr;
+		delete writeback;
+		writeback = nullptr;
+		delete subtitles;
+		subtitles = nullptr;
+
+		drmModeAtomicFree(drm->modeset_request);
+
+		// Without pages, deinit() restores the enabled output.
+		if (!(flags & output_enabled)) {
+			drmModeAtomicFree(drm->restore_request);
+			drm->restore_request = nullptr;
+		}
+
+		cerr << msg_prefix << e.what() << ".\n";
+
+		return false;
+	}
+
+	page_vi = vi;
+	flags |= pages_alloced;
+
+	return true;
+}
+
+void ExynosDRM::free_pages()
+{
+	static const std::string msg_prefix("ExynosDRM::free_pages(): ");
+
+	if (!(flags & pages_alloced))
+		return;
+
+	if (flags & headless) {
+		deinit_free_list();
+		pages.clear();
+		flags &= ~pages_alloced;
+
+		return;
+	}
+
+	// Restore the display state.
+	if (drmModeAtomicCommit(fd, drm->restore_request,
+							DRM_MODE_ATOMIC_ALLOW_MODESET, nullptr)) {
+		std::cerr << msg_prefix << "failed to restore the display.\n";
+	}
+
+	if (out_fence >= 0)
+		::close(out_fence);
+
+	deinit_free_list();
+	pages.clear();
+	retired_pages.clear();
+	cur_page = pending_page = mailbox = nullptr;
+
+	delete overlay;
+	overlay = nullptr;
+	delete writeback;
+	writeback = nullptr;
+	delete subtitles;
+	subtitles = nullptr;
+	out_fence = -1;
+	flags &= ~(pageflip_pending | geometry_pending);
+
+	drmModeAtomicFree(drm->modeset_request);
+	drmModeAtomicFree(drm->restore_request);
+	drm->restore_request = nullptr;
+
+	// The restore also disabled the outputs that enable_output() set up.
+	flags &= ~(pages_alloced | output_enabled);
+}
+
+bool ExynosDRM::reset_pages(unsigned num_pages, const videoinfo &vi)
+{
+	static const std::string msg_prefix("ExynosDRM::reset_pages(): ");
+
+	if (!(flags & pages_alloced))
+		return alloc_pages(num_pages, vi);
+
+	using namespace std;
+
+	// The last frames of the previous stream reach the screen first,
+	// including the one in the mailbox.
+	while (wait_for_flip()) {
+		if (!(flags & headless) && !handle_events())
+			break;
+	}
+
+	// Another pixel format might need another video plane, which only
+	// a new modeset can set up.
+	if (vi.pixel_format != page_vi.pixel_format) {
+		cout << msg_prefix << "pixel format changed, reallocating pages.\n";
+
+		free_pages();
+
+		return alloc_pages(num_pages, vi);
+	}
+
+	if (!validate_videoinfo(vi)) {
+		cerr << msg_prefix << "invalid video info.\n";
+		return false;
+	}
+
+	if (num_pages == 0 || num_pages > max_pages) {
+		cerr << msg_prefix << "invalid number of pages.\n";
+		return false;
+	}
+
+	uint32_t drm_fmt;
+	bool tiling;
+
+	if (!get_drm_format(vi.pixel_format, drm_fmt, tiling))
+		return false;
+
+	// Pages with the same buffer layout are kept, together with their
+	// framebuffers and atomic requests. Only the crop might differ.
+	const bool same_layout = (vi.w == page_vi.w && vi.h == page_vi.h &&
+		vi.buffer_size[0] == page_vi.buffer_size[0] &&
+		vi.buffer_size[1] == page_vi.buffer_size[1]);
+
+	const bool same_geometry = same_layout &&
+		vi.crop_w == page_vi.crop_w && vi.crop_h == page_vi.crop_h &&
+		vi.crop_left == page_vi.crop_left && vi.crop_top == page_vi.crop_top;
+
+	if (!same_layout || num_pages != pages.size())
+		cout << msg_prefix << "setting up " << num_pages << " pages for the next stream.\n";
+
+	deinit_free_list();
+
+	std::vector<ExynosPage> old;
+
+	old.swap(pages);
+	pages.reserve(num_pages);
+
+	ExynosPage *shown = cur_page;
+	cur_page = nullptr;
+
+	if (shown && same_layout) {
+		// The page on the screen stays, and becomes the first one.
+		pages.emplace_back(std::move(*shown));
+		cur_page = &pages.back();
+	} else if (shown) {
+		// Removing the framebuffer of the page on the screen would turn
+		// off the plane. The page is kept until the next flip replaces it.
+		retired_pages.emplace_back(std::move(*shown));
+	}
+
+	if (same_layout) {
+		for (auto &i : old) {
+			if (&i != shown && pages.size() < num_pages)
+				pages.emplace_back(std::move(i));
+		}
+	}
+
+	// The remaining pages give their buffers back to the pool.
+	old.clear();
+
+	const unsigned fb_size = vi.buffer_size[0] + vi.buffer_size[1];
+
+	const ExynosPage::fbinfo fbi = {
+		vi.w, vi.h,
+		vi.w,
+		vi.buffer_size[0],
+		drm_fmt,
+		tiling
+	};
+
+	try {
+		if (!pool.reserve(num_pages - pages.size(), fb_size))
+			throw runtime_error("failed to allocate buffers for pages");
+
+		while (pages.size() < num_pages) {
+			pages.emplace_back(this);
+
+			if (!pages.back().alloc(fb_size))
+				throw runtime_error("failed to allocate BO for page");
+
+			if (flags & headless)
+				continue;
+
+			if (!pages.back().add(fbi))
+				throw runtime_error("failed to add BO as framebuffer");
+
+			if (!pages.back().create_request())
+				throw runtime_error("failed to create atomic request for page");
+		}
+
+		// The video planes get the new geometry with the first flip.
+		// The output itself, and the other planes, stay as they are.
+		if (!(flags & headless) && !same_geometry) {
+			const video_geometry g = compute_geometry(scaling, width, height, vi);
+
+			cout << msg_prefix << "video plane: " << g.src_w << 'x' << g.src_h
+				 << '+' << g.src_x << '+' << g.src_y << " -> " << g.crtc_w << 'x'
+				 << g.crtc_h << '+' << g.crtc_x << '+' << g.crtc_y << '\n';
+
+			drmModeAtomicFree(drm->modeset_request);
+			drm->modeset_request = nullptr;
+
+			if (!create_modeset_req(fd, *drm, width, height, scaling, vi))
+				throw runtime_error("failed to create modeset atomic request");
+
+			flags |= geometry_pending;
+		}
+
+		if (!init_free_list())
+			throw runtime_error("failed to setup free list of pages");
+	}
+	catch (exception &e) {
+		cerr << msg_prefix << e.what() << ".\n";
+
+		free_pages();
+
+		return false;
+	}
+
+	page_vi = vi;
+
+	for (auto &i : pages)
+		i.state = ExynosPage::state_free;
+
+	// All pages are free again, except for the one on the screen.
+	if (cur_page) {
+		uint64_t value;
+
+		free_mask.fetch_and(~uint64_t(1));
+
+		if (read(free_fd, &value, sizeof(value)) != sizeof(value))
+			cerr << msg_prefix << "free page count out of sync.\n";
+
+		cur_page->state = ExynosPage::state_on_screen;
+	}
+
+	return true;
+}
+
+bool ExynosDRM::alloc_mosaic(const std::vector<ExynosMosaic::tile_setup> &setup)
+{
+	static const std::string msg_prefix("ExynosDRM::alloc_mosaic(): ");
+
+	if (flags & (pages_alloced | mosaic_alloced))
+		return false;
+
+	if (!(flags & initialized) || !(flags & buffers_alloced))
+		return false;
+
+	using namespace std;
+
+	if (flags & headless) {
+		cerr << msg_prefix << "mosaic needs a display.\n";
+		return false;
+	}
+
+	if (setup.empty()) {
+		cerr << msg_prefix << "no tiles requested.\n";
+		return false;
+	}
+
+	for (auto &i : setup) {
+		if (!validate_videoinfo(i.vi) || i.num_pages == 0) {
+			cerr << msg_prefix << "invalid video info.\n";
+			return false;
+		}
+
+		// All tiles share the planes, which are selected by the format.
+		if (i.vi.pixel_format != setup[0].vi.pixel_format) {
+			cerr << msg_prefix << "streams with different pixel formats.\n";
+			return false;
+		}
+	}
+
+	uint32_t drm_fmt;
+	bool tiling;
+
+	if (!get_drm_format(setup[0].vi.pixel_format, drm_fmt, tiling)) {
+		cerr << msg_prefix << "unknown V4L2 pixel format.\n";
+		return false;
+	}
+
+	auto plane_resources = drmMode::make_unique(drmModeGetPlaneResources(fd));
+	if (!plane_resources) {
+		cerr << msg_prefix << "failed to get DRM plane resources.\n";
+		return false;
+	}
+
+	if (!drm->clones.empty()) {
+		cerr << msg_prefix << "clone outputs are not used by the mosaic.\n";
+		drop_clones();
+	}
+
+	drm->plane_id[plane_primary] = 0;
+	drm->plane_id[plane_video] = 0;
+	drm->subtitle_plane_id = 0;
+	drm->mosaic_plane_ids.clear();
+
+	// Same selection as for a single stream, except that all video
+	// planes of the CRTC are collected.
+	for (unsigned i = 0; i < plane_resources->count_planes; ++i) {
+		auto plane = drmMode::make_unique(drmModeGetPlane(fd, plane_resources->planes[i]));
+
+		if (!plane || !(plane->possible_crtcs & (1 << drm->crtc_index)))
+			continue;
+
+		for (unsigned j = 0; j < plane->count_formats; ++j) {
+			const uint32_t f = plane->formats[j];
+
+			if (f == drm_fmt) {
+				drm->mosaic_plane_ids.push_back(plane->plane_id);
+				break;
+			} else if (f == DRM_FORMAT_ARGB8888 && !drm->plane_id[plane_primary]) {
+				drm->plane_id[plane_primary] = plane->plane_id;
+				break;
+			}
+		}
+	}
+
+	if (!drm->plane_id[plane_primary]) {
+		cerr << msg_prefix << "no primary plane with support for ARGB32 found.\n";
+		return false;
+	}
+
+	if (drm->mosaic_plane_ids.empty()) {
+		cerr << msg_prefix << "no video plane found.\n";
+		return false;
+	}
+
+	if (!get_propid_by_name(fd, drm->plane_id[plane_primary], DRM_MODE_OBJECT_PLANE,
+							"FB_DAMAGE_CLIPS", drm->damage_prop))
+		drm->damage_prop = 0;
+
+	try {
+		if (!(flags & output_enabled))
+			drm->restore_request = nullptr;
+
+		overlay = new ExynosOverlay(this);
+
+		if (!overlay->alloc(width, height))
+			throw runtime_error("failed to allocate overlay");
+
+		if (!overlay->add())
+			throw runtime_error("failed to add overlay as framebuffer");
+
+		if (flags & output_enabled) {
+			if (!add_restore_props(fd, *drm, drm->restore_request, DRM_MODE_OBJECT_PLANE))
+				throw runtime_error("failed to save the state of the planes");
+		} else if (!create_restore_req(fd, *drm)) {
+			throw runtime_error("failed to create restore atomic request");
+		}
+
+		mosaic = new ExynosMosaic(this);
+
+		if (!mosaic->alloc(setup, drm->mosaic_plane_ids, drm_fmt, tiling))
+			throw runtime_error("failed to allocate tiles");
+
+		if (!mosaic->modeset())
+			throw runtime_error("initial atomic modeset failed");
+
+		fh->set_handler(mosaic_flip_handler);
+	}
+	catch (exception &e) {
+		delete mosaic;
+		mosaic = nullptr;
+		delete overlay;
+		overlay = nullptr;
+
+		// Without the mosaic, deinit() restores the enabled output.
+		if (!(flags & output_enabled)) {
+			drmModeAtomicFree(drm->restore_request);
+			drm->restore_request = nullptr;
+		}
+
+		drm->mosaic_plane_ids.clear();
+
+		cerr << msg_prefix << e.what() << ".\n";
+
+		return false;
+	}
+
+	flags |= mosaic_alloced;
+
+	return true;
+}
+
+void ExynosDRM::free_mosaic()
+{
+	static const std::string msg_prefix("ExynosDRM::free_mosaic(): ");
+
+	if (!(flags & mosaic_alloced))
+		return;
+
+	// The event of the pending commit refers to the mosaic.
+	if (flags & pageflip_pending)
+		fh->wait();
+
+	if (drmModeAtomicCommit(fd, drm->restore_request,
+							DRM_MODE_ATOMIC_ALLOW_MODESET, nullptr)) {
+		std::cerr << msg_prefix << "failed to restore the display.\n";
+	}
+
+	fh->set_handler(page_flip_handler);
+
+	delete mosaic;
+	mosaic = nullptr;
+	delete overlay;
+	overlay = nullptr;
+	flags &= ~pageflip_pending;
+
+	drmModeAtomicFree(drm->restore_request);
+	drm->restore_request = nullptr;
+	drm->mosaic_plane_ids.clear();
+
+	flags &= ~(mosaic_alloced | output_enabled);
+}
+
+std::vector<ExynosPage*> ExynosDRM::get_tile_pages(unsigned tile)
+{
+	std::vector<ExynosPage*> ret;
+
+	if (!mosaic || tile >= mosaic->tiles.size())
+		return ret;
+
+	for (auto &i : mosaic->tiles[tile].pages)
+		ret.push_back(&i);
+
+	return ret;
+}
+
+ExynosPage* ExynosDRM::get_tile_page(unsigned tile)
+{
+	if (!mosaic || tile >= mosaic->tiles.size())
+		return nullptr;
+
+	auto &free_pages = mosaic->tiles[tile].free_pages;
+
+	if (free_pages.empty())
+		return nullptr;
+
+	ExynosPage *p = free_pages.back();
+	free_pages.pop_back();
+
+	p->state = ExynosPage::state_queued;
+
+	return p;
+}
+
+bool ExynosDRM::present_tile(unsigned tile, ExynosPage *p, ExynosPage *&displaced)
+{
+	displaced = nullptr;
+
+	if (!mosaic || !p || tile >= mosaic->tiles.size())
+		return false;
+
+	ExynosMosaic::tile &t = mosaic->tiles[tile];
+
+	// A page that is still waiting is never going to be displayed.
+	if (t.next) {
+		displaced = t.next;
+		frames_replaced++;
+	}
+
+	t.next = p;
+
+	return mosaic->commit();
+}
+
+int ExynosDRM::get_pack_fd() const
+{
+	if (!mosaic)
+		return -1;
+
+	return mosaic->pack_loop.get_fd();
+}
+
+bool ExynosDRM::handle_pack()
+{
+	if (!mosaic)
+		return false;
+
+	return mosaic->handle_pack();
+}
+
+bool ExynosDRM::wait_for_pack()
+{
+	if (!mosaic || !(mosaic->flags & ExynosMosaic::packing))
+		return false;
+
+	struct pollfd pfd = { mosaic->pack_loop.get_fd(), POLLIN, 0 };
+
+	// The timer of the loop ends the packing in any case.
+	if (poll(&pfd, 1, -1) < 0)
+		return false;
+
+	return mosaic->handle_pack();
+}
+
+void ExynosDRM::setup_clones(uint32_t drm_fmt)
+{
+	static const std::string msg_prefix("ExynosDRM::setup_clones(): ");
+
+	using namespace std;
+
+	if (drm->clones.empty())
+		return;
+
+	auto plane_resources = drmMode::make_unique(drmModeGetPlaneResources(fd));
+	if (!plane_resources) {
+		cerr << msg_prefix << "failed to get DRM plane resources, clone outputs dropped.\n";
+		drop_clones();
+		return;
+	}
+
+	vector<uint32_t> used_planes{drm->plane_id[plane_primary], drm->plane_id[plane_video]};
+
+	for (auto it = drm->clones.begin(); it != drm->clones.end();) {
+		it->plane_id = 0;
+
+		for (unsigned i = 0; i < plane_resources->count_planes && !it->plane_id; ++i) {
+			const uint32_t plane_id = plane_resources->planes[i];
+
+			if (find(used_planes.cbegin(), used_planes.cend(), plane_id) != used_planes.cend())
+				continue;
+
+			drmModePlane *plane = drmModeGetPlane(fd, plane_id);
+			if (!plane)
+				continue;
+
+			if (plane->possible_crtcs & (1 << it->crtc_index)) {
+				for (unsigned j = 0; j < plane->count_formats; ++j) {
+					if (plane->formats[j] == drm_fmt) {
+						it->plane_id = plane_id;
+						break;
+					}
+				}
+			}
+
+			drmModeFreePlane(plane);
+		}
+
+		if (!it->plane_id) {
+			cerr << msg_prefix << "no video plane for CRTC " << it->crtc_id
+				 << " found, clone output dropped.\n";
+
+			drmModeDestroyPropertyBlob(fd, it->mode_blob_id);
+			it = drm->clones.erase(it);
+
+			continue;
+		}
+
+		used_planes.push_back(it->plane_id);
+		++it;
+	}
+}
+
+void ExynosDRM::drop_clones()
+{
+	for (auto &i : drm->clones) {
+		if (i.mode_blob_id != 0)
+			drmModeDestroyPropertyBlob(fd, i.mode_blob_id);
+	}
+
+	drm->clones.clear();
+}
+
+void ExynosDRM::set_scaling(enum scaling_mode m)
+{
+	scaling = m;
+}
+
+bool ExynosDRM::init_free_list()
+{
+	free_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+	if (free_fd < 0)
+		return false;
+
+	// All pages start out free.
+	const uint64_t count = pages.size();
+
+	if (write(free_fd, &count, sizeof(count)) != sizeof(count)) {
+		::close(free_fd);
+		free_fd = -1;
+
+		return false;
+	}
+
+	free_mask.store((count == max_pages) ? ~uint64_t(0) : (uint64_t(1) << count) - 1);
+
+	return true;
+}
+
+void ExynosDRM::deinit_free_list()
+{
+	if (free_fd >= 0)
+		::close(free_fd);
+
+	free_fd = -1;
+	free_mask.store(0);
+}
+
+void ExynosDRM::release_page(ExynosPage *p)
+{
+	static const std::string msg_prefix("ExynosDRM::release_page(): ");
+
+	const unsigned index = p - pages.data();
+	const uint64_t one = 1;
+
+	p->state = ExynosPage::state_free;
+
+	// Count the page before it can be claimed, so that get_page()
+	// always finds the count for it.
+	if (write(free_fd, &one, sizeof(one)) != sizeof(one))
+		std::cerr << msg_prefix << "failed to signal free page.\n";
+
+	free_mask.fetch_or(uint64_t(1) << index, std::memory_order_release);
+}
+
+ExynosPage* ExynosDRM::get_page()
+{
+	static const std::string msg_prefix("ExynosDRM::get_page(): ");
+
+	uint64_t mask = free_mask.load(std::memory_order_acquire);
+
+	// Claim the lowest free page. If another thread claimed a page in
+	// the meantime, the exchange fails and updates the mask.
+	while (mask != 0) {
+		const unsigned index = __builtin_ctzll(mask);
+		const uint64_t claimed = mask & ~(uint64_t(1) << index);
+
+		if (!free_mask.compare_exchange_weak(mask, claimed, std::memory_order_acquire))
+			continue;
+
+		// This never blocks, the page was counted before it was freed.
+		uint64_t value;
+
+		if (read(free_fd, &value, sizeof(value)) != sizeof(value))
+			std::cerr << msg_prefix << "free page count out of sync.\n";
+
+		ExynosPage *p = &pages[index];
+
+		p->state = ExynosPage::state_queued;
+
+		return p;
+	}
+
+	return nullptr;
+}
+
+ExynosPage* ExynosDRM::acquire_page(int timeout)
+{
+	ExynosPage *p = get_page();
+
+	// Another thread might take the page that woke us up, in that
+	// case we wait again.
+	while (!p && free_fd >= 0) {
+		struct pollfd pfd = { free_fd, POLLIN, 0 };
+		const int ret = poll(&pfd, 1, timeout);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			break;
+
+		p = get_page();
+	}
+
+	return p;
+}
+
+std::vector<ExynosPage*> ExynosDRM::get_pages()
+{
+	std::vector<ExynosPage*> ret;
+
+	for (auto &i : pages)
+		ret.push_back(&i);
+
+	return ret;
+}
+
+int ExynosDRM::get_page_fd() const
+{
+	return free_fd;
+}
+
+bool ExynosDRM::wait_for_flip()
+{
+	// Nothing to wait for, e.g. when all pages are with the decoder.
+	if (!(flags & pageflip_pending))
+		return false;
+
+	fh->wait();
+
+	return true;
+}
+
+bool ExynosDRM::commit_flip(ExynosPage *p)
+{
+	static const std::string msg_prefix("ExynosDRM::commit_flip(): ");
+
+	drmModeAtomicReq *req = p->atomic_request;
+	const int cursor = drmModeAtomicGetCursor(req);
+
+	// Ask for an out-fence for this commit only. The cursor is reset
+	// afterwards, so that the request of the page stays unchanged.
+	if (drm->out_fence_prop != 0) {
+		fence_storage = -1;
+
+		if (drmModeAtomicAddProperty(req, drm->crtc_id, drm->out_fence_prop,
+									 uint64_t(uintptr_t(&fence_storage))) < 0) {
+			drmModeAtomicSetCursor(req, cursor);
+
+			std::cerr << msg_prefix << "failed to request out-fence.\n";
+			return false;
+		}
+	}
+
+	// Update the overlay together with the page, if its text changed.
+	if (!overlay->add_update(req)) {
+		drmModeAtomicSetCursor(req, cursor);
+
+		std::cerr << msg_prefix << "failed to add overlay update.\n";
+		return false;
+	}
+
+	// Capture the output of this flip, if it is due.
+	if (writeback && !writeback->add_capture(req)) {
+		drmModeAtomicSetCursor(req, cursor);
+
+		std::cerr << msg_prefix << "failed to add writeback capture.\n";
+		return false;
+	}
+
+	// Show the cue that is due for the page.
+	if (subtitles && !subtitles->add_update(req, p->index)) {
+		drmModeAtomicSetCursor(req, cursor);
+
+		std::cerr << msg_prefix << "failed to add subtitle update.\n";
+		return false;
+	}
+
+	// Move the video planes to the geometry of the next stream.
+	if (flags & geometry_pending) {
+		bool ok = add_video_props(req, *drm, drm->plane_id[plane_video], drm->crtc_id,
+								  compute_geometry(scaling, width, height, page_vi));
+
+		for (auto &i : drm->clones) {
+			ok = ok && add_video_props(req, *drm, i.plane_id, i.crtc_id,
+									   compute_geometry(scaling, i.w, i.h, page_vi));
+		}
+
+		if (!ok) {
+			drmModeAtomicSetCursor(req, cursor);
+
+			std::cerr << msg_prefix << "failed to add video plane geometry.\n";
+			return false;
+		}
+	}
+
+	p->issue_time = monotonic_us();
+
+	// Issue a page flip at the next vblank interval. The commit
+	// returns at once, the completion is reported by an event.
+	const int ret = drmModeAtomicCommit(fd, req,
+		DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK, p);
+
+	drmModeAtomicSetCursor(req, cursor);
+
+	if (ret) {
+		std::cerr << msg_prefix << "failed to issue atomic page flip.\n";
+		return false;
+	}
+
+	out_fence = (drm->out_fence_prop != 0) ? fence_storage : -1;
+	overlay->handle_commit();
+
+	flags &= ~geometry_pending;
+
+	if (writeback)
+		writeback->handle_commit();
+
+	if (subtitles)
+		subtitles->handle_commit();
+
+	// Each CRTC reports the flip with its own event.
+	pending_crtcs = 1 + drm->clones.size();
+	first_flip_time = 0;
+
+	p->state = ExynosPage::state_pending;
+	pending_page = p;
+
+	flags |= pageflip_pending;
+
+	return true;
+}
+
+void ExynosDRM::complete_flip(ExynosPage *p)
+{
+	// The previous page left the screen, it can go back to the decoder.
+	if (cur_page && cur_page != p)
+		release_page(cur_page);
+
+	p->state = ExynosPage::state_on_screen;
+	cur_page = p;
+	pending_page = nullptr;
+	pending_crtcs = 0;
+
+	// The page of the previous stream left the screen.
+	retired_pages.clear();
+
+	overlay->handle_flip();
+
+	if (subtitles)
+		subtitles->handle_flip();
+
+	if (out_fence >= 0) {
+		::close(out_fence);
+		out_fence = -1;
+	}
+
+	flags &= ~pageflip_pending;
+}
+
+bool ExynosDRM::flush_mailbox()
+{
+	// Flip to the page from the mailbox, once the display is free.
+	if (mailbox && !(flags & pageflip_pending)) {
+		ExynosPage *p = mailbox;
+
+		mailbox = nullptr;
+
+		return commit_flip(p);
+	}
+
+	return true;
+}
+
+bool ExynosDRM::issue_flip(ExynosPage *p)
+{
+	static const std::string msg_prefix("ExynosDRM::issue_flip(): ");
+
+	if (!p || (flags & headless))
+		return false;
+
+	// We don't queue multiple page flips.
+	if (flags & pageflip_pending) {
+		std::cerr << msg_prefix << "page flip already pending.\n";
+		return false;
+	}
+
+	return commit_flip(p);
+}
+
+bool ExynosDRM::flip_pending() const
+{
+	return (flags & pageflip_pending);
+}
+
+bool ExynosDRM::present_mailbox(ExynosPage *p, ExynosPage *&displaced)
+{
+	displaced = nullptr;
+
+	if (!p || (flags & headless))
+		return false;
+
+	// The page waits for the pending flip to complete. A page that
+	// is still waiting is never going to be displayed.
+	if (flags & pageflip_pending) {
+		displaced = mailbox;
+		mailbox = p;
+
+		if (displaced)
+			frames_replaced++;
+
+		return true;
+	}
+
+	return commit_flip(p);
+}
+
+int ExynosDRM::get_fd() const
+{
+	return fd;
+}
+
+bool ExynosDRM::handle_events()
+{
+	if (!(flags & initialized) || (flags & headless))
+		return false;
+
+	fh->dispatch();
+
+	if (writeback)
+		writeback->collect();
+
+	// The new frames of the tiles go out once the display is free.
+	if (mosaic)
+		return mosaic->commit();
+
+	return flush_mailbox();
+}
+
+int ExynosDRM::get_fence_fd() const
+{
+	return out_fence;
+}
+
+bool ExynosDRM::handle_fence()
+{
+	if (!(flags & initialized) || (flags & headless))
+		return false;
+
+	if (out_fence < 0)
+		return true;
+
+	// The event might belong to the fence of an earlier flip, which
+	// was already completed by its flip event. Check the current one.
+	struct pollfd pfd = { out_fence, POLLIN, 0 };
+
+	if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN))
+		return true;
+
+	// The flip event is sent when the fence signals, so read it first
+	// to get the timestamp of the flip for the statistics.
+	fh->dispatch();
+
+	if (pending_page)
+		complete_flip(pending_page);
+
+	if (writeback)
+		writeback->collect();
+
+	return flush_mailbox();
+}
+
+bool ExynosDRM::get_capture(ExynosWriteback::capture &c)
+{
+	if (!writeback || writeback->results.empty())
+		return false;
+
+	c = writeback->results.front();
+	writeback->results.pop_front();
+
+	return true;
+}
+
+bool ExynosDRM::open_flip_log(const std::string &name)
+{
+	static const std::string msg_prefix("ExynosDRM::open_flip_log(): ");
+
+	if (flip_log.is_open())
+		flip_log.close();
+
+	flip_log.open(name, std::ios::out | std::ios::trunc);
+
+	if (!flip_log) {
+		std::cerr << msg_prefix << "failed to open flip log: " << name << ".\n";
+		return false;
+	}
+
+	flip_log << "flip,frame,timestamp_us,issue_us,decode_us,vblanks,missed\n";
 
 	return true;
 }
+
+bool ExynosDRM::set_overlay_text(const std::string &text)
+{
+	if (!overlay)
+		return false;
+
+	overlay->text = text;
+
+	return overlay->update();
+}
+
+unsigned ExynosDRM::get_refresh_period() const
+{
+	return refresh_period;
+}
+
+uint64_t ExynosDRM::get_last_flip_time() const
+{
+	return last_flip_time;
+}
+
+uint64_t ExynosDRM::get_frames_presented() const
+{
+	return frames_presented;
+}
+
+uint64_t ExynosDRM::get_frames_replaced() const
+{
+	return frames_replaced;
+}
+
+unsigned ExynosDRM::get_free_pages() const
+{
+	return __builtin_popcountll(free_mask.load(std::memory_order_relaxed));
+}
+
+void ExynosDRM::add_stats(StatsReport &r) const
+{
+	r.add("flip_latency", flip_latency);
+	r.add("flip_interval", flip_interval);
+	r.add("vblank_jitter", vblank_jitter);
+	r.add("refresh_interval", refresh_interval);
+	r.add("scanout_latency", scanout_latency);
+	r.add("vblanks_missed", vblanks_missed.load());
+	r.add("vblanks_repeated", vblanks_repeated.load());
+
+	// Only reported when there were clone outputs.
+	if (clone_skew.summary().count != 0)
+		r.add("clone_skew", clone_skew);
+	r.add("frames_presented", frames_presented.load());
+	r.add("frames_late", frames_late.load());
+	r.add("frames_replaced", frames_replaced.load());
+
+	if (writeback)
+		writeback->add_stats(r);
+
+	if (subtitles)
+		subtitles->add_stats(r);
+
+	if (mosaic)
+		mosaic->add_stats(r);
+
+	pool.add_stats(r);
+}
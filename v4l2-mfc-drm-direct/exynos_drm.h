@@ -17,16 +17,29 @@
 #if !defined(__EXYNOS_DRM_)
 #define __EXYNOS_DRM_
 
+#include "main.h"
+#include "stats.h"
+#include "glyph_text.h"
+#include "drm_backend.h"
+#include "bo_pool.h"
+#include "scaler.h"
+#include "event_loop.h"
+
 #include <vector>
+#include <deque>
+#include <string>
 #include <cstdint>
+#include <atomic>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 // Forward-declarations
 class ExynosDRM;
 class FlipHandler;
-class CairoText;
+class SubtitleTrack;
 struct CommonDRM;
-struct videoinfo;
-struct exynos_device;
 struct _drmModeAtomicReq;
 typedef _drmModeAtomicReq drmModeAtomicReq;
 
@@ -37,7 +50,7 @@ class ExynosBuffer {
 	friend class ExynosDRM;
 
 private:
-	struct exynos_bo *bo;
+	drm_bo *bo;
 
 	ExynosDRM *root;
 
@@ -61,49 +74,65 @@ public:
 
 class ExynosPage {
 	friend class ExynosDRM;
+	friend class ExynosMosaic;
+
+public:
+	// Life cycle of a page. A page is handed out by ExynosDRM::get_page(),
+	// filled by the decoder, flipped to the display, and becomes free
+	// again once the next page is on the screen.
+	enum page_state {
+		state_free = 0,
+		state_queued,		// owned by the decoder
+		state_decoded,		// holds a frame that waits for the display
+		state_pending,		// flip to the page was issued
+		state_on_screen,	// page is scanned out
+	};
 
 private:
 	enum flags {
 		allocated		= (1 << 0),
 		added			= (1 << 1),
 		req_created		= (1 << 2),
-
-		// Page is currently in use.
-		page_used		= (1 << 3),
 	};
 
 	// Framebuffer information struct
 	//
-	// @{w,h}: total framebuffer width and height
+	// @{w,h}: total framebuffer width and height, including the
+	//         padding of the decoder (the visible area is selected
+	//         by the source rectangle of the plane)
+	// @pitch: pitch of the luma and the chroma plane in bytes
+	// @chroma_offset: offset of the chroma plane in bytes
 	// @pixel_format: DRM pixel format
 	// @tiling: framebuffer uses tiling layout
 	struct fbinfo {
 		unsigned w, h;
+		unsigned pitch;
+		unsigned chroma_offset;
 		uint32_t pixel_format;
 		bool tiling;
 	};
 
-	// Buffer objects and IDs for the primary and the video plane.
-	// The video plane is our actual main plane, while the
-	// primary plane functions as an overlay to display text.
-	struct exynos_bo *bo[2];
-	uint32_t buf_id[2];
-
-	// The Cairo text renderer that is used for the primary plane.
-	CairoText *renderer;
+	// Buffer object and framebuffer ID of the video plane. The overlay
+	// on the primary plane is shared by all pages (see ExynosOverlay).
+	drm_bo *bo;
+	uint32_t buf_id;
 
 	// Atomic request to display the page.
 	drmModeAtomicReq *atomic_request;
 
 	ExynosDRM *root;
 
-	unsigned flags;
+	// Timestamps (monotonic, in microseconds) of when the page was
+	// dequeued from the decoder, and when the flip to it was issued.
+	uint64_t decode_time;
+	uint64_t issue_time;
+
+	// Position of the frame in display order.
+	unsigned index;
 
-	// Internal methods
-	bool alloc_overlay();
-	bool alloc_video(unsigned size);
-	bool add_overlay();
-	bool add_video(const fbinfo &fbi);
+	enum page_state state;
+
+	unsigned flags;
 
 	// Order of operations:
 	// alloc(), add(), create_request()
@@ -128,7 +157,9 @@ private:
 	bool create_request();
 	void destroy_request();
 
-	bool initial_modeset() const;
+	// @overlay_fb: framebuffer ID of the overlay
+	// @test_only: only check if the modeset would succeed
+	bool initial_modeset(uint32_t overlay_fb, bool test_only = false) const;
 
 public:
 	ExynosPage(ExynosDRM *r);
@@ -138,49 +169,755 @@ public:
 	ExynosPage(ExynosPage &&p) noexcept;
 
 	int get_prime_fd();
+
+	// Map the video buffer of the page, e.g. to read decoded
+	// frames with the CPU. Returns nullptr if an error occurs.
+	void* mmap();
+
+	enum page_state get_state() const;
+
+	// Record that the page was queued to the decoder.
+	void mark_queued();
+
+	// Record the time when the page was filled by the decoder.
+	void mark_decoded(uint64_t timestamp);
+
+	// Set/get the position of the frame in display order, which gives
+	// the time of the frame in the stream (e.g. for subtitles).
+	void set_index(unsigned i);
+	unsigned get_index() const;
+
+	// Called when the flip to this page has completed on a CRTC. With
+	// clone outputs, the page is on the screen once all CRTCs of the
+	// flip have reported.
+	//
+	// @frame: vblank counter at the time of the flip
+	// @timestamp: time of the flip (monotonic, in microseconds)
+	// @crtc_id: CRTC that has completed the flip
+	void handle_flip(unsigned frame, uint64_t timestamp, uint32_t crtc_id);
+};
+
+
+// Text overlay on the primary plane, which is shared by all pages. The
+// overlay covers the whole screen and is double-buffered: new text is
+// rendered into the back buffer, which is then committed together with
+// the next page flip. Unchanged text is neither rendered nor committed.
+class ExynosOverlay {
+	friend class ExynosDRM;
+	friend class ExynosMosaic;
+
+private:
+	enum flags {
+		allocated		= (1 << 0),
+		added			= (1 << 1),
+
+		// The back buffer holds new text, which waits for a flip.
+		update_ready	= (1 << 2),
+
+		// The back buffer was committed, the flip is pending.
+		update_pending	= (1 << 3),
+	};
+
+	enum constants {
+		buffer_count = 2,
+	};
+
+	// @offset: offset of the buffer in the BO
+	// @buf_id: framebuffer ID
+	// @renderer: text renderer that draws into the buffer
+	struct buffer {
+		unsigned offset;
+		uint32_t buf_id;
+		GlyphText *renderer;
+	};
+
+	ExynosDRM *root;
+
+	// Glyphs that are shared by the renderers of both buffers.
+	GlyphAtlas atlas;
+
+	// Both buffers are placed in a single BO.
+	drm_bo *bo;
+	buffer buffers[buffer_count];
+
+	// Index of the buffer that is on the screen.
+	unsigned front;
+
+	unsigned width, height;
+
+	// Text that should be shown, the text on the screen, and the
+	// text in the back buffer.
+	std::string text;
+	std::string front_text;
+	std::string back_text;
+
+	// Blob with the damaged area of the back buffer (zero if none).
+	uint32_t damage_blob;
+
+	unsigned flags;
+
+	// Order of operations:
+	// alloc(), add()
+
+	// Allocate/free the overlay buffers.
+	// alloc() returns false if an error occurs.
+	//
+	// @{w,h}: size of the overlay
+	bool alloc(unsigned w, unsigned h);
+	void free();
+
+	// Add/remove the overlay buffers as framebuffers.
+	// add() returns false if an error occurs.
+	bool add();
+	void remove();
+
+	// Render the text into the back buffer, unless an earlier
+	// update is still waiting for the display.
+	bool update();
+
+	// Add the back buffer to an atomic request, if it holds new text.
+	// add_update() returns false if an error occurs.
+	//
+	// @req: request of the next flip
+	bool add_update(drmModeAtomicReq *req);
+
+	// Called after the flip was committed or has completed.
+	void handle_commit();
 	void handle_flip();
+
+	uint32_t get_front_id() const;
+
+public:
+	ExynosOverlay(ExynosDRM *r);
+	~ExynosOverlay();
+
+	ExynosOverlay(const ExynosOverlay &o) = delete;
+};
+
+
+// Capture of the composed output (video and overlay) by a writeback
+// connector, which is e.g. provided by vkms. Every n-th flip is written
+// back into a buffer, and a checksum of the buffer is computed once the
+// capture has completed. Only one capture is in flight at a time.
+class ExynosWriteback {
+	friend class ExynosDRM;
+
+public:
+	// Result of a capture.
+	//
+	// @flip: number of the captured flip (counted from the first flip)
+	// @latency: time from the commit until the capture was written
+	//           (in microseconds)
+	// @checksum: hash of the captured pixels
+	struct capture {
+		uint64_t flip;
+		uint64_t latency;
+		uint32_t checksum;
+	};
+
+private:
+	enum flags {
+		allocated			= (1 << 0),
+		added				= (1 << 1),
+
+		// The capture was added to the request of the next flip.
+		capture_queued		= (1 << 2),
+
+		// The capture was committed, its fence has not signalled yet.
+		capture_pending		= (1 << 3),
+	};
+
+	enum constants {
+		// Number of results that are kept for the consumer.
+		max_results = 16,
+	};
+
+	ExynosDRM *root;
+
+	drm_bo *bo;
+	uint32_t buf_id;
+	const uint8_t *map;
+
+	unsigned width, height, pitch;
+
+	// Capture every n-th flip.
+	unsigned decimation;
+
+	// Number of committed flips, the flip that is captured, and
+	// the first flip that is due for the next capture.
+	uint64_t flip_count;
+	uint64_t capture_flip;
+	uint64_t next_flip;
+
+	// Time when the capture was issued.
+	uint64_t issue_time;
+
+	// Fence of the pending capture (-1 if there is none). The kernel
+	// writes the fence fd to 'fence_storage' during the commit.
+	int fence;
+	int32_t fence_storage;
+
+	// Results that were not yet taken by the consumer.
+	std::deque<capture> results;
+	uint32_t last_checksum;
+
+	LatencyHistogram capture_latency;
+	LatencyHistogram checksum_time;
+
+	std::atomic<uint64_t> captures;
+
+	// Captures that were identical to the previous one.
+	std::atomic<uint64_t> repeats;
+
+	unsigned flags;
+
+	// Order of operations:
+	// alloc(), add()
+
+	// Allocate/free the capture buffer.
+	// alloc() returns false if an error occurs.
+	//
+	// @{w,h}: size of the mode
+	// @n: capture every n-th flip
+	bool alloc(unsigned w, unsigned h, unsigned n);
+	void free();
+
+	// Add/remove the capture buffer as framebuffer.
+	// add() returns false if an error occurs.
+	bool add();
+	void remove();
+
+	// Add a capture to an atomic request, if the flip is due for one
+	// and no capture is pending.
+	// add_capture() returns false if an error occurs.
+	//
+	// @req: request of the next flip
+	bool add_capture(drmModeAtomicReq *req);
+
+	// Called after the flip was committed.
+	void handle_commit();
+
+	// Compute the checksum of the pending capture, once its fence has
+	// signalled. This never blocks.
+	void collect();
+
+	void add_stats(StatsReport &r) const;
+
+public:
+	ExynosWriteback(ExynosDRM *r);
+	~ExynosWriteback();
+
+	ExynosWriteback(const ExynosWriteback &w) = delete;
+};
+
+
+// Subtitles on an additional ARGB plane, which is stacked between the
+// video and the text overlay. A worker thread renders the upcoming cues
+// ahead of time into a small cache of buffers. A flip then only switches
+// the plane to the buffer of the cue that is due for its page, which is
+// done in the same atomic commit. The plane is cropped to the text of
+// the cue, and centered at the bottom of the screen.
+class ExynosSubtitles {
+	friend class ExynosDRM;
+
+private:
+	enum flags {
+		allocated		= (1 << 0),
+		added			= (1 << 1),
+		started			= (1 << 2),
+
+		// The plane change was added to the request of the next flip.
+		update_queued	= (1 << 3),
+
+		// The plane change was committed, the flip is pending.
+		update_pending	= (1 << 4),
+	};
+
+	enum constants {
+		// Number of cue buffers. One buffer is kept for the cue on
+		// the screen, the others hold the upcoming cues.
+		slot_count = 4,
+
+		// Lines of a cue, further lines are cut off.
+		max_lines = 3,
+	};
+
+	enum slot_state {
+		slot_free = 0,
+		slot_rendering,
+		slot_ready,
+	};
+
+	// @offset: offset of the buffer in the BO
+	// @buf_id: framebuffer ID
+	// @renderer: text renderer that draws into the buffer
+	// @cue: index of the cue in the buffer (-1 if none)
+	// @{text_w,text_h}: size of the text at the bottom left of the buffer
+	// @state: slot_ready once the cue is rendered
+	struct slot {
+		unsigned offset;
+		uint32_t buf_id;
+		GlyphText *renderer;
+		int cue;
+		unsigned text_w, text_h;
+		enum slot_state state;
+	};
+
+	ExynosDRM *root;
+	const SubtitleTrack *track;
+
+	// Frame rate of the stream.
+	uint64_t fps_num, fps_den;
+
+	GlyphAtlas atlas;
+
+	// All buffers are placed in a single BO.
+	drm_bo *bo;
+	slot slots[slot_count];
+
+	// Size of a buffer, and of the screen.
+	unsigned width, height;
+	unsigned screen_w, screen_h;
+
+	std::thread *worker;
+
+	// Protects the slots and the fields below.
+	std::mutex mtx;
+	std::condition_variable cond;
+
+	// First cue that has not ended at the time of the last flip.
+	unsigned upcoming;
+
+	// Slot on the screen, and slot of the next flip (-1 for none).
+	int shown;
+	int queued;
+
+	bool stop;
+
+	// Cue that was due, but not rendered in time (-1 for none).
+	int late_cue;
+
+	LatencyHistogram render_time;
+
+	std::atomic<uint64_t> cues_shown;
+	std::atomic<uint64_t> cues_late;
+
+	unsigned flags;
+
+	// Order of operations:
+	// alloc(), add(), start()
+
+	// Allocate/free the cue buffers.
+	// alloc() returns false if an error occurs.
+	//
+	// @t: subtitle track
+	// @{num,den}: frame rate of the stream
+	// @{w,h}: size of the mode
+	bool alloc(const SubtitleTrack *t, unsigned num, unsigned den,
+			   unsigned w, unsigned h);
+	void free();
+
+	// Add/remove the cue buffers as framebuffers.
+	// add() returns false if an error occurs.
+	bool add();
+	void remove();
+
+	// Start/stop the worker thread that renders the cues.
+	void start();
+	void stop_worker();
+
+	void worker_thread();
+
+	// Find the next cue to render, and a slot for it. Called with
+	// the mutex held. Returns false if there is nothing to do.
+	bool next_job(int &cue, unsigned &s) const;
+
+	// Add the plane change to an atomic request, if the page needs
+	// another cue than the one on the screen.
+	// add_update() returns false if an error occurs.
+	//
+	// @req: request of the next flip
+	// @index: position of the page in display order
+	bool add_update(drmModeAtomicReq *req, unsigned index);
+
+	// Called after the flip was committed or has completed.
+	void handle_commit();
+	void handle_flip();
+
+	void add_stats(StatsReport &r) const;
+
+public:
+	ExynosSubtitles(ExynosDRM *r);
+	~ExynosSubtitles();
+
+	ExynosSubtitles(const ExynosSubtitles &s) = delete;
+};
+
+
+// Several streams at once, each in a tile of a grid (video wall). Every
+// tile has its own pages, which are filled by the decoder of its stream.
+// If the CRTC has enough video planes, each tile is shown on a plane of
+// its own, which scales the frames into the cell of the tile. The tiles
+// that don't get a plane are packed into a shared frame by the m2m scaler
+// (see M2MScaler). That frame is double-buffered, and shown on one more
+// plane below the others. The newest frame of each tile waits in a
+// mailbox, and the frames of all tiles go out with one atomic commit, once
+// the previous commit has reached the screen. The scalers run while the
+// event loop keeps going, and the commit is issued once they are done.
+class ExynosMosaic {
+	friend class ExynosDRM;
+
+public:
+	// @num_pages: number of pages that the decoder of the tile needs
+	// @vi: video information of the stream
+	struct tile_setup {
+		unsigned num_pages;
+		videoinfo vi;
+	};
+
+private:
+	enum flags {
+		allocated		= (1 << 0),
+
+		// The packed frame changes with the pending commit.
+		canvas_pending	= (1 << 1),
+
+		// The scalers are packing the back buffer of the packed frame.
+		packing			= (1 << 2),
+
+		// The back buffer received new frames, and goes out with
+		// the next commit.
+		canvas_ready	= (1 << 3),
+	};
+
+	enum constants {
+		// Buffers of the packed frame.
+		canvas_count = 2,
+
+		// Timeout for packing the frames of a commit (in milliseconds).
+		pack_timeout = 100,
+	};
+
+	// The scaler of tile i is registered as pack_event_scaler + i.
+	enum pack_event_id {
+		pack_event_timeout = 0,
+		pack_event_scaler,
+	};
+
+	// @pages: pages of the tile
+	// @free_pages: pages that the display doesn't use anymore
+	// @fds: dma-bufs of the pages (only for packed tiles)
+	// @vi: video information of the stream
+	// @plane_id: video plane of the tile (zero if the tile is packed)
+	// @{src,dst}: visible part of the frames, and its area on the screen
+	// @scaler: packs the frames of the tile (nullptr if it has a plane)
+	// @next: newest frame, which waits for the next commit
+	// @pending: frame of the pending commit
+	// @shown: frame on the screen (with packed tiles: the frame that
+	//         was packed last)
+	// @seq: number of frames that were taken from the mailbox
+	struct tile {
+		std::vector<ExynosPage> pages;
+		std::vector<ExynosPage*> free_pages;
+		std::vector<int> fds;
+		videoinfo vi;
+		uint32_t plane_id;
+		M2MScaler::rect src, dst;
+		M2MScaler *scaler;
+		ExynosPage *next;
+		ExynosPage *pending;
+		ExynosPage *shown;
+		uint64_t seq;
+	};
+
+	ExynosDRM *root;
+
+	std::vector<tile> tiles;
+
+	// Buffers of the packed frame, their dma-bufs, and for each buffer
+	// the frame number of each tile that it holds.
+	std::vector<ExynosPage> canvas;
+	std::vector<int> canvas_fds;
+	std::vector<uint64_t> canvas_seq[canvas_count];
+
+	// Plane of the packed frame (zero if all tiles have a plane), and
+	// the buffer that is on the screen.
+	uint32_t canvas_plane_id;
+	unsigned canvas_front;
+
+	// Frames that go out with the pending commit.
+	unsigned pending_frames;
+
+	// Scalers that are busy, and a timer that gives up on them. The
+	// loop is nested into the loop of the caller (see get_pack_fd()).
+	EventLoop pack_loop;
+	std::vector<EventLoop::event> pack_events;
+
+	// Time to pack the frames of one commit, and when it started.
+	LatencyHistogram pack_time;
+	uint64_t pack_start;
+
+	std::atomic<uint64_t> commits;
+	std::atomic<uint64_t> frames_packed;
+
+	// Frames of packed tiles that the scaler failed to pack.
+	std::atomic<uint64_t> pack_errors;
+
+	unsigned flags;
+
+	// Order of operations:
+	// alloc(), modeset()
+
+	// Allocate/free the tiles. The tiles get the video planes in
+	// order, as long as the CRTC can show them together.
+	// alloc() returns false if an error occurs.
+	//
+	// @setup: pages and video information of each tile
+	// @planes: video planes that can be used
+	// @drm_fmt: DRM pixel format of the frames
+	// @tiling: frames use tiling layout
+	bool alloc(const std::vector<tile_setup> &setup, const std::vector<uint32_t> &planes,
+			   uint32_t drm_fmt, bool tiling);
+	void free();
+
+	bool alloc_canvas();
+
+	// Check if the CRTC can show a number of tiles on their own planes,
+	// with the remaining tiles packed on the next plane.
+	//
+	// @direct: number of tiles with a plane of their own
+	// @planes: video planes that can be used
+	bool test_layout(unsigned direct, const std::vector<uint32_t> &planes);
+
+	// Enable the output, with the packed frame and without the tiles,
+	// until their first frames arrive.
+	bool modeset();
+
+	// Commit the frames from the mailboxes, unless a commit is pending.
+	// With new frames for packed tiles, the packing is started first,
+	// and the commit follows from handle_pack().
+	// commit() returns false if an error occurs.
+	bool commit();
+
+	// Start to pack the new frames into a buffer of the packed frame.
+	// Frames that the buffer missed with the previous commit are packed
+	// again. A tile whose scaler fails keeps its old frame.
+	//
+	// @back: buffer of the packed frame
+	void start_pack(unsigned back);
+
+	// Collect the scalers that are done, and issue the commit once all
+	// of them are. Scalers that take too long are stopped.
+	// handle_pack() returns false if an error occurs.
+	bool handle_pack();
+
+	// Issue the commit with the packed frame (if it changed) and the new
+	// frames of the tiles with a plane.
+	// issue() returns false if an error occurs.
+	bool issue();
+
+	void release(tile &t, ExynosPage *p);
+
+	void add_stats(StatsReport &r) const;
+
+public:
+	ExynosMosaic(ExynosDRM *r);
+	~ExynosMosaic();
+
+	ExynosMosaic(const ExynosMosaic &m) = delete;
+
+	// Called when the commit of the tiles has completed.
+	//
+	// @frame: vblank counter at the time of the flip
+	// @timestamp: time of the flip (monotonic, in microseconds)
+	void handle_flip(unsigned frame, uint64_t timestamp);
 };
 
 
 class ExynosDRM {
 	friend class ExynosPage;
+	friend class ExynosOverlay;
 	friend class ExynosBuffer;
+	friend class ExynosWriteback;
+	friend class ExynosSubtitles;
+	friend class ExynosMosaic;
 
 public:
 	enum connector_type {
 		connector_hdmi = 0,
 		connector_vga,
 		connector_other,
+
+		// Don't use any connector. Only buffer allocation is available
+		// in this mode, e.g. when decoding to a file.
+		connector_none,
+	};
+
+	// How the video is placed on the screen. The scaling is done by
+	// the display engine, using the source and CRTC rectangle of the
+	// video plane.
+	enum scaling_mode {
+		// Scale to the screen, keeping the aspect ratio.
+		scaling_fit = 0,
+
+		// Scale to cover the whole screen, keeping the aspect ratio.
+		// The parts of the frame that don't fit are cut off.
+		scaling_fill,
+
+		// Don't scale, one frame pixel is one screen pixel.
+		scaling_none,
+
+		// Scale by the largest integer factor that fits the screen.
+		scaling_integer,
 	};
 
 private:
+	enum constants {
+		// The free pages are tracked in a 64-bit mask.
+		max_pages = 64,
+	};
+
 	enum flags {
 		opened				= (1 << 0),
 		initialized			= (1 << 1),
 		buffers_alloced		= (1 << 2),
 		pages_alloced		= (1 << 3),
 		pageflip_pending	= (1 << 4),
+		headless			= (1 << 5),
+		output_enabled		= (1 << 6),
+		mosaic_alloced		= (1 << 7),
+
+		// The next flip moves the video planes to the geometry of
+		// the pages (after a stream change).
+		geometry_pending	= (1 << 8),
 	};
 
 	int fd;
 	enum connector_type preferred_connector;
-	struct exynos_device *device;
+	enum scaling_mode scaling;
+	DRMBackend *backend;
+
+	// Pool for the BOs of the pages and the overlay, which is kept
+	// until the buffers are freed.
+	BOPool pool;
 
 	CommonDRM *drm;
 	FlipHandler *fh;
 
 	std::vector<ExynosPage> pages;
 
+	// Video information that the pages were allocated for.
+	videoinfo page_vi;
+
+	// Free list of the pages: a bit for each free page, and an eventfd
+	// (in semaphore mode) that counts them. A released page is counted
+	// before its bit is set, so the count never lags behind the mask.
+	// This makes the hand-off of pages safe between threads, e.g. with
+	// the flip events handled on another thread than the decoder.
+	std::atomic<uint64_t> free_mask;
+	int free_fd;
+
+	// text overlay (nullptr in headless mode)
+	ExynosOverlay *overlay;
+
+	// capture of the output (nullptr if writeback is not enabled)
+	ExynosWriteback *writeback;
+	unsigned writeback_decimation;
+
+	// subtitles (nullptr if there are none), with the track and the
+	// frame rate that is used to time the cues
+	ExynosSubtitles *subtitles;
+	const SubtitleTrack *subtitle_track;
+	unsigned subtitle_fps_num, subtitle_fps_den;
+
+	// tiles of several streams (nullptr if there is only one stream)
+	ExynosMosaic *mosaic;
+
 	// currently displayed page
 	ExynosPage *cur_page;
 
+	// page of the previous stream, which stays on the screen until the
+	// first flip of the next stream (see reset_pages())
+	std::vector<ExynosPage> retired_pages;
+
+	// page that the pending flip goes to
+	ExynosPage *pending_page;
+
+	// page that is flipped once the pending flip completes (mailbox mode)
+	ExynosPage *mailbox;
+
 	// dimensions of the selected mode
 	unsigned width, height;
 
+	// refresh period of the selected mode in microseconds
+	unsigned refresh_period;
+
+	// Time from dequeueing a page from the decoder until it is scanned out.
+	LatencyHistogram flip_latency;
+
+	// Interval between two completed flips, and its deviation
+	// from the closest multiple of the refresh period.
+	LatencyHistogram flip_interval;
+	LatencyHistogram vblank_jitter;
+
+	// Time from issuing a flip until the vblank that latched it, and
+	// the refresh interval that was measured by the vblank counter.
+	LatencyHistogram scanout_latency;
+	LatencyHistogram refresh_interval;
+
+	// Time and vblank counter of the last completed flip.
+	uint64_t last_flip_time;
+	unsigned last_frame;
+
+	// One line per completed flip (if enabled).
+	std::ofstream flip_log;
+
+	// Out-fence of the pending flip (-1 if there is none). The kernel
+	// writes the fence fd to 'fence_storage' during the commit.
+	int out_fence;
+	int32_t fence_storage;
+
+	// Number of CRTCs that have not yet reported the pending flip, and
+	// the time of the first report.
+	unsigned pending_crtcs;
+	uint64_t first_flip_time;
+
+	// Difference between the flip of the main output and the flips
+	// of the clone outputs.
+	LatencyHistogram clone_skew;
+
+	std::atomic<uint64_t> frames_presented;
+	std::atomic<uint64_t> frames_late;
+
+	// Pages that were replaced in the mailbox before being displayed.
+	std::atomic<uint64_t> frames_replaced;
+
+	// Vblanks that a flip landed later than the first vblank after it
+	// was issued, and vblanks that showed the previous frame again.
+	std::atomic<uint64_t> vblanks_missed;
+	std::atomic<uint64_t> vblanks_repeated;
+
 	unsigned flags;
 
 	bool check_connector_type(enum connector_type ct, uint32_t drm_ct) const;
 
+	// Find a connected output of a type, whose connector and CRTC are
+	// not used yet by the main output or a clone.
+	bool find_output(enum connector_type ct, uint32_t &connector_id,
+					 unsigned &crtc_index, uint32_t &crtc_id) const;
+
+	// Select a video plane for each clone output, and drop the clones
+	// that can't be used.
+	void setup_clones(uint32_t drm_fmt);
+	void drop_clones();
+	bool init_free_list();
+	void deinit_free_list();
+	void release_page(ExynosPage *p);
+
+	bool commit_flip(ExynosPage *p);
+	void complete_flip(ExynosPage *p);
+	bool flush_mailbox();
+
 public:
 	ExynosDRM();
 	~ExynosDRM();
@@ -189,15 +926,50 @@ public:
 
 	// Order of operations:
 	// open(), init(), alloc_buffers(), alloc_pages()
-	// Any other order is going to result in an error.
+	// alloc_buffers() only depends on open(), so it can also come
+	// before init(). Any other order is going to result in an error.
 
 	// Open/close the Exynos DRM.
 	// open() returns false if an error occurs.
 	//
 	// @ct: connector type that should be used
-	bool open(enum connector_type ct);
+	// With connector_none no display setup is done, and the pages are
+	// neither added as framebuffers nor can they be flipped.
+	// @bt: backend that allocates the buffers (with backend_dumb, the
+	//      first KMS device is used, e.g. vkms)
+	bool open(enum connector_type ct,
+			  enum DRMBackend::backend_type bt = DRMBackend::backend_exynos);
 	void close();
 
+	// Mirror the video to another output. Has to be called between
+	// open() and init(). The output uses its native mode, and shows
+	// the same pages as the main output, without the overlay. Both
+	// outputs are flipped with one atomic commit.
+	// add_clone() returns false if no such output is available.
+	//
+	// @ct: connector type of the output
+	bool add_clone(enum connector_type ct);
+
+	// Capture the composed output of the main CRTC with a writeback
+	// connector, e.g. to verify the output of vkms without a monitor.
+	// Has to be called between open() and enable_output() or
+	// alloc_pages().
+	// enable_writeback() returns false if no usable writeback
+	// connector is available.
+	//
+	// @decimation: capture every n-th flip
+	bool enable_writeback(unsigned decimation);
+
+	// Show subtitles on an additional plane. Has to be called between
+	// open() and alloc_pages(). The cues are timed by the position of the
+	// pages in display order (see ExynosPage::set_index()). If the CRTC
+	// has no plane left for the subtitles, they are not shown.
+	// enable_subtitles() returns false if an error occurs.
+	//
+	// @t: subtitle track (has to stay valid until the pages are freed)
+	// @{num,den}: frame rate of the stream
+	bool enable_subtitles(const SubtitleTrack *t, unsigned num, unsigned den);
+
 	// Initialize/deinitialize the Exynos DRM.
 	// Does some basic initialization for the requested mode.
 	// init() returns false if an error occurs.
@@ -207,6 +979,15 @@ public:
 	bool init(unsigned w, unsigned h);
 	void deinit();
 
+	// Enable the main output with the mode of init(), before the pages
+	// are allocated. The full modeset is the slowest part of the display
+	// setup. Done ahead, e.g. while the decoder parses the stream header,
+	// the first commit of alloc_pages() only has to set up the planes.
+	// Has to be called after the clones and the writeback are set up.
+	// enable_output() returns false if an error occurs, in which case
+	// alloc_pages() does the full modeset as usual.
+	bool enable_output();
+
 	// Allocate/free the Exynos DRM buffers.
 	// Allocates mmap-capable buffer to be used as source for MFC decoding.
 	// alloc_buffers() returns false if an error occurs.
@@ -228,11 +1009,156 @@ public:
 	bool alloc_pages(unsigned num_pages, const videoinfo &vi);
 	void free_pages();
 
-	// Get a pointer to a free page.
+	// Prepare the pages for the next stream. The outputs stay enabled,
+	// and the last frame stays on the screen until the first frame of
+	// the next stream replaces it. Pages with the same buffer layout are
+	// kept, other pages are added or dropped (from/to the BO pool). If
+	// the geometry changes, the first flip updates the video planes.
+	// Only a change of the pixel format needs a new modeset. The
+	// decoder of the previous stream must not hold any pages anymore.
+	// Without pages, this is the same as alloc_pages().
+	// reset_pages() returns false if an error occurs.
+	//
+	// @num_pages: number of pages that the next stream needs
+	// @vi: video information of the next stream
+	bool reset_pages(unsigned num_pages, const videoinfo &vi);
+
+	// Allocate/free the pages of a mosaic, which shows several streams
+	// at once in a grid of tiles (see ExynosMosaic). This is used instead
+	// of alloc_pages(), and the pages of each tile are handled by the
+	// tile functions below. Clone outputs, writeback and subtitles are
+	// not available with a mosaic.
+	// alloc_mosaic() returns false if an error occurs.
+	//
+	// @setup: pages and video information of each stream
+	bool alloc_mosaic(const std::vector<ExynosMosaic::tile_setup> &setup);
+	void free_mosaic();
+
+	// Pointers to all pages of a tile (see get_pages()).
+	//
+	// @tile: index of the tile
+	std::vector<ExynosPage*> get_tile_pages(unsigned tile);
+
+	// Get a free page of a tile, which the display doesn't use anymore.
+	// This never blocks, and returns nullptr if no page is free.
+	//
+	// @tile: index of the tile
+	ExynosPage* get_tile_page(unsigned tile);
+
+	// Present a page of a tile. The page goes out with the next commit,
+	// together with the pages of the other tiles. A page of the tile that
+	// was still waiting for the commit is returned in 'displaced'. This
+	// never blocks.
+	// present_tile() returns false if an error occurs.
+	//
+	// @tile: index of the tile
+	// @p: page with the decoded frame
+	bool present_tile(unsigned tile, ExynosPage *p, ExynosPage *&displaced);
+
+	// A fd that becomes readable when the scalers of the packed tiles
+	// need attention (-1 without a mosaic). The commit of the tiles is
+	// issued by handle_pack(), once the packing has completed.
+	int get_pack_fd() const;
+
+	// Handle the scalers that are done. This never blocks.
+	// handle_pack() returns false if an error occurs.
+	bool handle_pack();
+
+	// Wait for the packing of the tiles to complete.
+	// Returns false if no packing is in progress.
+	bool wait_for_pack();
+
+	// Select how the video is scaled to the mode. Has to be called
+	// before alloc_pages() (default: scaling_fit). With a mosaic, this
+	// is how the video is scaled to the cell of its tile.
+	void set_scaling(enum scaling_mode m);
+
+	// Get a pointer to a free page. The page is considered to be
+	// queued to the decoder from now on. This never blocks, and
+	// returns nullptr if no page is free.
 	ExynosPage* get_page();
 
-	void wait_for_flip();
+	// Same as get_page(), but wait for a page to become free.
+	//
+	// @timeout: timeout in milliseconds for each wait (-1 for none)
+	ExynosPage* acquire_page(int timeout);
+
+	// Pointers to all pages, whatever their state is, e.g. to set them
+	// up with the decoder ahead (see MFCDecoder::prepare_dest()).
+	std::vector<ExynosPage*> get_pages();
+
+	// An eventfd, which is readable while pages are free.
+	int get_page_fd() const;
+
+	// Wait for the pending page flip to complete.
+	// Returns false if no flip is pending.
+	bool wait_for_flip();
+
+	// Issue a flip to a page at the next vblank. This does not block,
+	// the completion is handled by handle_events().
+	// issue_flip() returns false if a flip is pending or an error occurs.
 	bool issue_flip(ExynosPage *p);
+	bool flip_pending() const;
+
+	// Present a page in mailbox mode. If a flip is pending, the page
+	// replaces the one that waits for the flip, and the replaced page is
+	// returned in 'displaced'. This never blocks.
+	// present_mailbox() returns false if an error occurs.
+	bool present_mailbox(ExynosPage *p, ExynosPage *&displaced);
+
+	// The DRM fd, which becomes readable when a flip has completed.
+	int get_fd() const;
+
+	// Handle the completed flips, and flip to the page from the
+	// mailbox. This never blocks.
+	// handle_events() returns false if an error occurs.
+	bool handle_events();
+
+	// The out-fence of the pending flip, which becomes readable when the
+	// flip has reached the screen. Returns -1 if no flip is pending, or
+	// if the driver does not support out-fences.
+	int get_fence_fd() const;
+
+	// Release the page that left the screen, once the out-fence has
+	// signalled. This might happen before the flip event is read.
+	// Also flips to the page from the mailbox. This never blocks.
+	// handle_fence() returns false if an error occurs.
+	bool handle_fence();
+
+	// Log every completed flip of the main output as CSV: the flip
+	// number, the vblank counter, the times of the flip, of issuing it
+	// and of decoding the page (monotonic, in microseconds), the vblanks
+	// since the previous flip, and how many of them were missed.
+	// open_flip_log() returns false if an error occurs.
+	//
+	// @name: path of the log file
+	bool open_flip_log(const std::string &name);
+
+	// Take the oldest result of the writeback captures, which were not
+	// taken yet. Returns false if there is none.
+	bool get_capture(ExynosWriteback::capture &c);
+
+	// Set the text that is shown on the overlay. The overlay is
+	// updated together with the next page flip.
+	// set_overlay_text() returns false if an error occurs.
+	bool set_overlay_text(const std::string &text);
+
+	// Refresh period of the selected mode in microseconds.
+	unsigned get_refresh_period() const;
+
+	// Time of the last completed flip (zero if there was none).
+	uint64_t get_last_flip_time() const;
+
+	uint64_t get_frames_presented() const;
+
+	// Pages that were replaced in the mailbox (see present_mailbox()).
+	uint64_t get_frames_replaced() const;
+
+	// Number of pages in the free list (see get_page()).
+	unsigned get_free_pages() const;
+
+	// Add the presentation statistics to a report.
+	void add_stats(StatsReport &r) const;
 };
 
 #endif // __EXYNOS_DRM_
@@ -0,0 +1,453 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file_writer.h"
+#include "detile.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <linux/videodev2.h>
+
+namespace {
+
+// Write all vectors to a file, starting at 'offset'. Partial writes
+// are continued, the vectors are modified in the process.
+bool
+pwritev_all(int fd, std::vector<struct iovec> &iov, off_t offset)
+{
+	unsigned first = 0;
+
+	while (first < iov.size()) {
+		const int count = std::min<size_t>(iov.size() - first, IOV_MAX);
+
+		ssize_t ret = pwritev(fd, &iov[first], count, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			return false;
+
+		offset += ret;
+
+		// Skip the vectors that were written completely, and
+		// adjust the one that was only written partially.
+		while (ret > 0) {
+			if (size_t(ret) >= iov[first].iov_len) {
+				ret -= iov[first].iov_len;
+				++first;
+			} else {
+				iov[first].iov_base = static_cast<uint8_t*>(iov[first].iov_base) + ret;
+				iov[first].iov_len -= ret;
+				ret = 0;
+			}
+		}
+	}
+
+	return true;
+}
+
+}; // anonymous namespace
+
+FramePacker::FramePacker() : planar(false)
+{
+	zerostruct(&vi);
+}
+
+bool FramePacker::init(const videoinfo &v, bool p)
+{
+	static const std::string msg_prefix("FramePacker::init(): ");
+
+	using namespace std;
+
+	switch (v.pixel_format) {
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_NV12MT:
+		break;
+
+	default:
+		cerr << msg_prefix << "unsupported V4L2 pixel format.\n";
+		return false;
+	}
+
+	if (v.crop_w == 0 || v.crop_h == 0) {
+		cerr << msg_prefix << "invalid video parameters.\n";
+		return false;
+	}
+
+	vi = v;
+	planar = p;
+
+	if (vi.pixel_format == V4L2_PIX_FMT_NV12MT)
+		scratch.resize(((vi.crop_w + 1) & ~1u) * ((vi.crop_h + 1) / 2));
+	else
+		scratch.clear();
+
+	return true;
+}
+
+unsigned FramePacker::get_frame_size() const
+{
+	// The chroma plane has half the resolution in both directions.
+	const unsigned chroma_w = (vi.crop_w + 1) & ~1u;
+	const unsigned chroma_h = (vi.crop_h + 1) / 2;
+
+	return vi.crop_w * vi.crop_h + chroma_w * chroma_h;
+}
+
+FileWriter::FileWriter() : writer(nullptr), failed(false), stop(false), flags(0)
+{
+	// Nothing here.
+}
+
+FileWriter::~FileWriter()
+{
+	close();
+}
+
+bool FileWriter::open(const std::string &name, enum format f, const videoinfo &v,
+					  unsigned fps_num, unsigned fps_den)
+{
+	static const std::string msg_prefix("FileWriter::open(): ");
+
+	if (flags & opened)
+		return false;
+
+	using namespace std;
+
+	if (fps_num == 0 || fps_den == 0) {
+		cerr << msg_prefix << "invalid frame rate.\n";
+		return false;
+	}
+
+	if (!packer.init(v, f == format_y4m))
+		return false;
+
+	fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		cerr << msg_prefix << "failed to open output file: " << name << ".\n";
+		return false;
+	}
+
+	fmt = f;
+
+	frame_size = packer.get_frame_size();
+	batch_frames = max(1u, unsigned(batch_size) / frame_size);
+
+	file_offset = 0;
+	data_offset = 0;
+	frame_header.clear();
+
+	if (fmt == format_y4m) {
+		const string header = "YUV4MPEG2 W" + to_string(v.crop_w) +
+			" H" + to_string(v.crop_h) + " F" + to_string(fps_num) + ':' +
+			to_string(fps_den) + " Ip A0:0 C420mpeg2\n";
+
+		if (pwrite(fd, header.data(), header.size(), 0) != ssize_t(header.size())) {
+			cerr << msg_prefix << "failed to write Y4M header.\n";
+			::close(fd);
+			return false;
+		}
+
+		file_offset = data_offset = header.size();
+		frame_header = "FRAME\n";
+	}
+
+	for (auto &i : stage) {
+		i.data.resize(batch_frames * frame_size);
+		i.num_frames = 0;
+		i.offset = 0;
+		i.busy = false;
+	}
+
+	cur = 0;
+	failed = false;
+	stop = false;
+
+	writer = new std::thread(&FileWriter::writer_thread, this);
+
+	cout << msg_prefix << "writing " << (fmt == format_y4m ? "Y4M" : "NV12")
+		 << " to " << name << " (" << batch_frames << " frame(s) per batch).\n";
+
+	flags |= opened;
+
+	return true;
+}
+
+void FileWriter::close()
+{
+	static const std::string msg_prefix("FileWriter::close(): ");
+
+	if (!(flags & opened))
+		return;
+
+	// Flush the partially filled batch and wait for the writer.
+	submit();
+
+	for (unsigned i = 0; i < staging_count; ++i)
+		wait_idle(i);
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stop = true;
+	}
+
+	cv.notify_all();
+	writer->join();
+	delete writer;
+	writer = nullptr;
+
+	if (failed)
+		std::cerr << msg_prefix << "output file is incomplete.\n";
+
+	::close(fd);
+
+	flags &= ~opened;
+}
+
+unsigned FileWriter::get_frame_size() const
+{
+	if (!(flags & opened))
+		return 0;
+
+	return frame_size;
+}
+
+void FramePacker::pack_luma(const uint8_t *src, uint8_t *dst) const
+{
+	if (vi.pixel_format == V4L2_PIX_FMT_NV12MT) {
+		detile_nv12mt(src, vi.w, vi.h, dst, vi.crop_w,
+					  vi.crop_left, vi.crop_top, vi.crop_w, vi.crop_h);
+		return;
+	}
+
+	src += vi.crop_top * vi.w + vi.crop_left;
+
+	for (unsigned i = 0; i < vi.crop_h; ++i)
+		std::memcpy(dst + i * vi.crop_w, src + i * vi.w, vi.crop_w);
+}
+
+void FramePacker::pack_chroma(const uint8_t *src, uint8_t *dst)
+{
+	const unsigned x = vi.crop_left & ~1u;
+	const unsigned y = vi.crop_top / 2;
+	const unsigned w = (vi.crop_w + 1) & ~1u;
+	const unsigned h = (vi.crop_h + 1) / 2;
+
+	const uint8_t *in;
+	unsigned in_stride;
+
+	if (vi.pixel_format == V4L2_PIX_FMT_NV12MT) {
+		// Without deinterleaving, we can detile directly into the destination.
+		uint8_t *out = planar ? scratch.data() : dst;
+
+		detile_nv12mt(src, vi.w, vi.h / 2, out, w, x, y, w, h);
+
+		if (!planar)
+			return;
+
+		in = out;
+		in_stride = w;
+	} else {
+		in = src + y * vi.w + x;
+		in_stride = vi.w;
+
+		if (!planar) {
+			for (unsigned i = 0; i < h; ++i)
+				std::memcpy(dst + i * w, in + i * in_stride, w);
+
+			return;
+		}
+	}
+
+	// Split the interleaved chroma into separate U and V planes.
+	const unsigned plane_size = (w / 2) * h;
+	const bool swap = (vi.pixel_format == V4L2_PIX_FMT_NV21);
+
+	uint8_t *u = dst + (swap ? plane_size : 0);
+	uint8_t *v = dst + (swap ? 0 : plane_size);
+
+	for (unsigned i = 0; i < h; ++i) {
+		const uint8_t *line = in + i * in_stride;
+
+		for (unsigned j = 0; j < w / 2; ++j) {
+			*u++ = line[j * 2 + 0];
+			*v++ = line[j * 2 + 1];
+		}
+	}
+}
+
+void FramePacker::pack(const uint8_t *src, uint8_t *dst)
+{
+	pack_luma(src, dst);
+	pack_chroma(src + vi.buffer_size[0], dst + vi.crop_w * vi.crop_h);
+}
+
+uint8_t* FileWriter::next_frame()
+{
+	if (!wait_idle(cur))
+		return nullptr;
+
+	staging &s = stage[cur];
+
+	return s.data.data() + s.num_frames * frame_size;
+}
+
+bool FileWriter::write(const uint8_t *src)
+{
+	if (!(flags & opened))
+		return false;
+
+	uint8_t *dst = next_frame();
+	if (!dst)
+		return false;
+
+	packer.pack(src, dst);
+
+	staging &s = stage[cur];
+	if (++s.num_frames == batch_frames)
+		return submit();
+
+	return true;
+}
+
+bool FileWriter::write_packed(const uint8_t *src)
+{
+	if (!(flags & opened))
+		return false;
+
+	uint8_t *dst = next_frame();
+	if (!dst)
+		return false;
+
+	std::memcpy(dst, src, frame_size);
+
+	staging &s = stage[cur];
+	if (++s.num_frames == batch_frames)
+		return submit();
+
+	return true;
+}
+
+bool FileWriter::write_packed_at(uint64_t first, unsigned count, const uint8_t *src)
+{
+	if (!(flags & opened))
+		return false;
+
+	std::vector<struct iovec> iov;
+
+	for (unsigned i = 0; i < count; ++i) {
+		if (!frame_header.empty()) {
+			iov.push_back({const_cast<char*>(frame_header.data()),
+						   frame_header.size()});
+		}
+
+		iov.push_back({const_cast<uint8_t*>(src) + i * frame_size, frame_size});
+	}
+
+	const off_t offset = data_offset + off_t(first) * (frame_header.size() + frame_size);
+
+	return pwritev_all(fd, iov, offset);
+}
+
+bool FileWriter::submit()
+{
+	staging &s = stage[cur];
+
+	if (s.num_frames == 0)
+		return true;
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+
+		s.offset = file_offset;
+		s.busy = true;
+	}
+
+	cv.notify_all();
+
+	file_offset += off_t(s.num_frames) * (frame_header.size() + frame_size);
+	cur = (cur + 1) % staging_count;
+
+	return true;
+}
+
+bool FileWriter::wait_idle(unsigned index)
+{
+	std::unique_lock<std::mutex> lock(mtx);
+
+	cv.wait(lock, [&] { return !stage[index].busy; });
+
+	return !failed;
+}
+
+bool FileWriter::write_batch(const staging &s)
+{
+	std::vector<struct iovec> iov;
+
+	for (unsigned i = 0; i < s.num_frames; ++i) {
+		if (!frame_header.empty()) {
+			iov.push_back({const_cast<char*>(frame_header.data()),
+						   frame_header.size()});
+		}
+
+		iov.push_back({const_cast<uint8_t*>(s.data.data()) + i * frame_size,
+					   frame_size});
+	}
+
+	return pwritev_all(fd, iov, s.offset);
+}
+
+void FileWriter::writer_thread()
+{
+	static const std::string msg_prefix("FileWriter::writer_thread(): ");
+
+	// Batches are submitted in order, so we can just cycle
+	// through the staging buffers.
+	unsigned next = 0;
+
+	std::unique_lock<std::mutex> lock(mtx);
+
+	while (true) {
+		cv.wait(lock, [&] { return stage[next].busy || stop; });
+
+		if (!stage[next].busy)
+			break;
+
+		lock.unlock();
+		const bool ret = write_batch(stage[next]);
+		lock.lock();
+
+		if (!ret && !failed) {
+			std::cerr << msg_prefix << "failed to write frames (errno="
+					  << errno << ").\n";
+			failed = true;
+		}
+
+		stage[next].num_frames = 0;
+		stage[next].busy = false;
+		next = (next + 1) % staging_count;
+
+		cv.notify_all();
+	}
+}
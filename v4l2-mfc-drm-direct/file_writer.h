@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__FILE_WRITER_)
+#define __FILE_WRITER_
+
+#include "main.h"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <sys/types.h>
+
+
+// Converts decoded frames into a packed layout without padding, with
+// the chroma either interleaved (NV12) or split into planes (I420).
+class FramePacker {
+private:
+	videoinfo vi;
+	bool planar;
+
+	// Scratch buffer for the interleaved chroma plane.
+	std::vector<uint8_t> scratch;
+
+	void pack_luma(const uint8_t *src, uint8_t *dst) const;
+	void pack_chroma(const uint8_t *src, uint8_t *dst);
+
+public:
+	FramePacker();
+
+	FramePacker(const FramePacker &fp) = delete;
+
+	// Setup the packer for a video format.
+	// init() returns false if the format is not supported.
+	//
+	// @v: reference to a struct containing video information
+	// @p: split the chroma into separate planes
+	bool init(const videoinfo &v, bool p);
+
+	// Size of a packed frame in bytes.
+	unsigned get_frame_size() const;
+
+	// Convert a decoded frame into the packed layout.
+	//
+	// @src: start of the decoded frame (luma plane)
+	// @dst: destination with room for get_frame_size() bytes
+	void pack(const uint8_t *src, uint8_t *dst);
+};
+
+
+// Sink that writes decoded frames to a file, either as raw NV12 or
+// as Y4M (planar 4:2:0). The decoder side only converts the frame into
+// a staging buffer, the actual I/O is done by a separate writer thread.
+class FileWriter {
+public:
+	enum format {
+		format_nv12 = 0,
+		format_y4m,
+	};
+
+private:
+	enum flags {
+		opened			= (1 << 0),
+	};
+
+	enum constants {
+		// Two staging buffers: one is filled by the decoder side,
+		// while the other one is written to disk.
+		staging_count = 2,
+
+		// Target size of a single batch of frames.
+		batch_size = 4 * 1024 * 1024,
+	};
+
+	// A batch of packed frames.
+	//
+	// @data: packed frame data
+	// @num_frames: number of frames in the batch
+	// @offset: file offset of the first frame
+	// @busy: batch was submitted and is owned by the writer thread
+	struct staging {
+		std::vector<uint8_t> data;
+		unsigned num_frames;
+		off_t offset;
+		bool busy;
+	};
+
+	int fd;
+	enum format fmt;
+	FramePacker packer;
+
+	// Size of a packed frame, and the number of frames in a batch.
+	unsigned frame_size;
+	unsigned batch_frames;
+
+	// Per-frame header (only used for Y4M).
+	std::string frame_header;
+
+	staging stage[staging_count];
+	unsigned cur;
+	off_t file_offset;
+
+	// File offset of the first frame (after the Y4M header).
+	off_t data_offset;
+
+	// The mutex protects the staging state as well as the
+	// 'failed' and 'stop' members, which the writer thread uses.
+	std::thread *writer;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool failed;
+	bool stop;
+
+	unsigned flags;
+
+	void writer_thread();
+
+	bool write_batch(const staging &s);
+	bool submit();
+	bool wait_idle(unsigned index);
+
+	uint8_t* next_frame();
+
+public:
+	FileWriter();
+	~FileWriter();
+
+	FileWriter(const FileWriter &fw) = delete;
+
+	// Open/close the output file.
+	// close() flushes all pending frames.
+	// open() returns false if an error occurs.
+	//
+	// @name: path of the output file
+	// @f: output format
+	// @v: reference to a struct containing video information
+	// @fps_{num,den}: frame rate (used for the Y4M header)
+	bool open(const std::string &name, enum format f, const videoinfo &v,
+			  unsigned fps_num, unsigned fps_den);
+	void close();
+
+	// Size of a packed frame in bytes.
+	unsigned get_frame_size() const;
+
+	// Pack a decoded frame and queue it for writing. The source buffer
+	// can be reused as soon as write() returns.
+	// Returns false if an error occurs.
+	bool write(const uint8_t *src);
+
+	// Same as write(), but for a frame that was already packed, e.g.
+	// by a FramePacker that was initialized for the same format.
+	bool write_packed(const uint8_t *src);
+
+	// Write packed frames directly to their position in the file,
+	// bypassing the staging buffers and the writer thread. Several
+	// threads can call this at once, e.g. each for a different part of
+	// the stream. Don't mix this with write()/write_packed().
+	// Returns false if an error occurs.
+	//
+	// @first: position of the first frame in the stream
+	// @count: number of frames
+	// @src: packed frames, one after another
+	bool write_packed_at(uint64_t first, unsigned count, const uint8_t *src);
+};
+
+#endif // __FILE_WRITER_
@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmark of the atomic presentation path, with a synthetic frame
+// source instead of the MFC. With the dumb buffer backend, this also
+// runs on generic KMS drivers like vkms.
+//
+// Usage: flip_bench [<backend> [<frames> [<pages> [<width> <height> [<writeback>]]]]]
+// <backend> is either "dumb" (default) or "exynos".
+// With <writeback> set to n, every n-th flip is captured by a writeback
+// connector (vkms provides one), which verifies that the frames reach
+// the output. Since the bar moves with every frame, consecutive
+// captures should never be identical. The program exits with an error
+// if a capture repeats the previous one, or if captures are missing.
+
+#include "main.h"
+#include "exynos_drm.h"
+#include "stats.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstring>
+
+#include <linux/videodev2.h>
+
+namespace {
+
+enum bench_constants {
+	// The flip path does not use any stream buffers, but the
+	// backend is only set up together with them.
+	stream_buffer_size = 4096,
+};
+
+// Position of the bar in a frame.
+unsigned
+bar_position(const videoinfo &vi, uint64_t index)
+{
+	const unsigned bar_w = vi.w / 16;
+
+	return (index * 8) % (vi.w - bar_w);
+}
+
+// Fill a page with a synthetic NV12 frame: a vertical bar that
+// moves by a few pixels with every frame.
+bool
+fill_page(ExynosPage *p, const videoinfo &vi, unsigned index)
+{
+	uint8_t *frame = static_cast<uint8_t*>(p->mmap());
+	if (!frame)
+		return false;
+
+	const unsigned bar_w = vi.w / 16;
+	const unsigned bar_x = bar_position(vi, index);
+
+	for (unsigned y = 0; y < vi.h; ++y) {
+		uint8_t *line = frame + y * vi.w;
+
+		std::memset(line, 16, vi.w);
+		std::memset(line + bar_x, 235, bar_w);
+	}
+
+	std::memset(frame + vi.buffer_size[0], 128, vi.buffer_size[1]);
+
+	return true;
+}
+
+// Checks the writeback captures against the frames that were flipped.
+//
+// @repeated: captures that are identical to the previous one, although
+//            the bar has moved in between
+// @missed: captures that should have happened between two captures
+struct capture_check {
+	unsigned captured;
+	unsigned repeated;
+	unsigned missed;
+	bool have_last;
+	ExynosWriteback::capture last;
+
+	capture_check() : captured(0), repeated(0), missed(0), have_last(false), last() {}
+
+	// @decimation: every n-th flip is captured
+	void add(const ExynosWriteback::capture &c, const videoinfo &vi, unsigned decimation)
+	{
+		if (have_last) {
+			if (c.checksum == last.checksum &&
+				bar_position(vi, c.flip) != bar_position(vi, last.flip))
+				repeated++;
+
+			// A capture is only delayed while the previous one is
+			// pending, which takes less than another interval.
+			const uint64_t gap = c.flip - last.flip;
+
+			if (gap > 2 * uint64_t(decimation))
+				missed += gap / decimation - 1;
+		}
+
+		last = c;
+		have_last = true;
+		captured++;
+	}
+};
+
+}; // anonymous namespace
+
+
+int main(int argc, char* argv[])
+{
+	using namespace std;
+
+	const string backend_name = (argc > 1) ? argv[1] : "dumb";
+	const unsigned num_frames = (argc > 2) ? stoul(argv[2]) : 600;
+	const unsigned num_pages = (argc > 3) ? stoul(argv[3]) : 3;
+	const unsigned writeback = (argc > 6) ? stoul(argv[6]) : 0;
+
+	videoinfo vi;
+
+	vi.w = (argc > 5) ? stoul(argv[4]) : 1280;
+	vi.h = (argc > 5) ? stoul(argv[5]) : 720;
+	vi.crop_w = vi.w;
+	vi.crop_h = vi.h;
+	vi.crop_left = 0;
+	vi.crop_top = 0;
+	vi.pixel_format = V4L2_PIX_FMT_NV12;
+	vi.buffer_size[0] = vi.w * vi.h;
+	vi.buffer_size[1] = vi.w * vi.h / 2;
+	vi.buffer_size[2] = vi.buffer_size[3] = 0;
+
+	DRMBackend::backend_type bt;
+
+	if (backend_name == "dumb") {
+		bt = DRMBackend::backend_dumb;
+	} else if (backend_name == "exynos") {
+		bt = DRMBackend::backend_exynos;
+	} else {
+		cerr << "unknown backend \"" << backend_name << "\".\n";
+		return 1;
+	}
+
+	if (num_pages < 2 || vi.w < 16 || vi.h < 2) {
+		cerr << "invalid arguments.\n";
+		return 1;
+	}
+
+	ExynosDRM drm;
+	vector<ExynosBuffer> stream_buffers;
+
+	if (!drm.open(ExynosDRM::connector_other, bt) ||
+		(writeback != 0 && !drm.enable_writeback(writeback)) || !drm.init(0, 0) ||
+		!drm.alloc_buffers(1, stream_buffer_size, stream_buffers) ||
+		!drm.alloc_pages(num_pages, vi)) {
+		cerr << "initialization failed.\n";
+		return 1;
+	}
+
+	LatencyHistogram commit_latency;
+	LatencyHistogram fill_time;
+	deque<ExynosPage*> ready;
+
+	ExynosWriteback::capture c;
+	capture_check check;
+
+	unsigned filled = 0, flipped = 0;
+	const uint64_t start = monotonic_us();
+
+	while (flipped < num_frames) {
+		ExynosPage *p;
+
+		// The pages that left the screen are the "decoded" frames.
+		while ((p = drm.get_page()) != nullptr) {
+			const uint64_t t = monotonic_us();
+
+			if (!fill_page(p, vi, filled++)) {
+				cerr << "failed to map page.\n";
+				return 1;
+			}
+
+			p->mark_decoded(monotonic_us());
+			fill_time.record(monotonic_us() - t);
+
+			ready.push_back(p);
+		}
+
+		if (!drm.flip_pending() && !ready.empty()) {
+			const uint64_t t = monotonic_us();
+
+			if (!drm.issue_flip(ready.front())) {
+				cerr << "page flip failed.\n";
+				return 1;
+			}
+
+			commit_latency.record(monotonic_us() - t);
+
+			ready.pop_front();
+			++flipped;
+
+			continue;
+		}
+
+		if (drm.wait_for_flip() && !drm.handle_events()) {
+			cerr << "event handling failed.\n";
+			return 1;
+		}
+
+		while (drm.get_capture(c))
+			check.add(c, vi, writeback);
+	}
+
+	while (drm.wait_for_flip())
+		drm.handle_events();
+
+	while (drm.get_capture(c))
+		check.add(c, vi, writeback);
+
+	const uint64_t elapsed = max<uint64_t>(monotonic_us() - start, 1);
+
+	StatsReport r;
+
+	drm.add_stats(r);
+	r.add("commit_latency", commit_latency);
+	r.add("fill_time", fill_time);
+
+	cout << backend_name << ": " << flipped << " flips in " << elapsed
+		 << " us (" << double(flipped) * 1000000.0 / double(elapsed)
+		 << " flips/s)\n";
+	r.print_text(cout);
+
+	if (writeback == 0)
+		return 0;
+
+	if (check.captured != 0) {
+		cout << "writeback: " << check.captured << " capture(s), last of flip "
+			 << check.last.flip << " with checksum " << hex << check.last.checksum
+			 << dec << '\n';
+	}
+
+	// A pending capture delays the next one by up to an interval, so at
+	// least every other interval ends up in a capture.
+	if (check.captured == 0 || check.captured < flipped / writeback / 2) {
+		cerr << "writeback: too few captures (" << check.captured << " of "
+			 << flipped / writeback << ").\n";
+		return 1;
+	}
+
+	if (check.repeated != 0 || check.missed != 0) {
+		cerr << "writeback: " << check.repeated << " repeated and " << check.missed
+			 << " missing capture(s).\n";
+		return 1;
+	}
+
+	return 0;
+}
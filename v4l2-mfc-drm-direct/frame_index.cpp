@@ -0,0 +1,543 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frame_index.h"
+#include "input_file.h"
+
+#include <iostream>
+#include <string>
+
+namespace {
+
+enum nal_unit_type {
+	nal_slice			= 1,
+	nal_slice_dpa		= 2,
+	nal_slice_idr		= 5,
+	nal_sei				= 6,
+	nal_sps				= 7,
+	nal_pps				= 8,
+	nal_aud				= 9,
+};
+
+// Find the next three byte start code (0x000001) at or after 'pos'.
+// Returns 'size' if there is none.
+size_t
+find_start_code(const uint8_t *data, size_t size, size_t pos)
+{
+	while (pos + 3 <= size) {
+		if (data[pos + 2] > 1) {
+			pos += 3;
+		} else if (data[pos] == 0 && data[pos + 1] == 0 && data[pos + 2] == 1) {
+			return pos;
+		} else {
+			pos++;
+		}
+	}
+
+	return size;
+}
+
+// Reader for the Exp-Golomb coded fields of a RBSP. The emulation
+// prevention bytes (0x000003) are skipped while reading. Reading past
+// the end sets the error flag, and returns zero bits.
+class BitReader {
+private:
+	const uint8_t *data;
+	size_t size, pos;
+	unsigned bit;
+	unsigned zeros;
+
+public:
+	bool error;
+
+	BitReader(const uint8_t *d, size_t s) : data(d), size(s), pos(0),
+		bit(0), zeros(0), error(false) {}
+
+	unsigned u1()
+	{
+		if (bit == 0) {
+			// Skip the 0x03 byte after two zero bytes.
+			if (zeros >= 2 && pos < size && data[pos] == 0x03) {
+				zeros = 0;
+				pos++;
+			}
+
+			if (pos >= size) {
+				error = true;
+				return 0;
+			}
+
+			zeros = (data[pos] == 0) ? zeros + 1 : 0;
+		}
+
+		const unsigned ret = (data[pos] >> (7 - bit)) & 1;
+
+		if (++bit == 8) {
+			bit = 0;
+			pos++;
+		}
+
+		return ret;
+	}
+
+	unsigned u(unsigned n)
+	{
+		unsigned ret = 0;
+
+		while (n--)
+			ret = (ret << 1) | u1();
+
+		return ret;
+	}
+
+	unsigned ue()
+	{
+		unsigned leading = 0;
+
+		while (!u1() && !error) {
+			// Larger values don't occur in the fields that we read.
+			if (++leading > 31) {
+				error = true;
+				return 0;
+			}
+		}
+
+		return ((1u << leading) - 1) + u(leading);
+	}
+
+	int se()
+	{
+		const unsigned v = ue();
+
+		return (v & 1) ? int((v + 1) / 2) : -int(v / 2);
+	}
+};
+
+// Fields of the SPS that are needed to parse a slice header.
+//
+// @log2_max_frame_num: size of the frame_num field in bits
+// @frame_mbs_only: the stream has no field pictures
+// @separate_colour_plane: the slices carry colour_plane_id
+struct slice_params {
+	unsigned log2_max_frame_num;
+	bool frame_mbs_only;
+	bool separate_colour_plane;
+};
+
+// Start of a picture, i.e. its first slice.
+//
+// @field, bottom: field picture, and its parity
+// @frame_num: frame_num of the slice header
+struct picture_start {
+	bool field, bottom;
+	unsigned frame_num;
+};
+
+void
+skip_scaling_list(BitReader &br, unsigned size)
+{
+	int last_scale = 8, next_scale = 8;
+
+	for (unsigned i = 0; i < size && !br.error; ++i) {
+		if (next_scale != 0)
+			next_scale = (last_scale + br.se() + 256) % 256;
+
+		if (next_scale != 0)
+			last_scale = next_scale;
+	}
+}
+
+// Parse the picture size from a SPS NAL unit (without the start code,
+// starting with the NAL header).
+//
+// @sp: optional, filled with the fields for parsing slice headers
+bool
+parse_sps(const uint8_t *nal, size_t size, FrameIndex::picture_size &ps,
+		  slice_params *sp = nullptr)
+{
+	BitReader br(nal + 1, size - 1);
+
+	const unsigned profile_idc = br.u(8);
+
+	br.u(8); // constraint flags
+
+	const unsigned level_idc = br.u(8);
+
+	br.ue(); // seq_parameter_set_id
+
+	unsigned chroma_format_idc = 1;
+	unsigned separate_colour_plane = 0;
+
+	switch (profile_idc) {
+	case 100: case 110: case 122: case 244: case 44:
+	case 83: case 86: case 118: case 128: case 138:
+	case 139: case 134: case 135:
+		chroma_format_idc = br.ue();
+
+		if (chroma_format_idc == 3)
+			separate_colour_plane = br.u1();
+
+		br.ue(); // bit_depth_luma_minus8
+		br.ue(); // bit_depth_chroma_minus8
+		br.u1(); // qpprime_y_zero_transform_bypass_flag
+
+		if (br.u1()) {
+			const unsigned num_lists = (chroma_format_idc == 3) ? 12 : 8;
+
+			for (unsigned i = 0; i < num_lists; ++i) {
+				if (br.u1())
+					skip_scaling_list(br, (i < 6) ? 16 : 64);
+			}
+		}
+
+		break;
+
+	default:
+		break;
+	}
+
+	const unsigned log2_max_frame_num = br.ue() + 4;
+
+	const unsigned poc_type = br.ue();
+
+	if (poc_type == 0) {
+		br.ue(); // log2_max_pic_order_cnt_lsb_minus4
+	} else if (poc_type == 1) {
+		br.u1(); // delta_pic_order_always_zero_flag
+		br.se(); // offset_for_non_ref_pic
+		br.se(); // offset_for_top_to_bottom_field
+
+		const unsigned num_offsets = br.ue();
+
+		for (unsigned i = 0; i < num_offsets && !br.error; ++i)
+			br.se();
+	}
+
+	const unsigned max_ref_frames = br.ue();
+
+	br.u1(); // gaps_in_frame_num_value_allowed_flag
+
+	const unsigned width_mbs = br.ue() + 1;
+	const unsigned height_units = br.ue() + 1;
+	const unsigned frame_mbs_only = br.u1();
+
+	if (!frame_mbs_only)
+		br.u1(); // mb_adaptive_frame_field_flag
+
+	br.u1(); // direct_8x8_inference_flag
+
+	ps.w = width_mbs * 16;
+	ps.h = height_units * 16 * (2 - frame_mbs_only);
+	ps.crop_left = ps.crop_top = 0;
+	ps.crop_w = ps.w;
+	ps.crop_h = ps.h;
+	ps.profile_idc = profile_idc;
+	ps.level_idc = level_idc;
+	ps.max_ref_frames = max_ref_frames;
+
+	if (sp) {
+		sp->log2_max_frame_num = log2_max_frame_num;
+		sp->frame_mbs_only = frame_mbs_only;
+		sp->separate_colour_plane = separate_colour_plane;
+	}
+
+	if (br.u1()) {
+		// The offsets are given in chroma samples (for 4:2:0 and 4:2:2).
+		const unsigned unit_x = (chroma_format_idc == 1 || chroma_format_idc == 2) ? 2 : 1;
+		const unsigned unit_y = ((chroma_format_idc == 1) ? 2 : 1) * (2 - frame_mbs_only);
+
+		const unsigned left = br.ue() * unit_x;
+		const unsigned right = br.ue() * unit_x;
+		const unsigned top = br.ue() * unit_y;
+		const unsigned bottom = br.ue() * unit_y;
+
+		if (left + right >= ps.w || top + bottom >= ps.h)
+			return false;
+
+		ps.crop_left = left;
+		ps.crop_top = top;
+		ps.crop_w = ps.w - left - right;
+		ps.crop_h = ps.h - top - bottom;
+	}
+
+	return !br.error;
+}
+
+// Parse the start of a slice header (without the start code, starting
+// with the NAL header). Returns false if the slice is not the first one
+// of a picture, or if the header can't be parsed.
+bool
+parse_picture_start(const uint8_t *nal, size_t size, const slice_params &sp,
+					picture_start &pic)
+{
+	BitReader br(nal + 1, size - 1);
+
+	if (br.ue() != 0) // first_mb_in_slice
+		return false;
+
+	br.ue(); // slice_type
+	br.ue(); // pic_parameter_set_id
+
+	if (sp.separate_colour_plane)
+		br.u(2); // colour_plane_id
+
+	pic.frame_num = br.u(sp.log2_max_frame_num);
+	pic.field = !sp.frame_mbs_only && br.u1();
+	pic.bottom = pic.field && br.u1();
+
+	return !br.error;
+}
+
+}; // anonymous namespace
+
+
+FrameIndex::FrameIndex() : size(0)
+{
+	// Nothing here.
+}
+
+bool FrameIndex::build(const InputFile &in)
+{
+	static const std::string msg_prefix("FrameIndex::build(): ");
+
+	using namespace std;
+
+	const uint8_t *data = in.data();
+	if (!data) {
+		cerr << msg_prefix << "no input file.\n";
+		return false;
+	}
+
+	size = in.get_size();
+	gops.clear();
+	header.clear();
+
+	// Start of the run of non-VCL NAL units since the last slice, and
+	// whether a SPS is part of this run.
+	size_t run_start = size;
+	bool run_sps = false;
+	bool seen_slice = false;
+
+	// Parameters of the last SPS, which are needed for the slice headers.
+	slice_params sp = {4, true, false};
+
+	// Pictures before the first IDR picture, and the first field of a
+	// pair, while its second field has not been seen yet.
+	unsigned leading_frames = 0;
+	picture_start open_field = {false, false, 0};
+	bool field_open = false;
+
+	size_t pos = find_start_code(data, size, 0);
+
+	while (pos < size) {
+		const size_t payload = pos + 3;
+		const size_t next = find_start_code(data, size, payload);
+
+		// A four byte start code has a leading zero byte, which we
+		// also count to the NAL unit.
+		const size_t start = (pos > 0 && data[pos - 1] == 0) ? pos - 1 : pos;
+
+		// Trailing zero bytes belong to the start code of the next unit.
+		size_t end = next;
+		if (end < size && end > payload && data[end - 1] == 0)
+			end--;
+
+		if (payload >= size)
+			break;
+
+		const unsigned type = data[payload] & 0x1f;
+
+		switch (type) {
+		case nal_sei:
+		case nal_sps:
+		case nal_pps:
+		case nal_aud:
+			if (run_start == size) {
+				run_start = start;
+				run_sps = false;
+			}
+
+			if (type == nal_sps) {
+				picture_size ps;
+				slice_params next_sp;
+
+				if (parse_sps(data + payload, end - payload, ps, &next_sp))
+					sp = next_sp;
+
+				run_sps = true;
+			}
+
+			if (!seen_slice && (type == nal_sps || type == nal_pps))
+				header.insert(header.end(), data + start, data + end);
+
+			break;
+
+		default:
+			// Slices (including data partitions) end the non-VCL run.
+			if (type < nal_slice || type > nal_slice_idr)
+				break;
+
+			// The first slice of a picture has first_mb_in_slice equal
+			// to zero, which is coded as a single set bit. Data partitions
+			// B and C have no slice header.
+			if ((type == nal_slice || type == nal_slice_dpa || type == nal_slice_idr) &&
+				payload + 1 < size && (data[payload + 1] & 0x80)) {
+				picture_start pic;
+
+				// A broken header still starts a picture, the decoder
+				// reports it as a frame.
+				if (!parse_picture_start(data + payload, end - payload, sp, pic))
+					pic = {false, false, 0};
+
+				// The second field of a pair belongs to the same frame,
+				// and to the same GOP.
+				const bool second_field = pic.field && field_open &&
+					pic.bottom != open_field.bottom && pic.frame_num == open_field.frame_num;
+
+				field_open = pic.field && !second_field;
+				open_field = pic;
+
+				if (!second_field) {
+					if (type == nal_slice_idr) {
+						if (run_start == size)
+							gops.push_back({start, false, 0});
+						else
+							gops.push_back({run_start, run_sps, 0});
+					}
+
+					if (gops.empty())
+						leading_frames++;
+					else
+						gops.back().num_frames++;
+				}
+			}
+
+			seen_slice = true;
+			run_start = size;
+			break;
+		}
+
+		pos = next;
+	}
+
+	// Everything before the first IDR picture belongs to the first
+	// GOP, so that no data is lost.
+	if (gops.empty()) {
+		gops.push_back({0, !header.empty(), leading_frames});
+	} else {
+		gops.front().offset = 0;
+		gops.front().num_frames += leading_frames;
+	}
+
+	unsigned num_frames = 0;
+
+	for (auto &i : gops)
+		num_frames += i.num_frames;
+
+	cout << msg_prefix << "found " << gops.size() << " GOP(s) with " << num_frames
+		 << " picture(s), header has " << header.size() << " bytes.\n";
+
+	return true;
+}
+
+bool FrameIndex::probe(const InputFile &in, picture_size &ps)
+{
+	const uint8_t *data = in.data();
+	if (!data)
+		return false;
+
+	const size_t size = in.get_size();
+
+	size_t pos = find_start_code(data, size, 0);
+
+	while (pos < size) {
+		const size_t payload = pos + 3;
+		const size_t next = find_start_code(data, size, payload);
+
+		if (payload >= size)
+			break;
+
+		const unsigned type = data[payload] & 0x1f;
+
+		if (type == nal_sps)
+			return parse_sps(data + payload, next - payload, ps);
+
+		// Same as in build(), the header ends with the first slice.
+		if (type >= nal_slice && type <= nal_slice_idr)
+			break;
+
+		pos = next;
+	}
+
+	return false;
+}
+
+unsigned FrameIndex::get_gop_count() const
+{
+	return gops.size();
+}
+
+const std::vector<uint8_t>& FrameIndex::get_header() const
+{
+	return header;
+}
+
+bool FrameIndex::get_picture_size(picture_size &ps) const
+{
+	// The header holds the parameter sets, each with its start code.
+	size_t pos = find_start_code(header.data(), header.size(), 0);
+
+	while (pos < header.size()) {
+		const size_t payload = pos + 3;
+		const size_t next = find_start_code(header.data(), header.size(), payload);
+
+		if (payload < next && (header[payload] & 0x1f) == nal_sps)
+			return parse_sps(header.data() + payload, next - payload, ps);
+
+		pos = next;
+	}
+
+	return false;
+}
+
+std::vector<FrameIndex::segment> FrameIndex::split(unsigned num_segments) const
+{
+	std::vector<segment> segs;
+
+	if (gops.empty() || num_segments == 0)
+		return segs;
+
+	const size_t target = size / num_segments;
+
+	for (unsigned i = 0; i < gops.size(); ++i) {
+		const size_t end = (i + 1 < gops.size()) ? gops[i + 1].offset : size;
+
+		// Start a new segment once the GOP lies beyond the
+		// ideal boundary of the current segment.
+		if (segs.empty() || (gops[i].offset >= segs.size() * target &&
+							 segs.size() < num_segments)) {
+			segs.push_back({gops[i].offset, 0, gops[i].has_sps, 0, 0});
+		}
+
+		segment &s = segs.back();
+
+		s.length = end - s.offset;
+		s.num_gops++;
+		s.num_frames += gops[i].num_frames;
+	}
+
+	return segs;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__FRAME_INDEX_)
+#define __FRAME_INDEX_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Forward-declarations
+class InputFile;
+
+// Index of the GOPs (groups of pictures) of a H.264 elementary stream
+// in Annex B format. A GOP starts with an IDR picture, together with the
+// parameter sets and other non-VCL NAL units that precede it. Since no
+// picture references anything before an IDR picture, the stream can be
+// split at these positions and the parts can be decoded independently.
+class FrameIndex {
+public:
+	// @offset: byte offset of the GOP in the stream
+	// @has_sps: a SPS is part of the GOP
+	// @num_frames: number of pictures (frames or field pairs) in the GOP
+	struct gop {
+		size_t offset;
+		bool has_sps;
+		unsigned num_frames;
+	};
+
+	// Picture size from the SPS of a stream, and the fields that
+	// determine how many pictures the decoder has to keep.
+	//
+	// @{w,h}: size of the decoded pictures (whole macroblocks)
+	// @crop_*: visible area of the pictures
+	// @profile_idc, level_idc: profile and level of the stream
+	// @max_ref_frames: max_num_ref_frames of the SPS
+	struct picture_size {
+		unsigned w, h;
+		unsigned crop_left, crop_top;
+		unsigned crop_w, crop_h;
+		unsigned profile_idc, level_idc;
+		unsigned max_ref_frames;
+	};
+
+	// Range of consecutive GOPs.
+	//
+	// @offset, length: byte range of the segment in the stream
+	// @has_sps: the segment starts with a SPS
+	// @num_gops: number of GOPs in the segment
+	// @num_frames: number of pictures that the segment decodes to
+	struct segment {
+		size_t offset, length;
+		bool has_sps;
+		unsigned num_gops;
+		unsigned num_frames;
+	};
+
+private:
+	std::vector<gop> gops;
+
+	// SPS and PPS NAL units (including start codes) that appear
+	// before the first slice of the stream.
+	std::vector<uint8_t> header;
+
+	size_t size;
+
+public:
+	FrameIndex();
+
+	FrameIndex(const FrameIndex &fi) = delete;
+
+	// Scan the stream for GOPs. The whole file is accessed via
+	// its mapping, the file position is not changed.
+	// build() returns false if an error occurs.
+	bool build(const InputFile &in);
+
+	// Read the picture size from the first SPS of a stream, without
+	// building an index. Only the start of the stream is scanned, up to
+	// the first SPS (or the first slice), so this is cheap enough to
+	// run while another stream is playing.
+	// probe() returns false if no SPS precedes the first slice, or if
+	// the SPS can't be parsed.
+	static bool probe(const InputFile &in, picture_size &ps);
+
+	unsigned get_gop_count() const;
+
+	// Parameter sets that have to be prepended to a segment without SPS.
+	const std::vector<uint8_t>& get_header() const;
+
+	// Read the picture size from the first SPS of the stream.
+	// get_picture_size() returns false if there is no SPS, or if
+	// it can't be parsed.
+	bool get_picture_size(picture_size &ps) const;
+
+	// Split the stream into (at most) 'num_segments' segments of about
+	// the same size. The segments are ordered and cover the whole stream.
+	std::vector<segment> split(unsigned num_segments) const;
+};
+
+#endif // __FRAME_INDEX_
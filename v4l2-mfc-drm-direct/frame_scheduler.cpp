@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frame_scheduler.h"
+
+#include <iostream>
+#include <string>
+
+
+FrameScheduler::FrameScheduler() : period(0), fps_num(0), fps_den(0), base(0),
+	anchored(false), last_index(0), last_target(0), have_last(false),
+	frames_dropped(0), vblanks_missed(0), resyncs(0)
+{
+	// Nothing here.
+}
+
+bool FrameScheduler::init(uint64_t refresh, unsigned num, unsigned den)
+{
+	static const std::string msg_prefix("FrameScheduler::init(): ");
+
+	if (refresh == 0 || num == 0 || den == 0) {
+		std::cerr << msg_prefix << "invalid refresh period or frame rate.\n";
+		return false;
+	}
+
+	period = refresh;
+	fps_num = num;
+	fps_den = den;
+
+	anchored = false;
+	have_last = false;
+
+	std::cout << msg_prefix << "pacing " << num << '/' << den << " fps on a refresh period of "
+			  << refresh << " us.\n";
+
+	return true;
+}
+
+uint64_t FrameScheduler::pts(unsigned index) const
+{
+	return uint64_t(index) * 1000000 * fps_den / fps_num;
+}
+
+uint64_t FrameScheduler::nearest_vblank(uint64_t t, uint64_t vblank) const
+{
+	if (t <= vblank)
+		return vblank;
+
+	return vblank + ((t - vblank + period / 2) / period) * period;
+}
+
+enum FrameScheduler::action FrameScheduler::schedule(unsigned index, uint64_t vblank,
+	uint64_t now, uint64_t &issue_time)
+{
+	issue_time = now;
+
+	// Nothing is on the screen yet, so show the first frame right away.
+	if (vblank == 0) {
+		last_index = index;
+		have_last = false;
+
+		return action_present;
+	}
+
+	// The scanout of the first frame defines the clock.
+	if (!anchored) {
+		base = vblank - pts(last_index);
+		anchored = true;
+	}
+
+	// Check how well the previous frame was placed.
+	if (have_last) {
+		const uint64_t err = (vblank > last_target) ?
+			vblank - last_target : last_target - vblank;
+
+		pacing_error.record(err);
+
+		if (vblank > last_target)
+			vblanks_missed += (vblank - last_target + period / 2) / period;
+	}
+
+	// First vblank that we can still reach with a flip.
+	uint64_t earliest = vblank + period;
+	while (earliest < now + issue_margin)
+		earliest += period;
+
+	uint64_t target = base + pts(index);
+
+	// After a stall, continue from here instead of dropping
+	// all the frames that are late.
+	if (target + resync_threshold < earliest) {
+		base += earliest - target;
+		target = earliest;
+		resyncs++;
+	}
+
+	uint64_t v = nearest_vblank(target, vblank);
+
+	if (v < earliest) {
+		// The frame is late. Drop it, if the next frame is due at
+		// the earliest vblank anyway.
+		const uint64_t next = base + pts(index + 1);
+
+		if (nearest_vblank(next, vblank) <= earliest) {
+			frames_dropped++;
+			return action_drop;
+		}
+
+		v = earliest;
+	}
+
+	// A flip that is issued after the vblank before the target
+	// completes on the target vblank.
+	if (v - period > now)
+		issue_time = v - period + issue_margin / 2;
+
+	last_index = index;
+	last_target = v;
+	have_last = true;
+
+	return action_present;
+}
+
+void FrameScheduler::add_stats(StatsReport &r) const
+{
+	r.add("pacing_error", pacing_error);
+	r.add("frames_dropped_late", frames_dropped.load());
+	r.add("vblanks_missed", vblanks_missed.load());
+	r.add("pacing_resyncs", resyncs.load());
+}
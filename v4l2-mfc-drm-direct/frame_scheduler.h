@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__FRAME_SCHEDULER_)
+#define __FRAME_SCHEDULER_
+
+#include "stats.h"
+
+#include <cstdint>
+#include <atomic>
+
+// Presentation scheduler that maps the timestamps of the frames to the
+// vblanks of the display. An elementary stream carries no timestamps, so
+// the presentation time of a frame is derived from its position in display
+// order and the frame rate. The clock is anchored to the scanout of the
+// first frame, and each frame is flipped at the vblank closest to its
+// presentation time. A frame stays on the screen until the next one is due,
+// which gives the usual cadence (e.g. 3:2 for 24 fps on 60 Hz). Frames that
+// are already late are dropped, if the next frame is due as well.
+class FrameScheduler {
+public:
+	enum action {
+		// Flip the frame at the given time.
+		action_present = 0,
+
+		// Give the frame back to the decoder without displaying it.
+		action_drop,
+	};
+
+private:
+	enum constants {
+		// Time that we need to issue a flip before the vblank.
+		issue_margin = 2000,
+
+		// If we are behind by more than this, the clock is
+		// re-anchored instead of dropping frames (e.g. after a stall).
+		resync_threshold = 500000,
+	};
+
+	uint64_t period;
+	uint64_t fps_num, fps_den;
+
+	// Time at which frame 0 is due (valid once anchored).
+	uint64_t base;
+	bool anchored;
+
+	// Display index and target vblank of the last presented frame.
+	unsigned last_index;
+	uint64_t last_target;
+	bool have_last;
+
+	// Deviation of the actual scanout from the target vblank.
+	LatencyHistogram pacing_error;
+
+	std::atomic<uint64_t> frames_dropped;
+	std::atomic<uint64_t> vblanks_missed;
+	std::atomic<uint64_t> resyncs;
+
+	uint64_t pts(unsigned index) const;
+	uint64_t nearest_vblank(uint64_t t, uint64_t vblank) const;
+
+public:
+	FrameScheduler();
+
+	FrameScheduler(const FrameScheduler &fs) = delete;
+
+	// Setup the scheduler.
+	// init() returns false if the parameters are invalid.
+	//
+	// @refresh: refresh period of the display (in microseconds)
+	// @{num,den}: frame rate of the stream
+	bool init(uint64_t refresh, unsigned num, unsigned den);
+
+	// Decide what to do with a decoded frame. The previous flip has to
+	// be complete when this is called.
+	//
+	// @index: position of the frame in display order
+	// @vblank: time of the last completed flip (zero if none)
+	// @now: current time
+	// @issue_time: time at which the flip should be issued
+	enum action schedule(unsigned index, uint64_t vblank, uint64_t now,
+						 uint64_t &issue_time);
+
+	// Add the scheduler statistics to a report.
+	void add_stats(StatsReport &r) const;
+};
+
+#endif // __FRAME_SCHEDULER_
@@ -0,0 +1,479 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "glyph_text.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <cairo/cairo.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GLYPH_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define GLYPH_SSE2
+#endif
+
+namespace {
+
+// (a * c) / 255, rounded.
+inline uint8_t
+mul_alpha(uint8_t a, uint8_t c)
+{
+	const unsigned t = unsigned(a) * c + 128;
+
+	return (t + (t >> 8)) >> 8;
+}
+
+// Expand a line of a glyph mask into premultiplied ARGB8888 pixels.
+//
+// @mask: alpha values of the line
+// @dst: destination pixels
+// @w: number of pixels
+// @{r,g,b}: text color
+void
+blit_line(const uint8_t *mask, uint32_t *dst, unsigned w,
+		  uint8_t r, uint8_t g, uint8_t b)
+{
+	unsigned x = 0;
+
+#if defined(GLYPH_NEON)
+	const uint8x8_t vr = vdup_n_u8(r);
+	const uint8x8_t vg = vdup_n_u8(g);
+	const uint8x8_t vb = vdup_n_u8(b);
+
+	// Eight pixels at a time. vst4 interleaves the channels into
+	// B, G, R, A bytes, which is ARGB8888 in little-endian.
+	for (; x + 8 <= w; x += 8) {
+		const uint8x8_t a = vld1_u8(mask + x);
+		uint16x8_t t;
+		uint8x8x4_t px;
+
+		t = vmull_u8(a, vb);
+		px.val[0] = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+		t = vmull_u8(a, vg);
+		px.val[1] = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+		t = vmull_u8(a, vr);
+		px.val[2] = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+		px.val[3] = a;
+
+		vst4_u8(reinterpret_cast<uint8_t*>(dst + x), px);
+	}
+#elif defined(GLYPH_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(128);
+	const __m128i vr = _mm_set1_epi16(r);
+	const __m128i vg = _mm_set1_epi16(g);
+	const __m128i vb = _mm_set1_epi16(b);
+
+	auto mul = [&](const __m128i &a, const __m128i &c) {
+		const __m128i t = _mm_add_epi16(_mm_mullo_epi16(a, c), round);
+
+		return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+	};
+
+	// Eight pixels at a time, in 16-bit lanes. The channels are
+	// combined into B|G and R|A pairs, which are then interleaved.
+	for (; x + 8 <= w; x += 8) {
+		const __m128i a = _mm_unpacklo_epi8(
+			_mm_loadl_epi64(reinterpret_cast<const __m128i*>(mask + x)), zero);
+
+		const __m128i bg = _mm_or_si128(mul(a, vb), _mm_slli_epi16(mul(a, vg), 8));
+		const __m128i ra = _mm_or_si128(mul(a, vr), _mm_slli_epi16(a, 8));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x + 4), _mm_unpackhi_epi16(bg, ra));
+	}
+#endif
+
+	for (; x < w; ++x) {
+		const uint8_t a = mask[x];
+
+		dst[x] = (uint32_t(a) << 24) | (uint32_t(mul_alpha(a, r)) << 16) |
+			(uint32_t(mul_alpha(a, g)) << 8) | mul_alpha(a, b);
+	}
+}
+
+std::vector<std::string>
+split_lines(const std::string &str)
+{
+	std::vector<std::string> lines;
+	size_t start = 0;
+
+	if (str.empty())
+		return lines;
+
+	while (true) {
+		const size_t end = str.find('\n', start);
+
+		lines.push_back(str.substr(start, end - start));
+
+		if (end == std::string::npos)
+			break;
+
+		start = end + 1;
+	}
+
+	return lines;
+}
+
+void
+unite(text_rect &a, const text_rect &b)
+{
+	if (b.w == 0 || b.h == 0)
+		return;
+
+	if (a.w == 0 || a.h == 0) {
+		a = b;
+		return;
+	}
+
+	const unsigned x1 = std::max(a.x + a.w, b.x + b.w);
+	const unsigned y1 = std::max(a.y + a.h, b.y + b.h);
+
+	a.x = std::min(a.x, b.x);
+	a.y = std::min(a.y, b.y);
+	a.w = x1 - a.x;
+	a.h = y1 - a.y;
+}
+
+}; // anonymous namespace
+
+
+GlyphAtlas::GlyphAtlas() : cell_w(0), cell_h(0), flags(0)
+{
+	// Nothing here.
+}
+
+bool GlyphAtlas::init(const std::string &font, double size)
+{
+	static const std::string msg_prefix("GlyphAtlas::init(): ");
+
+	if (flags & initialized)
+		return false;
+
+	using namespace std;
+
+	// Measure the font first, to get the size of the cells.
+	cairo_surface_t *surf = cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+	cairo_t *ctx = cairo_create(surf);
+
+	cairo_select_font_face(ctx, font.c_str(), CAIRO_FONT_SLANT_NORMAL,
+						   CAIRO_FONT_WEIGHT_BOLD);
+	cairo_set_font_size(ctx, size);
+
+	cairo_font_extents_t fe;
+	cairo_font_extents(ctx, &fe);
+
+	cairo_destroy(ctx);
+	cairo_surface_destroy(surf);
+
+	cell_w = unsigned(ceil(fe.max_x_advance));
+	cell_h = unsigned(ceil(fe.ascent + fe.descent));
+
+	if (cell_w == 0 || cell_h == 0) {
+		cerr << msg_prefix << "invalid font metrics.\n";
+		return false;
+	}
+
+	// The glyphs are placed below each other, one per cell.
+	surf = cairo_image_surface_create(CAIRO_FORMAT_A8, cell_w, cell_h * glyph_count);
+	if (cairo_surface_status(surf) != CAIRO_STATUS_SUCCESS) {
+		cerr << msg_prefix << "failed to create Cairo surface.\n";
+		cairo_surface_destroy(surf);
+		return false;
+	}
+
+	ctx = cairo_create(surf);
+
+	cairo_select_font_face(ctx, font.c_str(), CAIRO_FONT_SLANT_NORMAL,
+						   CAIRO_FONT_WEIGHT_BOLD);
+	cairo_set_font_size(ctx, size);
+	cairo_set_source_rgba(ctx, 0.0, 0.0, 0.0, 1.0);
+
+	for (unsigned i = 0; i < glyph_count; ++i) {
+		const char str[2] = { char(first_char + i), '\0' };
+
+		// Keep glyphs that overhang their cell out of the neighbours.
+		cairo_save(ctx);
+		cairo_rectangle(ctx, 0.0, i * cell_h, cell_w, cell_h);
+		cairo_clip(ctx);
+
+		cairo_move_to(ctx, 0.0, i * cell_h + fe.ascent);
+		cairo_show_text(ctx, str);
+
+		cairo_restore(ctx);
+	}
+
+	cairo_surface_flush(surf);
+
+	const uint8_t *data = cairo_image_surface_get_data(surf);
+	const unsigned data_stride = cairo_image_surface_get_stride(surf);
+
+	masks.resize(cell_w * cell_h * glyph_count);
+
+	for (unsigned y = 0; y < cell_h * glyph_count; ++y)
+		memcpy(&masks[y * cell_w], data + y * data_stride, cell_w);
+
+	cairo_destroy(ctx);
+	cairo_surface_destroy(surf);
+
+	flags |= initialized;
+
+	return true;
+}
+
+const uint8_t* GlyphAtlas::get_mask(char c) const
+{
+	if (!(flags & initialized))
+		return nullptr;
+
+	unsigned index = static_cast<unsigned char>(c);
+
+	if (index < first_char || index > last_char)
+		index = '?';
+
+	return &masks[(index - first_char) * cell_w * cell_h];
+}
+
+unsigned GlyphAtlas::get_cell_width() const
+{
+	return cell_w;
+}
+
+unsigned GlyphAtlas::get_cell_height() const
+{
+	return cell_h;
+}
+
+
+GlyphText::GlyphText(unsigned w, unsigned h, const GlyphAtlas &a) : atlas(a),
+	buffer(nullptr), width(w), height(h), stride(w * 4), red(0), green(0),
+	blue(0), flags(0)
+{
+	// Nothing here.
+}
+
+GlyphText::~GlyphText()
+{
+	deinit();
+}
+
+unsigned GlyphText::get_size() const
+{
+	return stride * height;
+}
+
+bool GlyphText::init(uint8_t *b)
+{
+	if (flags & initialized)
+		return false;
+
+	if (width == 0 || height == 0)
+		return false;
+
+	if (!b || atlas.get_cell_width() == 0)
+		return false;
+
+	buffer = b;
+	current.clear();
+
+	flags |= initialized;
+
+	return true;
+}
+
+void GlyphText::deinit()
+{
+	if (!(flags & initialized))
+		return;
+
+	buffer = nullptr;
+
+	flags &= ~initialized;
+}
+
+void GlyphText::set_color(uint8_t r, uint8_t g, uint8_t b)
+{
+	red = r;
+	green = g;
+	blue = b;
+
+	// Redraw the whole text with the next render() call.
+	clear();
+}
+
+long GlyphText::cell_top(unsigned line, unsigned num_lines) const
+{
+	// The last line ends one pixel above the bottom.
+	return long(height) - 1 - long(num_lines - line) * atlas.get_cell_height();
+}
+
+text_rect GlyphText::cell_rect(unsigned line, unsigned num_lines, unsigned col) const
+{
+	text_rect r = {0, 0, 0, 0};
+
+	const long cw = atlas.get_cell_width();
+	const long ch = atlas.get_cell_height();
+
+	// The text starts one pixel from the left.
+	const long x = 1 + long(col) * cw;
+	const long y = cell_top(line, num_lines);
+
+	const long x0 = std::max(x, 0L);
+	const long y0 = std::max(y, 0L);
+	const long x1 = std::min(x + cw, long(width));
+	const long y1 = std::min(y + ch, long(height));
+
+	if (x1 > x0 && y1 > y0) {
+		r.x = x0;
+		r.y = y0;
+		r.w = x1 - x0;
+		r.h = y1 - y0;
+	}
+
+	return r;
+}
+
+void GlyphText::draw_cell(const text_rect &r, long top, char c)
+{
+	const unsigned cw = atlas.get_cell_width();
+
+	// The text starts right of the left edge, so a cell is never
+	// clipped on the left. Skip the lines that are clipped at the top.
+	const uint8_t *mask = atlas.get_mask(c) + (r.y - top) * cw;
+
+	for (unsigned i = 0; i < r.h; ++i) {
+		uint32_t *dst = reinterpret_cast<uint32_t*>(buffer + (r.y + i) * stride) + r.x;
+
+		blit_line(mask + i * cw, dst, r.w, red, green, blue);
+	}
+}
+
+void GlyphText::clear_cell(const text_rect &r)
+{
+	for (unsigned i = 0; i < r.h; ++i)
+		memset(buffer + (r.y + i) * stride + r.x * 4, 0, r.w * 4);
+}
+
+text_rect GlyphText::render(const std::string &str)
+{
+	text_rect changed = {0, 0, 0, 0};
+
+	if (!(flags & initialized))
+		return changed;
+
+	const std::vector<std::string> old_lines = split_lines(current);
+	const std::vector<std::string> new_lines = split_lines(str);
+
+	const unsigned num_old = old_lines.size();
+	const unsigned num_new = new_lines.size();
+
+	// With a different number of lines, all lines move.
+	if (num_old != num_new) {
+		for (unsigned i = 0; i < num_old; ++i) {
+			for (unsigned j = 0; j < old_lines[i].size(); ++j) {
+				const text_rect r = cell_rect(i, num_old, j);
+
+				clear_cell(r);
+				unite(changed, r);
+			}
+		}
+
+		for (unsigned i = 0; i < num_new; ++i) {
+			for (unsigned j = 0; j < new_lines[i].size(); ++j) {
+				const text_rect r = cell_rect(i, num_new, j);
+
+				draw_cell(r, cell_top(i, num_new), new_lines[i][j]);
+				unite(changed, r);
+			}
+		}
+
+		current = str;
+
+		return changed;
+	}
+
+	// Otherwise only the cells with a different character are drawn.
+	for (unsigned i = 0; i < num_new; ++i) {
+		const std::string &o = old_lines[i];
+		const std::string &n = new_lines[i];
+
+		for (unsigned j = 0; j < std::max(o.size(), n.size()); ++j) {
+			if (j < o.size() && j < n.size() && o[j] == n[j])
+				continue;
+
+			const text_rect r = cell_rect(i, num_new, j);
+
+			if (j < n.size())
+				draw_cell(r, cell_top(i, num_new), n[j]);
+			else
+				clear_cell(r);
+
+			unite(changed, r);
+		}
+	}
+
+	current = str;
+
+	return changed;
+}
+
+text_rect GlyphText::diff(const std::string &a, const std::string &b) const
+{
+	text_rect changed = {0, 0, 0, 0};
+
+	const std::vector<std::string> a_lines = split_lines(a);
+	const std::vector<std::string> b_lines = split_lines(b);
+
+	if (a_lines.size() != b_lines.size()) {
+		for (auto lines : {&a_lines, &b_lines}) {
+			for (unsigned i = 0; i < lines->size(); ++i) {
+				for (unsigned j = 0; j < (*lines)[i].size(); ++j)
+					unite(changed, cell_rect(i, lines->size(), j));
+			}
+		}
+
+		return changed;
+	}
+
+	for (unsigned i = 0; i < a_lines.size(); ++i) {
+		const std::string &x = a_lines[i];
+		const std::string &y = b_lines[i];
+
+		for (unsigned j = 0; j < std::max(x.size(), y.size()); ++j) {
+			if (j < x.size() && j < y.size() && x[j] == y[j])
+				continue;
+
+			unite(changed, cell_rect(i, a_lines.size(), j));
+		}
+	}
+
+	return changed;
+}
+
+void GlyphText::clear()
+{
+	if (!(flags & initialized))
+		return;
+
+	memset(buffer, 0, get_size());
+	current.clear();
+}
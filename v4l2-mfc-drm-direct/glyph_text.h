@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__GLYPH_TEXT_)
+#define __GLYPH_TEXT_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Rectangle in pixels, e.g. the area that is covered by rendered text.
+// A rectangle with zero width or height is empty.
+struct text_rect {
+	unsigned x, y;
+	unsigned w, h;
+};
+
+
+// Alpha masks of the printable ASCII characters in a monospace font.
+// The glyphs are rasterized once with Cairo, and are then only copied.
+// All glyphs have the same cell size, so that a character can be
+// replaced without touching its neighbours.
+class GlyphAtlas {
+private:
+	enum constants {
+		first_char = 32,
+		last_char = 126,
+		glyph_count = last_char - first_char + 1,
+	};
+
+	enum flags {
+		initialized		= (1 << 0),
+	};
+
+	// The masks of all glyphs, one cell after the other.
+	std::vector<uint8_t> masks;
+
+	unsigned cell_w, cell_h;
+
+	unsigned flags;
+
+public:
+	GlyphAtlas();
+	~GlyphAtlas() {}
+
+	GlyphAtlas(const GlyphAtlas &a) = delete;
+
+	// Rasterize the glyphs.
+	// init() returns false if an error occurs.
+	//
+	// @font: name of the font family
+	// @size: font size in pixels
+	bool init(const std::string &font, double size);
+
+	// Mask of a character (cell_w * cell_h bytes). Characters that
+	// are not in the atlas are shown as '?'.
+	const uint8_t* get_mask(char c) const;
+
+	unsigned get_cell_width() const;
+	unsigned get_cell_height() const;
+};
+
+
+// Text renderer that draws into a ARGB8888 buffer, by copying the glyph
+// masks from an atlas. The renderer remembers the text in its buffer,
+// and only redraws the character cells that differ from it. The lines
+// of the text are placed at the lower left corner of the buffer.
+class GlyphText {
+private:
+	enum flags {
+		initialized		= (1 << 0),
+	};
+
+	const GlyphAtlas &atlas;
+
+	uint8_t *buffer;
+
+	unsigned width;
+	unsigned height;
+	unsigned stride;
+
+	// Text color (not premultiplied).
+	uint8_t red, green, blue;
+
+	// Text that is currently in the buffer.
+	std::string current;
+
+	unsigned flags;
+
+	// Top of a line, which might be above the buffer.
+	long cell_top(unsigned line, unsigned num_lines) const;
+
+	// Area of a character cell, clipped to the buffer.
+	//
+	// @line: line of the character
+	// @num_lines: total number of lines of the text
+	// @col: column of the character
+	text_rect cell_rect(unsigned line, unsigned num_lines, unsigned col) const;
+
+	// @r: area of the cell
+	// @top: top of the line of the cell (see cell_top())
+	// @c: character to draw
+	void draw_cell(const text_rect &r, long top, char c);
+	void clear_cell(const text_rect &r);
+
+public:
+	GlyphText(unsigned w, unsigned h, const GlyphAtlas &a);
+	~GlyphText();
+
+	GlyphText(const GlyphText& gt) = delete;
+
+	unsigned get_size() const;
+
+	bool init(uint8_t *b);
+	void deinit();
+
+	void set_color(uint8_t r, uint8_t g, uint8_t b);
+
+	// Render text, replacing the text in the buffer. Lines are
+	// separated by '\n'. Returns the area that was changed.
+	text_rect render(const std::string &str);
+
+	// Area of the character cells that differ between two texts.
+	text_rect diff(const std::string &a, const std::string &b) const;
+
+	// Clear the whole buffer.
+	void clear();
+};
+
+#endif // __GLYPH_TEXT_
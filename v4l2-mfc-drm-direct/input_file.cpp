@@ -65,15 +65,55 @@ bool InputFile::open(const std::string &name)
 	return true;
 }
 
+bool InputFile::open(const InputFile &parent, size_t offset, size_t length,
+					 const std::vector<uint8_t> &prefix)
+{
+	static const std::string msg_prefix("InputFile::open(): ");
+
+	if (flags & opened)
+		return false;
+
+	if (!parent.is_open() || offset + length > parent.size) {
+		std::cerr << msg_prefix << "invalid range for view.\n";
+		return false;
+	}
+
+	const uint8_t *src = parent.data() + offset;
+
+	// Without a prefix we can point directly into the parent.
+	if (prefix.empty()) {
+		p = const_cast<uint8_t*>(src);
+	} else {
+		storage.reserve(prefix.size() + length);
+		storage.assign(prefix.begin(), prefix.end());
+		storage.insert(storage.end(), src, src + length);
+
+		p = storage.data();
+	}
+
+	fd = -1;
+	size = prefix.size() + length;
+	saved_offs = offs = 0;
+
+	flags |= (opened | view);
+
+	return true;
+}
+
 void InputFile::close()
 {
 	if (!(flags & opened))
 		return;
 
-	munmap(p, size);
-	::close(fd);
+	if (flags & view) {
+		storage.clear();
+		storage.shrink_to_fit();
+	} else {
+		munmap(p, size);
+		::close(fd);
+	}
 
-	flags &= ~opened;
+	flags &= ~(opened | view);
 }
 
 bool InputFile::is_open() const
@@ -131,3 +171,19 @@ void InputFile::rewind()
 {
 	offs = 0;
 }
+
+const uint8_t* InputFile::data() const
+{
+	if (!(flags & opened))
+		return nullptr;
+
+	return static_cast<const uint8_t*>(p);
+}
+
+size_t InputFile::get_size() const
+{
+	if (!(flags & opened))
+		return 0;
+
+	return size;
+}
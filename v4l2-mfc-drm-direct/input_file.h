@@ -18,17 +18,25 @@
 #define __INPUT_FILE_
 
 #include <string>
+#include <vector>
+#include <cstdint>
 
 class InputFile {
 private:
 	enum flags {
 		opened			= (1 << 0),
+
+		// File is a view into another input file.
+		view			= (1 << 1),
 	};
 
 	int fd;
 	void *p;
 	size_t size, offs, saved_offs;
 
+	// Backing storage of a view that needs a prefix.
+	std::vector<uint8_t> storage;
+
 	unsigned flags;
 
 public:
@@ -40,6 +48,16 @@ public:
 	bool open(const std::string &name);
 	void close();
 
+	// Open a view of a range of another (opened) input file.
+	// The view stays valid as long as the other file is open.
+	// open() returns false if an error occurs.
+	//
+	// @parent: reference to the input file to take the range from
+	// @offset, length: byte range of the view
+	// @prefix: data that is put in front of the range (can be empty)
+	bool open(const InputFile &parent, size_t offset, size_t length,
+			  const std::vector<uint8_t> &prefix);
+
 	// Returns true if associated with a file.
 	bool is_open() const;
 
@@ -66,6 +84,11 @@ public:
 	// Check for EOF state.
 	bool eof() const;
 
+	// Direct access to the file contents.
+	// Returns nullptr if no file is open.
+	const uint8_t* data() const;
+	size_t get_size() const;
+
 };
 
 #endif // __INPUT_FILE_
@@ -19,11 +19,23 @@
 #include "exynos_drm.h"
 #include "parser.h"
 #include "input_file.h"
+#include "stats.h"
+#include "file_writer.h"
+#include "parallel_decoder.h"
+#include "frame_scheduler.h"
+#include "player.h"
+#include "subtitles.h"
+#include "control_socket.h"
+#include "playlist.h"
+#include "mosaic_player.h"
 
 #include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
 #include <thread>
-#include <atomic>
 
+#include <unistd.h>
 #include <linux/videodev2.h>
 
 enum common_constants {
@@ -35,167 +47,1339 @@ enum common_constants {
 
 	// The number of compressed stream buffers
 	input_buffer_count = 2,
-};
 
-enum state_flags {
-	finished	= (1 << 0),
-	error		= (1 << 1),
+	// Streams of a mosaic, each needs a MFC context of its own.
+	mosaic_max_streams = 16,
 };
 
-struct thread_data {
-	ExynosDRM *drm;
-	MFCDecoder *mfcdec;
-
-	std::atomic<unsigned> decoding_state;
+// Command line options
+//
+// @input: path of the H.264 elementary stream
+// @stats_interval: seconds between periodic statistics reports (zero
+//                  disables the periodic reports)
+// @stats_json: print statistics as JSON instead of text
+// @output: path of the output file (if empty, the frames are displayed)
+// @fps_{num,den}: frame rate of the stream
+// @contexts: number of MFC contexts for parallel decoding to a file
+//            (zero disables parallel decoding)
+// @low_latency: use the low-latency decoding mode
+// @pacing: present the frames according to the frame rate, instead of
+//          flipping as soon as they are decoded
+// @mailbox: present the frames in mailbox mode
+// @scaling: how the video is scaled to the screen
+// @clones: connector types of additional outputs that mirror the video
+// @writeback: capture every n-th flip with a writeback connector
+//             (zero disables the capture)
+// @flip_log: path of the CSV log of the flips (empty for none)
+// @osd: show the performance OSD on the overlay
+// @subtitles: path of a SRT or WebVTT file (empty for none)
+// @control: path of the control socket, which enables the daemon mode
+//           (empty for none)
+// @playlist: path of the playlist (empty for none)
+// @loop: play the playlist in a loop
+// @mosaic: path of the list of streams that are shown at once (empty
+//          for none)
+struct options {
+	std::string input;
+	unsigned stats_interval;
+	bool stats_json;
+	std::string output;
+	unsigned fps_num, fps_den;
+	unsigned contexts;
+	bool low_latency;
+	bool pacing;
+	bool mailbox;
+	ExynosDRM::scaling_mode scaling;
+	std::vector<ExynosDRM::connector_type> clones;
+	unsigned writeback;
+	std::string flip_log;
+	bool osd;
+	std::string subtitles;
+	std::string control;
+	std::string playlist;
+	bool loop;
+	std::string mosaic;
 };
 
-int presentation_thread(thread_data *data)
+void print_usage(const char *name)
+{
+	std::cout << "Usage: " << name << " [options]\n"
+			  << "\t-i <file>: H.264 elementary stream to play (default: /dev/shm/test.h264)\n"
+			  << "\t-s <seconds>: interval for periodic statistics reports (default: 0 = off)\n"
+			  << "\t-j: print statistics as JSON\n"
+			  << "\t-o <file>: decode to a file instead of the display (raw NV12, or Y4M\n"
+			  << "\t           if the name ends with .y4m)\n"
+			  << "\t-r <num>[/<den>]: frame rate of the stream (default: 25)\n"
+			  << "\t-P <contexts>: decode to the file with several MFC contexts in parallel,\n"
+			  << "\t               by splitting the stream at IDR frames (requires -o)\n"
+			  << "\t-l: low-latency mode, the decoder outputs frames without delay\n"
+			  << "\t    (only for streams without B-frames, implies -n)\n"
+			  << "\t-n: no frame pacing, flip frames as soon as they are decoded\n"
+			  << "\t-m: mailbox mode, always show the newest frame and drop older\n"
+			  << "\t    ones that wait for the display (implies -n)\n"
+			  << "\t-z <mode>: scaling of the video: fit (default), fill, 1:1 or integer\n"
+			  << "\t-c <connector>: mirror the video to another output: hdmi, vga or other\n"
+			  << "\t                (can be given several times)\n"
+			  << "\t-w <n>: capture every n-th flip with a writeback connector, and\n"
+			  << "\t        report the checksums of the captures\n"
+			  << "\t-V <file>: log the vblank counter and timing of every flip as CSV\n"
+			  << "\t-O: show decoder/display rates, drops, queue depths and CPU load\n"
+			  << "\t    of the parser/decoder/display on the screen\n"
+			  << "\t-S <file>: show subtitles from a SRT or WebVTT file, timed by the\n"
+			  << "\t           frame rate (see -r)\n"
+			  << "\t-d <socket>: daemon mode, play the streams that are requested on a\n"
+			  << "\t             control socket, keeping the display initialized\n"
+			  << "\t             (commands: play <file>, queue <file>, next, stop,\n"
+			  << "\t             status, quit)\n"
+			  << "\t-p <file>: play the streams of a playlist (one path per line),\n"
+			  << "\t           without gaps between streams of the same picture size\n"
+			  << "\t-L: play the playlist in a loop\n"
+			  << "\t-M <file>: show the streams of a list (one path per line) at once in\n"
+			  << "\t           a grid, each decoded by its own MFC context (video wall)\n"
+			  << "\t-h: show this help\n";
+}
+
+bool parse_options(int argc, char* argv[], options &opts)
 {
-	while (true) {
-		if (data->decoding_state.load() & (finished | error))
+	opts.input = "/dev/shm/test.h264";
+	opts.stats_interval = 0;
+	opts.stats_json = false;
+	opts.output.clear();
+	opts.fps_num = 25;
+	opts.fps_den = 1;
+	opts.contexts = 0;
+	opts.low_latency = false;
+	opts.pacing = true;
+	opts.mailbox = false;
+	opts.scaling = ExynosDRM::scaling_fit;
+	opts.clones.clear();
+	opts.writeback = 0;
+	opts.flip_log.clear();
+	opts.osd = false;
+	opts.subtitles.clear();
+	opts.control.clear();
+	opts.playlist.clear();
+	opts.loop = false;
+	opts.mosaic.clear();
+
+	int c;
+
+	while ((c = getopt(argc, argv, "i:s:jo:r:P:lnmz:c:w:V:OS:d:p:LM:h")) != -1) {
+		switch (c) {
+		case 'i':
+			opts.input = optarg;
 			break;
 
-		ExynosPage *p;
+		case 's':
+			opts.stats_interval = std::stoul(optarg);
+			break;
+
+		case 'j':
+			opts.stats_json = true;
+			break;
+
+		case 'o':
+			opts.output = optarg;
+			break;
+
+		case 'r': {
+			const std::string rate(optarg);
+			const size_t sep = rate.find('/');
+
+			opts.fps_num = std::stoul(rate.substr(0, sep));
+			opts.fps_den = (sep == std::string::npos) ?
+				1 : std::stoul(rate.substr(sep + 1));
+
+			if (opts.fps_num == 0 || opts.fps_den == 0)
+				return false;
 
-		p = data->mfcdec->dequeue_dest();
-		if (!p) {
-			std::cerr << "DEBUG: dequeue failed.\n";
-			data->decoding_state.fetch_or(error);
 			break;
 		}
 
-		if (!data->drm->issue_flip(p)) {
-			std::cerr << "DEBUG: flip failed.\n";
-			data->decoding_state.fetch_or(error);
+		case 'P':
+			opts.contexts = std::stoul(optarg);
+			if (opts.contexts == 0)
+				return false;
+
+			break;
+
+		case 'l':
+			opts.low_latency = true;
+			opts.pacing = false;
+			break;
+
+		case 'n':
+			opts.pacing = false;
+			break;
+
+		case 'm':
+			opts.mailbox = true;
+			opts.pacing = false;
+			break;
+
+		case 'z': {
+			const std::string mode(optarg);
+
+			if (mode == "fit")
+				opts.scaling = ExynosDRM::scaling_fit;
+			else if (mode == "fill")
+				opts.scaling = ExynosDRM::scaling_fill;
+			else if (mode == "1:1")
+				opts.scaling = ExynosDRM::scaling_none;
+			else if (mode == "integer")
+				opts.scaling = ExynosDRM::scaling_integer;
+			else
+				return false;
+
 			break;
 		}
 
-		p = nullptr;
+		case 'c': {
+			const std::string type(optarg);
 
-		while (!p) {
-			p = data->drm->get_page();
+			if (type == "hdmi")
+				opts.clones.push_back(ExynosDRM::connector_hdmi);
+			else if (type == "vga")
+				opts.clones.push_back(ExynosDRM::connector_vga);
+			else if (type == "other")
+				opts.clones.push_back(ExynosDRM::connector_other);
+			else
+				return false;
 
-			if (!p)
-				data->drm->wait_for_flip();
+			break;
 		}
 
-		if (!data->mfcdec->queue_dest(p)) {
-			std::cerr << "DEBUG: queue failed.\n";
-			data->decoding_state.fetch_or(error);
+		case 'w':
+			opts.writeback = std::stoul(optarg);
+			if (opts.writeback == 0)
+				return false;
+
+			break;
+
+		case 'V':
+			opts.flip_log = optarg;
+			break;
+
+		case 'O':
+			opts.osd = true;
 			break;
+
+		case 'S':
+			opts.subtitles = optarg;
+			break;
+
+		case 'd':
+			opts.control = optarg;
+			break;
+
+		case 'p':
+			opts.playlist = optarg;
+			break;
+
+		case 'L':
+			opts.loop = true;
+			break;
+
+		case 'M':
+			opts.mosaic = optarg;
+			break;
+
+		case 'h':
+		default:
+			return false;
+		}
+	}
+
+	if (opts.contexts != 0 && opts.output.empty())
+		return false;
+
+	// The daemon only plays to the display.
+	if (!opts.control.empty() && !opts.output.empty())
+		return false;
+
+	// The same goes for playlists, which the daemon has on its own.
+	if (!opts.playlist.empty() && (!opts.output.empty() || !opts.control.empty()))
+		return false;
+
+	if (opts.loop && opts.playlist.empty())
+		return false;
+
+	// The mosaic only uses the main output, and has its own streams.
+	if (!opts.mosaic.empty() &&
+		(!opts.output.empty() || !opts.control.empty() || !opts.playlist.empty() ||
+		 !opts.clones.empty() || opts.writeback != 0 || !opts.subtitles.empty()))
+		return false;
+
+	return true;
+}
+
+enum FileWriter::format output_format(const std::string &name)
+{
+	const std::string ext(".y4m");
+
+	if (name.size() > ext.size() &&
+		name.compare(name.size() - ext.size(), ext.size(), ext) == 0)
+		return FileWriter::format_y4m;
+
+	return FileWriter::format_nv12;
+}
+
+// Decode the whole stream to a file, using several MFC contexts.
+int decode_parallel(const options &opts)
+{
+	ParallelDecoder pdec;
+	FileWriter writer;
+
+	if (!pdec.open(opts.input, opts.contexts)) {
+		std::cerr << "initialization failed.\n";
+		return 1;
+	}
+
+	if (!pdec.decode(writer, opts.output, output_format(opts.output),
+					 opts.fps_num, opts.fps_den)) {
+		std::cerr << "parallel decoding failed.\n";
+		return 1;
+	}
+
+	return 0;
+}
+
+// Check the decode latency that was achieved in low-latency mode. Without
+// display delay, a frame should leave the decoder within one frame period.
+void print_latency_check(const MFCDecoder *mfcdec, const options &opts)
+{
+	const histogram_summary hs = mfcdec->get_decode_latency();
+	const uint64_t period = uint64_t(opts.fps_den) * 1000000 / opts.fps_num;
+
+	if (hs.count == 0)
+		return;
+
+	std::cout << "low-latency mode: decode latency p50 = " << hs.p50
+			  << " us, p99 = " << hs.p99 << " us (frame period = "
+			  << period << " us).\n";
+
+	if (hs.p50 > period) {
+		std::cout << "low-latency mode: decoder still delays frames, the "
+				  << "stream probably needs reordering.\n";
+	}
+}
+
+void print_stats(const MFCDecoder *mfcdec, const ExynosDRM *drm,
+				 const FrameScheduler *sched, bool json)
+{
+	StatsReport r;
+
+	mfcdec->add_stats(r);
+	drm->add_stats(r);
+
+	if (sched)
+		sched->add_stats(r);
+
+	if (json) {
+		r.print_json(std::cout);
+	} else {
+		std::cout << "statistics:\n";
+		r.print_text(std::cout);
+	}
+}
+
+// Print the timing of the startup phases.
+void print_startup(const PhaseTimer &t, bool json)
+{
+	StatsReport r;
+
+	t.add_stats(r, "startup_");
+
+	if (json) {
+		r.print_json(std::cout);
+	} else {
+		std::cout << "startup:\n";
+		r.print_text(std::cout);
+	}
+}
+
+// Hand the initial pages to the decoder. All pages are prepared first,
+// so that neither this nor the playback has to map them later.
+// queue_pages() returns false if an error occurs.
+bool queue_pages(MFCDecoder *mfcdec, ExynosDRM *drm)
+{
+	// Not every driver supports this, the pages are then mapped
+	// when they are queued for the first time.
+	for (auto &i : drm->get_pages()) {
+		if (!mfcdec->prepare_dest(i)) {
+			std::cerr << "pages can't be prepared ahead.\n";
+			break;
+		}
+	}
+
+	// MFC needs some destination buffers queued, before it can begin
+	// operation. Queue these buffers here.
+	while (!mfcdec->ready()) {
+		if (!mfcdec->queue_dest(drm->get_page()))
+			return false;
+	}
+
+	// One more page, so that the decoder can continue while the first
+	// frame is displayed. In low-latency mode, there is no page left.
+	ExynosPage *p = drm->get_page();
+
+	if (p && !mfcdec->queue_dest(p))
+		return false;
+
+	return true;
+}
+
+// Decoder side of a stream. In daemon mode, this is set up again for
+// each stream, while the display stays initialized.
+struct stream {
+	InputFile *input;
+	Parser *parser;
+	MFCDecoder *mfcdec;
+	FrameScheduler *sched;
+};
+
+void close_stream(stream &s)
+{
+	delete s.sched;
+	delete s.mfcdec;
+	delete s.parser;
+	delete s.input;
+
+	s = stream{nullptr, nullptr, nullptr, nullptr};
+}
+
+// Set up the decoder of a stream, and hand the pages of the display
+// to it. open_stream() returns false if an error occurs.
+//
+// @name: path of the H.264 elementary stream (for messages)
+// @in: opened input of the stream (owned by the stream from now on)
+// @drm: initialized DRM device (the pages are set up for the stream)
+// @input_buffers: stream buffers of the DRM device
+// @s: receives the stream
+// @t: timer for the setup phases
+bool open_stream(const options &opts, const std::string &name, InputFile *in,
+				 ExynosDRM *drm, std::vector<ExynosBuffer> &input_buffers,
+				 stream &s, PhaseTimer &t)
+{
+	using namespace std;
+
+	s = stream{in, nullptr, nullptr, nullptr};
+
+	try {
+		s.parser = Parser::get_parser_from_codec(Parser::h264);
+		s.mfcdec = new MFCDecoder;
+
+		if (!s.parser->link(s.input))
+			throw runtime_error("failed to open stream");
+
+		unsigned phase = t.begin("decoder_open");
+
+		if (!s.mfcdec->open(opts.low_latency ? MFCDecoder::mode_low_latency :
+							MFCDecoder::mode_normal))
+			throw runtime_error("failed to open decoder");
+
+		// The mailbox holds one more page outside of the decoder.
+		if (opts.mailbox)
+			s.mfcdec->add_extra_buffers(1);
+
+		videoinfo vi;
+		unsigned num_pages;
+
+		if (!s.mfcdec->set_parser(s.parser))
+			throw runtime_error("failed to setup decoder");
+
+		t.end(phase);
+		phase = t.begin("header_parse");
+
+		if (!s.mfcdec->set_source(input_buffers))
+			throw runtime_error("failed to parse stream header");
+
+		t.end(phase);
+		phase = t.begin("capture_setup");
+
+		if (!s.mfcdec->init(num_pages, vi))
+			throw runtime_error("failed to setup decoder");
+
+		t.end(phase);
+		phase = t.begin("page_alloc");
+
+		// Usually the pages of the previous stream fit, and the
+		// display keeps its state.
+		if (!drm->reset_pages(num_pages, vi))
+			throw runtime_error("failed to setup pages");
+
+		t.end(phase);
+
+		if (opts.pacing && drm->get_refresh_period() != 0) {
+			s.sched = new FrameScheduler;
+
+			if (!s.sched->init(drm->get_refresh_period(), opts.fps_num, opts.fps_den))
+				throw runtime_error("failed to setup frame scheduler");
 		}
+
+		phase = t.begin("page_queue");
+
+		if (!queue_pages(s.mfcdec, drm))
+			throw runtime_error("failed to queue pages");
+
+		t.end(phase);
 	}
+	catch (exception &e) {
+		cerr << "stream \"" << name << "\": " << e.what() << ".\n";
+		close_stream(s);
+
+		return false;
+	}
+
+	return true;
+}
+
+// Set up the display for playing several streams, which share the
+// stream buffers and the pages. Unlike the single stream setup, the
+// display is set up before the first decoder.
+// open_display() returns false if an error occurs.
+//
+// @drm: DRM device to open
+// @input_buffers: receives the stream buffers
+// @streams: number of streams that are decoded at the same time
+bool open_display(const options &opts, ExynosDRM &drm,
+				  std::vector<ExynosBuffer> &input_buffers, unsigned streams = 1)
+{
+	using namespace std;
 
-	if (data->decoding_state.load() & finished) {
-		// TODO: drain
+	if (!drm.open(ExynosDRM::connector_hdmi))
+		return false;
+
+	for (auto &i : opts.clones) {
+		if (!drm.add_clone(i))
+			cerr << "clone output not available.\n";
 	}
 
+	if (opts.writeback != 0 && !drm.enable_writeback(opts.writeback))
+		return false;
+
+	if (!opts.flip_log.empty() && !drm.open_flip_log(opts.flip_log))
+		return false;
+
+	if (!drm.init(1920, 1080))
+		return false;
+
+	if (!drm.enable_output())
+		cerr << "output not enabled ahead, modeset with the first frame.\n";
+
+	drm.set_scaling(opts.scaling);
+
+	return drm.alloc_buffers(input_buffer_count * streams, input_buffer_size,
+							 input_buffers);
+}
+
+// Keep the display initialized, and play the streams that are requested
+// on the control socket. Between streams, only the decoder is set up
+// again, so that switching streams is fast.
+int run_daemon(const options &opts)
+{
+	using namespace std;
+
+	enum daemon_event {
+		event_control = 0,
+		event_player,
+	};
+
+	ExynosDRM drm;
+	std::vector<ExynosBuffer> input_buffers;
+	ControlSocket control;
+	EventLoop loop;
+
+	if (!opts.subtitles.empty())
+		cerr << "subtitles are not available in daemon mode.\n";
+
+	if (!open_display(opts, drm, input_buffers) || !control.open(opts.control) ||
+		!loop.open() || !loop.add(control.get_fd(), EPOLLIN, event_control)) {
+		cerr << "initialization failed.\n";
+		return 1;
+	}
+
+	Player player;
+	stream s{nullptr, nullptr, nullptr, nullptr};
+	deque<string> playlist;
+	string current;
+	bool playing = false;
+
+	// Timing of the setup of the current stream, until its first frame
+	// is presented (nullptr once reported).
+	PhaseTimer *startup = nullptr;
+	uint64_t presented = 0;
+
+	// Stop the current stream. The last frame stays on the screen.
+	auto stop = [&]() {
+		if (!playing)
+			return;
+
+		loop.remove(player.get_fd());
+		player.deinit();
+
+		print_stats(s.mfcdec, &drm, s.sched, opts.stats_json);
+		close_stream(s);
+
+		current.clear();
+		playing = false;
+	};
+
+	// Continue with the next stream of the playlist. Streams that can't
+	// be played are skipped. Returns false if none is left.
+	auto play_next = [&]() -> bool {
+		stop();
+
+		while (!playlist.empty()) {
+			const string name = playlist.front();
+
+			playlist.pop_front();
+
+			delete startup;
+			startup = new PhaseTimer;
+
+			const unsigned phase = startup->begin("input_open");
+			InputFile *in = new InputFile;
+
+			if (!in->open(name)) {
+				cerr << "stream \"" << name << "\": failed to open stream.\n";
+				delete in;
+
+				continue;
+			}
+
+			startup->end(phase);
+
+			if (!open_stream(opts, name, in, &drm, input_buffers, s, *startup))
+				continue;
+
+			Player::present_mode mode = Player::present_fifo;
+
+			if (opts.mailbox)
+				mode = Player::present_mailbox;
+			else if (s.sched)
+				mode = Player::present_paced;
+
+			if (!player.init(&drm, s.mfcdec, nullptr, s.sched, mode, opts.osd) ||
+				!loop.add(player.get_fd(), EPOLLIN, event_player)) {
+				player.deinit();
+				close_stream(s);
+
+				continue;
+			}
+
+			cout << "playing \"" << name << "\".\n";
+
+			presented = drm.get_frames_presented();
+			current = name;
+			playing = true;
+
+			return true;
+		}
+
+		return false;
+	};
+
+	vector<EventLoop::event> events;
+	deque<ControlSocket::command> commands;
+	bool running = true;
+
+	while (running) {
+		if (!loop.wait(events, -1))
+			break;
+
+		for (auto &i : events) {
+			if (i.id == event_control && !control.receive(commands)) {
+				running = false;
+				break;
+			}
+
+			if (i.id != event_player || !playing)
+				continue;
+
+			if (!player.dispatch(0)) {
+				cerr << "playback of \"" << current << "\" failed.\n";
+				play_next();
+
+				continue;
+			}
+
+			if (startup && drm.get_frames_presented() != presented) {
+				startup->mark("first_frame", drm.get_last_flip_time());
+				print_startup(*startup, opts.stats_json);
+
+				delete startup;
+				startup = nullptr;
+			}
+
+			if (player.done())
+				play_next();
+		}
+
+		for (; !commands.empty(); commands.pop_front()) {
+			const ControlSocket::command &c = commands.front();
+
+			if (c.name == "play" && !c.arg.empty()) {
+				playlist.clear();
+				playlist.push_back(c.arg);
+
+				control.reply(c.client, play_next() ? "ok" : "error: failed to play stream");
+			} else if (c.name == "queue" && !c.arg.empty()) {
+				playlist.push_back(c.arg);
+
+				if (!playing && !play_next())
+					control.reply(c.client, "error: failed to play stream");
+				else
+					control.reply(c.client, "ok");
+			} else if (c.name == "next") {
+				if (playlist.empty())
+					control.reply(c.client, "error: playlist is empty");
+				else
+					control.reply(c.client, play_next() ? "ok" : "error: failed to play stream");
+			} else if (c.name == "stop") {
+				playlist.clear();
+				stop();
+
+				control.reply(c.client, "ok");
+			} else if (c.name == "status") {
+				control.reply(c.client, playing ? "ok playing " + current : "ok stopped");
+			} else if (c.name == "quit") {
+				running = false;
+
+				control.reply(c.client, "ok");
+			} else {
+				control.reply(c.client, "error: unknown command");
+			}
+		}
+	}
+
+	stop();
+	delete startup;
+
+	// The buffers have to be released before their DRM device.
+	input_buffers.clear();
+
 	return 0;
 }
 
+// Play the clips of a playlist. As long as the next clip has the same
+// picture size, and fits into the buffers of the running decoder, it is
+// passed to that decoder, and follows the current clip without a gap. Otherwise the decoder finishes the
+// current clip, and a new decoder is set up for the next one, while the
+// last frame stays on the screen.
+int run_playlist(const options &opts)
+{
+	using namespace std;
+
+	Playlist playlist;
+	ExynosDRM drm;
+	std::vector<ExynosBuffer> input_buffers;
+
+	if (!opts.subtitles.empty())
+		cerr << "subtitles are not available with playlists.\n";
+
+	if (!playlist.open(opts.playlist, opts.loop) ||
+		!open_display(opts, drm, input_buffers)) {
+		cerr << "initialization failed.\n";
+		return 1;
+	}
+
+	// The clip that the parser reads, and the clip after the last one
+	// that was passed to the decoder, which is read ahead.
+	Playlist::clip cur{}, ahead{};
+	bool have_cur = playlist.next(cur);
+	bool have_ahead = have_cur && playlist.next(ahead);
+
+	const uint64_t stats_interval = uint64_t(opts.stats_interval) * 1000000;
+	uint64_t last_stats = monotonic_us();
+
+	Player player;
+	stream s{nullptr, nullptr, nullptr, nullptr};
+	int ret = 0;
+
+	while (have_cur) {
+		PhaseTimer startup;
+
+		if (!open_stream(opts, cur.name, cur.input, &drm, input_buffers, s, startup)) {
+			cur = ahead;
+			have_cur = have_ahead;
+			have_ahead = have_cur && playlist.next(ahead);
+
+			continue;
+		}
+
+		Player::present_mode mode = Player::present_fifo;
+
+		if (opts.mailbox)
+			mode = Player::present_mailbox;
+		else if (s.sched)
+			mode = Player::present_paced;
+
+		if (!player.init(&drm, s.mfcdec, nullptr, s.sched, mode, opts.osd)) {
+			close_stream(s);
+			ret = 1;
+
+			break;
+		}
+
+		cout << "playing \"" << cur.name << "\".\n";
+
+		// The decoder is set up for this clip, also while it plays
+		// the clips that follow.
+		const Playlist::clip running = cur;
+
+		const uint64_t presented = drm.get_frames_presented();
+		bool startup_done = false;
+
+		// Clip that was passed to the decoder, but that the parser
+		// has not reached yet.
+		Playlist::clip queued{};
+		bool have_queued = false;
+
+		while (!player.done()) {
+			if (!have_queued && have_ahead && Playlist::can_follow(running, ahead)) {
+				s.mfcdec->set_next_input(ahead.input);
+
+				queued = ahead;
+				have_queued = true;
+				have_ahead = playlist.next(ahead);
+			}
+
+			int timeout = -1;
+
+			if (stats_interval != 0) {
+				const uint64_t now = monotonic_us();
+
+				if (now - last_stats >= stats_interval) {
+					print_stats(s.mfcdec, &drm, s.sched, opts.stats_json);
+					last_stats = now;
+				}
+
+				timeout = (last_stats + stats_interval - now + 999) / 1000;
+			}
+
+			if (!player.dispatch(timeout)) {
+				cerr << "playback of \"" << cur.name << "\" failed.\n";
+				ret = 1;
+
+				break;
+			}
+
+			if (!startup_done && drm.get_frames_presented() != presented) {
+				startup.mark("first_frame", drm.get_last_flip_time());
+				print_startup(startup, opts.stats_json);
+
+				startup_done = true;
+			}
+
+			// The parser continues with the queued clip, the input of
+			// the current one is no longer used.
+			if (have_queued && !s.mfcdec->has_next_input()) {
+				delete s.input;
+				s.input = queued.input;
+
+				cur = queued;
+				have_queued = false;
+
+				cout << "continuing with \"" << cur.name << "\".\n";
+			}
+		}
+
+		player.deinit();
+
+		print_stats(s.mfcdec, &drm, s.sched, opts.stats_json);
+
+		if (have_queued) {
+			s.mfcdec->set_next_input(nullptr);
+			delete queued.input;
+		}
+
+		close_stream(s);
+
+		if (ret != 0)
+			break;
+
+		cur = ahead;
+		have_cur = have_ahead;
+		have_ahead = have_cur && playlist.next(ahead);
+	}
+
+	if (have_ahead)
+		delete ahead.input;
+
+	// The buffers have to be released before their DRM device.
+	input_buffers.clear();
+
+	return ret;
+}
+
+// Statistics of the display, and of the decoder of each tile.
+void print_mosaic_stats(const std::vector<stream> &streams, const ExynosDRM *drm,
+						bool json)
+{
+	StatsReport r;
+
+	drm->add_stats(r);
+
+	if (json) {
+		r.print_json(std::cout);
+	} else {
+		std::cout << "statistics:\n";
+		r.print_text(std::cout);
+	}
+
+	for (unsigned i = 0; i < streams.size(); ++i) {
+		StatsReport dr;
+
+		streams[i].mfcdec->add_stats(dr);
+
+		if (json) {
+			dr.print_json(std::cout);
+		} else {
+			std::cout << "statistics of tile " << i << ":\n";
+			dr.print_text(std::cout);
+		}
+	}
+}
+
+// Same as queue_pages(), with the pages of a tile.
+bool queue_tile_pages(MFCDecoder *mfcdec, ExynosDRM *drm, unsigned tile)
+{
+	for (auto &i : drm->get_tile_pages(tile)) {
+		if (!mfcdec->prepare_dest(i)) {
+			std::cerr << "pages can't be prepared ahead.\n";
+			break;
+		}
+	}
+
+	while (!mfcdec->ready()) {
+		if (!mfcdec->queue_dest(drm->get_tile_page(tile)))
+			return false;
+	}
+
+	ExynosPage *p = drm->get_tile_page(tile);
+
+	if (p && !mfcdec->queue_dest(p))
+		return false;
+
+	return true;
+}
+
+// Show several streams at once, each in a tile of a grid (video wall).
+// Every stream is decoded by its own MFC context, and the frames of all
+// streams go out together, with at most one commit per vblank.
+int run_mosaic(const options &opts)
+{
+	using namespace std;
+
+	Playlist list;
+	ExynosDRM drm;
+	std::vector<ExynosBuffer> input_buffers;
+	std::vector<stream> streams;
+
+	// The list is read like a playlist, which also checks the SPS
+	// of each stream.
+	if (!list.open(opts.mosaic, false)) {
+		cerr << "initialization failed.\n";
+		return 1;
+	}
+
+	Playlist::clip c{};
+
+	while (streams.size() < mosaic_max_streams && list.next(c))
+		streams.push_back(stream{c.input, nullptr, nullptr, nullptr});
+
+	list.close();
+
+	if (streams.empty() || !open_display(opts, drm, input_buffers, streams.size())) {
+		cerr << "initialization failed.\n";
+
+		for (auto &i : streams)
+			close_stream(i);
+
+		return 1;
+	}
+
+	// Each decoder gets its own share of the stream buffers.
+	std::vector<std::vector<ExynosBuffer>> buffers(streams.size());
+
+	for (unsigned i = 0; i < input_buffers.size(); ++i)
+		buffers[i / input_buffer_count].push_back(std::move(input_buffers[i]));
+
+	input_buffers.clear();
+
+	std::vector<ExynosMosaic::tile_setup> setup;
+	std::vector<MFCDecoder*> decoders;
+	int ret = 0;
+
+	try {
+		for (unsigned i = 0; i < streams.size(); ++i) {
+			stream &s = streams[i];
+			ExynosMosaic::tile_setup ts;
+
+			s.parser = Parser::get_parser_from_codec(Parser::h264);
+			s.mfcdec = new MFCDecoder;
+
+			if (!s.parser->link(s.input))
+				throw runtime_error("failed to open stream");
+
+			if (!s.mfcdec->open(opts.low_latency ? MFCDecoder::mode_low_latency :
+								MFCDecoder::mode_normal))
+				throw runtime_error("failed to open decoder");
+
+			// The tile holds one more page in its mailbox.
+			s.mfcdec->add_extra_buffers(1);
+
+			if (!s.mfcdec->set_parser(s.parser) ||
+				!s.mfcdec->set_source(buffers[i]) ||
+				!s.mfcdec->init(ts.num_pages, ts.vi))
+				throw runtime_error("failed to setup decoder");
+
+			setup.push_back(ts);
+			decoders.push_back(s.mfcdec);
+		}
+
+		if (!drm.alloc_mosaic(setup))
+			throw runtime_error("failed to setup the tiles");
+
+		for (unsigned i = 0; i < streams.size(); ++i) {
+			if (!queue_tile_pages(streams[i].mfcdec, &drm, i))
+				throw runtime_error("failed to queue pages");
+		}
+	}
+	catch (exception &e) {
+		cerr << "mosaic: " << e.what() << ".\n";
+		ret = 1;
+	}
+
+	MosaicPlayer player;
+
+	if (ret == 0 && !player.init(&drm, decoders)) {
+		cerr << "initialization failed.\n";
+		ret = 1;
+	}
+
+	const uint64_t stats_interval = uint64_t(opts.stats_interval) * 1000000;
+	uint64_t last_stats = monotonic_us();
+
+	while (ret == 0 && !player.done()) {
+		int timeout = -1;
+
+		if (stats_interval != 0) {
+			const uint64_t now = monotonic_us();
+
+			if (now - last_stats >= stats_interval) {
+				print_mosaic_stats(streams, &drm, opts.stats_json);
+				last_stats = now;
+			}
+
+			timeout = (last_stats + stats_interval - now + 999) / 1000;
+		}
+
+		if (!player.dispatch(timeout)) {
+			cerr << "mosaic playback failed.\n";
+			ret = 1;
+		}
+	}
+
+	// The other tiles went on without the streams that failed.
+	if (ret == 0 && player.get_failed() != 0) {
+		cerr << player.get_failed() << " of " << streams.size()
+			 << " stream(s) failed.\n";
+		ret = 1;
+	}
+
+	player.deinit();
+
+	if (ret == 0)
+		print_mosaic_stats(streams, &drm, opts.stats_json);
+
+	// The decoders hold the pages of the tiles.
+	for (auto &i : streams)
+		close_stream(i);
+
+	drm.free_mosaic();
+
+	// The buffers have to be released before their DRM device.
+	buffers.clear();
+
+	return ret;
+}
+
 int main(int argc, char* argv[]) {
 	using namespace std;
 
+	// Time to the first frame starts with the process.
+	PhaseTimer startup;
+	options opts;
+
+	try {
+		if (!parse_options(argc, argv, opts)) {
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+	catch (exception &e) {
+		cerr << "invalid argument.\n";
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	if (opts.contexts != 0)
+		return decode_parallel(opts);
+
+	if (!opts.control.empty())
+		return run_daemon(opts);
+
+	if (!opts.playlist.empty())
+		return run_playlist(opts);
+
+	if (!opts.mosaic.empty())
+		return run_mosaic(opts);
+
 	InputFile *input;
 	ExynosDRM *drm;
 	MFCDecoder *mfcdec;
 	Parser *parser;
-	std::thread *pres;
+	FileWriter *writer = nullptr;
+	FrameScheduler *sched = nullptr;
+	SubtitleTrack *subtitles = nullptr;
 
 	std::vector<ExynosBuffer> input_buffers;
 
+	// Sets up the display, while the decoder parses the stream header.
+	std::thread display;
+	bool display_ok = false;
+
 	try {
 		input = new InputFile;
 		drm = new ExynosDRM;
 		mfcdec = new MFCDecoder;
 		parser = Parser::get_parser_from_codec(Parser::h264);
 
-		if (!input->open("/dev/shm/test.h264"))
-			throw exception();
-		if (!parser->link(input))
-			throw exception();
+		const bool to_file = !opts.output.empty();
+
+		unsigned phase = startup.begin("drm_open");
 
 		// TODO: parse resolution from command line
-		if (!drm->open(ExynosDRM::connector_hdmi))
-			throw exception();
-		if (!drm->init(1920, 1080))
+		if (!drm->open(to_file ? ExynosDRM::connector_none : ExynosDRM::connector_hdmi))
 			throw exception();
+
+		// A missing clone output is not fatal, the video is still shown
+		// on the main output.
+		if (!to_file) {
+			for (auto &i : opts.clones) {
+				if (!drm->add_clone(i))
+					cerr << "clone output not available.\n";
+			}
+
+			if (opts.writeback != 0 && !drm->enable_writeback(opts.writeback))
+				throw exception();
+
+			if (!opts.flip_log.empty() && !drm->open_flip_log(opts.flip_log))
+				throw exception();
+
+			if (!opts.subtitles.empty()) {
+				subtitles = new SubtitleTrack;
+
+				if (!subtitles->open(opts.subtitles) ||
+					!drm->enable_subtitles(subtitles, opts.fps_num, opts.fps_den))
+					throw exception();
+			}
+		}
+
+		// The stream buffers only need the device, the decoder gets
+		// them before the display is set up.
 		if (!drm->alloc_buffers(input_buffer_count, input_buffer_size, input_buffers))
 			throw exception();
 
+		startup.end(phase);
+
+		// Selecting the mode probes the connector, and the modeset
+		// waits for the output. Neither depends on the stream. Until
+		// the thread is joined, only it uses the DRM device.
+		display = std::thread([&, to_file]() {
+			const unsigned id = startup.begin("display_setup");
+
+			display_ok = drm->init(1920, 1080);
+
+			if (display_ok && !to_file && !drm->enable_output())
+				cerr << "output not enabled ahead, modeset with the first frame.\n";
+
+			startup.end(id);
+		});
+
+		phase = startup.begin("input_open");
+
+		if (!input->open(opts.input))
+			throw exception();
+		if (!parser->link(input))
+			throw exception();
+
+		startup.end(phase);
+
 		videoinfo vi;
 		unsigned num_pages;
 
-		if (!mfcdec->open())
+		phase = startup.begin("decoder_open");
+
+		if (!mfcdec->open(opts.low_latency ? MFCDecoder::mode_low_latency :
+						  MFCDecoder::mode_normal))
 			throw exception();
+
+		// The mailbox holds one more page outside of the decoder.
+		if (opts.mailbox && !to_file)
+			mfcdec->add_extra_buffers(1);
+
 		if (!mfcdec->set_parser(parser))
 			throw exception();
+
+		startup.end(phase);
+		phase = startup.begin("header_parse");
+
 		if (!mfcdec->set_source(input_buffers))
 			throw exception();
+
+		startup.end(phase);
+		phase = startup.begin("capture_setup");
+
 		if (!mfcdec->init(num_pages, vi))
 			throw exception();
 
+		startup.end(phase);
+
+		display.join();
+
+		if (!display_ok)
+			throw exception();
+
+		drm->set_scaling(opts.scaling);
+
+		phase = startup.begin("page_alloc");
+
 		if (!drm->alloc_pages(num_pages, vi))
 			throw exception();
 
-		// MFC needs some destination buffers queued, before it can begin
-		// operation. Queue these buffers here.
-		while (!mfcdec->ready()) {
-			if (!mfcdec->queue_dest(drm->get_page()))
+		startup.end(phase);
+
+		if (to_file) {
+			writer = new FileWriter;
+
+			if (!writer->open(opts.output, output_format(opts.output),
+							  vi, opts.fps_num, opts.fps_den))
+				throw exception();
+		} else if (opts.pacing && drm->get_refresh_period() == 0) {
+			cerr << "unknown refresh period, frame pacing disabled.\n";
+		} else if (opts.pacing) {
+			sched = new FrameScheduler;
+
+			if (!sched->init(drm->get_refresh_period(), opts.fps_num, opts.fps_den))
 				throw exception();
 		}
 
-		// First page that we dequeue in the presentation thread.
-		if (!mfcdec->queue_dest(drm->get_page()))
+		phase = startup.begin("page_queue");
+
+		if (!queue_pages(mfcdec, drm))
 			throw exception();
+
+		startup.end(phase);
 	}
 	catch (exception &e) {
 		cerr << "initialization failed.\n";
 
+		if (display.joinable())
+			display.join();
+
+		delete sched;
+		delete writer;
 		delete mfcdec;
+		input_buffers.clear();
 		delete drm;
 		delete parser;
 		delete input;
+		delete subtitles;
 
 		return 1;
 	}
 
-	thread_data td;
-	td.drm = drm;
-	td.mfcdec = mfcdec;
-	td.decoding_state.store(0);
+	Player::present_mode mode = Player::present_fifo;
 
-	pres = new std::thread(presentation_thread, &td);
+	if (opts.mailbox)
+		mode = Player::present_mailbox;
+	else if (sched)
+		mode = Player::present_paced;
 
-	while (true) {
-		if (td.decoding_state.load() & (finished | error))
-			break;
+	Player player;
 
-		switch (mfcdec->run()) {
-		case MFCDecoder::run_active:
-			break;
+	if (!player.init(drm, mfcdec, writer, sched, mode, opts.osd)) {
+		cerr << "initialization failed.\n";
 
-		case MFCDecoder::run_finished:
-			td.decoding_state.fetch_or(finished);
-			break;
+		delete sched;
+		delete writer;
+		delete mfcdec;
+		input_buffers.clear();
+		delete drm;
+		delete parser;
+		delete input;
+		delete subtitles;
 
-		case MFCDecoder::run_nop:
-			// TODO
-			break;
+		return 1;
+	}
+
+	const uint64_t stats_interval = uint64_t(opts.stats_interval) * 1000000;
+	uint64_t last_stats = monotonic_us();
+	bool startup_done = false;
 
-		case MFCDecoder::run_error:
-			std::cerr << "DEBUG: run() failed.\n";
-			td.decoding_state.fetch_or(error);
+	while (!player.done()) {
+		int timeout = -1;
+
+		if (stats_interval != 0) {
+			const uint64_t now = monotonic_us();
+
+			if (now - last_stats >= stats_interval) {
+				print_stats(mfcdec, drm, sched, opts.stats_json);
+				last_stats = now;
+			}
+
+			timeout = (last_stats + stats_interval - now + 999) / 1000;
+		}
+
+		if (!player.dispatch(timeout)) {
+			cerr << "DEBUG: playback failed.\n";
 			break;
 		}
+
+		if (!startup_done && drm->get_frames_presented() != 0) {
+			startup.mark("first_frame", drm->get_last_flip_time());
+			print_startup(startup, opts.stats_json);
+
+			startup_done = true;
+		}
 	}
 
-	pres->join();
+	player.deinit();
+
+	// Without a display, there is no first frame.
+	if (!startup_done)
+		print_startup(startup, opts.stats_json);
+
+	// Flushes the remaining frames to disk.
+	delete writer;
 
+	print_stats(mfcdec, drm, sched, opts.stats_json);
+
+	if (opts.low_latency)
+		print_latency_check(mfcdec, opts);
+
+	delete sched;
 	delete mfcdec;
+
+	// The buffers have to be released before their DRM device.
+	input_buffers.clear();
 	delete drm;
 	delete parser;
 	delete input;
+	delete subtitles;
 
 	return 0;
 }
@@ -19,6 +19,8 @@
 
 #include <cstring>
 #include <cstdint>
+#include <ctime>
+#include <cerrno>
 
 template <typename T>
 inline void
@@ -27,6 +29,41 @@ zerostruct(T* t, unsigned num = 1)
 	std::memset(t, 0, sizeof(T) * num);
 }
 
+// Current time of the monotonic clock in microseconds.
+// This is the same clock that DRM uses for its event timestamps.
+inline uint64_t
+monotonic_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// CPU time that the calling thread has used so far in microseconds.
+inline uint64_t
+thread_cpu_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Sleep until the monotonic clock reaches 't' (in microseconds).
+inline void
+sleep_until_us(uint64_t t)
+{
+	struct timespec ts;
+
+	ts.tv_sec = t / 1000000;
+	ts.tv_nsec = (t % 1000000) * 1000;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR);
+}
+
 // video information struct
 //
 // @{w,h}: total video width and height
@@ -23,6 +23,7 @@
 #include <iostream>
 #include <algorithm>
 #include <stdexcept>
+#include <cerrno>
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -41,7 +42,10 @@ public:
 
 	QueueHandler(const QueueHandler& fh) = delete;
 
-	bool wait();
+	// Check if a buffer can be dequeued without blocking.
+	//
+	// @events: POLLOUT for source, POLLIN for destination buffers
+	bool ready(short events);
 };
 
 
@@ -65,6 +69,10 @@ enum mfc_constants {
 	// is needed to be queued to be the next scanout. This number is added
 	// on top of the destination required for the MFC hardware to decode.
 	dest_extra_buffer_count = 2,
+
+	// In low-latency mode the MFC does not hold back frames, so the
+	// next scanout buffer can be taken from the decoding buffers.
+	dest_extra_buffer_count_ll = 1,
 };
 
 enum flags {
@@ -73,8 +81,15 @@ enum flags {
 	source_set		= (1 << 2),
 	initialized		= (1 << 3),
 	dest_stream		= (1 << 4),
+	draining		= (1 << 5),
+	end_of_stream	= (1 << 6),
+	nonblocking		= (1 << 7),
+	no_frame		= (1 << 8),
 };
 
+// Index returned by dqdst() when no buffer was dequeued.
+const unsigned invalid_index = ~0u;
+
 enum buffer_flags {
 	busy			= (1 << 0),
 };
@@ -137,13 +152,13 @@ QueueHandler::QueueHandler(int fd)
 	zerostruct(&fds);
 
 	fds.fd = fd;
-	fds.events = POLLIN;
 }
 
-bool QueueHandler::wait()
+bool QueueHandler::ready(short events)
 {
-	const int timeout = 500;
+	const int timeout = 0;
 
+	fds.events = events;
 	fds.revents = 0;
 
 	if (poll(&fds, 1, timeout) < 0)
@@ -152,13 +167,12 @@ bool QueueHandler::wait()
 	if (fds.revents & (POLLHUP | POLLERR))
 		return false;
 
-	if (!(fds.revents & POLLIN))
-		return false;
-
-	return true;
+	return (fds.revents & events);
 }
 
-MFCDecoder::MFCDecoder() : flags(0) {}
+MFCDecoder::MFCDecoder() : next_input(nullptr), inputs_switched(0), dest_buffer_count(0),
+	dest_extra_count(dest_extra_buffer_count),
+	frames_decoded(0), frames_dropped(0), parse_time(0), flags(0) {}
 
 MFCDecoder::~MFCDecoder()
 {
@@ -166,7 +180,7 @@ MFCDecoder::~MFCDecoder()
 	// TODO
 }
 
-bool MFCDecoder::open()
+bool MFCDecoder::open(enum decode_mode m)
 {
 	static const std::string msg_prefix("MFCDecoder::open(): ");
 
@@ -218,6 +232,12 @@ bool MFCDecoder::open()
 	if (!found)
 		return false;
 
+	// The controls have to be set before the stream header is parsed.
+	if (!set_controls(m)) {
+		::close(fd);
+		return false;
+	}
+
 	qh = new QueueHandler(fd);
 
 	flags |= opened;
@@ -233,9 +253,24 @@ void MFCDecoder::close()
 	delete qh;
 	::close(fd);
 
+	release_source();
+
 	flags &= ~opened;
 }
 
+void MFCDecoder::add_extra_buffers(unsigned n)
+{
+	if (flags & initialized)
+		return;
+
+	dest_extra_count += n;
+}
+
+int MFCDecoder::get_fd() const
+{
+	return fd;
+}
+
 bool MFCDecoder::set_parser(Parser *p)
 {
 	static const std::string msg_prefix("MFCDecoder::set_parser(): ");
@@ -272,6 +307,16 @@ void MFCDecoder::unset_parser()
 	flags &= ~parser_set;
 }
 
+void MFCDecoder::set_next_input(InputFile *in)
+{
+	next_input = in;
+}
+
+bool MFCDecoder::has_next_input() const
+{
+	return (next_input != nullptr);
+}
+
 bool MFCDecoder::set_source(std::vector<ExynosBuffer> &buffers)
 {
 	static const std::string msg_prefix("MFCDecoder::set_source(): ");
@@ -289,7 +334,7 @@ bool MFCDecoder::set_source(std::vector<ExynosBuffer> &buffers)
 	source_buffer_size = 0;
 
 	unsigned index = 0;
-	source_buffers.clear();
+	release_source();
 	for (auto &i : buffers) {
 		buffer b = {
 			reinterpret_cast<uint8_t*>(i.mmap()),
@@ -354,7 +399,7 @@ void MFCDecoder::unset_source()
 	if (flags & initialized)
 		return;
 
-	// TODO
+	release_source();
 
 	flags &= ~source_set;
 }
@@ -428,14 +473,16 @@ enum MFCDecoder::run_state MFCDecoder::run()
 
 	using namespace std;
 
-	if (dest_num_queued < dest_queue_min) {
-		cerr << "DEBUG: num error.\n";
-		return run_error;
-	}
-
 	// If the MFC decoder is ready, enabling streaming for the
-	// destination queue.
+	// destination queue. The MFC needs the minimum number of buffers
+	// only to start decoding. Afterwards fewer buffers can be queued,
+	// e.g. while pages are on the screen.
 	if (!(flags & dest_stream)) {
+		if (dest_num_queued < dest_queue_min) {
+			cerr << "DEBUG: num error.\n";
+			return run_error;
+		}
+
 		if (!stream(destination, true))
 			return run_error;
 
@@ -452,26 +499,48 @@ enum MFCDecoder::run_state MFCDecoder::run()
 		int size;
 		bool finished;
 
-		if (!parser->parse(i.addr, source_buffer_size, size, finished, false))
+		const uint64_t t = thread_cpu_us();
+		const bool complete = parser->parse(i.addr, source_buffer_size, size, finished, false);
+
+		parse_time += thread_cpu_us() - t;
+
+		// No start code follows the last frame of the input, so the
+		// parser returns it as incomplete.
+		if (!complete && !parser->finished())
 			return run_error;
 
 		cout << msg_prefix << "parser extracted " << size << " bytes.\n";
 
-		if (finished && parser->finished()) {
+		if (size > 0) {
+			if (!qsrc(i.index, size))
+				return run_error;
+
+			i.flags |= busy;
+		}
+
+		if (!parser->finished())
+			continue;
+
+		// Gapless playback: the next input follows right after the
+		// last frame of this one, without draining the decoder.
+		if (next_input) {
+			if (!switch_input())
+				return run_error;
+
+			continue;
+		}
+
+		if (size == 0) {
 			cout << msg_prefix << "parser has extracted all frames.\n";
 
 			ret = run_finished;
 			break;
 		}
-
-		if (!qsrc(i.index, size))
-			return run_error;
-
-		i.flags |= busy;
 	}
 
-	// If we have busy source buffers, try to dequeue one.
-	if (is_src_busy()) {
+	// If we have busy source buffers, try to dequeue one. In nonblocking
+	// mode, we only do this if the decoder is done with one.
+	if (is_src_busy() && (!(flags & nonblocking) || qh->ready(POLLOUT))) {
 		unsigned index;
 
 		if (!dqsrc(index))
@@ -488,62 +557,261 @@ enum MFCDecoder::run_state MFCDecoder::run()
 
 bool MFCDecoder::queue_dest(ExynosPage *page)
 {
-	static const std::string msg_prefix("MFCDecoder::queue_dest(): ");
+	unsigned index;
+
+	if (!dest_index(page, index))
+		return false;
+
+	const int dma_fd = page->get_prime_fd();
+
+	if (dma_fd < 0)
+		return false;
+
+	// Same as in prepare_dest(), the decoder keeps its own reference.
+	const bool ret = qdst(index, dma_fd);
+
+	::close(dma_fd);
+
+	if (!ret)
+		return false;
+
+	page->mark_queued();
+	dest_num_queued++;
+
+	return true;
+}
+
+bool MFCDecoder::prepare_dest(ExynosPage *page)
+{
+	if (!(flags & initialized))
+		return false;
 
 	unsigned index;
 
+	if (!dest_index(page, index))
+		return false;
+
+	const int dma_fd = page->get_prime_fd();
+
+	if (dma_fd < 0)
+		return false;
+
+	// The decoder keeps its own reference to the dma-buf.
+	const bool ret = qdst(index, dma_fd, true);
+
+	::close(dma_fd);
+
+	return ret;
+}
+
+ExynosPage* MFCDecoder::dequeue_dest()
+{
+	static const std::string msg_prefix("MFCDecoder::dequeue_dest(): ");
+
+	unsigned index;
+	bool finished, corrupt;
+	uint64_t timestamp;
+	ExynosPage *p;
+
 	using namespace std;
 
-	auto p = std::find(dest_buffers.begin(), dest_buffers.end(), page);
+	flags &= ~no_frame;
 
-	if (p == dest_buffers.end()) {
-		index = dest_buffers.size();
+	while (true) {
+		// In nonblocking mode, only dequeue if a frame is available.
+		// After draining, the queue also becomes ready, so that we
+		// can pick up the end of the stream.
+		if ((flags & nonblocking) && !qh->ready(POLLIN)) {
+			flags |= no_frame;
+			return nullptr;
+		}
 
-		cout << msg_prefix << "adding new buffer with index "
+		if (!dqdst(index, finished, corrupt, timestamp))
+			return nullptr;
+
+		if (finished && (flags & draining)) {
+			// The empty buffer that marks the end of the stream.
+			if (index != invalid_index)
+				dest_num_queued--;
+
+			cout << msg_prefix << "end of stream reached.\n";
+			flags |= end_of_stream;
+
+			return nullptr;
+		}
+
+		try {
+			p = dest_buffers.at(index);
+		}
+		catch (exception &e) {
+			cerr << msg_prefix << "unknown buffer destinaton buffer deqeued.\n";
+			return nullptr;
+		}
+
+		dest_num_queued--;
+
+		if (!corrupt)
+			break;
+
+		// The MFC flagged the frame as erroneous. Don't pass it on
+		// for display, but give the buffer directly back to the decoder.
+		cerr << msg_prefix << "dropping corrupt frame with index "
 			 << index << ".\n";
 
-		dest_buffers.push_back(page);
-	} else {
-		index = p - dest_buffers.begin();
+		frames_dropped++;
+
+		if (!queue_dest(p))
+			return nullptr;
 	}
 
-	if (index >= dest_buffer_count) {
-		cerr << msg_prefix << "index out of bounds.\n";
+	const uint64_t now = monotonic_us();
+
+	// The MFC copies the timestamp of the source buffer to the
+	// destination buffer, so this is the time since the frame was parsed.
+	if (timestamp != 0 && timestamp <= now)
+		decode_latency.record(now - timestamp);
+
+	frames_decoded++;
+	p->mark_decoded(now);
+
+	return p;
+}
+
+bool MFCDecoder::drain()
+{
+	static const std::string msg_prefix("MFCDecoder::drain(): ");
+
+	if (!(flags & initialized))
 		return false;
-	}
 
-	if (!qdst(index, page->get_prime_fd()))
+	if (flags & draining)
+		return true;
+
+	if (!stop())
 		return false;
 
-	dest_num_queued++;
+	std::cout << msg_prefix << "draining decoder.\n";
+
+	flags |= draining;
 
 	return true;
 }
 
-ExynosPage* MFCDecoder::dequeue_dest()
+bool MFCDecoder::eos() const
 {
-	static const std::string msg_prefix("MFCDecoder::dequeue_dest(): ");
+	return (flags & end_of_stream);
+}
 
-	unsigned index;
-	bool finished;
+void MFCDecoder::set_nonblocking(bool enable)
+{
+	if (enable)
+		flags |= nonblocking;
+	else
+		flags &= ~nonblocking;
+}
+
+bool MFCDecoder::would_block() const
+{
+	return (flags & no_frame);
+}
+
+void MFCDecoder::add_stats(StatsReport &r) const
+{
+	r.add("decode_latency", decode_latency);
+	r.add("frames_decoded", frames_decoded.load());
+	r.add("frames_dropped_corrupt", frames_dropped.load());
+	r.add("dest_buffers", dest_buffer_count);
+	r.add("inputs_switched", inputs_switched);
+}
+
+histogram_summary MFCDecoder::get_decode_latency() const
+{
+	return decode_latency.summary();
+}
+
+uint64_t MFCDecoder::get_frames_decoded() const
+{
+	return frames_decoded;
+}
+
+uint64_t MFCDecoder::get_frames_dropped() const
+{
+	return frames_dropped;
+}
+
+unsigned MFCDecoder::get_queued_dest() const
+{
+	return dest_num_queued;
+}
+
+uint64_t MFCDecoder::get_parse_time() const
+{
+	return parse_time;
+}
+
+bool MFCDecoder::switch_input()
+{
+	static const std::string msg_prefix("MFCDecoder::switch_input(): ");
 
 	using namespace std;
 
-	if (!dqdst(index, finished))
-		return nullptr;
+	parser->unlink();
 
-	try {
-		auto p = dest_buffers.at(index);
+	// Linking doesn't reset the state of the parser.
+	if (!parser->link(next_input) || !parser->reset()) {
+		cerr << msg_prefix << "failed to link the parser to the next input.\n";
+		return false;
+	}
 
-		dest_num_queued--;
-		return p;
+	next_input = nullptr;
+	inputs_switched++;
+
+	cout << msg_prefix << "continuing with the next input.\n";
+
+	return true;
+}
+
+bool MFCDecoder::set_controls(enum decode_mode m)
+{
+	static const std::string msg_prefix("MFCDecoder::set_controls(): ");
+
+	using namespace std;
+
+	if (m == mode_normal) {
+		dest_extra_count = dest_extra_buffer_count;
+		return true;
 	}
-	catch (exception &e) {
-		cerr << msg_prefix << "unknown buffer destinaton buffer deqeued.\n";
-		return nullptr;
+
+	struct v4l2_control ctrl;
+
+	// Enable the display delay and set it to zero. The MFC then
+	// returns every frame as soon as it is decoded, instead of
+	// holding it back for a possible reordering.
+	zerostruct(&ctrl);
+	ctrl.id = V4L2_CID_MPEG_MFC51_VIDEO_DECODER_H264_DISPLAY_DELAY_ENABLE;
+	ctrl.value = 1;
+
+	if (ioctl(fd, VIDIOC_S_CTRL, &ctrl)) {
+		cerr << msg_prefix << "failed to enable display delay (errno="
+			 << errno << ").\n";
+		return false;
 	}
 
-	return nullptr;
+	zerostruct(&ctrl);
+	ctrl.id = V4L2_CID_MPEG_MFC51_VIDEO_DECODER_H264_DISPLAY_DELAY;
+	ctrl.value = 0;
+
+	if (ioctl(fd, VIDIOC_S_CTRL, &ctrl)) {
+		cerr << msg_prefix << "failed to set display delay (errno="
+			 << errno << ").\n";
+		return false;
+	}
+
+	dest_extra_count = dest_extra_buffer_count_ll;
+
+	cout << msg_prefix << "low-latency mode enabled (display delay = 0).\n";
+
+	return true;
 }
 
 bool MFCDecoder::set_source_v4l2()
@@ -582,7 +850,13 @@ bool MFCDecoder::set_source_v4l2()
 	cout << msg_prefix << "got " << reqbuf.count << " source buffers (requested="
 		 << source_buffers.size() << ")\n";
 
-	source_buffers.resize(reqbuf.count);
+	// Buffers beyond the ones that we got aren't used. The driver may
+	// also hand out more, but we have nothing to back those with.
+	for (unsigned i = reqbuf.count; i < source_buffers.size(); ++i)
+		::close(source_buffers[i].fd);
+
+	if (reqbuf.count < source_buffers.size())
+		source_buffers.resize(reqbuf.count);
 
 	return true;
 }
@@ -625,7 +899,7 @@ bool MFCDecoder::set_dest_v4l2(videoinfo &vi)
 		return false;
 	}
 
-	dest_buffer_count = ctrl.value + dest_extra_buffer_count;
+	dest_buffer_count = ctrl.value + dest_extra_count;
 
 	dest_queue_min = ctrl.value;
 	dest_num_queued = 0;
@@ -656,7 +930,7 @@ bool MFCDecoder::set_dest_v4l2(videoinfo &vi)
 	}
 
 	cout << msg_prefix << "got " << reqbuf.count << " destination buffers (requested="
-		 << dest_buffer_count << ", extra=" << dest_extra_buffer_count
+		 << dest_buffer_count << ", extra=" << dest_extra_count
 		 << ").\n";
 
 	dest_buffer_count = reqbuf.count;
@@ -664,6 +938,17 @@ bool MFCDecoder::set_dest_v4l2(videoinfo &vi)
 	return true;
 }
 
+void MFCDecoder::release_source()
+{
+	// The source buffers use their own export of the dma-buf.
+	for (auto &i : source_buffers) {
+		if (i.fd >= 0)
+			::close(i.fd);
+	}
+
+	source_buffers.clear();
+}
+
 bool MFCDecoder::is_src_busy() const
 {
 	for (auto &i : source_buffers) {
@@ -695,6 +980,13 @@ bool MFCDecoder::qsrc(unsigned index, unsigned frame_size)
 	qbuf.length = source_plane_count;
 	qbuf.m.planes = planes;
 
+	// Tag the buffer with the current time. The MFC passes the timestamp
+	// on to the decoded frame, which we use for latency measurement.
+	const uint64_t now = monotonic_us();
+
+	qbuf.timestamp.tv_sec = now / 1000000;
+	qbuf.timestamp.tv_usec = now % 1000000;
+
 	zerostruct(&planes, source_plane_count);
 	planes[0].m.fd = source_buffers[index].fd;
 	planes[0].length = source_buffer_size;
@@ -711,7 +1003,34 @@ bool MFCDecoder::qsrc(unsigned index, unsigned frame_size)
 	return true;
 }
 
-bool MFCDecoder::qdst(unsigned index, int dma_fd)
+bool MFCDecoder::dest_index(ExynosPage *page, unsigned &index)
+{
+	static const std::string msg_prefix("MFCDecoder::dest_index(): ");
+
+	using namespace std;
+
+	auto p = std::find(dest_buffers.begin(), dest_buffers.end(), page);
+
+	if (p == dest_buffers.end()) {
+		index = dest_buffers.size();
+
+		cout << msg_prefix << "adding new buffer with index "
+			 << index << ".\n";
+
+		dest_buffers.push_back(page);
+	} else {
+		index = p - dest_buffers.begin();
+	}
+
+	if (index >= dest_buffer_count) {
+		cerr << msg_prefix << "index out of bounds.\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool MFCDecoder::qdst(unsigned index, int dma_fd, bool prepare)
 {
 	static const std::string msg_prefix("MFCDecoder::qdst(): ");
 
@@ -735,6 +1054,19 @@ bool MFCDecoder::qdst(unsigned index, int dma_fd)
 	planes[0].data_offset = 0;
 	planes[1].data_offset = dest_plane_size[0];
 
+	if (prepare) {
+		if (ioctl(fd, VIDIOC_PREPARE_BUF, &qbuf)) {
+			cerr << msg_prefix << "failed to prepare destination with index "
+				 << index << " (errno=" << errno << ").\n";
+			return false;
+		}
+
+		cout << msg_prefix << "prepared destination with index "
+			 << index << ".\n";
+
+		return true;
+	}
+
 	if (ioctl(fd, VIDIOC_QBUF, &qbuf)) {
 		cerr << msg_prefix << "failed to queue destination with index "
 			 << index << ".\n";
@@ -778,7 +1110,8 @@ bool MFCDecoder::dqsrc(unsigned &index)
 	return true;
 }
 
-bool MFCDecoder::dqdst(unsigned &index, bool &finished)
+bool MFCDecoder::dqdst(unsigned &index, bool &finished, bool &corrupt,
+					   uint64_t &timestamp)
 {
 	static const std::string msg_prefix("MFCDecoder::dqdst(): ");
 
@@ -796,12 +1129,24 @@ bool MFCDecoder::dqdst(unsigned &index, bool &finished)
 	zerostruct(planes, dest_plane_count);
 
 	if (ioctl(fd, VIDIOC_DQBUF, &qbuf)) {
+		// After the last buffer was dequeued, the queue signals EPIPE.
+		if (errno == EPIPE && (flags & draining)) {
+			index = invalid_index;
+			finished = true;
+			corrupt = false;
+			timestamp = 0;
+
+			return true;
+		}
+
 		cerr << msg_prefix << "failed to dequeue destination (errno="
 			 << errno << ").\n";
 		return false;
 	}
 
-	finished = (planes[0].bytesused == 0);
+	finished = (planes[0].bytesused == 0) || (qbuf.flags & V4L2_BUF_FLAG_LAST);
+	corrupt = (qbuf.flags & V4L2_BUF_FLAG_ERROR);
+	timestamp = uint64_t(qbuf.timestamp.tv_sec) * 1000000 + qbuf.timestamp.tv_usec;
 	index = qbuf.index;
 
 	cout << msg_prefix << "dequeued destination with index "
@@ -850,7 +1195,7 @@ bool MFCDecoder::stop()
 	struct v4l2_decoder_cmd dcmd;
 
 	zerostruct(&dcmd);
-	dcmd.cmd = V4L2_ENC_CMD_STOP;
+	dcmd.cmd = V4L2_DEC_CMD_STOP;
 
 	if (ioctl(fd, VIDIOC_DECODER_CMD, &dcmd)) {
 		cerr << msg_prefix << "failed to stop decoder (errno="
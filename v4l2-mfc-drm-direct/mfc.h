@@ -17,12 +17,16 @@
 #if !defined(__MFC_DECODER_)
 #define __MFC_DECODER_
 
+#include "stats.h"
+
 #include <cstdint>
 #include <vector>
 #include <map>
+#include <atomic>
 
 // Forward-declarations
 class Parser;
+class InputFile;
 class ExynosBuffer;
 class ExynosPage;
 class QueueHandler;
@@ -46,15 +50,29 @@ private:
 	Parser *parser;
 	QueueHandler *qh;
 
+	// Input that the parser continues with (see set_next_input()).
+	InputFile *next_input;
+	uint64_t inputs_switched;
+
 	std::vector<buffer> source_buffers;
 	unsigned source_buffer_size;
 
 	std::vector<ExynosPage*> dest_buffers;
 	unsigned dest_buffer_count;
+	unsigned dest_extra_count;
 	unsigned dest_plane_size[4];
 	unsigned dest_queue_min;
 	unsigned dest_num_queued;
 
+	// Time from queueing a parsed frame to dequeueing the decoded frame.
+	LatencyHistogram decode_latency;
+
+	std::atomic<uint64_t> frames_decoded;
+	std::atomic<uint64_t> frames_dropped;
+
+	// CPU time that the parser used in run() (in microseconds).
+	uint64_t parse_time;
+
 	unsigned flags;
 
 public:
@@ -63,6 +81,16 @@ public:
 		destination,
 	};
 
+	enum decode_mode {
+		// Let the MFC hold back frames for reordering.
+		mode_normal = 0,
+
+		// Output frames as soon as they are decoded, and use as few
+		// destination buffers as possible. Only suitable for streams
+		// where decoding order equals display order (no B-frames).
+		mode_low_latency,
+	};
+
 	enum run_state {
 		run_active = 0,
 		run_finished,
@@ -81,14 +109,37 @@ public:
 
 	// Open/close the MFC decoder.
 	// open() returns false if an error occurs.
-	bool open();
+	//
+	// @m: decoding mode (see decode_mode)
+	bool open(enum decode_mode m = mode_normal);
 	void close();
 
+	// Request additional destination buffers, e.g. for pages that are
+	// held by the display. Has to be called between open() and init().
+	void add_extra_buffers(unsigned n);
+
+	// The fd of the decoder, which becomes readable when a decoded
+	// frame can be dequeued.
+	int get_fd() const;
+
 	// Set/unset the parser of the MFC decoder.
 	// set_parser() returns false if an error occurs.
 	bool set_parser(Parser *p);
 	void unset_parser();
 
+	// Continue with another input, once the parser has reached the end
+	// of the current one. The decoder is not drained in between, and
+	// the frames of both inputs form one stream (gapless playback).
+	// Hence the next input has to start with its parameter sets and an
+	// IDR picture, and has to use the same codec and picture size.
+	// The parser is unlinked from the current input by the switch.
+	//
+	// @in: next input (nullptr to continue with none)
+	void set_next_input(InputFile *in);
+
+	// Returns true while the switch to the next input is pending.
+	bool has_next_input() const;
+
 	// Set/unset source buffers for the MFC decoder.
 	// These buffers are filled by the parser and
 	// are then passed to the decoder.
@@ -113,17 +164,68 @@ public:
 	bool queue_dest(ExynosPage *page);
 	ExynosPage* dequeue_dest();
 
+	// Validate a destination buffer ahead (VIDIOC_PREPARE_BUF), without
+	// queueing it. The decoder then maps the dma-buf of the page now,
+	// instead of when the page is queued for the first time, e.g. during
+	// playback. Has to be called after init().
+	// prepare_dest() returns false if an error occurs.
+	bool prepare_dest(ExynosPage *page);
+
+	// Drain the decoder after the parser has finished. The decoder
+	// then outputs all frames that it still holds, after which
+	// dequeue_dest() returns nullptr and eos() returns true.
+	// drain() returns false if an error occurs.
+	bool drain();
+	bool eos() const;
+
+	// In nonblocking mode, run() and dequeue_dest() never wait for the
+	// decoder. Then dequeue_dest() also returns nullptr if no frame is
+	// available, in which case would_block() returns true. This is meant
+	// for an event loop that polls the fd (see get_fd()).
+	void set_nonblocking(bool enable);
+	bool would_block() const;
+
+	// Add the decoder statistics to a report.
+	void add_stats(StatsReport &r) const;
+
+	// Summary of the time from queueing a parsed frame to
+	// dequeueing the decoded frame.
+	histogram_summary get_decode_latency() const;
+
+	uint64_t get_frames_decoded() const;
+
+	// Frames that were dropped by the decoder, since they were corrupt.
+	uint64_t get_frames_dropped() const;
+
+	// Number of destination buffers that are queued to the decoder.
+	unsigned get_queued_dest() const;
+
+	// CPU time that the parser used so far (in microseconds).
+	uint64_t get_parse_time() const;
+
 private:
+	bool set_controls(enum decode_mode m);
+	bool switch_input();
 	bool set_source_v4l2();
+
+	// Close the dma-buf fds of the source buffers, and drop the buffers.
+	void release_source();
 	bool set_dest_v4l2(videoinfo &vi);
 
 	bool is_src_busy() const;
 
+	// Look up the index of a destination buffer. Pages that are new to
+	// the decoder get the next free index.
+	bool dest_index(ExynosPage *page, unsigned &index);
+
 	bool qsrc(unsigned index, unsigned frame_size);
-	bool qdst(unsigned index, int dma_fd);
+
+	// @prepare: only prepare the buffer, don't queue it
+	bool qdst(unsigned index, int dma_fd, bool prepare = false);
 
 	bool dqsrc(unsigned &index);
-	bool dqdst(unsigned &index, bool &finished);
+	bool dqdst(unsigned &index, bool &finished, bool &corrupt,
+			   uint64_t &timestamp);
 
 	bool stream(enum buffer_type type, bool enable);
 
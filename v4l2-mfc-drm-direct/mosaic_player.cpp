@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mosaic_player.h"
+#include "mfc.h"
+#include "exynos_drm.h"
+
+#include <iostream>
+#include <string>
+#include <stdexcept>
+
+
+MosaicPlayer::MosaicPlayer() : drm(nullptr), flags(0)
+{
+	// Nothing here.
+}
+
+MosaicPlayer::~MosaicPlayer()
+{
+	deinit();
+}
+
+bool MosaicPlayer::init(ExynosDRM *d, const std::vector<MFCDecoder*> &decoders)
+{
+	static const std::string msg_prefix("MosaicPlayer::init(): ");
+
+	if (flags & initialized)
+		return false;
+
+	using namespace std;
+
+	if (decoders.empty())
+		return false;
+
+	drm = d;
+	streams.clear();
+
+	for (auto &i : decoders)
+		streams.push_back(stream{i, 0});
+
+	if (!loop.open())
+		return false;
+
+	try {
+		for (unsigned i = 0; i < streams.size(); ++i) {
+			if (!loop.add(streams[i].mfcdec->get_fd(), EPOLLIN | EPOLLOUT, event_decoder + i))
+				throw runtime_error("failed to watch decoder");
+		}
+
+		if (!loop.add(drm->get_fd(), EPOLLIN, event_display))
+			throw runtime_error("failed to watch display");
+
+		if (!loop.add(drm->get_pack_fd(), EPOLLIN, event_pack))
+			throw runtime_error("failed to watch scalers");
+	}
+	catch (exception &e) {
+		cerr << msg_prefix << e.what() << ".\n";
+		loop.close();
+
+		return false;
+	}
+
+	for (auto &i : streams)
+		i.mfcdec->set_nonblocking(true);
+
+	flags = initialized;
+
+	// Start the decoders, the remaining work is driven by events.
+	for (unsigned i = 0; i < streams.size(); ++i) {
+		if (!decode(i)) {
+			deinit();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void MosaicPlayer::deinit()
+{
+	if (!(flags & initialized))
+		return;
+
+	for (auto &i : streams)
+		i.mfcdec->set_nonblocking(false);
+
+	loop.close();
+	streams.clear();
+
+	flags = 0;
+}
+
+bool MosaicPlayer::dispatch(int timeout)
+{
+	if (!(flags & initialized) || (flags & finished))
+		return false;
+
+	if (!loop.wait(events, timeout))
+		return false;
+
+	for (auto &i : events) {
+		bool ret = true;
+
+		if (i.id == event_display) {
+			ret = drm->handle_events();
+		} else if (i.id == event_pack) {
+			ret = drm->handle_pack();
+		} else {
+			const unsigned s = i.id - event_decoder;
+
+			// The stream might have been stopped by an earlier event.
+			if (streams[s].flags & failed)
+				continue;
+
+			if ((i.events & EPOLLOUT) && !(streams[s].flags & draining))
+				ret = decode(s);
+
+			if (ret && (i.events & EPOLLIN))
+				ret = handle_frames(s);
+
+			// See Player::dispatch(), the decoder has no buffers queued.
+			if (ret && (i.events & EPOLLERR) && !(i.events & (EPOLLIN | EPOLLOUT)))
+				unwatch_decoder(s);
+		}
+
+		// Packing a tile, or a completed commit, releases pages.
+		if (!ret || !recycle())
+			return false;
+	}
+
+	if (all_ended())
+		finish();
+
+	return true;
+}
+
+bool MosaicPlayer::done() const
+{
+	return (flags & finished);
+}
+
+unsigned MosaicPlayer::get_failed() const
+{
+	unsigned ret = 0;
+
+	for (auto &i : streams) {
+		if (i.flags & failed)
+			ret++;
+	}
+
+	return ret;
+}
+
+bool MosaicPlayer::decode(unsigned s)
+{
+	static const std::string msg_prefix("MosaicPlayer::decode(): ");
+
+	stream &st = streams[s];
+
+	// Same as Player::decode(), for the decoder of one tile.
+	while (true) {
+		switch (st.mfcdec->run()) {
+		case MFCDecoder::run_active:
+			continue;
+
+		case MFCDecoder::run_nop:
+			return true;
+
+		case MFCDecoder::run_finished:
+			if (!st.mfcdec->drain()) {
+				st.flags |= end_of_stream;
+				unwatch_decoder(s);
+
+				return true;
+			}
+
+			st.flags |= draining;
+
+			if (!(st.flags & decoder_idle))
+				loop.modify(st.mfcdec->get_fd(), EPOLLIN, event_decoder + s);
+
+			return true;
+
+		case MFCDecoder::run_error:
+		default:
+			std::cerr << msg_prefix << "decoder of tile " << s << " failed.\n";
+			stop(s);
+
+			return true;
+		}
+	}
+}
+
+bool MosaicPlayer::handle_frames(unsigned s)
+{
+	static const std::string msg_prefix("MosaicPlayer::handle_frames(): ");
+
+	stream &st = streams[s];
+
+	while (!(st.flags & end_of_stream)) {
+		ExynosPage *p = st.mfcdec->dequeue_dest();
+
+		if (p) {
+			ExynosPage *displaced;
+
+			if (!drm->present_tile(s, p, displaced))
+				return false;
+
+			if (displaced && !requeue(s, displaced))
+				return false;
+
+			continue;
+		}
+
+		// The last frame stays in the tile, until all streams ended.
+		if (st.mfcdec->eos()) {
+			st.flags |= end_of_stream;
+			unwatch_decoder(s);
+			break;
+		}
+
+		if (!st.mfcdec->would_block()) {
+			std::cerr << msg_prefix << "failed to dequeue frame of tile " << s << ".\n";
+			stop(s);
+		}
+
+		break;
+	}
+
+	return true;
+}
+
+bool MosaicPlayer::requeue(unsigned s, ExynosPage *p)
+{
+	static const std::string msg_prefix("MosaicPlayer::requeue(): ");
+
+	stream &st = streams[s];
+
+	// The page stays with the tile, like the pages of an ended stream.
+	if (st.flags & end_of_stream)
+		return true;
+
+	if (!st.mfcdec->queue_dest(p)) {
+		std::cerr << msg_prefix << "failed to queue page of tile " << s << ".\n";
+		stop(s);
+
+		return true;
+	}
+
+	// With a buffer queued, the decoder fd is usable again.
+	if ((st.flags & decoder_idle) && !(st.flags & end_of_stream)) {
+		const uint32_t ev = (st.flags & draining) ? EPOLLIN : (EPOLLIN | EPOLLOUT);
+
+		if (!loop.add(st.mfcdec->get_fd(), ev, event_decoder + s))
+			return false;
+
+		st.flags &= ~decoder_idle;
+	}
+
+	return true;
+}
+
+void MosaicPlayer::unwatch_decoder(unsigned s)
+{
+	stream &st = streams[s];
+
+	if (st.flags & decoder_idle)
+		return;
+
+	loop.remove(st.mfcdec->get_fd());
+	st.flags |= decoder_idle;
+}
+
+void MosaicPlayer::stop(unsigned s)
+{
+	static const std::string msg_prefix("MosaicPlayer::stop(): ");
+
+	stream &st = streams[s];
+
+	std::cerr << msg_prefix << "tile " << s << " keeps its last frame.\n";
+
+	st.flags |= end_of_stream | failed;
+	unwatch_decoder(s);
+}
+
+bool MosaicPlayer::recycle()
+{
+	for (unsigned i = 0; i < streams.size(); ++i) {
+		ExynosPage *p;
+
+		// A decoder that has ended doesn't need its pages anymore.
+		while (!(streams[i].flags & end_of_stream) &&
+			   (p = drm->get_tile_page(i)) != nullptr) {
+			if (!requeue(i, p))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+bool MosaicPlayer::all_ended() const
+{
+	for (auto &i : streams) {
+		if (!(i.flags & end_of_stream))
+			return false;
+	}
+
+	return true;
+}
+
+void MosaicPlayer::finish()
+{
+	// The last frames might still be packed, or their commit pending.
+	while (drm->wait_for_pack() || drm->wait_for_flip()) {
+		if (!drm->handle_events())
+			break;
+	}
+
+	flags |= finished;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__MOSAIC_PLAYER_)
+#define __MOSAIC_PLAYER_
+
+#include "event_loop.h"
+
+#include <vector>
+
+// Forward-declarations
+class ExynosDRM;
+class ExynosPage;
+class MFCDecoder;
+
+// Drives the decoders of a mosaic (see ExynosMosaic) from a single
+// thread. Each stream has its own MFC context, whose frames go to the
+// tile with the same index. Like the Player, the decoders and the display
+// are serviced by one event loop, and all atomic commits are nonblocking.
+// The newest frame of each tile is shown, older ones that miss the commit
+// go back to their decoder. A stream whose decoder fails is stopped, and
+// its tile keeps the last frame, while the other tiles go on.
+class MosaicPlayer {
+private:
+	enum flags {
+		initialized		= (1 << 0),
+		finished		= (1 << 1),
+	};
+
+	enum stream_flags {
+		draining		= (1 << 0),
+		end_of_stream	= (1 << 1),
+
+		// The decoder fd is not watched, since no buffers are queued.
+		decoder_idle	= (1 << 2),
+
+		// The stream was stopped by an error of its decoder.
+		failed			= (1 << 3),
+	};
+
+	// The decoder of stream i is registered as event_decoder + i.
+	enum event_id {
+		event_display = 0,
+		event_pack,
+		event_decoder,
+	};
+
+	// @mfcdec: decoder of the stream
+	// @flags: state of the decoder (see stream_flags)
+	struct stream {
+		MFCDecoder *mfcdec;
+		unsigned flags;
+	};
+
+	ExynosDRM *drm;
+	std::vector<stream> streams;
+
+	EventLoop loop;
+	std::vector<EventLoop::event> events;
+
+	unsigned flags;
+
+	// Errors of the decoder stop the stream (see stop()), only errors
+	// of the display or the event loop make these return false.
+	//
+	// @s: index of the stream (and of its tile)
+	bool decode(unsigned s);
+	bool handle_frames(unsigned s);
+	bool requeue(unsigned s, ExynosPage *p);
+	void unwatch_decoder(unsigned s);
+	void stop(unsigned s);
+
+	// Give the pages that the display released back to their decoders.
+	bool recycle();
+
+	bool all_ended() const;
+	void finish();
+
+public:
+	MosaicPlayer();
+	~MosaicPlayer();
+
+	MosaicPlayer(const MosaicPlayer &p) = delete;
+
+	// Initialize/deinitialize the player. The decoders have to be
+	// initialized, with their initial pages queued.
+	// init() returns false if an error occurs.
+	//
+	// @d: DRM device with an allocated mosaic
+	// @decoders: decoder of each tile
+	bool init(ExynosDRM *d, const std::vector<MFCDecoder*> &decoders);
+	void deinit();
+
+	// Wait for events and handle them.
+	// dispatch() returns false if an error occurs.
+	//
+	// @timeout: timeout in milliseconds (-1 for none)
+	bool dispatch(int timeout);
+
+	// Returns true once all streams were decoded and presented.
+	bool done() const;
+
+	// Number of streams that were stopped by an error.
+	unsigned get_failed() const;
+};
+
+#endif // __MOSAIC_PLAYER_
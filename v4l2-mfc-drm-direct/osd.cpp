@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "osd.h"
+
+#include <sstream>
+#include <iomanip>
+
+namespace {
+
+// Change of a counter, which is zero if the counter went backwards.
+inline uint64_t
+delta(uint64_t cur, uint64_t prev)
+{
+	return (cur > prev) ? (cur - prev) : 0;
+}
+
+// Rate of a counter in events per second.
+inline double
+rate(uint64_t count, uint64_t elapsed)
+{
+	return double(count) * 1000000.0 / double(elapsed);
+}
+
+// Share of the CPU time in percent.
+inline unsigned
+load(uint64_t cpu, uint64_t elapsed)
+{
+	return unsigned((cpu * 100 + elapsed / 2) / elapsed);
+}
+
+}; // anonymous namespace
+
+
+PerformanceOSD::PerformanceOSD() : last_time(0), flags(0)
+{
+	last = osd_sample{0, 0, 0, 0, 0, 0, 0, 0, 0};
+}
+
+void PerformanceOSD::start(uint64_t now, const osd_sample &s)
+{
+	last = s;
+	last_time = now;
+	text.clear();
+
+	flags = started;
+}
+
+bool PerformanceOSD::update(uint64_t now, const osd_sample &s)
+{
+	if (!(flags & started)) {
+		start(now, s);
+		return false;
+	}
+
+	if (now - last_time < update_interval)
+		return false;
+
+	using namespace std;
+
+	const uint64_t elapsed = now - last_time;
+
+	ostringstream os;
+
+	os << fixed << setprecision(1);
+
+	os << "decode  " << setw(5) << rate(delta(s.frames_decoded, last.frames_decoded), elapsed)
+	   << " fps   display " << setw(5) << rate(delta(s.frames_presented, last.frames_presented), elapsed)
+	   << " fps\n";
+
+	os << "dropped " << setw(5) << s.frames_dropped << '\n';
+
+	os << "queue   decoder " << setw(2) << s.queued_decoder
+	   << "  display " << setw(2) << s.queued_display
+	   << "  free " << setw(2) << s.free_pages << '\n';
+
+	os << "cpu     parser " << setw(3) << load(delta(s.cpu_parser, last.cpu_parser), elapsed)
+	   << "%  decoder " << setw(3) << load(delta(s.cpu_decoder, last.cpu_decoder), elapsed)
+	   << "%  display " << setw(3) << load(delta(s.cpu_display, last.cpu_display), elapsed)
+	   << '%';
+
+	last = s;
+	last_time = now;
+
+	const string t = os.str();
+
+	if (t == text)
+		return false;
+
+	text = t;
+
+	return true;
+}
+
+const std::string& PerformanceOSD::get_text() const
+{
+	return text;
+}
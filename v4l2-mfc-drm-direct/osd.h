@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__OSD_)
+#define __OSD_
+
+#include <cstdint>
+#include <string>
+
+// Counters that are shown by the performance OSD. The counters are
+// totals since the start of playback, except for the queue depths.
+//
+// @frames_{decoded,presented}: frames dequeued from the decoder, and
+//                              frames that reached the screen
+// @frames_dropped: frames that were never shown (corrupt, late or
+//                  replaced in the mailbox)
+// @queued_{decoder,display}: pages held by the decoder, and decoded
+//                            pages that wait for the display
+// @free_pages: pages that are neither on the screen nor queued
+// @cpu_{parser,decoder,display}: CPU time spent in each stage of the
+//                                player (in microseconds)
+struct osd_sample {
+	uint64_t frames_decoded;
+	uint64_t frames_presented;
+	uint64_t frames_dropped;
+	unsigned queued_decoder;
+	unsigned queued_display;
+	unsigned free_pages;
+	uint64_t cpu_parser;
+	uint64_t cpu_decoder;
+	uint64_t cpu_display;
+};
+
+
+// Formats the counters as text for the overlay. Rates and CPU loads are
+// computed over the interval between two updates. The text has a fixed
+// layout, so that only the characters of changed values differ.
+class PerformanceOSD {
+private:
+	enum constants {
+		// Minimum time between two updates of the text.
+		update_interval = 1000000,
+	};
+
+	enum flags {
+		started			= (1 << 0),
+	};
+
+	osd_sample last;
+	uint64_t last_time;
+
+	std::string text;
+
+	unsigned flags;
+
+public:
+	PerformanceOSD();
+	~PerformanceOSD() {}
+
+	PerformanceOSD(const PerformanceOSD &o) = delete;
+
+	// Take the first sample, which the rates of the next update refer to.
+	//
+	// @now: current time (monotonic, in microseconds)
+	// @s: current counters
+	void start(uint64_t now, const osd_sample &s);
+
+	// Compute a new text, if the last update is old enough.
+	// Returns true if the text has changed (see get_text()).
+	//
+	// @now: current time (monotonic, in microseconds)
+	// @s: current counters
+	bool update(uint64_t now, const osd_sample &s);
+
+	const std::string& get_text() const;
+};
+
+#endif // __OSD_
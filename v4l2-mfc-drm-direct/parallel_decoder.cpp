@@ -0,0 +1,444 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "parallel_decoder.h"
+#include "input_file.h"
+#include "parser.h"
+#include "mfc.h"
+#include "exynos_drm.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+
+
+ParallelDecoder::ParallelDecoder() : input(nullptr), writer(nullptr),
+	planar(false), next_segment(0), writer_ready(false), num_written(0),
+	failed(false), flags(0)
+{
+	// Nothing here.
+}
+
+ParallelDecoder::~ParallelDecoder()
+{
+	close();
+}
+
+bool ParallelDecoder::open(const std::string &name, unsigned num_contexts)
+{
+	static const std::string msg_prefix("ParallelDecoder::open(): ");
+
+	if (flags & opened)
+		return false;
+
+	using namespace std;
+
+	if (num_contexts == 0) {
+		cerr << msg_prefix << "no decoder contexts requested.\n";
+		return false;
+	}
+
+	input = new InputFile;
+
+	try {
+		if (!input->open(name))
+			throw runtime_error("failed to open input file");
+
+		if (!index.build(*input))
+			throw runtime_error("failed to index input file");
+
+		segments = index.split(num_contexts * segments_per_context);
+
+		// There is no point in having idle contexts.
+		num_contexts = min<unsigned>(num_contexts, segments.size());
+
+		contexts.resize(num_contexts);
+
+		for (auto &i : contexts) {
+			i.drm = new ExynosDRM;
+			i.thread = nullptr;
+
+			if (!i.drm->open(ExynosDRM::connector_none))
+				throw runtime_error("failed to open DRM device");
+			if (!i.drm->init(0, 0))
+				throw runtime_error("failed to initialize DRM device");
+			if (!i.drm->alloc_buffers(input_buffer_count, input_buffer_size, i.buffers))
+				throw runtime_error("failed to allocate stream buffers");
+		}
+	}
+	catch (exception &e) {
+		cerr << msg_prefix << e.what() << ".\n";
+
+		for (auto &i : contexts) {
+			i.buffers.clear();
+			delete i.drm;
+		}
+
+		contexts.clear();
+		segments.clear();
+
+		delete input;
+		input = nullptr;
+
+		return false;
+	}
+
+	cout << msg_prefix << "using " << contexts.size() << " context(s) for "
+		 << segments.size() << " segment(s).\n";
+
+	flags |= opened;
+
+	return true;
+}
+
+void ParallelDecoder::close()
+{
+	if (!(flags & opened))
+		return;
+
+	// The buffers have to be released before their DRM device.
+	for (auto &i : contexts) {
+		i.buffers.clear();
+		delete i.drm;
+	}
+
+	contexts.clear();
+	segments.clear();
+	outputs.clear();
+
+	delete input;
+	input = nullptr;
+
+	flags &= ~opened;
+}
+
+bool ParallelDecoder::decode(FileWriter &w, const std::string &name,
+							 enum FileWriter::format f, unsigned fps_num, unsigned fps_den)
+{
+	static const std::string msg_prefix("ParallelDecoder::decode(): ");
+
+	if (!(flags & opened))
+		return false;
+
+	using namespace std;
+
+	outputs.clear();
+	outputs.resize(segments.size());
+
+	// The frames of a segment follow the frames of all segments before it.
+	uint64_t num_frames = 0;
+
+	for (unsigned i = 0; i < segments.size(); ++i) {
+		outputs[i].first_frame = num_frames;
+		zerostruct(&outputs[i].vi);
+		outputs[i].started = false;
+
+		num_frames += segments[i].num_frames;
+	}
+
+	writer = &w;
+	planar = (f == FileWriter::format_y4m);
+	next_segment = 0;
+	writer_ready = false;
+	num_written = 0;
+	failed = false;
+
+	for (unsigned i = 0; i < contexts.size(); ++i)
+		contexts[i].thread = new std::thread(&ParallelDecoder::worker_thread, this, i);
+
+	const uint64_t start = monotonic_us();
+
+	{
+		unique_lock<mutex> lock(mtx);
+
+		cv.wait(lock, [&] { return outputs[0].started || failed; });
+
+		if (!failed) {
+			const videoinfo first = outputs[0].vi;
+
+			lock.unlock();
+			const bool ret = w.open(name, f, first, fps_num, fps_den);
+			lock.lock();
+
+			if (ret)
+				writer_ready = true;
+			else
+				failed = true;
+		}
+	}
+
+	cv.notify_all();
+
+	for (auto &i : contexts) {
+		i.thread->join();
+		delete i.thread;
+		i.thread = nullptr;
+	}
+
+	writer = nullptr;
+
+	const uint64_t elapsed = max<uint64_t>(monotonic_us() - start, 1);
+
+	cout << msg_prefix << "decoded " << num_written << " of " << num_frames << " frame(s) in "
+		 << elapsed / 1000 << " ms (" << double(num_written) * 1000000.0 / double(elapsed)
+		 << " fps).\n";
+
+	return !failed;
+}
+
+void ParallelDecoder::worker_thread(unsigned id)
+{
+	context &ctx = contexts[id];
+
+	// The segments don't depend on each other, so a context that is
+	// done takes the next segment that nobody works on yet.
+	while (true) {
+		unsigned s;
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+
+			if (failed || next_segment == segments.size())
+				break;
+
+			s = next_segment++;
+		}
+
+		// Stop the other contexts, and the wait for the first segment.
+		if (!decode_segment(ctx, s)) {
+			set_failed();
+			break;
+		}
+	}
+}
+
+bool ParallelDecoder::decode_segment(context &ctx, unsigned s)
+{
+	static const std::string msg_prefix("ParallelDecoder::decode_segment(): ");
+
+	using namespace std;
+
+	const FrameIndex::segment &seg = segments[s];
+	static const std::vector<uint8_t> no_prefix;
+
+	// Segments without their own SPS get the parameter sets
+	// from the start of the stream.
+	InputFile view;
+
+	if (!view.open(*input, seg.offset, seg.length, seg.has_sps ? no_prefix : index.get_header())) {
+		cerr << msg_prefix << "failed to open segment " << s << ".\n";
+		return false;
+	}
+
+	Parser *parser = Parser::get_parser_from_codec(Parser::h264);
+	MFCDecoder *mfcdec = new MFCDecoder;
+	std::thread *dest = nullptr;
+	FramePacker packer;
+	bool dest_ret = false;
+
+	try {
+		videoinfo vi;
+		unsigned num_pages;
+
+		if (!parser->link(&view))
+			throw runtime_error("failed to link parser");
+		if (!mfcdec->open())
+			throw runtime_error("failed to open decoder");
+		if (!mfcdec->set_parser(parser))
+			throw runtime_error("failed to set parser");
+		if (!mfcdec->set_source(ctx.buffers))
+			throw runtime_error("failed to set source buffers");
+		if (!mfcdec->init(num_pages, vi))
+			throw runtime_error("failed to initialize decoder");
+		if (!ctx.drm->alloc_pages(num_pages, vi))
+			throw runtime_error("failed to allocate pages");
+		if (!packer.init(vi, planar))
+			throw runtime_error("unsupported video format");
+
+		// All pages go to the decoder, since nothing is displayed.
+		ExynosPage *p;
+
+		while ((p = ctx.drm->get_page()) != nullptr) {
+			if (!mfcdec->queue_dest(p))
+				throw runtime_error("failed to queue page");
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+
+			outputs[s].vi = vi;
+			outputs[s].started = true;
+		}
+
+		cv.notify_all();
+	}
+	catch (exception &e) {
+		cerr << msg_prefix << "segment " << s << ": " << e.what() << ".\n";
+
+		delete mfcdec;
+		ctx.drm->free_pages();
+		delete parser;
+
+		return false;
+	}
+
+	// Pack the decoded frames in batches, write each batch to its place
+	// in the file, and give the pages directly back to the decoder. After
+	// an error, the frames are only discarded, so that the decoder can
+	// still be drained.
+	dest = new std::thread([&] {
+		const unsigned frame_size = packer.get_frame_size();
+		const unsigned batch_frames = max(1u, unsigned(batch_size) / frame_size);
+
+		std::vector<uint8_t> batch(batch_frames * frame_size);
+		uint64_t next = 0;
+		unsigned count = 0;
+		bool discard = !wait_for_writer(s);
+
+		while (true) {
+			ExynosPage *p = mfcdec->dequeue_dest();
+			if (!p)
+				break;
+
+			if (!discard && next + count == seg.num_frames) {
+				cerr << msg_prefix << "segment " << s << " has more than the "
+					 << seg.num_frames << " frame(s) of the index.\n";
+				discard = true;
+			}
+
+			if (!discard) {
+				const uint8_t *frame = static_cast<const uint8_t*>(p->mmap());
+
+				if (frame) {
+					packer.pack(frame, batch.data() + count * frame_size);
+					count++;
+				} else {
+					discard = true;
+				}
+			}
+
+			if (!discard && count == batch_frames) {
+				discard = !write_frames(s, next, count, batch.data());
+				next += count;
+				count = 0;
+			}
+
+			if (!mfcdec->queue_dest(p))
+				return;
+		}
+
+		if (!discard && count != 0) {
+			discard = !write_frames(s, next, count, batch.data());
+			next += count;
+		}
+
+		if (!discard && next != seg.num_frames) {
+			cerr << msg_prefix << "segment " << s << " has " << next << " of the "
+				 << seg.num_frames << " frame(s) of the index.\n";
+			discard = true;
+		}
+
+		dest_ret = mfcdec->eos() && !discard;
+	});
+
+	enum MFCDecoder::run_state state = MFCDecoder::run_active;
+
+	while (state != MFCDecoder::run_finished && state != MFCDecoder::run_error) {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+
+			if (failed)
+				break;
+		}
+
+		state = mfcdec->run();
+	}
+
+	// Draining also terminates the destination thread.
+	const bool drained = mfcdec->drain();
+
+	dest->join();
+	delete dest;
+
+	delete mfcdec;
+	ctx.drm->free_pages();
+	delete parser;
+
+	if (state != MFCDecoder::run_finished || !drained)
+		return false;
+
+	return dest_ret;
+}
+
+bool ParallelDecoder::wait_for_writer(unsigned s)
+{
+	static const std::string msg_prefix("ParallelDecoder::wait_for_writer(): ");
+
+	std::unique_lock<std::mutex> lock(mtx);
+
+	cv.wait(lock, [&] { return writer_ready || failed; });
+
+	if (failed)
+		return false;
+
+	// All segments go to the same file, with the frame size of the first.
+	const videoinfo &first = outputs[0].vi;
+	const videoinfo &vi = outputs[s].vi;
+
+	if (vi.crop_w != first.crop_w || vi.crop_h != first.crop_h) {
+		std::cerr << msg_prefix << "segment " << s << " has a different resolution.\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool ParallelDecoder::write_frames(unsigned s, uint64_t first, unsigned count,
+								   const uint8_t *data)
+{
+	static const std::string msg_prefix("ParallelDecoder::write_frames(): ");
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+
+		if (failed)
+			return false;
+	}
+
+	// The writes of the segments don't overlap, hence no lock is held.
+	if (!writer->write_packed_at(outputs[s].first_frame + first, count, data)) {
+		std::cerr << msg_prefix << "failed to write frames of segment " << s
+				  << " (errno=" << errno << ").\n";
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	num_written += count;
+
+	return true;
+}
+
+void ParallelDecoder::set_failed()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+
+		failed = true;
+	}
+
+	cv.notify_all();
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__PARALLEL_DECODER_)
+#define __PARALLEL_DECODER_
+
+#include "main.h"
+#include "frame_index.h"
+#include "file_writer.h"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Forward-declarations
+class InputFile;
+class ExynosDRM;
+class ExynosBuffer;
+
+// Offline decoder that splits a H.264 stream at IDR boundaries into
+// segments, and decodes these segments concurrently on several MFC
+// contexts. The index tells how many pictures each segment has, so
+// every segment writes its frames directly to their place in the file,
+// and no context ever waits for the segments before its own.
+//
+// The MFC itself time-slices between its contexts, so the speedup is
+// mostly gained by overlapping parsing, detiling and I/O with decoding.
+class ParallelDecoder {
+private:
+	enum flags {
+		opened			= (1 << 0),
+	};
+
+	enum constants {
+		// Same as for a single decoder.
+		input_buffer_size = 1024 * 1024,
+		input_buffer_count = 2,
+
+		// Number of segments for each context. More segments balance
+		// the load better, since a context that is done early takes the
+		// next segment, but each segment sets up a decoder of its own.
+		segments_per_context = 4,
+
+		// Target size of the packed frames that a segment writes at once.
+		batch_size = 4 * 1024 * 1024,
+	};
+
+	// A MFC context together with its DRM device, which provides the
+	// buffers for the compressed stream and the decoded frames.
+	//
+	// @drm: headless DRM device of the context
+	// @buffers: compressed stream buffers
+	// @thread: worker thread that decodes the segments
+	struct context {
+		ExynosDRM *drm;
+		std::vector<ExynosBuffer> buffers;
+		std::thread *thread;
+	};
+
+	// Output of a segment.
+	//
+	// @first_frame: position of the first frame of the segment in the stream
+	// @vi: video information (valid once 'started' is set)
+	// @started: the decoder of the segment is set up
+	struct segment_output {
+		uint64_t first_frame;
+		videoinfo vi;
+		bool started;
+	};
+
+	InputFile *input;
+	FrameIndex index;
+	std::vector<FrameIndex::segment> segments;
+
+	std::vector<context> contexts;
+	std::vector<segment_output> outputs;
+
+	// Output file, which is opened with the video information of the
+	// first segment. The segments write to it concurrently.
+	FileWriter *writer;
+	bool planar;
+
+	// The mutex protects the segment outputs and the members below.
+	std::mutex mtx;
+	std::condition_variable cv;
+	unsigned next_segment;
+	bool writer_ready;
+	uint64_t num_written;
+	bool failed;
+
+	unsigned flags;
+
+	void worker_thread(unsigned id);
+
+	bool decode_segment(context &ctx, unsigned s);
+	bool wait_for_writer(unsigned s);
+	bool write_frames(unsigned s, uint64_t first, unsigned count,
+					  const uint8_t *data);
+	void set_failed();
+
+public:
+	ParallelDecoder();
+	~ParallelDecoder();
+
+	ParallelDecoder(const ParallelDecoder &pd) = delete;
+
+	// Open/close the parallel decoder.
+	// open() returns false if an error occurs.
+	//
+	// @name: path of the H.264 elementary stream
+	// @num_contexts: number of MFC contexts to use
+	bool open(const std::string &name, unsigned num_contexts);
+	void close();
+
+	// Decode the whole stream into a file.
+	// decode() returns false if an error occurs.
+	//
+	// @writer: file writer, which is opened with the video information
+	//          of the first segment
+	// @name, f, fps_{num,den}: see FileWriter::open()
+	bool decode(FileWriter &writer, const std::string &name,
+				enum FileWriter::format f, unsigned fps_num, unsigned fps_den);
+};
+
+#endif // __PARALLEL_DECODER_
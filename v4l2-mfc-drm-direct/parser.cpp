@@ -103,6 +103,8 @@ bool Parser::reset()
 	zerostruct(bytes, 6);
 	input->rewind();
 
+	flags &= ~(got_start | got_end | seek_end);
+
 	return true;
 }
 
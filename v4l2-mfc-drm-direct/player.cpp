@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "player.h"
+#include "main.h"
+#include "mfc.h"
+#include "exynos_drm.h"
+#include "file_writer.h"
+#include "frame_scheduler.h"
+
+#include <iostream>
+#include <string>
+#include <algorithm>
+
+
+Player::Player() : drm(nullptr), mfcdec(nullptr), writer(nullptr), sched(nullptr),
+	mode(present_fifo), scheduled(nullptr), index(0), fence_fd(-1), cpu_decoder(0),
+	cpu_display(0), frames_skipped(0), flags(0)
+{
+	// Nothing here.
+}
+
+Player::~Player()
+{
+	deinit();
+}
+
+bool Player::init(ExynosDRM *d, MFCDecoder *dec, FileWriter *w,
+				  FrameScheduler *s, enum present_mode m, bool with_osd)
+{
+	static const std::string msg_prefix("Player::init(): ");
+
+	if (flags & initialized)
+		return false;
+
+	using namespace std;
+
+	if (m == present_paced && !s) {
+		cerr << msg_prefix << "frame pacing requires a scheduler.\n";
+		return false;
+	}
+
+	drm = d;
+	mfcdec = dec;
+	writer = w;
+	sched = s;
+	mode = m;
+
+	ready.clear();
+	scheduled = nullptr;
+	index = 0;
+	fence_fd = -1;
+	cpu_decoder = 0;
+	cpu_display = 0;
+	frames_skipped = 0;
+
+	if (!loop.open())
+		return false;
+
+	try {
+		if (!loop.add(mfcdec->get_fd(), EPOLLIN | EPOLLOUT, event_decoder))
+			throw runtime_error("failed to watch decoder");
+
+		if (!writer && !loop.add(drm->get_fd(), EPOLLIN, event_display))
+			throw runtime_error("failed to watch display");
+
+		// Pages that left the screen are signalled by the free list.
+		if (!writer && !loop.add(drm->get_page_fd(), EPOLLIN, event_pages))
+			throw runtime_error("failed to watch free pages");
+
+		if (!writer && mode == present_paced && !loop.add_timer(event_timer))
+			throw runtime_error("failed to add timer");
+	}
+	catch (exception &e) {
+		cerr << msg_prefix << e.what() << ".\n";
+		loop.close();
+
+		return false;
+	}
+
+	mfcdec->set_nonblocking(true);
+
+	flags = initialized;
+
+	if (with_osd && !writer)
+		flags |= show_osd;
+
+	// Start the decoder, the remaining work is driven by events.
+	if (!decode()) {
+		deinit();
+		return false;
+	}
+
+	if (flags & show_osd)
+		osd.start(monotonic_us(), sample());
+
+	return true;
+}
+
+void Player::deinit()
+{
+	if (!(flags & initialized))
+		return;
+
+	mfcdec->set_nonblocking(false);
+	loop.close();
+
+	ready.clear();
+	scheduled = nullptr;
+	fence_fd = -1;
+
+	flags = 0;
+}
+
+bool Player::dispatch(int timeout)
+{
+	if (!(flags & initialized) || (flags & finished))
+		return false;
+
+	if (!loop.wait(events, timeout))
+		return false;
+
+	for (auto &i : events) {
+		bool ret = true;
+
+		const uint64_t cpu_start = (flags & show_osd) ? thread_cpu_us() : 0;
+		const uint64_t parse_start = mfcdec->get_parse_time();
+
+		switch (i.id) {
+		case event_decoder:
+			if ((i.events & EPOLLOUT) && !(flags & draining))
+				ret = decode();
+
+			if (ret && (i.events & EPOLLIN))
+				ret = handle_frames();
+
+			// The decoder has neither source nor destination buffers
+			// queued, which makes its fd signal an error. Stop watching
+			// it, until we give a page back.
+			if (ret && (i.events & EPOLLERR) && !(i.events & (EPOLLIN | EPOLLOUT)))
+				unwatch_decoder();
+
+			break;
+
+		case event_display:
+			ret = handle_display();
+			break;
+
+		case event_timer:
+			ret = handle_timer();
+			break;
+
+		case event_fence:
+			ret = handle_fence();
+			break;
+
+		case event_pages:
+			ret = handle_pages();
+			break;
+
+		default:
+			break;
+		}
+
+		if (!ret)
+			return false;
+
+		if (flags & show_osd)
+			account(i.id, cpu_start, parse_start);
+	}
+
+	if (!writer && !watch_fence())
+		return false;
+
+	if (flags & show_osd)
+		update_osd();
+
+	// All frames were presented, or written to the file.
+	if ((flags & end_of_stream) && ready.empty() && !scheduled)
+		finish();
+
+	return true;
+}
+
+bool Player::done() const
+{
+	return (flags & finished);
+}
+
+int Player::get_fd() const
+{
+	return loop.get_fd();
+}
+
+bool Player::decode()
+{
+	static const std::string msg_prefix("Player::decode(): ");
+
+	// Refill the source buffers, as long as the decoder returns them.
+	while (true) {
+		switch (mfcdec->run()) {
+		case MFCDecoder::run_active:
+			continue;
+
+		case MFCDecoder::run_nop:
+			return true;
+
+		case MFCDecoder::run_finished:
+			// Let the decoder output the remaining frames. If draining is
+			// not possible, these frames are lost.
+			if (!mfcdec->drain()) {
+				flags |= end_of_stream;
+				unwatch_decoder();
+
+				return true;
+			}
+
+			flags |= draining;
+
+			// The source buffers are no longer of interest.
+			if (!(flags & decoder_idle))
+				loop.modify(mfcdec->get_fd(), EPOLLIN, event_decoder);
+
+			return true;
+
+		case MFCDecoder::run_error:
+		default:
+			std::cerr << msg_prefix << "decoder failed.\n";
+			return false;
+		}
+	}
+}
+
+bool Player::handle_frames()
+{
+	static const std::string msg_prefix("Player::handle_frames(): ");
+
+	while (!(flags & end_of_stream)) {
+		ExynosPage *p = mfcdec->dequeue_dest();
+
+		if (p) {
+			if (!handle_frame(p))
+				return false;
+
+			continue;
+		}
+
+		// The decoder stays readable after the end of the stream.
+		if (mfcdec->eos()) {
+			flags |= end_of_stream;
+			unwatch_decoder();
+			break;
+		}
+
+		if (!mfcdec->would_block()) {
+			std::cerr << msg_prefix << "failed to dequeue frame.\n";
+			return false;
+		}
+
+		break;
+	}
+
+	return true;
+}
+
+bool Player::handle_frame(ExynosPage *p)
+{
+	static const std::string msg_prefix("Player::handle_frame(): ");
+
+	// When decoding to a file, the writer copies the frame into its
+	// staging buffer. Hence the page can go back to the decoder at once.
+	if (writer) {
+		const uint8_t *frame = static_cast<const uint8_t*>(p->mmap());
+
+		if (!frame || !writer->write(frame)) {
+			std::cerr << msg_prefix << "failed to write frame.\n";
+			return false;
+		}
+
+		return requeue(p);
+	}
+
+	// The position in display order gives the time of the frame.
+	p->set_index(index++);
+
+	if (mode == present_mailbox) {
+		ExynosPage *displaced;
+
+		if (!drm->present_mailbox(p, displaced))
+			return false;
+
+		return displaced ? requeue(displaced) : true;
+	}
+
+	ready.push_back(p);
+
+	return present_next();
+}
+
+bool Player::handle_display()
+{
+	if (!drm->handle_events())
+		return false;
+
+	return present_next();
+}
+
+bool Player::handle_fence()
+{
+	// Same as for the flip event, but the fence may signal first.
+	if (!drm->handle_fence())
+		return false;
+
+	return present_next();
+}
+
+bool Player::handle_pages()
+{
+	// Pages that left the screen go back to the decoder.
+	ExynosPage *p;
+
+	while ((p = drm->get_page()) != nullptr) {
+		if (!requeue(p))
+			return false;
+	}
+
+	return true;
+}
+
+bool Player::watch_fence()
+{
+	// Each flip comes with a new fence, and the old one was closed when
+	// its flip completed. Since the fd number might have been reused in
+	// the meantime, we always register the current fence again.
+	if (fence_fd >= 0)
+		loop.remove(fence_fd);
+
+	fence_fd = drm->get_fence_fd();
+
+	if (fence_fd >= 0 && !loop.add(fence_fd, EPOLLIN, event_fence))
+		return false;
+
+	return true;
+}
+
+bool Player::handle_timer()
+{
+	loop.ack_timer();
+
+	if (!scheduled)
+		return true;
+
+	ExynosPage *p = scheduled;
+	scheduled = nullptr;
+
+	if (!drm->issue_flip(p))
+		return false;
+
+	return true;
+}
+
+bool Player::present_next()
+{
+	// The scheduler needs the time of the last completed flip, so we
+	// only look at the next frame once the display is idle.
+	while (!ready.empty() && !scheduled && !drm->flip_pending()) {
+		ExynosPage *p = ready.front();
+		ready.pop_front();
+
+		if (mode == present_paced) {
+			const uint64_t now = monotonic_us();
+			uint64_t issue_time;
+
+			if (sched->schedule(p->get_index(), drm->get_last_flip_time(), now,
+								issue_time) == FrameScheduler::action_drop) {
+				frames_skipped++;
+
+				if (!requeue(p))
+					return false;
+
+				continue;
+			}
+
+			if (issue_time > now) {
+				scheduled = p;
+
+				return loop.arm_timer(issue_time);
+			}
+		}
+
+		if (!drm->issue_flip(p))
+			return false;
+	}
+
+	return true;
+}
+
+bool Player::requeue(ExynosPage *p)
+{
+	if (!mfcdec->queue_dest(p))
+		return false;
+
+	// With a buffer queued, the decoder fd is usable again.
+	if ((flags & decoder_idle) && !(flags & end_of_stream)) {
+		const uint32_t ev = (flags & draining) ? EPOLLIN : (EPOLLIN | EPOLLOUT);
+
+		if (!loop.add(mfcdec->get_fd(), ev, event_decoder))
+			return false;
+
+		flags &= ~decoder_idle;
+	}
+
+	return true;
+}
+
+void Player::unwatch_decoder()
+{
+	if (flags & decoder_idle)
+		return;
+
+	loop.remove(mfcdec->get_fd());
+	flags |= decoder_idle;
+}
+
+void Player::finish()
+{
+	// The last frame might still wait in the mailbox, so
+	// wait until the display is idle.
+	if (!writer) {
+		while (drm->wait_for_flip()) {
+			if (!drm->handle_events())
+				break;
+		}
+	}
+
+	flags |= finished;
+}
+
+void Player::account(unsigned id, uint64_t cpu_start, uint64_t parse_start)
+{
+	const uint64_t cpu = thread_cpu_us() - cpu_start;
+
+	// The parser runs as part of the decoder event, but is shown
+	// as its own stage.
+	if (id == event_decoder)
+		cpu_decoder += cpu - std::min(cpu, mfcdec->get_parse_time() - parse_start);
+	else
+		cpu_display += cpu;
+}
+
+osd_sample Player::sample() const
+{
+	osd_sample s;
+
+	s.frames_decoded = mfcdec->get_frames_decoded();
+	s.frames_presented = drm->get_frames_presented();
+	s.frames_dropped = mfcdec->get_frames_dropped() + drm->get_frames_replaced() + frames_skipped;
+	s.queued_decoder = mfcdec->get_queued_dest();
+	s.queued_display = ready.size() + (scheduled ? 1 : 0);
+	s.free_pages = drm->get_free_pages();
+	s.cpu_parser = mfcdec->get_parse_time();
+	s.cpu_decoder = cpu_decoder;
+	s.cpu_display = cpu_display;
+
+	return s;
+}
+
+void Player::update_osd()
+{
+	static const std::string msg_prefix("Player::update_osd(): ");
+
+	if (!osd.update(monotonic_us(), sample()))
+		return;
+
+	// Playback continues without the OSD, e.g. in headless mode.
+	if (!drm->set_overlay_text(osd.get_text())) {
+		std::cerr << msg_prefix << "failed to show OSD, disabling it.\n";
+		flags &= ~show_osd;
+	}
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__PLAYER_)
+#define __PLAYER_
+
+#include "event_loop.h"
+#include "osd.h"
+
+#include <vector>
+#include <deque>
+
+// Forward-declarations
+class ExynosDRM;
+class ExynosPage;
+class MFCDecoder;
+class FileWriter;
+class FrameScheduler;
+
+// Drives decoding and presentation from a single thread. The decoder,
+// the display and the timer of the frame scheduler are serviced by one
+// event loop, and all atomic commits are nonblocking.
+class Player {
+public:
+	enum present_mode {
+		// Flip each frame as soon as the previous flip has completed.
+		present_fifo = 0,
+
+		// Flip the frames according to the frame rate (see FrameScheduler).
+		present_paced,
+
+		// Always flip to the newest frame (see ExynosDRM::present_mailbox()).
+		present_mailbox,
+	};
+
+private:
+	enum flags {
+		initialized		= (1 << 0),
+		draining		= (1 << 1),
+		end_of_stream	= (1 << 2),
+		finished		= (1 << 3),
+
+		// The decoder fd is not watched, since no buffers are queued.
+		decoder_idle	= (1 << 4),
+
+		// The performance OSD is shown on the overlay.
+		show_osd		= (1 << 5),
+	};
+
+	enum event_id {
+		event_decoder = 0,
+		event_display,
+		event_timer,
+		event_fence,
+		event_pages,
+	};
+
+	ExynosDRM *drm;
+	MFCDecoder *mfcdec;
+	FileWriter *writer;
+	FrameScheduler *sched;
+	enum present_mode mode;
+
+	EventLoop loop;
+	std::vector<EventLoop::event> events;
+
+	// Decoded pages that wait for the display.
+	std::deque<ExynosPage*> ready;
+
+	// Page whose flip is issued when the timer expires.
+	ExynosPage *scheduled;
+
+	// Position of the next frame in display order.
+	unsigned index;
+
+	// Out-fence that is watched by the event loop (-1 if none).
+	int fence_fd;
+
+	PerformanceOSD osd;
+
+	// CPU time spent on the decoder (without the parser) and
+	// on the display (in microseconds).
+	uint64_t cpu_decoder;
+	uint64_t cpu_display;
+
+	// Frames that the scheduler dropped, since they were late.
+	uint64_t frames_skipped;
+
+	unsigned flags;
+
+	bool decode();
+	bool handle_frames();
+	bool handle_frame(ExynosPage *p);
+	bool handle_display();
+	bool handle_timer();
+	bool handle_fence();
+	bool handle_pages();
+	bool watch_fence();
+	bool present_next();
+	bool requeue(ExynosPage *p);
+	void unwatch_decoder();
+	void finish();
+
+	// Add the CPU time of an event to its stage.
+	//
+	// @id: event that was handled
+	// @{cpu,parse}_start: CPU time of the thread and of the parser
+	//                     before the event was handled
+	void account(unsigned id, uint64_t cpu_start, uint64_t parse_start);
+
+	osd_sample sample() const;
+	void update_osd();
+
+public:
+	Player();
+	~Player();
+
+	Player(const Player &p) = delete;
+
+	// Initialize/deinitialize the player. The decoder has to be
+	// initialized, with its initial destination buffers queued.
+	// init() returns false if an error occurs.
+	//
+	// @d: DRM device that provides the pages
+	// @dec: MFC decoder
+	// @w: file writer (if not nullptr, the frames are written to
+	//     it instead of being displayed)
+	// @s: frame scheduler (only used with present_paced)
+	// @m: presentation mode
+	// @with_osd: show the performance OSD on the overlay (ignored
+	//            when the frames are written to a file)
+	bool init(ExynosDRM *d, MFCDecoder *dec, FileWriter *w,
+			  FrameScheduler *s, enum present_mode m, bool with_osd = false);
+	void deinit();
+
+	// Wait for events and handle them.
+	// dispatch() returns false if an error occurs.
+	//
+	// @timeout: timeout in milliseconds (-1 for none)
+	bool dispatch(int timeout);
+
+	// Returns true if the whole stream was decoded and presented.
+	bool done() const;
+
+	// A fd, which becomes readable when dispatch() has events to
+	// handle (e.g. to wait for several players, or other fds).
+	int get_fd() const;
+};
+
+#endif // __PLAYER_
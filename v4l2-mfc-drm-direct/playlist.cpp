@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "playlist.h"
+#include "input_file.h"
+
+#include <iostream>
+#include <fstream>
+
+
+Playlist::Playlist() : pos(0), flags(0)
+{
+	// Nothing here.
+}
+
+bool Playlist::open(const std::string &name, bool loop)
+{
+	static const std::string msg_prefix("Playlist::open(): ");
+
+	if (flags & opened)
+		return false;
+
+	using namespace std;
+
+	ifstream f(name);
+
+	if (!f) {
+		cerr << msg_prefix << "failed to open playlist: " << name << ".\n";
+		return false;
+	}
+
+	string line;
+
+	names.clear();
+
+	while (getline(f, line)) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		names.push_back(line);
+	}
+
+	if (names.empty()) {
+		cerr << msg_prefix << "playlist is empty.\n";
+		return false;
+	}
+
+	cout << msg_prefix << "playlist with " << names.size() << " clip(s).\n";
+
+	pos = 0;
+	flags = opened;
+
+	if (loop)
+		flags |= looping;
+
+	return true;
+}
+
+void Playlist::close()
+{
+	if (!(flags & opened))
+		return;
+
+	names.clear();
+	flags = 0;
+}
+
+bool Playlist::next(clip &c)
+{
+	static const std::string msg_prefix("Playlist::next(): ");
+
+	if (!(flags & opened))
+		return false;
+
+	using namespace std;
+
+	// Give up after a whole round without a usable clip.
+	for (unsigned i = 0; i < names.size(); ++i) {
+		if (pos == names.size()) {
+			if (!(flags & looping))
+				return false;
+
+			pos = 0;
+		}
+
+		const string &name = names[pos++];
+
+		InputFile *in = new InputFile;
+
+		// Only the SPS is read, since the previous clip is still
+		// playing on this thread.
+		if (!in->open(name) || !FrameIndex::probe(*in, c.size)) {
+			cerr << msg_prefix << "skipping clip: " << name << ".\n";
+
+			delete in;
+			continue;
+		}
+
+		c.name = name;
+		c.input = in;
+
+		return true;
+	}
+
+	cerr << msg_prefix << "no usable clip in the playlist.\n";
+
+	return false;
+}
+
+bool Playlist::can_follow(const clip &running, const clip &next)
+{
+	const FrameIndex::picture_size &x = running.size;
+	const FrameIndex::picture_size &y = next.size;
+
+	if (x.w != y.w || x.h != y.h || x.crop_left != y.crop_left ||
+		x.crop_top != y.crop_top || x.crop_w != y.crop_w || x.crop_h != y.crop_h)
+		return false;
+
+	// The destination buffers were counted for the DPB of the running
+	// clip. The profiles that the MFC decodes (baseline, main, high)
+	// have increasing profile_idc values.
+	return y.profile_idc <= x.profile_idc && y.level_idc <= x.level_idc &&
+		   y.max_ref_frames <= x.max_ref_frames;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__PLAYLIST_)
+#define __PLAYLIST_
+
+#include "frame_index.h"
+
+#include <string>
+#include <vector>
+
+// Forward-declarations
+class InputFile;
+
+// List of H.264 elementary streams (clips) that are played one after
+// the other, e.g. for signage. The list file has one path per line,
+// empty lines and lines starting with '#' are skipped (so that simple
+// M3U files can be used). A clip is opened and its SPS is read ahead,
+// while the clip before it is still playing.
+class Playlist {
+public:
+	// @name: path of the clip
+	// @input: opened stream of the clip
+	// @size: picture size and DPB parameters from the SPS of the clip
+	struct clip {
+		std::string name;
+		InputFile *input;
+		FrameIndex::picture_size size;
+	};
+
+private:
+	enum flags {
+		opened			= (1 << 0),
+		looping			= (1 << 1),
+	};
+
+	std::vector<std::string> names;
+
+	// Position of the next clip in the list.
+	unsigned pos;
+
+	unsigned flags;
+
+public:
+	Playlist();
+	~Playlist() {}
+
+	Playlist(const Playlist &p) = delete;
+
+	// Read the list of clips.
+	// open() returns false if an error occurs, or if the list is empty.
+	//
+	// @name: path of the list file
+	// @loop: start again with the first clip after the last one
+	bool open(const std::string &name, bool loop);
+	void close();
+
+	// Open the next clip of the list. Clips that can't be opened, or
+	// that have no usable SPS, are skipped.
+	// next() returns false at the end of the list, or if no clip of
+	// the list can be opened.
+	//
+	// @c: receives the clip (the input is owned by the caller)
+	bool next(clip &c);
+
+	// Check if a clip can be spliced into a decoder, which was set up
+	// for another clip. Both need the same picture size, and the clip
+	// must not need more pictures in the decoder (profile, level and
+	// reference frames) than the decoder was set up for.
+	//
+	// @running: clip that the decoder was set up for
+	// @next: clip that should follow
+	static bool can_follow(const clip &running, const clip &next);
+};
+
+#endif // __PLAYLIST_
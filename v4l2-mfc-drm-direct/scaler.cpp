@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scaler.h"
+#include "main.h"
+
+#include <string>
+#include <iostream>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+
+namespace {
+
+enum scaler_constants {
+	// Planes of a decoded frame, and of the destination frame.
+	source_plane_count = 2,
+	dest_plane_count = 1,
+};
+
+inline std::string
+u8tostr(const uint8_t* d)
+{
+	return std::string(reinterpret_cast<const char*>(d));
+}
+
+// Check if a device is a scaler, which can be used for mem2mem.
+inline bool
+is_scaler(const struct v4l2_capability &cap)
+{
+	const std::string driver = u8tostr(cap.driver);
+
+	if (driver != "exynos-gsc" && driver != "exynos4-fimc")
+		return false;
+
+	const uint32_t c = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ?
+		cap.device_caps : cap.capabilities;
+
+	return (c & V4L2_CAP_VIDEO_M2M_MPLANE) && (c & V4L2_CAP_STREAMING);
+}
+
+// The decoder reports its frames with a single-planar format name, but
+// stores the planes separately. The scaler needs the multi-planar name.
+inline uint32_t
+source_format(uint32_t f)
+{
+	switch (f) {
+	case V4L2_PIX_FMT_NV12:
+		return V4L2_PIX_FMT_NV12M;
+
+	case V4L2_PIX_FMT_NV21:
+		return V4L2_PIX_FMT_NV21M;
+
+	default:
+		return f;
+	}
+}
+
+bool
+set_selection(int fd, uint32_t type, uint32_t target, const M2MScaler::rect &r)
+{
+	struct v4l2_selection sel;
+
+	zerostruct(&sel);
+	sel.type = type;
+	sel.target = target;
+	sel.r.left = r.x;
+	sel.r.top = r.y;
+	sel.r.width = r.w;
+	sel.r.height = r.h;
+
+	return (ioctl(fd, VIDIOC_S_SELECTION, &sel) == 0);
+}
+
+bool
+request_buffers(int fd, uint32_t type, unsigned count)
+{
+	struct v4l2_requestbuffers reqbuf;
+
+	zerostruct(&reqbuf);
+	reqbuf.count = count;
+	reqbuf.type = type;
+	reqbuf.memory = V4L2_MEMORY_DMABUF;
+
+	if (ioctl(fd, VIDIOC_REQBUFS, &reqbuf))
+		return false;
+
+	return (reqbuf.count >= count);
+}
+
+}; // anonymous namespace
+
+
+M2MScaler::M2MScaler() : fd(-1), src_count(0), dst_count(0), dst_size(0), flags(0)
+{
+	zerostruct(src_plane_size, 2);
+}
+
+M2MScaler::~M2MScaler()
+{
+	close();
+}
+
+bool M2MScaler::open()
+{
+	static const std::string msg_prefix("M2MScaler::open(): ");
+
+	if (flags & opened)
+		return false;
+
+	using namespace std;
+
+	const string video_prefix = "/dev/video";
+
+	for (unsigned i = 0; ; ++i) {
+		const string video_device = video_prefix + to_string(i);
+		struct v4l2_capability cap;
+
+		fd = ::open(video_device.c_str(), O_RDWR, 0);
+		if (fd < 0)
+			break;
+
+		zerostruct(&cap);
+
+		if (ioctl(fd, VIDIOC_QUERYCAP, &cap) || !is_scaler(cap)) {
+			::close(fd);
+			continue;
+		}
+
+		cout << msg_prefix << "scaler detected at " << video_device
+			 << " (card = " << u8tostr(cap.card) << ").\n";
+
+		flags |= opened;
+
+		return true;
+	}
+
+	fd = -1;
+
+	cerr << msg_prefix << "no scaler found.\n";
+
+	return false;
+}
+
+void M2MScaler::close()
+{
+	if (!(flags & opened))
+		return;
+
+	teardown();
+	::close(fd);
+
+	fd = -1;
+	flags &= ~opened;
+}
+
+bool M2MScaler::setup(const videoinfo &vi, const rect &src, unsigned num_src,
+					  unsigned dst_w, unsigned dst_h, const rect &dst, unsigned num_dst)
+{
+	static const std::string msg_prefix("M2MScaler::setup(): ");
+
+	if (!(flags & opened) || (flags & configured))
+		return false;
+
+	using namespace std;
+
+	struct v4l2_format fmt;
+
+	// The source frames are the pages of the decoder.
+	zerostruct(&fmt);
+	fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	fmt.fmt.pix_mp.width = vi.w;
+	fmt.fmt.pix_mp.height = vi.h;
+	fmt.fmt.pix_mp.pixelformat = source_format(vi.pixel_format);
+	fmt.fmt.pix_mp.num_planes = source_plane_count;
+
+	for (unsigned i = 0; i < source_plane_count; ++i) {
+		fmt.fmt.pix_mp.plane_fmt[i].bytesperline = vi.w;
+		fmt.fmt.pix_mp.plane_fmt[i].sizeimage = vi.buffer_size[i];
+	}
+
+	if (ioctl(fd, VIDIOC_S_FMT, &fmt) ||
+		fmt.fmt.pix_mp.pixelformat != source_format(vi.pixel_format)) {
+		cerr << msg_prefix << "source format not supported.\n";
+		return false;
+	}
+
+	// The destination is linear NV12, with both planes in one buffer.
+	dst_size = dst_w * dst_h * 3 / 2;
+
+	zerostruct(&fmt);
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	fmt.fmt.pix_mp.width = dst_w;
+	fmt.fmt.pix_mp.height = dst_h;
+	fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_NV12;
+	fmt.fmt.pix_mp.num_planes = dest_plane_count;
+	fmt.fmt.pix_mp.plane_fmt[0].bytesperline = dst_w;
+	fmt.fmt.pix_mp.plane_fmt[0].sizeimage = dst_size;
+
+	if (ioctl(fd, VIDIOC_S_FMT, &fmt) ||
+		fmt.fmt.pix_mp.pixelformat != V4L2_PIX_FMT_NV12) {
+		cerr << msg_prefix << "destination format not supported.\n";
+		return false;
+	}
+
+	// The selection API uses the single-planar buffer types.
+	if (!set_selection(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT, V4L2_SEL_TGT_CROP, src) ||
+		!set_selection(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_SEL_TGT_COMPOSE, dst)) {
+		cerr << msg_prefix << "failed to set the rectangles (errno="
+			 << errno << ").\n";
+		return false;
+	}
+
+	if (!request_buffers(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, num_src) ||
+		!request_buffers(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, num_dst)) {
+		cerr << msg_prefix << "failed to request buffers.\n";
+		return false;
+	}
+
+	src_count = num_src;
+	dst_count = num_dst;
+	src_plane_size[0] = vi.buffer_size[0];
+	src_plane_size[1] = vi.buffer_size[1];
+
+	if (!stream(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, true) ||
+		!stream(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, true)) {
+		cerr << msg_prefix << "failed to enable streaming.\n";
+
+		stream(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, false);
+		request_buffers(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, 0);
+		request_buffers(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, 0);
+
+		return false;
+	}
+
+	flags |= configured;
+
+	return true;
+}
+
+void M2MScaler::teardown()
+{
+	if (!(flags & configured))
+		return;
+
+	// Streaming off also returns the buffers of an unfinished conversion.
+	stream(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, false);
+	stream(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, false);
+
+	request_buffers(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, 0);
+	request_buffers(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, 0);
+
+	flags &= ~(configured | busy);
+}
+
+bool M2MScaler::start(unsigned src_index, int src_fd, unsigned dst_index, int dst_fd)
+{
+	static const std::string msg_prefix("M2MScaler::start(): ");
+
+	if (!(flags & configured) || (flags & busy))
+		return false;
+
+	if (src_index >= src_count || dst_index >= dst_count)
+		return false;
+
+	using namespace std;
+
+	struct v4l2_buffer qbuf;
+	struct v4l2_plane planes[source_plane_count];
+
+	// Both planes are in the same buffer. The used bytes of a plane
+	// include its offset.
+	zerostruct(&qbuf);
+	qbuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	qbuf.memory = V4L2_MEMORY_DMABUF;
+	qbuf.index = src_index;
+	qbuf.length = source_plane_count;
+	qbuf.m.planes = planes;
+
+	zerostruct(planes, source_plane_count);
+	planes[0].m.fd = src_fd;
+	planes[0].length = src_plane_size[0];
+	planes[0].bytesused = src_plane_size[0];
+	planes[1].m.fd = src_fd;
+	planes[1].length = src_plane_size[0] + src_plane_size[1];
+	planes[1].bytesused = src_plane_size[0] + src_plane_size[1];
+	planes[1].data_offset = src_plane_size[0];
+
+	if (ioctl(fd, VIDIOC_QBUF, &qbuf)) {
+		cerr << msg_prefix << "failed to queue source with index "
+			 << src_index << " (errno=" << errno << ").\n";
+		return false;
+	}
+
+	zerostruct(&qbuf);
+	qbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	qbuf.memory = V4L2_MEMORY_DMABUF;
+	qbuf.index = dst_index;
+	qbuf.length = dest_plane_count;
+	qbuf.m.planes = planes;
+
+	zerostruct(planes, dest_plane_count);
+	planes[0].m.fd = dst_fd;
+	planes[0].length = dst_size;
+
+	// The source is queued already, and only returned by streaming off.
+	if (ioctl(fd, VIDIOC_QBUF, &qbuf)) {
+		cerr << msg_prefix << "failed to queue destination with index "
+			 << dst_index << " (errno=" << errno << ").\n";
+
+		reset();
+
+		return false;
+	}
+
+	flags |= busy;
+
+	return true;
+}
+
+bool M2MScaler::finish(int timeout)
+{
+	static const std::string msg_prefix("M2MScaler::finish(): ");
+
+	if (!(flags & busy))
+		return false;
+
+	using namespace std;
+
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, timeout);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0 || !(pfd.revents & POLLIN)) {
+		cerr << msg_prefix << "conversion timed out.\n";
+
+		reset();
+
+		return false;
+	}
+
+	struct v4l2_buffer dqbuf;
+	struct v4l2_plane planes[source_plane_count];
+	bool ok = true;
+
+	const uint32_t types[] = {
+		V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
+		V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+	};
+
+	for (auto &i : types) {
+		zerostruct(&dqbuf);
+		zerostruct(planes, source_plane_count);
+
+		dqbuf.type = i;
+		dqbuf.memory = V4L2_MEMORY_DMABUF;
+		dqbuf.length = source_plane_count;
+		dqbuf.m.planes = planes;
+
+		if (ioctl(fd, VIDIOC_DQBUF, &dqbuf)) {
+			cerr << msg_prefix << "failed to dequeue buffer (errno="
+				 << errno << ").\n";
+
+			// Don't leave the other buffer behind.
+			reset();
+
+			return false;
+		}
+
+		if (dqbuf.flags & V4L2_BUF_FLAG_ERROR) {
+			cerr << msg_prefix << "conversion failed.\n";
+			ok = false;
+		}
+	}
+
+	flags &= ~busy;
+
+	return ok;
+}
+
+void M2MScaler::cancel()
+{
+	if (flags & busy)
+		reset();
+}
+
+int M2MScaler::get_fd() const
+{
+	return fd;
+}
+
+bool M2MScaler::is_busy() const
+{
+	return (flags & busy);
+}
+
+void M2MScaler::reset()
+{
+	// Streaming off returns the buffers of both queues.
+	stream(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, false);
+	stream(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, false);
+	stream(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, true);
+	stream(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, true);
+
+	flags &= ~busy;
+}
+
+bool M2MScaler::stream(uint32_t type, bool enable)
+{
+	const unsigned long request = (enable ? VIDIOC_STREAMON : VIDIOC_STREAMOFF);
+
+	return (ioctl(fd, request, &type) == 0);
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__M2M_SCALER_)
+#define __M2M_SCALER_
+
+#include <cstdint>
+
+// Forward-declarations
+struct videoinfo;
+
+
+// Scaler of the SoC (GScaler or FIMC), which is a V4L2 mem2mem device.
+// It scales decoded frames into a rectangle of a larger NV12 frame, e.g.
+// to pack several streams into one frame. Both frames are passed as
+// dma-bufs, so the CPU never touches the pixels. Each scaler is a context
+// of its own, several of them can share the hardware.
+class M2MScaler {
+public:
+	// @{x,y}: top left corner (in pixels)
+	// @{w,h}: width, height (in pixels)
+	struct rect {
+		unsigned x, y;
+		unsigned w, h;
+	};
+
+private:
+	enum flags {
+		opened			= (1 << 0),
+		configured		= (1 << 1),
+
+		// A conversion was started, and not yet finished.
+		busy			= (1 << 2),
+	};
+
+	int fd;
+
+	// Number of source and destination buffers, and the sizes of
+	// the planes of a source frame.
+	unsigned src_count;
+	unsigned dst_count;
+	unsigned src_plane_size[2];
+	unsigned dst_size;
+
+	unsigned flags;
+
+	bool stream(uint32_t type, bool enable);
+
+	// Return all queued buffers, by restarting both queues. This ends
+	// an unfinished conversion.
+	void reset();
+
+public:
+	M2MScaler();
+	~M2MScaler();
+
+	M2MScaler(const M2MScaler &s) = delete;
+
+	// Order of operations:
+	// open(), setup(), start(), finish()
+
+	// Open/close the scaler.
+	// open() returns false if no scaler is available.
+	bool open();
+	void close();
+
+	// Configure the conversion, which stays the same for all frames.
+	// setup() returns false if the scaler doesn't support it.
+	//
+	// @vi: video information of the source frames
+	// @src: visible part of the source frames
+	// @num_src: number of source buffers
+	// @{dst_w,dst_h}: size of the NV12 destination frame
+	// @dst: rectangle of the destination frame that receives the frames
+	// @num_dst: number of destination buffers
+	bool setup(const videoinfo &vi, const rect &src, unsigned num_src,
+			   unsigned dst_w, unsigned dst_h, const rect &dst, unsigned num_dst);
+	void teardown();
+
+	// Start a conversion. This does not block, the conversion is
+	// completed by finish(). Only one conversion is in flight at a time.
+	// start() returns false if an error occurs.
+	//
+	// @src_{index,fd}: index and dma-buf of the source frame
+	// @dst_{index,fd}: index and dma-buf of the destination frame
+	bool start(unsigned src_index, int src_fd, unsigned dst_index, int dst_fd);
+
+	// Wait for the conversion to complete. If it doesn't complete in
+	// time, it is dropped, and the scaler can be used again.
+	// finish() returns false if an error occurs.
+	//
+	// @timeout: timeout in milliseconds (-1 for none)
+	bool finish(int timeout);
+
+	// Drop the conversion that is in flight (if any).
+	void cancel();
+
+	// The fd of the scaler, which becomes readable when the conversion
+	// has completed. Only watch it while a conversion is in flight, an
+	// idle mem2mem device reports an error instead.
+	int get_fd() const;
+
+	bool is_busy() const;
+};
+
+#endif // __M2M_SCALER_
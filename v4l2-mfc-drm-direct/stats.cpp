@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+#include "main.h"
+
+#include <algorithm>
+
+namespace {
+
+// Index of the most significant set bit. 'v' must be non-zero.
+inline unsigned
+msb(uint64_t v)
+{
+	return 63 - __builtin_clzll(v);
+}
+
+// Get the sample count that corresponds to a percentile.
+inline uint64_t
+percentile_rank(uint64_t count, unsigned percent)
+{
+	const uint64_t rank = (count * percent + 99) / 100;
+
+	return std::max<uint64_t>(rank, 1);
+}
+
+}; // anonymous namespace
+
+
+LatencyHistogram::LatencyHistogram()
+{
+	reset();
+}
+
+unsigned LatencyHistogram::index_of(uint64_t value)
+{
+	if (value < sub_bucket_count)
+		return value;
+
+	const unsigned shift = msb(value) - sub_bucket_bits + 1;
+	const unsigned index = sub_bucket_count + (shift - 1) * sub_bucket_half +
+		((value >> shift) - sub_bucket_half);
+
+	return std::min<unsigned>(index, bucket_count - 1);
+}
+
+uint64_t LatencyHistogram::value_of(unsigned index)
+{
+	if (index < sub_bucket_count)
+		return index;
+
+	const unsigned shift = (index - sub_bucket_count) / sub_bucket_half + 1;
+	const uint64_t sub = (index - sub_bucket_count) % sub_bucket_half + sub_bucket_half;
+
+	// Report the upper bound of the bucket.
+	return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	buckets[index_of(value)]++;
+	count++;
+	max = std::max(max, value);
+}
+
+void LatencyHistogram::reset()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	zerostruct(buckets, bucket_count);
+	count = 0;
+	max = 0;
+}
+
+histogram_summary LatencyHistogram::summary() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	histogram_summary s;
+
+	zerostruct(&s);
+	s.count = count;
+	s.max = max;
+
+	if (count == 0)
+		return s;
+
+	const std::pair<unsigned, uint64_t*> ranks[] = {
+		{ 50, &s.p50 },
+		{ 95, &s.p95 },
+		{ 99, &s.p99 },
+	};
+
+	uint64_t seen = 0;
+	unsigned r = 0;
+
+	for (unsigned i = 0; i < bucket_count && r < 3; ++i) {
+		seen += buckets[i];
+
+		while (r < 3 && seen >= percentile_rank(count, ranks[r].first)) {
+			*ranks[r].second = std::min(value_of(i), max);
+			++r;
+		}
+	}
+
+	return s;
+}
+
+void StatsReport::add(const std::string &name, const LatencyHistogram &h)
+{
+	histograms.emplace_back(name, h.summary());
+}
+
+void StatsReport::add(const std::string &name, uint64_t counter)
+{
+	counters.emplace_back(name, counter);
+}
+
+void StatsReport::print_text(std::ostream &os) const
+{
+	for (auto &i : histograms) {
+		const histogram_summary &s = i.second;
+
+		os << '\t' << i.first << ": count = " << s.count
+		   << ", p50 = " << s.p50 << " us, p95 = " << s.p95
+		   << " us, p99 = " << s.p99 << " us, max = " << s.max << " us\n";
+	}
+
+	for (auto &i : counters)
+		os << '\t' << i.first << " = " << i.second << '\n';
+}
+
+void StatsReport::print_json(std::ostream &os) const
+{
+	bool first = true;
+
+	os << '{';
+
+	for (auto &i : histograms) {
+		const histogram_summary &s = i.second;
+
+		os << (first ? "" : ",") << '"' << i.first << "\":{\"count\":" << s.count
+		   << ",\"p50_us\":" << s.p50 << ",\"p95_us\":" << s.p95
+		   << ",\"p99_us\":" << s.p99 << ",\"max_us\":" << s.max << '}';
+
+		first = false;
+	}
+
+	for (auto &i : counters) {
+		os << (first ? "" : ",") << '"' << i.first << "\":" << i.second;
+
+		first = false;
+	}
+
+	os << "}\n";
+}
+
+PhaseTimer::PhaseTimer() : origin(monotonic_us()) {}
+
+unsigned PhaseTimer::begin(const std::string &name)
+{
+	const uint64_t now = monotonic_us();
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	phases.push_back(phase{name, now - origin, now - origin});
+
+	return phases.size() - 1;
+}
+
+void PhaseTimer::end(unsigned id)
+{
+	const uint64_t now = monotonic_us();
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	if (id < phases.size())
+		phases[id].end = now - origin;
+}
+
+void PhaseTimer::mark(const std::string &name, uint64_t t)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	phases.push_back(phase{name, 0, (t > origin) ? t - origin : 0});
+}
+
+void PhaseTimer::add_stats(StatsReport &r, const std::string &prefix) const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	for (auto &i : phases) {
+		r.add(prefix + i.name + "_us", i.end - i.start);
+		r.add(prefix + i.name + "_done_us", i.end);
+	}
+}
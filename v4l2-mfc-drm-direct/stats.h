@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__STATS_)
+#define __STATS_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <mutex>
+#include <ostream>
+
+// Summary of a latency histogram.
+//
+// @count: number of recorded samples
+// @p{50,95,99}: percentiles in microseconds
+// @max: largest recorded sample in microseconds
+struct histogram_summary {
+	uint64_t count;
+	uint64_t p50, p95, p99;
+	uint64_t max;
+};
+
+
+// HDR-style latency histogram with logarithmic buckets.
+// Values are recorded in microseconds. Small values are stored exactly,
+// larger ones with a relative error of less than 1/32.
+// record() and summary() can be called from different threads.
+class LatencyHistogram {
+private:
+	enum constants {
+		sub_bucket_bits = 6,
+		sub_bucket_count = (1 << sub_bucket_bits),
+		sub_bucket_half = sub_bucket_count / 2,
+
+		// Values up to 2^32 - 1 microseconds can be recorded, larger
+		// ones end up in the last bucket.
+		value_bits = 32,
+		bucket_count = sub_bucket_count + (value_bits - sub_bucket_bits) * sub_bucket_half,
+	};
+
+	mutable std::mutex mtx;
+
+	uint32_t buckets[bucket_count];
+	uint64_t count;
+	uint64_t max;
+
+	static unsigned index_of(uint64_t value);
+	static uint64_t value_of(unsigned index);
+
+public:
+	LatencyHistogram();
+	~LatencyHistogram() {}
+
+	LatencyHistogram(const LatencyHistogram &h) = delete;
+
+	// Record a single sample (in microseconds).
+	void record(uint64_t value);
+
+	// Drop all recorded samples.
+	void reset();
+
+	histogram_summary summary() const;
+};
+
+
+// Collection of named histograms and counters that can be printed
+// either in a human-readable text form or as a JSON object.
+class StatsReport {
+private:
+	std::vector<std::pair<std::string, histogram_summary>> histograms;
+	std::vector<std::pair<std::string, uint64_t>> counters;
+
+public:
+	void add(const std::string &name, const LatencyHistogram &h);
+	void add(const std::string &name, uint64_t counter);
+
+	void print_text(std::ostream &os) const;
+	void print_json(std::ostream &os) const;
+};
+
+
+// Timing of the phases of a startup, e.g. up to the first frame on the
+// screen. Phases that run on different threads can overlap, hence each
+// one is recorded with its own start and end, relative to the creation
+// of the timer. begin() and end() can be called from different threads.
+class PhaseTimer {
+private:
+	// @{start,end}: time since the origin in microseconds
+	struct phase {
+		std::string name;
+		uint64_t start, end;
+	};
+
+	mutable std::mutex mtx;
+
+	uint64_t origin;
+	std::vector<phase> phases;
+
+public:
+	PhaseTimer();
+	~PhaseTimer() {}
+
+	PhaseTimer(const PhaseTimer &t) = delete;
+
+	// Start a phase. Returns the ID of the phase for end().
+	unsigned begin(const std::string &name);
+	void end(unsigned id);
+
+	// Record a phase that lasts from the origin until a point in time,
+	// e.g. the flip of the first frame.
+	//
+	// @t: end of the phase (monotonic, in microseconds)
+	void mark(const std::string &name, uint64_t t);
+
+	// Add the phases to a report. Each phase gives two counters, its
+	// duration (<name>_us) and its end since the origin (<name>_done_us).
+	//
+	// @prefix: prefix for the names of the counters
+	void add_stats(StatsReport &r, const std::string &prefix) const;
+};
+
+#endif // __STATS_
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "subtitles.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+namespace {
+
+// Parse a timestamp ("hh:mm:ss,ttt" in SRT, "[hh:]mm:ss.ttt" in WebVTT)
+// into microseconds.
+bool
+parse_timestamp(const std::string &s, uint64_t &t)
+{
+	uint64_t fields[3] = {0, 0, 0};
+	unsigned num_fields = 0;
+	unsigned digits = 0;
+	size_t i;
+
+	for (i = 0; i < s.size(); ++i) {
+		const char c = s[i];
+
+		if (c >= '0' && c <= '9') {
+			fields[num_fields] = fields[num_fields] * 10 + (c - '0');
+			++digits;
+		} else if (c == ':' && digits != 0 && num_fields < 2) {
+			++num_fields;
+			digits = 0;
+		} else {
+			break;
+		}
+	}
+
+	if (num_fields == 0 || digits == 0 || i == s.size() || (s[i] != '.' && s[i] != ','))
+		return false;
+
+	// The fraction has usually three digits, but we accept up to six.
+	uint64_t frac = 0;
+	unsigned frac_digits = 0;
+
+	for (++i; i < s.size() && s[i] >= '0' && s[i] <= '9' && frac_digits < 6; ++i, ++frac_digits)
+		frac = frac * 10 + (s[i] - '0');
+
+	if (frac_digits == 0 || i != s.size())
+		return false;
+
+	for (; frac_digits < 6; ++frac_digits)
+		frac *= 10;
+
+	const uint64_t hours = (num_fields == 2) ? fields[0] : 0;
+	const uint64_t minutes = fields[num_fields - 1];
+	const uint64_t seconds = fields[num_fields];
+
+	if (minutes >= 60 || seconds >= 60)
+		return false;
+
+	t = ((hours * 60 + minutes) * 60 + seconds) * 1000000 + frac;
+
+	return true;
+}
+
+// Remove the markup from a line of cue text, i.e. tags like <i> or
+// <c.yellow>, and ASS overrides like {\an8}. Characters outside of ASCII
+// are replaced by a single '?', since the glyph atlas only has ASCII.
+std::string
+strip_markup(const std::string &s)
+{
+	static const std::pair<std::string, char> entities[] = {
+		{ "&amp;", '&' },
+		{ "&lt;", '<' },
+		{ "&gt;", '>' },
+		{ "&nbsp;", ' ' },
+	};
+
+	std::string out;
+
+	for (size_t i = 0; i < s.size(); ++i) {
+		const unsigned char c = s[i];
+
+		if (c == '<' || (c == '{' && i + 1 < s.size() && s[i + 1] == '\\')) {
+			const size_t end = s.find(c == '<' ? '>' : '}', i);
+
+			if (end != std::string::npos) {
+				i = end;
+				continue;
+			}
+		}
+
+		if (c == '&') {
+			bool found = false;
+
+			for (auto &e : entities) {
+				if (s.compare(i, e.first.size(), e.first) == 0) {
+					out += e.second;
+					i += e.first.size() - 1;
+					found = true;
+					break;
+				}
+			}
+
+			if (found)
+				continue;
+		}
+
+		// Skip the continuation bytes of an UTF-8 sequence.
+		if (c >= 0x80) {
+			while (i + 1 < s.size() && (static_cast<unsigned char>(s[i + 1]) & 0xc0) == 0x80)
+				++i;
+
+			out += '?';
+			continue;
+		}
+
+		out += c;
+	}
+
+	const size_t last = out.find_last_not_of(" \t");
+
+	return (last == std::string::npos) ? std::string() : out.substr(0, last + 1);
+}
+
+// Parse a block of lines. Blocks without a timing line are ignored.
+// Returns false if the timing line is invalid.
+bool
+parse_block(const std::vector<std::string> &block, std::vector<SubtitleTrack::cue> &cues)
+{
+	using namespace std;
+
+	// The timing line is preceded by the index (SRT) or by an
+	// optional identifier (WebVTT).
+	auto timing = find_if(block.cbegin(), block.cend(), [](const string &l) {
+		return l.find("-->") != string::npos;
+	});
+
+	if (timing == block.cend())
+		return true;
+
+	istringstream is(*timing);
+	string start, arrow, end;
+
+	is >> start >> arrow >> end;
+
+	SubtitleTrack::cue c;
+
+	// WebVTT cue settings might follow the end time.
+	if (arrow != "-->" || !parse_timestamp(start, c.start) || !parse_timestamp(end, c.end))
+		return false;
+
+	for (auto it = timing + 1; it != block.cend(); ++it) {
+		const string line = strip_markup(*it);
+
+		if (line.empty())
+			continue;
+
+		if (!c.text.empty())
+			c.text += '\n';
+
+		c.text += line;
+	}
+
+	if (!c.text.empty() && c.end > c.start)
+		cues.push_back(c);
+
+	return true;
+}
+
+}; // anonymous namespace
+
+
+bool SubtitleTrack::open(const std::string &name)
+{
+	static const std::string msg_prefix("SubtitleTrack::open(): ");
+
+	using namespace std;
+
+	ifstream f(name);
+
+	if (!f) {
+		cerr << msg_prefix << "failed to open subtitle file: " << name << ".\n";
+		return false;
+	}
+
+	static const string bom("\xef\xbb\xbf");
+
+	vector<string> block;
+	string line;
+	unsigned line_number = 0;
+
+	cues.clear();
+
+	while (true) {
+		const bool eof = !getline(f, line);
+
+		if (!eof) {
+			++line_number;
+
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+
+			if (line_number == 1 && line.compare(0, bom.size(), bom) == 0)
+				line.erase(0, bom.size());
+
+			if (line.find_first_not_of(" \t") != string::npos) {
+				block.push_back(line);
+				continue;
+			}
+		}
+
+		if (!parse_block(block, cues)) {
+			cerr << msg_prefix << "invalid cue timing before line " << line_number << ".\n";
+			cues.clear();
+
+			return false;
+		}
+
+		block.clear();
+
+		if (eof)
+			break;
+	}
+
+	if (cues.empty()) {
+		cerr << msg_prefix << "no cues found in subtitle file.\n";
+		return false;
+	}
+
+	stable_sort(cues.begin(), cues.end(), [](const cue &a, const cue &b) {
+		return a.start < b.start;
+	});
+
+	// A cue ends when the next one starts, cues that end up
+	// empty are dropped.
+	for (size_t i = 0; i + 1 < cues.size(); ++i)
+		cues[i].end = min(cues[i].end, cues[i + 1].start);
+
+	cues.erase(remove_if(cues.begin(), cues.end(), [](const cue &c) {
+		return c.end <= c.start;
+	}), cues.end());
+
+	cout << msg_prefix << "read " << cues.size() << " cues.\n";
+
+	return true;
+}
+
+const std::vector<SubtitleTrack::cue>& SubtitleTrack::get_cues() const
+{
+	return cues;
+}
+
+int SubtitleTrack::find(uint64_t t) const
+{
+	// The last cue that starts at or before t.
+	auto it = std::upper_bound(cues.cbegin(), cues.cend(), t, [](uint64_t v, const cue &c) {
+		return v < c.start;
+	});
+
+	if (it == cues.cbegin())
+		return -1;
+
+	--it;
+
+	return (t < it->end) ? int(it - cues.cbegin()) : -1;
+}
+
+unsigned SubtitleTrack::next(uint64_t t) const
+{
+	// Without overlaps, the end times are sorted as well.
+	auto it = std::upper_bound(cues.cbegin(), cues.cend(), t, [](uint64_t v, const cue &c) {
+		return v < c.end;
+	});
+
+	return it - cues.cbegin();
+}
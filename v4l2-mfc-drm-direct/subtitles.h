@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2017 - Tobias Jakobi
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(__SUBTITLES_)
+#define __SUBTITLES_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Subtitle track from a SRT or WebVTT file. Both formats consist of
+// blocks that are separated by empty lines, where a cue block has a
+// timing line ("start --> end"), followed by the text. Other blocks
+// (e.g. the WebVTT header, NOTE and STYLE blocks) are skipped, as well
+// as markup (tags and ASS overrides) and cue settings. Overlapping cues
+// are not stacked: a cue ends when the next one starts.
+class SubtitleTrack {
+public:
+	// @{start,end}: time span of the cue (in microseconds, relative
+	//               to the first frame of the stream)
+	// @text: lines of the cue, separated by '\n'
+	struct cue {
+		uint64_t start, end;
+		std::string text;
+	};
+
+private:
+	// Sorted by start time, without overlaps.
+	std::vector<cue> cues;
+
+public:
+	SubtitleTrack() {}
+	~SubtitleTrack() {}
+
+	SubtitleTrack(const SubtitleTrack &t) = delete;
+
+	// Read the cues from a file.
+	// open() returns false if an error occurs, or if the file has no cues.
+	//
+	// @name: path of the SRT or WebVTT file
+	bool open(const std::string &name);
+
+	const std::vector<cue>& get_cues() const;
+
+	// Index of the cue that is shown at a time (-1 if there is none).
+	//
+	// @t: time relative to the first frame (in microseconds)
+	int find(uint64_t t) const;
+
+	// Index of the first cue that has not ended at a time (the number
+	// of cues if all have ended).
+	unsigned next(uint64_t t) const;
+};
+
+#endif // __SUBTITLES_